@@ -18,7 +18,6 @@
 #include <vector>
 
 #include <event2/buffer.h>
-#include <event2/event.h> /* evtimer */
 
 #define LIBTRANSMISSION_ANNOUNCER_MODULE
 
@@ -29,6 +28,7 @@
 #include "log.h"
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex() */
 #include "session.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "utils.h"
@@ -169,7 +169,7 @@ struct tr_announcer
     std::unordered_map<tr_quark, tr_scrape_info> scrape_info;
 
     tr_session* session;
-    struct event* upkeepTimer;
+    tr_timer* upkeepTimer;
     int key;
     time_t tauUpkeepAt;
 };
@@ -186,7 +186,7 @@ static tr_scrape_info* tr_announcerGetScrapeInfo(tr_announcer* announcer, tr_qua
     return &it.first->second;
 }
 
-static void onUpkeepTimer(evutil_socket_t fd, short what, void* vannouncer);
+static void onUpkeepTimer(void* vannouncer);
 
 void tr_announcerInit(tr_session* session)
 {
@@ -195,8 +195,8 @@ void tr_announcerInit(tr_session* session)
     auto* a = new tr_announcer{};
     a->key = tr_rand_int(INT_MAX);
     a->session = session;
-    a->upkeepTimer = evtimer_new(session->event_base, onUpkeepTimer, a);
-    tr_timerAddMsec(a->upkeepTimer, UpkeepIntervalMsec);
+    a->upkeepTimer = new tr_timer{ onUpkeepTimer, a };
+    tr_sessionAddTimer(session, a->upkeepTimer, UpkeepIntervalMsec);
 
     session->announcer = a;
 }
@@ -211,7 +211,7 @@ void tr_announcerClose(tr_session* session)
 
     tr_tracker_udp_start_shutdown(session);
 
-    event_free(announcer->upkeepTimer);
+    delete announcer->upkeepTimer;
     announcer->upkeepTimer = nullptr;
 
     session->announcer = nullptr;
@@ -1679,7 +1679,7 @@ static void scrapeAndAnnounceMore(tr_announcer* announcer)
     }
 }
 
-static void onUpkeepTimer(evutil_socket_t /*fd*/, short /*what*/, void* vannouncer)
+static void onUpkeepTimer(void* vannouncer)
 {
     auto* announcer = static_cast<tr_announcer*>(vannouncer);
     tr_session* session = announcer->session;
@@ -1705,7 +1705,7 @@ static void onUpkeepTimer(evutil_socket_t /*fd*/, short /*what*/, void* vannounc
     }
 
     /* set up the next timer */
-    tr_timerAddMsec(announcer->upkeepTimer, UpkeepIntervalMsec);
+    tr_sessionAddTimer(session, announcer->upkeepTimer, UpkeepIntervalMsec);
 
     tr_sessionUnlock(session);
 }
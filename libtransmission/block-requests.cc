@@ -0,0 +1,270 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include "transmission.h"
+#include "block-requests.h"
+#include "tr-assert.h"
+
+static auto constexpr NotFound = ~size_t{ 0 };
+
+size_t tr_block_requests::slotIndex(tr_block_index_t block) const
+{
+    auto hash = uint32_t(block) * 0x9E3779B1U;
+    hash ^= hash >> 16;
+    return hash & (std::size(slots_) - 1);
+}
+
+size_t tr_block_requests::findSlot(tr_block_index_t block) const
+{
+    if (std::empty(slots_))
+    {
+        return NotFound;
+    }
+
+    size_t const mask = std::size(slots_) - 1;
+
+    for (size_t pos = slotIndex(block);; pos = (pos + 1) & mask)
+    {
+        if (slots_[pos].first == None)
+        {
+            return NotFound;
+        }
+
+        if (slots_[pos].block == block)
+        {
+            return pos;
+        }
+    }
+}
+
+uint32_t tr_block_requests::findEntry(tr_block_index_t block, tr_peer const* peer) const
+{
+    auto const pos = findSlot(block);
+    if (pos == NotFound)
+    {
+        return None;
+    }
+
+    auto idx = slots_[pos].first;
+    while (idx != None && entries_[idx].peer != peer)
+    {
+        idx = entries_[idx].next_for_block;
+    }
+
+    return idx;
+}
+
+void tr_block_requests::rehash(size_t n_slots)
+{
+    TR_ASSERT((n_slots & (n_slots - 1)) == 0);
+
+    auto old = std::move(slots_);
+    slots_.assign(n_slots, slot{});
+    size_t const mask = n_slots - 1;
+
+    for (auto const& s : old)
+    {
+        if (s.first != None)
+        {
+            auto pos = slotIndex(s.block);
+
+            while (slots_[pos].first != None)
+            {
+                pos = (pos + 1) & mask;
+            }
+
+            slots_[pos] = s;
+        }
+    }
+}
+
+/* remove a slot without leaving a tombstone: move later slots in the same
+ * run back into the gap if they would still be reachable from home */
+void tr_block_requests::eraseSlot(size_t pos)
+{
+    size_t const mask = std::size(slots_) - 1;
+
+    for (auto next = (pos + 1) & mask; slots_[next].first != None; next = (next + 1) & mask)
+    {
+        auto const home = slotIndex(slots_[next].block);
+        bool const reachable = pos <= next ? (pos < home && home <= next) : (pos < home || home <= next);
+
+        if (!reachable)
+        {
+            slots_[pos] = slots_[next];
+            pos = next;
+        }
+    }
+
+    slots_[pos] = slot{};
+}
+
+void tr_block_requests::add(tr_block_index_t block, tr_peer* peer, time_t sent_at)
+{
+    TR_ASSERT(peer != nullptr);
+    TR_ASSERT(!has(block, peer));
+
+    if ((n_blocks_ + 1) * 2 > std::size(slots_))
+    {
+        rehash(std::max(size_t{ 64 }, std::size(slots_) * 2));
+    }
+
+    // get an entry
+    auto idx = free_;
+    if (idx != None)
+    {
+        free_ = entries_[idx].next_for_block;
+    }
+    else
+    {
+        idx = uint32_t(std::size(entries_));
+        entries_.emplace_back();
+    }
+
+    auto& e = entries_[idx];
+    e = entry{};
+    e.block = block;
+    e.peer = peer;
+    e.sent_at = sent_at;
+
+    // chain it to the block's other requests
+    size_t const mask = std::size(slots_) - 1;
+    auto pos = slotIndex(block);
+
+    while (slots_[pos].first != None && slots_[pos].block != block)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    if (slots_[pos].first == None)
+    {
+        slots_[pos].block = block;
+        ++n_blocks_;
+    }
+
+    e.next_for_block = slots_[pos].first;
+    slots_[pos].first = idx;
+
+    // chain it to the peer's other requests
+    auto const [it, is_first] = peer_last_.try_emplace(peer, idx);
+    if (!is_first)
+    {
+        e.prev_for_peer = it->second;
+        entries_[it->second].next_for_peer = idx;
+        it->second = idx;
+    }
+
+    ++size_;
+}
+
+bool tr_block_requests::remove(tr_block_index_t block, tr_peer const* peer)
+{
+    auto const pos = findSlot(block);
+    if (pos == NotFound)
+    {
+        return false;
+    }
+
+    auto prev = None;
+    auto idx = slots_[pos].first;
+    while (idx != None && entries_[idx].peer != peer)
+    {
+        prev = idx;
+        idx = entries_[idx].next_for_block;
+    }
+
+    if (idx == None)
+    {
+        return false;
+    }
+
+    auto& e = entries_[idx];
+
+    // unchain it from the block's other requests
+    if (prev == None)
+    {
+        slots_[pos].first = e.next_for_block;
+    }
+    else
+    {
+        entries_[prev].next_for_block = e.next_for_block;
+    }
+
+    if (slots_[pos].first == None)
+    {
+        eraseSlot(pos);
+        --n_blocks_;
+    }
+
+    // unchain it from the peer's other requests
+    if (e.prev_for_peer != None)
+    {
+        entries_[e.prev_for_peer].next_for_peer = e.next_for_peer;
+    }
+
+    if (e.next_for_peer != None)
+    {
+        entries_[e.next_for_peer].prev_for_peer = e.prev_for_peer;
+    }
+    else if (e.prev_for_peer != None)
+    {
+        peer_last_[peer] = e.prev_for_peer;
+    }
+    else
+    {
+        peer_last_.erase(peer);
+    }
+
+    // free the entry
+    e = entry{};
+    e.next_for_block = free_;
+    free_ = idx;
+
+    --size_;
+    return true;
+}
+
+bool tr_block_requests::has(tr_block_index_t block, tr_peer const* peer) const
+{
+    return findEntry(block, peer) != None;
+}
+
+std::vector<tr_peer*> tr_block_requests::peers(tr_block_index_t block) const
+{
+    auto ret = std::vector<tr_peer*>{};
+
+    if (auto const pos = findSlot(block); pos != NotFound)
+    {
+        for (auto idx = slots_[pos].first; idx != None; idx = entries_[idx].next_for_block)
+        {
+            ret.push_back(entries_[idx].peer);
+        }
+    }
+
+    return ret;
+}
+
+std::vector<tr_block_index_t> tr_block_requests::blocks(tr_peer const* peer) const
+{
+    auto ret = std::vector<tr_block_index_t>{};
+
+    if (auto const it = peer_last_.find(peer); it != std::end(peer_last_))
+    {
+        for (auto idx = it->second; idx != None; idx = entries_[idx].prev_for_peer)
+        {
+            ret.push_back(entries_[idx].block);
+        }
+
+        std::reverse(std::begin(ret), std::end(ret));
+    }
+
+    return ret;
+}
@@ -0,0 +1,118 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+
+#include "transmission.h"
+
+class tr_peer;
+
+/**
+ * @brief The blocks that we've requested from peers and haven't received yet.
+ *
+ * Requests are found by block through an open-addressing hash table, and
+ * each block's requests are chained together. Each peer's requests are also
+ * chained together, so a peer's requests can be listed without looking at
+ * anyone else's. Adding, finding, and removing a request are all O(1).
+ */
+class tr_block_requests
+{
+public:
+    struct request
+    {
+        tr_block_index_t block;
+        tr_peer* peer;
+        time_t sent_at;
+    };
+
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    void add(tr_block_index_t block, tr_peer* peer, time_t sent_at);
+
+    /* returns true if the request was found and removed */
+    bool remove(tr_block_index_t block, tr_peer const* peer);
+
+    [[nodiscard]] bool has(tr_block_index_t block, tr_peer const* peer) const;
+
+    /* the peers that we've requested this block from */
+    [[nodiscard]] std::vector<tr_peer*> peers(tr_block_index_t block) const;
+
+    /* the blocks that we've requested from this peer */
+    [[nodiscard]] std::vector<tr_block_index_t> blocks(tr_peer const* peer) const;
+
+    /**
+     * Call `func(request)` on every request, in no particular order.
+     * `func` must not change the requests.
+     */
+    template<typename Func>
+    void forEach(Func&& func) const
+    {
+        for (auto const& e : entries_)
+        {
+            if (e.peer != nullptr)
+            {
+                func(request{ e.block, e.peer, e.sent_at });
+            }
+        }
+    }
+
+private:
+    static auto constexpr None = uint32_t{ 0xFFFFFFFF };
+
+    struct entry
+    {
+        tr_block_index_t block = 0;
+        tr_peer* peer = nullptr; // nullptr if this entry is free
+        time_t sent_at = 0;
+        uint32_t next_for_block = None; // or the next free entry
+        uint32_t prev_for_peer = None;
+        uint32_t next_for_peer = None;
+    };
+
+    struct slot
+    {
+        tr_block_index_t block = 0;
+        uint32_t first = None; // the block's first entry, or None if the slot is empty
+    };
+
+    [[nodiscard]] size_t slotIndex(tr_block_index_t block) const;
+    [[nodiscard]] size_t findSlot(tr_block_index_t block) const;
+    [[nodiscard]] uint32_t findEntry(tr_block_index_t block, tr_peer const* peer) const;
+    void eraseSlot(size_t pos);
+    void rehash(size_t n_slots);
+
+    std::vector<entry> entries_;
+    uint32_t free_ = None;
+
+    // slots_.size() is a power of two that's at least twice the number of blocks in it
+    std::vector<slot> slots_;
+    size_t n_blocks_ = 0;
+
+    // each peer's most recent request
+    std::unordered_map<tr_peer const*, uint32_t> peer_last_;
+
+    size_t size_ = 0;
+};
@@ -6,16 +6,23 @@
  *
  */
 
-#include <cstdlib> /* qsort() */
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include <event2/buffer.h>
 
 #include "transmission.h"
 #include "cache.h"
+#include "crypto-utils.h"
+#include "disk-io.h"
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
-#include "ptrarray.h"
+#include "session.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "trevent.h"
@@ -43,12 +50,132 @@ struct cache_block
     struct evbuffer* evbuf;
 };
 
+/* Where a run sits in the session-wide flush order.
+ * Stale runs, runs sitting in cache for a long time or runs not growing, get priority. */
+struct run_rank
+{
+    /* Flushing stale blocks should be a top priority as the probability of them
+     * growing is very small, for blocks on piece boundaries, and nonexistant for
+     * blocks inside pieces. */
+    bool is_piece_done;
+
+    /* Move the multi piece runs higher */
+    bool is_multi_piece;
+
+    /* The run's length plus ~2 for every minute it has languished in the cache,
+     * scaled by 32 and offset by a constant `now` so that it never has to be
+     * recalculated as time passes. */
+    int64_t score;
+
+    int tor_id;
+    tr_block_index_t first;
+
+    /* higher rank comes before lower rank */
+    bool operator<(run_rank const& that) const
+    {
+        if (is_piece_done != that.is_piece_done)
+        {
+            return is_piece_done;
+        }
+
+        if (is_multi_piece != that.is_multi_piece)
+        {
+            return is_multi_piece;
+        }
+
+        if (score != that.score)
+        {
+            return score > that.score;
+        }
+
+        if (tor_id != that.tor_id)
+        {
+            return tor_id < that.tor_id;
+        }
+
+        return first < that.first;
+    }
+};
+
+/* a contiguous run of cached blocks in a single torrent */
+struct cache_run
+{
+    tr_block_index_t first;
+    tr_block_index_t len;
+    time_t time; /* when the run's newest block was written */
+    run_rank rank;
+
+    constexpr tr_block_index_t last() const
+    {
+        return first + len - 1;
+    }
+};
+
+/* all of one torrent's cached blocks, plus the runs they form */
+struct cache_torrent
+{
+    tr_torrent* tor = nullptr;
+    std::map<tr_block_index_t, cache_block> blocks;
+    std::map<tr_block_index_t /*first block*/, cache_run> runs;
+};
+
+using cache_piece_key = std::pair<int /*tr_torrent.uniqueId*/, tr_piece_index_t>;
+
+/* a whole piece, read from disk so that uploads of it can be served from memory */
+struct cache_piece
+{
+    uint8_t* buf;
+    uint32_t length;
+    bool is_pending; /* still being read by a disk I/O worker */
+    bool is_prefetch; /* read ahead of an upload, and not used yet */
+    std::list<cache_piece_key>::iterator lru;
+    std::list<cache_piece_key>::iterator prefetch_lru; /* if it's a prefetch that's been read */
+};
+
+/* a downloading piece's SHA1, advanced as its blocks arrive in order */
+struct cache_piece_hash
+{
+    tr_sha1_ctx_t sha;
+    tr_block_index_t next_block; /* the first block that hasn't been hashed yet */
+    uint32_t length; /* how many of the piece's bytes have been hashed */
+};
+
+/* flushed runs that haven't been handed to the disk I/O workers yet */
+struct cache_write_batch
+{
+    tr_torrent* tor;
+    std::vector<tr_io_block_run> runs;
+};
+
 struct tr_cache
 {
-    tr_ptrArray blocks;
+    std::map<int /*tr_torrent.uniqueId*/, cache_torrent> torrents;
+    std::set<run_rank> ranks;
+    int n_blocks;
     int max_blocks;
     size_t max_bytes;
 
+    /* the read cache. it shares max_bytes with the write cache,
+     * which always gets first call on the memory */
+    std::map<cache_piece_key, cache_piece> pieces;
+    std::list<cache_piece_key> piece_lru; /* most recently used first */
+    size_t read_bytes;
+
+    /* pieces that have been read ahead but not used yet */
+    size_t prefetch_bytes;
+    size_t max_prefetch_bytes;
+    std::list<cache_piece_key> prefetch_lru; /* the ones that have been read, oldest first */
+
+    uint64_t read_hits;
+    uint64_t read_misses;
+    uint64_t read_evictions;
+
+    std::map<int /*tr_torrent.uniqueId*/, cache_write_batch> writes;
+
+    /* pieces being hashed as they're downloaded. these outlive
+     * the blocks themselves, which may be flushed at any time */
+    std::map<cache_piece_key, cache_piece_hash> hashes;
+
     size_t disk_writes;
     size_t disk_write_bytes;
     size_t cache_writes;
@@ -56,184 +183,450 @@ struct tr_cache
 };
 
 /****
-*****
+*****  Run bookkeeping
 ****/
 
-struct run_info
+static void rankRun(tr_cache* cache, cache_torrent const& ct, cache_run& run)
 {
-    int pos;
-    int rank;
-    time_t last_block_time;
-    bool is_multi_piece;
-    bool is_piece_done;
-    unsigned int len;
-};
+    tr_piece_index_t const first_piece = tr_torBlockPiece(ct.tor, run.first);
+    tr_piece_index_t const last_piece = tr_torBlockPiece(ct.tor, run.last());
+
+    run.rank.is_piece_done = tr_torrentPieceIsComplete(ct.tor, last_piece);
+    run.rank.is_multi_piece = first_piece != last_piece;
+    run.rank.score = int64_t{ run.len } * 32 - run.time;
+    run.rank.tor_id = ct.tor->uniqueId;
+    run.rank.first = run.first;
+
+    cache->ranks.insert(run.rank);
+}
+
+static void unrankRun(tr_cache* cache, cache_run const& run)
+{
+    cache->ranks.erase(run.rank);
+}
 
-/* return a count of how many contiguous blocks there are starting at this pos */
-static int getBlockRun(tr_cache const* cache, int pos, struct run_info* info)
+/* find the run that holds `block`, if any */
+static auto findRun(cache_torrent& ct, tr_block_index_t block)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    struct cache_block const* const* blocks = (struct cache_block const* const*)tr_ptrArrayBase(&cache->blocks);
-    struct cache_block const* ref = blocks[pos];
-    tr_block_index_t block = ref->block;
-    int len = 0;
+    auto it = ct.runs.upper_bound(block);
 
-    for (int i = pos; i < n; ++i)
+    if (it == std::begin(ct.runs))
     {
-        struct cache_block const* b = blocks[i];
+        return std::end(ct.runs);
+    }
 
-        if (b->block != block)
-        {
-            break;
-        }
+    --it;
+    return it->second.last() >= block ? it : std::end(ct.runs);
+}
 
-        if (b->tor != ref->tor)
-        {
-            break;
-        }
+/* add a newly-cached block, merging it with its neighbouring runs */
+static void addBlockToRuns(tr_cache* cache, cache_torrent& ct, tr_block_index_t block, time_t now)
+{
+    auto run = cache_run{ block, 1, now, {} };
 
-        ++block;
-        ++len;
+    if (auto next = ct.runs.find(block + 1); next != std::end(ct.runs))
+    {
+        unrankRun(cache, next->second);
+        run.len += next->second.len;
+        run.time = std::max(run.time, next->second.time);
+        ct.runs.erase(next);
     }
 
-    if (info != nullptr)
+    if (auto prev = block > 0 ? findRun(ct, block - 1) : std::end(ct.runs); prev != std::end(ct.runs))
     {
-        struct cache_block const* b = blocks[pos + len - 1];
-        info->last_block_time = b->time;
-        info->is_piece_done = tr_torrentPieceIsComplete(b->tor, b->piece);
-        info->is_multi_piece = b->piece != blocks[pos]->piece;
-        info->len = len;
-        info->pos = pos;
+        unrankRun(cache, prev->second);
+        prev->second.len += run.len;
+        prev->second.time = std::max(prev->second.time, run.time);
+        rankRun(cache, ct, prev->second);
+    }
+    else
+    {
+        rankRun(cache, ct, ct.runs.emplace(block, run).first->second);
     }
-
-    return len;
 }
 
-/* higher rank comes before lower rank */
-static int compareRuns(void const* va, void const* vb)
+/* an already-cached block was rewritten */
+static void touchBlockRun(tr_cache* cache, cache_torrent& ct, tr_block_index_t block, time_t now)
 {
-    auto* a = static_cast<struct run_info const*>(va);
-    auto* b = static_cast<struct run_info const*>(vb);
-    return b->rank - a->rank;
+    auto it = findRun(ct, block);
+    TR_ASSERT(it != std::end(ct.runs));
+
+    unrankRun(cache, it->second);
+    it->second.time = now;
+    rankRun(cache, ct, it->second);
 }
 
-enum
-{
-    MULTIFLAG = 0x1000,
-    DONEFLAG = 0x2000,
-    SESSIONFLAG = 0x4000
-};
+/****
+*****  Flushing
+****/
 
-/* Calculte runs
- *   - Stale runs, runs sitting in cache for a long time or runs not growing, get priority.
- *     Returns number of runs.
- */
-// TODO: return std::vector
-static int calcRuns(tr_cache const* cache, struct run_info* runs)
+static int flushRun(tr_cache* cache, cache_torrent& ct, tr_block_index_t first)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    int i = 0;
-    time_t const now = tr_time();
+    auto const run_it = ct.runs.find(first);
+    TR_ASSERT(run_it != std::end(ct.runs));
 
-    for (int pos = 0; pos < n; pos += runs[i++].len)
-    {
-        int rank = getBlockRun(cache, pos, &runs[i]);
+    cache_run const run = run_it->second;
+    unrankRun(cache, run);
+    ct.runs.erase(run_it);
 
-        /* This adds ~2 to the relative length of a run for every minute it has
-         * languished in the cache. */
-        rank += (now - runs[i].last_block_time) / 32;
+    auto const begin = ct.blocks.find(run.first);
+    auto const end = std::next(begin, run.len);
+    TR_ASSERT(begin != std::end(ct.blocks));
 
-        /* Flushing stale blocks should be a top priority as the probability of them
-         * growing is very small, for blocks on piece boundaries, and nonexistant for
-         * blocks inside pieces. */
-        rank |= runs[i].is_piece_done ? DONEFLAG : 0;
+    tr_torrent* const tor = ct.tor;
+    tr_piece_index_t const piece = begin->second.piece;
+    uint32_t const offset = begin->second.offset;
 
-        /* Move the multi piece runs higher */
-        rank |= runs[i].is_multi_piece ? MULTIFLAG : 0;
+    /* the blocks' evbuffers are handed over as-is and written without being copied */
+    auto blocks = std::vector<evbuffer*>{};
+    blocks.reserve(run.len);
 
-        runs[i].rank = rank;
+    for (auto it = begin; it != end; ++it)
+    {
+        cache_block const& b = it->second;
+        blocks.push_back(b.evbuf);
+        cache->disk_write_bytes += b.length;
     }
 
-    qsort(runs, i, sizeof(struct run_info), compareRuns);
-    return i;
+    ct.blocks.erase(begin, end);
+    cache->n_blocks -= run.len;
+
+    ++cache->disk_writes;
+
+    cache_write_batch& writes = cache->writes[tor->uniqueId];
+    writes.tor = tor;
+    writes.runs.push_back(tr_io_block_run{ piece, offset, std::move(blocks) });
+    return 0;
 }
 
-static int flushContiguous(tr_cache* cache, int pos, int n)
+/* hand each torrent's flushed runs to the disk I/O workers as a single batch.
+ * write errors are reported through the torrent's local error. */
+static void submitWrites(tr_cache* cache)
 {
-    int err = 0;
-    uint8_t* buf = tr_new(uint8_t, n * MAX_BLOCK_SIZE);
-    uint8_t* walk = buf;
-    struct cache_block** blocks = (struct cache_block**)tr_ptrArrayBase(&cache->blocks);
+    for (auto& [tor_id, writes] : cache->writes)
+    {
+        tr_ioWriteAsync(writes.tor, std::move(writes.runs));
+    }
 
-    struct cache_block* b = blocks[pos];
-    tr_torrent* tor = b->tor;
-    tr_piece_index_t const piece = b->piece;
-    uint32_t const offset = b->offset;
+    cache->writes.clear();
+}
 
-    for (int i = 0; i < n; ++i)
+/* wait for the torrent's queued writes to land on disk */
+static void waitForWrites(tr_torrent const* tor)
+{
+    if (tor->session->diskIo != nullptr)
     {
-        b = blocks[pos + i];
-        evbuffer_copyout(b->evbuf, walk, b->length);
-        walk += b->length;
-        evbuffer_free(b->evbuf);
-        tr_free(b);
+        tr_diskIoWaitTorrent(tor->session->diskIo, tr_torrentId(tor));
     }
+}
 
-    tr_ptrArrayErase(&cache->blocks, pos, pos + n);
+/* flush the session's highest-ranked run */
+static int flushTopRun(tr_cache* cache, int* setme_len)
+{
+    run_rank const rank = *std::begin(cache->ranks);
+    cache_torrent& ct = cache->torrents[rank.tor_id];
 
-    err = tr_ioWrite(tor, piece, offset, walk - buf, buf);
-    tr_free(buf);
+    *setme_len = ct.runs[rank.first].len;
+    int const err = flushRun(cache, ct, rank.first);
+
+    if (std::empty(ct.blocks))
+    {
+        cache->torrents.erase(rank.tor_id);
+    }
 
-    ++cache->disk_writes;
-    cache->disk_write_bytes += walk - buf;
     return err;
 }
 
-static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
+static int cacheTrim(tr_cache* cache)
 {
     int err = 0;
 
-    for (int i = 0; err == 0 && i < n; i++)
+    if (cache->n_blocks > cache->max_blocks)
     {
-        err = flushContiguous(cache, runs[i].pos, runs[i].len);
+        /* Amount of cache that should be removed by the flush. This influences how large
+         * runs can grow as well as how often flushes will happen. */
+        int const cacheCutoff = 1 + cache->max_blocks / 4;
 
-        for (int j = i + 1; j < n; j++)
+        for (int flushed = 0; err == 0 && flushed < cacheCutoff && !std::empty(cache->ranks);)
         {
-            if (runs[j].pos > runs[i].pos)
-            {
-                runs[j].pos -= runs[i].len;
-            }
+            int len = 0;
+            err = flushTopRun(cache, &len);
+            flushed += len;
         }
+
+        submitWrites(cache);
     }
 
     return err;
 }
 
-static int cacheTrim(tr_cache* cache)
+/****
+*****  Read cache
+****/
+
+static size_t getWriteBytes(tr_cache const* cache)
 {
-    int err = 0;
+    return size_t(cache->n_blocks) * MAX_BLOCK_SIZE;
+}
+
+/* how much of the shared budget the read cache can use right now */
+static size_t getReadBudget(tr_cache const* cache)
+{
+    size_t const write_bytes = getWriteBytes(cache);
+    return write_bytes < cache->max_bytes ? cache->max_bytes - write_bytes : 0;
+}
+
+static void dropPiece(tr_cache* cache, std::map<cache_piece_key, cache_piece>::iterator it)
+{
+    cache->read_bytes -= it->second.length;
+    cache->piece_lru.erase(it->second.lru);
 
-    if (tr_ptrArraySize(&cache->blocks) > cache->max_blocks)
+    if (it->second.is_prefetch)
     {
-        /* Amount of cache that should be removed by the flush. This influences how large
-         * runs can grow as well as how often flushes will happen. */
-        int const cacheCutoff = 1 + cache->max_blocks / 4;
-        struct run_info* runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int j = 0;
+        cache->prefetch_bytes -= it->second.length;
+
+        if (!it->second.is_pending)
+        {
+            cache->prefetch_lru.erase(it->second.prefetch_lru);
+        }
+    }
+
+    /* a pending read's buffer is freed when the read finishes */
+    if (!it->second.is_pending)
+    {
+        tr_free(it->second.buf);
+    }
+
+    cache->pieces.erase(it);
+}
+
+/* drop the pieces in [begin, end) */
+static void dropPieces(tr_cache* cache, cache_piece_key const& begin, cache_piece_key const& end)
+{
+    for (auto it = cache->pieces.lower_bound(begin), last = cache->pieces.lower_bound(end); it != last;)
+    {
+        dropPiece(cache, it++);
+    }
+}
+
+/* evict the least recently used pieces until `len` more bytes fit in the budget */
+static void trimReadCache(tr_cache* cache, size_t len)
+{
+    size_t const budget = getReadBudget(cache);
+
+    while (!std::empty(cache->piece_lru) && cache->read_bytes + len > budget)
+    {
+        dropPiece(cache, cache->pieces.find(cache->piece_lru.back()));
+        ++cache->read_evictions;
+    }
+}
+
+/* true if some of the piece's blocks are in the write cache and not on disk yet */
+static bool pieceHasDirtyBlocks(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
+
+    if (tor_it == std::end(cache->torrents))
+    {
+        return false;
+    }
+
+    auto const [first, last] = tr_torGetPieceBlockRange(torrent, piece);
+    auto const it = tor_it->second.blocks.lower_bound(first);
+    return it != std::end(tor_it->second.blocks) && it->first <= last;
+}
+
+/* make room for a piece and add it. returns nullptr if it can't be cached */
+static cache_piece* addPiece(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    auto const key = cache_piece_key{ torrent->uniqueId, piece };
+    uint32_t const length = tr_torPieceCountBytes(torrent, piece);
+
+    /* reading it from disk would miss the blocks that are still in the write cache */
+    if (length > getReadBudget(cache) || pieceHasDirtyBlocks(cache, torrent, piece))
+    {
+        return nullptr;
+    }
+
+    trimReadCache(cache, length);
+
+    cache->piece_lru.push_front(key);
+    cache->read_bytes += length;
+    auto const [it, is_new] = cache->pieces.try_emplace(
+        key,
+        cache_piece{ tr_new(uint8_t, length), length, false, false, std::begin(cache->piece_lru), {} });
+    TR_ASSERT(is_new);
+    return &it->second;
+}
+
+/* returns the piece if it's cached and ready to use, marking it as recently used */
+static cache_piece* findPiece(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece)
+{
+    auto const it = cache->pieces.find(cache_piece_key{ torrent->uniqueId, piece });
+
+    if (it == std::end(cache->pieces) || it->second.is_pending)
+    {
+        return nullptr;
+    }
+
+    cache->piece_lru.splice(std::begin(cache->piece_lru), cache->piece_lru, it->second.lru);
+    return &it->second;
+}
+
+struct piece_read_job
+{
+    tr_cache* cache;
+    cache_piece_key key;
+    uint8_t* buf;
+};
+
+static void onPieceReadDone(int err, void* vjob)
+{
+    auto* const job = static_cast<piece_read_job*>(vjob);
+    auto const it = job->cache->pieces.find(job->key);
+
+    if (it == std::end(job->cache->pieces) || it->second.buf != job->buf)
+    {
+        /* it was dropped while the read was pending */
+        tr_free(job->buf);
+    }
+    else if (err != 0)
+    {
+        /* dropping a pending piece leaves its buffer alone */
+        dropPiece(job->cache, it);
+        tr_free(job->buf);
+    }
+    else
+    {
+        it->second.is_pending = false;
+
+        if (it->second.is_prefetch)
+        {
+            it->second.prefetch_lru = job->cache->prefetch_lru.insert(std::end(job->cache->prefetch_lru), job->key);
+        }
+    }
+
+    delete job;
+}
+
+/* returns true if the piece is cached, or is being read into the cache */
+static bool queuePieceRead(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    tr_session const* const session = torrent->session;
+    auto const key = cache_piece_key{ tr_torrentId(torrent), piece };
+
+    if (cache->pieces.count(key) != 0)
+    {
+        return true;
+    }
+
+    if (session->diskIo == nullptr || tr_diskIoGetWorkerCount(session->diskIo) == 0)
+    {
+        return false;
+    }
+
+    /* don't read further ahead than the uploads are keeping up with.
+     * unused read-aheads that have gone stale make way for new ones */
+    uint32_t const length = tr_torPieceCountBytes(torrent, piece);
+
+    while (!std::empty(cache->prefetch_lru) && cache->prefetch_bytes + length > cache->max_prefetch_bytes)
+    {
+        dropPiece(cache, cache->pieces.find(cache->prefetch_lru.front()));
+        ++cache->read_evictions;
+    }
+
+    if (cache->prefetch_bytes + length > cache->max_prefetch_bytes)
+    {
+        return false;
+    }
+
+    cache_piece* const cp = addPiece(cache, torrent, piece);
+
+    if (cp == nullptr)
+    {
+        return false;
+    }
+
+    cp->is_pending = true;
+    cp->is_prefetch = true;
+    cache->prefetch_bytes += cp->length;
+    tr_ioReadAsync(torrent, piece, 0, cp->length, cp->buf, onPieceReadDone, new piece_read_job{ cache, key, cp->buf });
+    return true;
+}
 
-        calcRuns(cache, runs);
+/****
+*****  Hashing pieces as they arrive
+****/
+
+static void dropPieceHash(tr_cache* cache, std::map<cache_piece_key, cache_piece_hash>::iterator it)
+{
+    tr_sha1_final(it->second.sha, nullptr);
+    cache->hashes.erase(it);
+}
+
+static void dropPieceHashes(tr_cache* cache, cache_piece_key const& begin, cache_piece_key const& end)
+{
+    auto it = cache->hashes.lower_bound(begin);
+
+    while (it != std::end(cache->hashes) && it->first < end)
+    {
+        dropPieceHash(cache, it++);
+    }
+}
+
+static void hashEvbuffer(tr_sha1_ctx_t sha, struct evbuffer* buf)
+{
+    int const n = evbuffer_peek(buf, -1, nullptr, nullptr, 0);
+    auto iov = std::vector<evbuffer_iovec>(n);
+    evbuffer_peek(buf, -1, nullptr, std::data(iov), n);
+
+    for (auto const& vec : iov)
+    {
+        tr_sha1_update(sha, vec.iov_base, vec.iov_len);
+    }
+}
+
+/* `block` was just written to the cache. if it's the next one that its
+ * piece's hash is waiting for, hash it and any cached blocks that follow */
+static void hashBlocks(tr_cache* cache, cache_torrent& ct, tr_piece_index_t piece, tr_block_index_t block)
+{
+    tr_torrent* const tor = ct.tor;
+    auto const key = cache_piece_key{ tor->uniqueId, piece };
+    auto const [first, last] = tr_torGetPieceBlockRange(tor, piece);
+    auto it = cache->hashes.find(key);
+
+    /* a block that's been hashed was written again, so start over */
+    if (it != std::end(cache->hashes) && block < it->second.next_block)
+    {
+        dropPieceHash(cache, it);
+        it = std::end(cache->hashes);
+    }
 
-        while (j < cacheCutoff)
+    if (it == std::end(cache->hashes))
+    {
+        if (block != first)
         {
-            j += runs[i++].len;
+            return;
         }
 
-        err = flushRuns(cache, runs, i);
-        tr_free(runs);
+        it = cache->hashes.try_emplace(key, cache_piece_hash{ tr_sha1_init(), first, 0 }).first;
     }
 
-    return err;
+    cache_piece_hash& ph = it->second;
+
+    while (ph.next_block <= last)
+    {
+        auto const block_it = ct.blocks.find(ph.next_block);
+
+        if (block_it == std::end(ct.blocks))
+        {
+            break;
+        }
+
+        hashEvbuffer(ph.sha, block_it->second.evbuf);
+        ph.length += block_it->second.length;
+        ++ph.next_block;
+    }
 }
 
 /***
@@ -255,7 +648,9 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
     tr_formatter_mem_B(buf, cache->max_bytes, sizeof(buf));
     tr_logAddNamedDbg(MY_NAME, "Maximum cache size set to %s (%d blocks)", buf, cache->max_blocks);
 
-    return cacheTrim(cache);
+    int const err = cacheTrim(cache);
+    trimReadCache(cache, 0);
+    return err;
 }
 
 int64_t tr_cacheGetLimit(tr_cache const* cache)
@@ -263,10 +658,19 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
     return cache->max_bytes;
 }
 
+void tr_cacheSetPrefetchLimit(tr_cache* cache, int64_t max_bytes)
+{
+    cache->max_prefetch_bytes = max_bytes;
+}
+
+int64_t tr_cacheGetPrefetchLimit(tr_cache const* cache)
+{
+    return cache->max_prefetch_bytes;
+}
+
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
     return cache;
@@ -274,43 +678,43 @@ tr_cache* tr_cacheNew(int64_t max_bytes)
 
 void tr_cacheFree(tr_cache* cache)
 {
-    TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
+    TR_ASSERT(std::empty(cache->torrents));
+
+    while (!std::empty(cache->pieces))
+    {
+        dropPiece(cache, std::begin(cache->pieces));
+    }
+
+    while (!std::empty(cache->hashes))
+    {
+        dropPieceHash(cache, std::begin(cache->hashes));
+    }
 
-    tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
+    delete cache;
 }
 
 /***
 ****
 ***/
 
-static int cache_block_compare(void const* va, void const* vb)
+static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
 {
-    auto const* a = static_cast<struct cache_block const*>(va);
-    auto const* b = static_cast<struct cache_block const*>(vb);
-
-    /* primary key: torrent id */
-    if (a->tor->uniqueId != b->tor->uniqueId)
-    {
-        return a->tor->uniqueId < b->tor->uniqueId ? -1 : 1;
-    }
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
 
-    /* secondary key: block # */
-    if (a->block != b->block)
+    if (tor_it == std::end(cache->torrents))
     {
-        return a->block < b->block ? -1 : 1;
+        return nullptr;
     }
 
-    /* they're equal */
-    return 0;
+    auto& blocks = tor_it->second.blocks;
+    auto const it = blocks.find(_tr_block(torrent, piece, offset));
+    return it == std::end(blocks) ? nullptr : &it->second;
 }
 
-static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
+bool tr_cacheHasBlock(tr_cache const* cache, tr_torrent const* torrent, tr_block_index_t block)
 {
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = _tr_block(torrent, piece, offset);
-    return static_cast<struct cache_block*>(tr_ptrArrayFindSorted(&cache->blocks, &key, cache_block_compare));
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
+    return tor_it != std::end(cache->torrents) && tor_it->second.blocks.count(block) != 0;
 }
 
 int tr_cacheWriteBlock(
@@ -323,23 +727,33 @@ int tr_cacheWriteBlock(
 {
     TR_ASSERT(tr_amInEventThread(torrent->session));
 
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
+    cache_torrent& ct = cache->torrents[torrent->uniqueId];
+    ct.tor = torrent;
+
+    time_t const now = tr_time();
+    tr_block_index_t const block = _tr_block(torrent, piece, offset);
+    auto const [it, is_new] = ct.blocks.try_emplace(block);
+    cache_block* const cb = &it->second;
 
-    if (cb == nullptr)
+    if (is_new)
     {
-        cb = tr_new(struct cache_block, 1);
         cb->tor = torrent;
         cb->piece = piece;
         cb->offset = offset;
         cb->length = length;
-        cb->block = _tr_block(torrent, piece, offset);
+        cb->block = block;
         cb->evbuf = evbuffer_new();
-        tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        ++cache->n_blocks;
+        addBlockToRuns(cache, ct, block, now);
+    }
+    else
+    {
+        touchBlockRun(cache, ct, block, now);
     }
 
     TR_ASSERT(cb->length == length);
 
-    cb->time = tr_time();
+    cb->time = now;
 
     evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
     evbuffer_remove_buffer(writeme, cb->evbuf, cb->length);
@@ -347,6 +761,15 @@ int tr_cacheWriteBlock(
     cache->cache_writes++;
     cache->cache_write_bytes += cb->length;
 
+    hashBlocks(cache, ct, piece, block);
+
+    /* any read-cached copy of this piece is out of date now */
+    if (!std::empty(cache->pieces))
+    {
+        dropPieces(cache, cache_piece_key{ torrent->uniqueId, piece }, cache_piece_key{ torrent->uniqueId, piece + 1 });
+        trimReadCache(cache, 0);
+    }
+
     return cacheTrim(cache);
 }
 
@@ -364,21 +787,69 @@ int tr_cacheReadBlock(
     if (cb != nullptr)
     {
         evbuffer_copyout(cb->evbuf, setme, len);
+        return 0;
     }
-    else
+
+    if (cache_piece const* const cp = findPiece(cache, torrent, piece); cp != nullptr)
     {
-        err = tr_ioRead(torrent, piece, offset, len, setme);
+        TR_ASSERT(offset + len <= cp->length);
+        std::copy_n(cp->buf + offset, len, setme);
+        return 0;
     }
 
+    err = tr_ioRead(torrent, piece, offset, len, setme);
     return err;
 }
 
+int tr_cacheReadBlockForUpload(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme)
+{
+    if (struct cache_block const* const cb = findBlock(cache, torrent, piece, offset); cb != nullptr)
+    {
+        evbuffer_copyout(cb->evbuf, setme, len);
+        return 0;
+    }
+
+    cache_piece* cp = findPiece(cache, torrent, piece);
+
+    if (cp != nullptr)
+    {
+        ++cache->read_hits;
+
+        if (cp->is_prefetch)
+        {
+            cp->is_prefetch = false;
+            cache->prefetch_bytes -= cp->length;
+            cache->prefetch_lru.erase(cp->prefetch_lru);
+        }
+    }
+    else
+    {
+        ++cache->read_misses;
+
+        /* only this block is worth waiting for. the peer's likely to want
+         * the rest of the piece too, so read that in the background */
+        int const err = tr_ioRead(torrent, piece, offset, len, setme);
+        queuePieceRead(cache, torrent, piece);
+        return err;
+    }
+
+    TR_ASSERT(offset + len <= cp->length);
+    std::copy_n(cp->buf + offset, len, setme);
+    return 0;
+}
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
     struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (cb == nullptr && !queuePieceRead(cache, torrent, piece))
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -386,86 +857,163 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
     return err;
 }
 
-/***
-****
-***/
+bool tr_cacheBlockIsPending(tr_cache const* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t /*offset*/)
+{
+    auto const it = cache->pieces.find(cache_piece_key{ torrent->uniqueId, piece });
+    return it != std::end(cache->pieces) && it->second.is_pending;
+}
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
+tr_cache_stats tr_cacheGetStats(tr_cache const* cache)
 {
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
+    auto stats = tr_cache_stats{};
+    stats.read_hits = cache->read_hits;
+    stats.read_misses = cache->read_misses;
+    stats.read_evictions = cache->read_evictions;
+    stats.read_bytes = cache->read_bytes;
+    stats.write_bytes = getWriteBytes(cache);
+    return stats;
 }
 
+void tr_cachePieceCompleted(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
+
+    if (tor_it == std::end(cache->torrents))
+    {
+        return;
+    }
+
+    /* re-rank the runs that end inside this piece */
+    cache_torrent& ct = tor_it->second;
+    auto const [first, last] = tr_torGetPieceBlockRange(torrent, piece);
+
+    for (auto it = ct.runs.upper_bound(last); it != std::begin(ct.runs);)
+    {
+        --it;
+        cache_run& run = it->second;
+
+        if (run.last() < first)
+        {
+            break;
+        }
+
+        if (run.last() <= last)
+        {
+            unrankRun(cache, run);
+            rankRun(cache, ct, run);
+        }
+    }
+}
+
+tr_sha1_ctx_t tr_cacheTakePieceHash(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t* setme_length)
+{
+    auto const it = cache->hashes.find(cache_piece_key{ torrent->uniqueId, piece });
+
+    if (it == std::end(cache->hashes))
+    {
+        *setme_length = 0;
+        return nullptr;
+    }
+
+    tr_sha1_ctx_t const sha = it->second.sha;
+    *setme_length = it->second.length;
+    cache->hashes.erase(it);
+    return sha;
+}
+
+/***
+****
+***/
+
 int tr_cacheFlushDone(tr_cache* cache)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > 0)
+    while (err == 0 && !std::empty(cache->ranks))
     {
-        auto* const runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int const n = calcRuns(cache, runs);
+        run_rank const& rank = *std::begin(cache->ranks);
 
-        while (i < n && (runs[i].is_piece_done || runs[i].is_multi_piece))
+        if (!rank.is_piece_done && !rank.is_multi_piece)
         {
-            runs[i++].rank |= SESSIONFLAG;
+            break;
         }
 
-        err = flushRuns(cache, runs, i);
-        tr_free(runs);
+        int len = 0;
+        err = flushTopRun(cache, &len);
     }
 
+    submitWrites(cache);
     return err;
 }
 
 int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
 {
-    auto const [first, last] = tr_torGetFileBlockRange(torrent, i);
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
+
+    if (tor_it == std::end(cache->torrents))
+    {
+        waitForWrites(torrent);
+        return 0;
+    }
 
-    int pos = findBlockPos(cache, torrent, first);
+    auto const [first, last] = tr_torGetFileBlockRange(torrent, i);
     dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu]", (int)i, (size_t)first, (size_t)last);
 
-    /* flush out all the blocks in that file */
+    /* flush out every run that holds some of the file's blocks */
     int err = 0;
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+    cache_torrent& ct = tor_it->second;
+    auto it = findRun(ct, first);
 
-        if (b->tor != torrent)
-        {
-            break;
-        }
+    if (it == std::end(ct.runs))
+    {
+        it = ct.runs.lower_bound(first);
+    }
 
-        if (b->block < first || b->block > last)
-        {
-            break;
-        }
+    while (err == 0 && it != std::end(ct.runs) && it->first <= last)
+    {
+        auto const next = std::next(it);
+        err = flushRun(cache, ct, it->first);
+        it = next;
+    }
 
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+    if (std::empty(ct.blocks))
+    {
+        cache->torrents.erase(tor_it);
     }
 
+    submitWrites(cache);
+    waitForWrites(torrent);
     return err;
 }
 
 int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
 {
-    int err = 0;
-    int const pos = findBlockPos(cache, torrent, 0);
+    dropPieces(cache, cache_piece_key{ torrent->uniqueId, 0 }, cache_piece_key{ torrent->uniqueId + 1, 0 });
+    dropPieceHashes(cache, cache_piece_key{ torrent->uniqueId, 0 }, cache_piece_key{ torrent->uniqueId + 1, 0 });
 
-    /* flush out all the blocks in that torrent */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
+    auto const tor_it = cache->torrents.find(torrent->uniqueId);
+
+    if (tor_it == std::end(cache->torrents))
     {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+        waitForWrites(torrent);
+        return 0;
+    }
 
-        if (b->tor != torrent)
-        {
-            break;
-        }
+    /* flush out all the blocks in that torrent */
+    int err = 0;
+    cache_torrent& ct = tor_it->second;
 
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+    while (err == 0 && !std::empty(ct.runs))
+    {
+        err = flushRun(cache, ct, std::begin(ct.runs)->first);
+    }
+
+    if (std::empty(ct.blocks))
+    {
+        cache->torrents.erase(tor_it);
     }
 
+    submitWrites(cache);
+    waitForWrites(torrent);
     return err;
 }
@@ -12,11 +12,25 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include "crypto-utils.h" /* tr_sha1_ctx_t */
 #include "tr-macros.h"
 
 struct evbuffer;
 struct tr_cache;
 
+struct tr_cache_stats
+{
+    /* uploads served from the read cache, and the ones that weren't */
+    uint64_t read_hits;
+    uint64_t read_misses;
+
+    /* pieces dropped from the read cache to make room */
+    uint64_t read_evictions;
+
+    size_t read_bytes;
+    size_t write_bytes;
+};
+
 /***
 ****
 ***/
@@ -33,6 +47,12 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes);
 
 int64_t tr_cacheGetLimit(tr_cache const*);
 
+/* the most memory that pieces read ahead of uploads, but not sent yet, can use.
+ * it's a share of the cache's limit, not an addition to it */
+void tr_cacheSetPrefetchLimit(tr_cache* cache, int64_t max_bytes);
+
+int64_t tr_cacheGetPrefetchLimit(tr_cache const* cache);
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -49,14 +69,46 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/* like tr_cacheReadBlock(), but for serving a peer's request:
+ * on a miss, the block is read right away and the rest of its piece
+ * is read into the read cache by a disk I/O worker */
+int tr_cacheReadBlockForUpload(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme);
+
+/* starts reading the block's piece ahead of an upload. with disk I/O workers,
+ * the piece is read into the read cache by a worker */
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
+/* true if a worker is still reading the block's piece into the read cache */
+bool tr_cacheBlockIsPending(tr_cache const* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t offset);
+
+bool tr_cacheHasBlock(tr_cache const* cache, tr_torrent const* torrent, tr_block_index_t block);
+
+tr_cache_stats tr_cacheGetStats(tr_cache const* cache);
+
+/* lets the cache know that all of a piece's blocks are in,
+ * so runs ending in that piece can be flushed first */
+void tr_cachePieceCompleted(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece);
+
+/* blocks that arrive in order are hashed as they're written to the cache.
+ * this hands the piece's SHA1 context over to the caller, who must finalize it,
+ * and sets `setme_length` to how many of the piece's leading bytes it's covered.
+ * returns nullptr if none of the piece has been hashed */
+tr_sha1_ctx_t tr_cacheTakePieceHash(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t* setme_length);
+
 /***
 ****
 ***/
 
 int tr_cacheFlushDone(tr_cache* cache);
 
+/* these don't return until the flushed blocks have been written */
+
 int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent);
 
 int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t file);
@@ -176,6 +176,41 @@ bool tr_sha1_final(tr_sha1_ctx_t handle, uint8_t* hash)
     return true;
 }
 
+tr_sha256_ctx_t tr_sha256_init(void)
+{
+    auto* handle = new CC_SHA256_CTX();
+    CC_SHA256_Init(handle);
+    return handle;
+}
+
+bool tr_sha256_update(tr_sha256_ctx_t handle, void const* data, size_t data_length)
+{
+    TR_ASSERT(handle != nullptr);
+
+    if (data_length == 0)
+    {
+        return true;
+    }
+
+    TR_ASSERT(data != nullptr);
+
+    CC_SHA256_Update(static_cast<CC_SHA256_CTX*>(handle), data, data_length);
+    return true;
+}
+
+bool tr_sha256_final(tr_sha256_ctx_t handle, uint8_t* hash)
+{
+    if (hash != nullptr)
+    {
+        TR_ASSERT(handle != nullptr);
+
+        CC_SHA256_Final(hash, static_cast<CC_SHA256_CTX*>(handle));
+    }
+
+    delete static_cast<CC_SHA256_CTX*>(handle);
+    return true;
+}
+
 /***
 ****
 ***/
@@ -23,6 +23,7 @@
 #include API_HEADER_CRYPT(error-crypt.h)
 #include API_HEADER_CRYPT(random.h)
 #include API_HEADER_CRYPT(sha.h)
+#include API_HEADER_CRYPT(sha256.h)
 #include API_HEADER(version.h)
 
 #include "transmission.h"
@@ -163,6 +164,50 @@ bool tr_sha1_final(tr_sha1_ctx_t raw_handle, uint8_t* hash)
     return ret;
 }
 
+tr_sha256_ctx_t tr_sha256_init(void)
+{
+    Sha256* handle = tr_new(Sha256, 1);
+
+    if (check_result(API(InitSha256)(handle)))
+    {
+        return handle;
+    }
+
+    tr_free(handle);
+    return nullptr;
+}
+
+bool tr_sha256_update(tr_sha256_ctx_t raw_handle, void const* data, size_t data_length)
+{
+    auto* handle = static_cast<Sha256*>(raw_handle);
+    TR_ASSERT(handle != nullptr);
+
+    if (data_length == 0)
+    {
+        return true;
+    }
+
+    TR_ASSERT(data != nullptr);
+
+    return check_result(API(Sha256Update)(handle, static_cast<byte const*>(data), data_length));
+}
+
+bool tr_sha256_final(tr_sha256_ctx_t raw_handle, uint8_t* hash)
+{
+    auto* handle = static_cast<Sha256*>(raw_handle);
+    bool ret = true;
+
+    if (hash != nullptr)
+    {
+        TR_ASSERT(handle != nullptr);
+
+        ret = check_result(API(Sha256Final)(handle, hash));
+    }
+
+    tr_free(handle);
+    return ret;
+}
+
 /***
 ****
 ***/
@@ -151,6 +151,56 @@ bool tr_sha1_final(tr_sha1_ctx_t raw_handle, uint8_t* hash)
     return ret;
 }
 
+tr_sha256_ctx_t tr_sha256_init(void)
+{
+    EVP_MD_CTX* handle = EVP_MD_CTX_create();
+
+    if (check_result(EVP_DigestInit_ex(handle, EVP_sha256(), nullptr)))
+    {
+        return handle;
+    }
+
+    EVP_MD_CTX_destroy(handle);
+    return nullptr;
+}
+
+bool tr_sha256_update(tr_sha256_ctx_t raw_handle, void const* data, size_t data_length)
+{
+    auto* handle = static_cast<EVP_MD_CTX*>(raw_handle);
+
+    TR_ASSERT(handle != nullptr);
+
+    if (data_length == 0)
+    {
+        return true;
+    }
+
+    TR_ASSERT(data != nullptr);
+
+    return check_result(EVP_DigestUpdate(handle, data, data_length));
+}
+
+bool tr_sha256_final(tr_sha256_ctx_t raw_handle, uint8_t* hash)
+{
+    auto* handle = static_cast<EVP_MD_CTX*>(raw_handle);
+
+    bool ret = true;
+
+    if (hash != nullptr)
+    {
+        TR_ASSERT(handle != nullptr);
+
+        unsigned int hash_length = 0;
+
+        ret = check_result(EVP_DigestFinal_ex(handle, hash, &hash_length));
+
+        TR_ASSERT(!ret || hash_length == TR_SHA256_DIGEST_LEN);
+    }
+
+    EVP_MD_CTX_destroy(handle);
+    return ret;
+}
+
 /***
 ****
 ***/
@@ -21,6 +21,7 @@
 #include API_HEADER(dhm.h)
 #include API_HEADER(error.h)
 #include API_HEADER(sha1.h)
+#include API_HEADER(sha256.h)
 #include API_HEADER(version.h)
 
 #include "transmission.h"
@@ -42,6 +43,7 @@
 
 using api_ctr_drbg_context = API(ctr_drbg_context);
 using api_sha1_context = API(sha1_context);
+using api_sha256_context = API(sha256_context);
 using api_dhm_context = API(dhm_context);
 
 static void log_polarssl_error(int error_code, char const* file, int line)
@@ -181,6 +183,53 @@ bool tr_sha1_final(tr_sha1_ctx_t raw_handle, uint8_t* hash)
     return true;
 }
 
+tr_sha256_ctx_t tr_sha256_init(void)
+{
+    api_sha256_context* handle = tr_new0(api_sha256_context, 1);
+
+#if API_VERSION_NUMBER >= 0x01030800
+    API(sha256_init)(handle);
+#endif
+
+    API(sha256_starts)(handle, 0);
+    return handle;
+}
+
+bool tr_sha256_update(tr_sha256_ctx_t raw_handle, void const* data, size_t data_length)
+{
+    auto* handle = static_cast<api_sha256_context*>(raw_handle);
+    TR_ASSERT(handle != nullptr);
+
+    if (data_length == 0)
+    {
+        return true;
+    }
+
+    TR_ASSERT(data != nullptr);
+
+    API(sha256_update)(handle, static_cast<unsigned char const*>(data), data_length);
+    return true;
+}
+
+bool tr_sha256_final(tr_sha256_ctx_t raw_handle, uint8_t* hash)
+{
+    auto* handle = static_cast<api_sha256_context*>(raw_handle);
+
+    if (hash != nullptr)
+    {
+        TR_ASSERT(handle != nullptr);
+
+        API(sha256_finish)(handle, hash);
+    }
+
+#if API_VERSION_NUMBER >= 0x01030800
+    API(sha256_free)(handle);
+#endif
+
+    tr_free(handle);
+    return true;
+}
+
 /***
 ****
 ***/
@@ -0,0 +1,600 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring> /* memcpy() */
+#include <utility> /* std::integer_sequence */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TR_SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "tr-assert.h"
+
+/***
+****  Bulk SHA1 hashing of equal-sized buffers, e.g. torrent pieces.
+****
+****  The crypto backends hash one buffer at a time. With the SHA extensions,
+****  two buffers' rounds are interleaved; with AVX2, eight buffers are hashed
+****  at once, one in each 32-bit lane.
+***/
+
+static auto constexpr BlockSize = size_t{ 64 };
+
+static auto constexpr InitialState = std::array<uint32_t, 5>{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+/* the padded final block or two of a message */
+struct sha1_tail
+{
+    std::array<uint8_t, BlockSize * 2> buf;
+    size_t n_blocks;
+};
+
+static void makeTail(sha1_tail* tail, uint8_t const* data, size_t length)
+{
+    size_t const rest = length % BlockSize;
+
+    tail->buf.fill(0);
+
+    if (rest > 0)
+    {
+        std::memcpy(std::data(tail->buf), data + length - rest, rest);
+    }
+
+    tail->buf[rest] = 0x80;
+    tail->n_blocks = rest + 1 + sizeof(uint64_t) <= BlockSize ? 1 : 2;
+
+    uint64_t const bits = uint64_t{ length } * 8;
+    uint8_t* const end = std::data(tail->buf) + tail->n_blocks * BlockSize;
+
+    for (size_t i = 0; i < sizeof(uint64_t); ++i)
+    {
+        end[-1 - int(i)] = uint8_t(bits >> (8 * i));
+    }
+}
+
+static void exportState(uint32_t const* state, tr_sha1_digest_t* setme)
+{
+    for (size_t i = 0; i < std::size(InitialState); ++i)
+    {
+        (*setme)[i * 4 + 0] = std::byte(state[i] >> 24);
+        (*setme)[i * 4 + 1] = std::byte(state[i] >> 16);
+        (*setme)[i * 4 + 2] = std::byte(state[i] >> 8);
+        (*setme)[i * 4 + 3] = std::byte(state[i]);
+    }
+}
+
+static void genericHash(uint8_t const* data, size_t length, tr_sha1_digest_t* setme)
+{
+    auto const sha = tr_sha1_init();
+    tr_sha1_update(sha, data, length);
+    tr_sha1_final(sha, reinterpret_cast<uint8_t*>(std::data(*setme)));
+}
+
+#ifdef TR_SHA1_X86
+
+/***
+****  SHA extensions
+***/
+
+#define TR_SHA1_SHANI __attribute__((target("sha,sse4.1")))
+
+/* rounds 4*I .. 4*I+3, scheduling the message words that later rounds need */
+template<int I>
+TR_SHA1_SHANI static inline void shaniRounds(uint8_t const* block, __m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4])
+{
+    auto& e_this = e[I % 2];
+    auto& e_next = e[(I + 1) % 2];
+    auto& m = msg[I % 4];
+
+    if constexpr (I < 4)
+    {
+        auto const big_endian = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+        m = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(block + 16 * I)), big_endian);
+    }
+
+    if constexpr (I == 0)
+    {
+        e_this = _mm_add_epi32(e_this, m);
+    }
+    else
+    {
+        e_this = _mm_sha1nexte_epu32(e_this, m);
+    }
+
+    e_next = abcd;
+
+    if constexpr (I >= 3 && I <= 18)
+    {
+        msg[(I + 1) % 4] = _mm_sha1msg2_epu32(msg[(I + 1) % 4], m);
+    }
+
+    abcd = _mm_sha1rnds4_epu32(abcd, e_this, I / 5);
+
+    if constexpr (I >= 1 && I <= 16)
+    {
+        msg[(I + 3) % 4] = _mm_sha1msg1_epu32(msg[(I + 3) % 4], m);
+    }
+
+    if constexpr (I >= 2 && I <= 17)
+    {
+        msg[(I + 2) % 4] = _mm_xor_si128(msg[(I + 2) % 4], m);
+    }
+}
+
+/* one of the messages that are being hashed side by side */
+struct shani_lane
+{
+    uint8_t const* data;
+    __m128i abcd;
+    __m128i e0;
+};
+
+template<int I, size_t NLanes>
+TR_SHA1_SHANI static inline void shaniLaneRounds(
+    shani_lane (&lanes)[NLanes],
+    __m128i (&e)[NLanes][2],
+    __m128i (&msg)[NLanes][4])
+{
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        shaniRounds<I>(lanes[lane].data, lanes[lane].abcd, e[lane], msg[lane]);
+    }
+}
+
+/* hashes one block of each lane. interleaving independent messages'
+ * rounds hides the latency of the SHA instructions */
+template<size_t NLanes, int... I>
+TR_SHA1_SHANI static inline void shaniBlock(shani_lane (&lanes)[NLanes], std::integer_sequence<int, I...> /*rounds*/)
+{
+    __m128i abcd_save[NLanes];
+    __m128i e[NLanes][2];
+    __m128i msg[NLanes][4] = {};
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        abcd_save[lane] = lanes[lane].abcd;
+        e[lane][0] = lanes[lane].e0;
+        e[lane][1] = _mm_setzero_si128();
+    }
+
+    (shaniLaneRounds<I>(lanes, e, msg), ...);
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        lanes[lane].e0 = _mm_sha1nexte_epu32(e[lane][0], lanes[lane].e0);
+        lanes[lane].abcd = _mm_add_epi32(lanes[lane].abcd, abcd_save[lane]);
+        lanes[lane].data += BlockSize;
+    }
+}
+
+/* hashes `n_blocks` consecutive blocks from each of the buffers into its state */
+template<size_t NLanes>
+TR_SHA1_SHANI static void shaniBlocks(uint32_t* const (&states)[NLanes], uint8_t const* const (&data)[NLanes], size_t n_blocks)
+{
+    shani_lane lanes[NLanes];
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        lanes[lane].data = data[lane];
+        lanes[lane].abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(states[lane])), 0x1B);
+        lanes[lane].e0 = _mm_set_epi32(int(states[lane][4]), 0, 0, 0);
+    }
+
+    for (; n_blocks > 0; --n_blocks)
+    {
+        shaniBlock(lanes, std::make_integer_sequence<int, 20>{});
+    }
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(states[lane]), _mm_shuffle_epi32(lanes[lane].abcd, 0x1B));
+        states[lane][4] = uint32_t(_mm_extract_epi32(lanes[lane].e0, 3));
+    }
+}
+
+/* hashes one or two buffers at once */
+template<size_t NLanes>
+static void shaniHash(uint8_t const* const* data, size_t length, tr_sha1_digest_t* setme)
+{
+    std::array<uint32_t, 5> state_buf[NLanes];
+    uint32_t* states[NLanes];
+    uint8_t const* lanes[NLanes];
+    sha1_tail tails[NLanes];
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        state_buf[lane] = InitialState;
+        states[lane] = std::data(state_buf[lane]);
+        lanes[lane] = data[lane];
+    }
+
+    shaniBlocks(states, lanes, length / BlockSize);
+
+    /* every buffer is the same length, so their tails have the same number of blocks */
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        makeTail(&tails[lane], data[lane], length);
+        lanes[lane] = std::data(tails[lane].buf);
+    }
+
+    shaniBlocks(states, lanes, tails[0].n_blocks);
+
+    for (size_t lane = 0; lane < NLanes; ++lane)
+    {
+        exportState(states[lane], setme + lane);
+    }
+}
+
+/***
+****  AVX2, eight buffers at a time
+***/
+
+#define TR_SHA1_AVX2 __attribute__((target("avx2")))
+
+static auto constexpr Lanes = size_t{ 8 };
+
+/* with fewer buffers than this, it's faster to hash them one at a time */
+static auto constexpr MinLanesUsed = size_t{ 3 };
+
+template<int N>
+TR_SHA1_AVX2 static inline __m256i rotl(__m256i x)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, N), _mm256_srli_epi32(x, 32 - N));
+}
+
+/* loads message words `first`..`first`+7 of each lane's block, so that w[i] holds word `first`+i of every lane */
+TR_SHA1_AVX2 static inline void avx2LoadWords(uint8_t const* const* blocks, size_t first, __m256i* w)
+{
+    __m256i r[Lanes];
+
+    for (size_t lane = 0; lane < Lanes; ++lane)
+    {
+        r[lane] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(blocks[lane] + first * 4));
+    }
+
+    /* transpose, so that each register holds one word from every lane */
+    auto const t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    auto const t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    auto const t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    auto const t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    auto const t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    auto const t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    auto const t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    auto const t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+    auto const u0 = _mm256_unpacklo_epi64(t0, t2);
+    auto const u1 = _mm256_unpackhi_epi64(t0, t2);
+    auto const u2 = _mm256_unpacklo_epi64(t1, t3);
+    auto const u3 = _mm256_unpackhi_epi64(t1, t3);
+    auto const u4 = _mm256_unpacklo_epi64(t4, t6);
+    auto const u5 = _mm256_unpackhi_epi64(t4, t6);
+    auto const u6 = _mm256_unpacklo_epi64(t5, t7);
+    auto const u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    auto const big_endian = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    w[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), big_endian);
+    w[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), big_endian);
+    w[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), big_endian);
+    w[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), big_endian);
+    w[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), big_endian);
+    w[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), big_endian);
+    w[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), big_endian);
+    w[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), big_endian);
+}
+
+/* the message word for round `t`, computing it from earlier ones once t >= 16 */
+TR_SHA1_AVX2 static inline __m256i avx2Word(__m256i* w, int t)
+{
+    if (t >= 16)
+    {
+        auto const x = _mm256_xor_si256(
+            _mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+            _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+        w[t & 15] = rotl<1>(x);
+    }
+
+    return w[t & 15];
+}
+
+TR_SHA1_AVX2 static inline void avx2Round(__m256i* s, __m256i f, __m256i k, __m256i w)
+{
+    auto const tmp = _mm256_add_epi32(_mm256_add_epi32(rotl<5>(s[0]), f), _mm256_add_epi32(_mm256_add_epi32(s[4], k), w));
+    s[4] = s[3];
+    s[3] = s[2];
+    s[2] = rotl<30>(s[1]);
+    s[1] = s[0];
+    s[0] = tmp;
+}
+
+/* hashes `n_blocks` consecutive blocks from each lane's buffer into `state` */
+TR_SHA1_AVX2 static void avx2Blocks(__m256i* state, uint8_t const* const* lanes, size_t n_blocks)
+{
+    auto const k0 = _mm256_set1_epi32(0x5A827999);
+    auto const k1 = _mm256_set1_epi32(0x6ED9EBA1);
+    auto const k2 = _mm256_set1_epi32(int(0x8F1BBCDC));
+    auto const k3 = _mm256_set1_epi32(int(0xCA62C1D6));
+
+    for (size_t block = 0; block < n_blocks; ++block)
+    {
+        uint8_t const* blocks[Lanes];
+        for (size_t lane = 0; lane < Lanes; ++lane)
+        {
+            blocks[lane] = lanes[lane] + block * BlockSize;
+        }
+
+        __m256i w[16];
+        avx2LoadWords(blocks, 0, w);
+        avx2LoadWords(blocks, 8, w + 8);
+
+        __m256i s[5] = { state[0], state[1], state[2], state[3], state[4] };
+        int t = 0;
+
+        for (; t < 20; ++t)
+        {
+            /* (b & c) | (~b & d) */
+            auto const f = _mm256_xor_si256(s[3], _mm256_and_si256(s[1], _mm256_xor_si256(s[2], s[3])));
+            avx2Round(s, f, k0, avx2Word(w, t));
+        }
+
+        for (; t < 40; ++t)
+        {
+            auto const f = _mm256_xor_si256(_mm256_xor_si256(s[1], s[2]), s[3]);
+            avx2Round(s, f, k1, avx2Word(w, t));
+        }
+
+        for (; t < 60; ++t)
+        {
+            /* (b & c) | (d & (b | c)) */
+            auto const f = _mm256_or_si256(_mm256_and_si256(s[1], s[2]), _mm256_and_si256(s[3], _mm256_or_si256(s[1], s[2])));
+            avx2Round(s, f, k2, avx2Word(w, t));
+        }
+
+        for (; t < 80; ++t)
+        {
+            auto const f = _mm256_xor_si256(_mm256_xor_si256(s[1], s[2]), s[3]);
+            avx2Round(s, f, k3, avx2Word(w, t));
+        }
+
+        for (size_t i = 0; i < 5; ++i)
+        {
+            state[i] = _mm256_add_epi32(state[i], s[i]);
+        }
+    }
+}
+
+/* hashes up to eight buffers at once */
+TR_SHA1_AVX2 static void avx2Hash(uint8_t const* const* data, size_t n, size_t length, tr_sha1_digest_t* setme)
+{
+    TR_ASSERT(n > 0);
+    TR_ASSERT(n <= Lanes);
+
+    /* unused lanes hash the first buffer again, and their results are ignored */
+    uint8_t const* lanes[Lanes];
+    for (size_t lane = 0; lane < Lanes; ++lane)
+    {
+        lanes[lane] = data[lane < n ? lane : 0];
+    }
+
+    __m256i state[5];
+    for (size_t i = 0; i < 5; ++i)
+    {
+        state[i] = _mm256_set1_epi32(int(InitialState[i]));
+    }
+
+    avx2Blocks(state, lanes, length / BlockSize);
+
+    /* every buffer is the same length, so their tails have the same number of blocks */
+    auto tails = std::array<sha1_tail, Lanes>{};
+    for (size_t lane = 0; lane < Lanes; ++lane)
+    {
+        makeTail(&tails[lane], lanes[lane], length);
+        lanes[lane] = std::data(tails[lane].buf);
+    }
+
+    avx2Blocks(state, lanes, tails[0].n_blocks);
+
+    uint32_t words[5][Lanes];
+    for (size_t i = 0; i < 5; ++i)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words[i]), state[i]);
+    }
+
+    for (size_t lane = 0; lane < n; ++lane)
+    {
+        uint32_t const lane_state[5] = { words[0][lane], words[1][lane], words[2][lane], words[3][lane], words[4][lane] };
+        exportState(lane_state, setme + lane);
+    }
+}
+
+/***
+****  CPU detection
+***/
+
+struct cpu_features
+{
+    bool sha = false;
+    bool avx2 = false;
+};
+
+static cpu_features getCpuFeatures(void)
+{
+    static auto constexpr Ssse3Bit = 1U << 9; /* leaf 1, ecx */
+    static auto constexpr Sse41Bit = 1U << 19; /* leaf 1, ecx */
+    static auto constexpr OsxsaveBit = 1U << 27; /* leaf 1, ecx */
+    static auto constexpr AvxBit = 1U << 28; /* leaf 1, ecx */
+    static auto constexpr Avx2Bit = 1U << 5; /* leaf 7, ebx */
+    static auto constexpr ShaBit = 1U << 29; /* leaf 7, ebx */
+
+    auto features = cpu_features{};
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return features;
+    }
+
+    bool const has_ssse3 = (ecx & Ssse3Bit) != 0;
+    bool const has_sse41 = (ecx & Sse41Bit) != 0;
+
+    /* AVX registers can only be used if the OS saves them on context switches */
+    bool has_avx = false;
+    if ((ecx & OsxsaveBit) != 0 && (ecx & AvxBit) != 0)
+    {
+        uint32_t xcr0_lo = 0;
+        uint32_t xcr0_hi = 0;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        has_avx = (xcr0_lo & 0x6) == 0x6;
+    }
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return features;
+    }
+
+    features.sha = (ebx & ShaBit) != 0 && has_ssse3 && has_sse41;
+    features.avx2 = (ebx & Avx2Bit) != 0 && has_avx;
+    return features;
+}
+
+#endif /* TR_SHA1_X86 */
+
+/***
+****
+***/
+
+static void sha1Many(tr_sha1_kernel kernel, uint8_t const* const* data, size_t n, size_t length, tr_sha1_digest_t* setme)
+{
+    switch (kernel)
+    {
+#ifdef TR_SHA1_X86
+
+    case TR_SHA1_KERNEL_SHANI:
+        for (size_t i = 0; i < n; i += 2)
+        {
+            if (i + 1 < n)
+            {
+                shaniHash<2>(data + i, length, setme + i);
+            }
+            else
+            {
+                shaniHash<1>(data + i, length, setme + i);
+            }
+        }
+
+        break;
+
+    case TR_SHA1_KERNEL_AVX2:
+        for (size_t i = 0; i < n; i += Lanes)
+        {
+            size_t const n_this_pass = std::min(n - i, Lanes);
+
+            if (n_this_pass >= MinLanesUsed)
+            {
+                avx2Hash(data + i, n_this_pass, length, setme + i);
+            }
+            else
+            {
+                for (size_t j = i; j < i + n_this_pass; ++j)
+                {
+                    genericHash(data[j], length, setme + j);
+                }
+            }
+        }
+
+        break;
+
+#endif
+
+    default:
+        for (size_t i = 0; i < n; ++i)
+        {
+            genericHash(data[i], length, setme + i);
+        }
+
+        break;
+    }
+}
+
+/* tr_sha1_many() is given several pieces at once, so hashing eight of
+ * them side by side with AVX2 is preferred; the crypto backends may
+ * already use the SHA extensions for a single buffer. */
+static tr_sha1_kernel getBestKernel(void)
+{
+    for (auto const kernel : { TR_SHA1_KERNEL_AVX2, TR_SHA1_KERNEL_SHANI })
+    {
+        if (tr_sha1_kernel_is_supported(kernel))
+        {
+            return kernel;
+        }
+    }
+
+    return TR_SHA1_KERNEL_GENERIC;
+}
+
+static std::atomic<tr_sha1_kernel>& getKernel(void)
+{
+    static auto kernel = std::atomic<tr_sha1_kernel>{ getBestKernel() };
+    return kernel;
+}
+
+bool tr_sha1_kernel_is_supported(tr_sha1_kernel kernel)
+{
+#ifdef TR_SHA1_X86
+
+    static auto const features = getCpuFeatures();
+
+    switch (kernel)
+    {
+    case TR_SHA1_KERNEL_SHANI:
+        return features.sha;
+
+    case TR_SHA1_KERNEL_AVX2:
+        return features.avx2;
+
+    default:
+        break;
+    }
+
+#endif
+
+    return kernel == TR_SHA1_KERNEL_GENERIC;
+}
+
+tr_sha1_kernel tr_sha1_get_kernel(void)
+{
+    return getKernel();
+}
+
+bool tr_sha1_set_kernel(tr_sha1_kernel kernel)
+{
+    if (!tr_sha1_kernel_is_supported(kernel))
+    {
+        return false;
+    }
+
+    getKernel() = kernel;
+    return true;
+}
+
+void tr_sha1_many(uint8_t const* const* data, size_t n, size_t length, tr_sha1_digest_t* setme)
+{
+    sha1Many(getKernel(), data, n, length, setme);
+}
@@ -25,6 +25,8 @@
 
 /** @brief Opaque SHA1 context type. */
 using tr_sha1_ctx_t = void*;
+/** @brief Opaque SHA256 context type. */
+using tr_sha256_ctx_t = void*;
 /** @brief Opaque DH context type. */
 using tr_dh_ctx_t = void*;
 /** @brief Opaque DH secret key type. */
@@ -58,6 +60,55 @@ bool tr_sha1_final(tr_sha1_ctx_t handle, uint8_t* setme);
 
 std::optional<tr_sha1_digest_t> tr_sha1_final(tr_sha1_ctx_t handle);
 
+/**
+ * @brief Allocate and initialize new SHA256 hasher context.
+ */
+tr_sha256_ctx_t tr_sha256_init(void);
+
+/**
+ * @brief Update SHA256 hash.
+ */
+bool tr_sha256_update(tr_sha256_ctx_t handle, void const* data, size_t data_length);
+
+/**
+ * @brief Finalize and export SHA256 hash, free hasher context.
+ */
+bool tr_sha256_final(tr_sha256_ctx_t handle, uint8_t* setme);
+
+std::optional<tr_sha256_digest_t> tr_sha256_final(tr_sha256_ctx_t handle);
+
+/** @brief Ways that @ref tr_sha1_many can hash its buffers. */
+enum tr_sha1_kernel
+{
+    TR_SHA1_KERNEL_GENERIC, /* one buffer at a time, with the crypto backend */
+    TR_SHA1_KERNEL_AVX2, /* eight buffers at once, one in each lane of the AVX2 registers */
+    TR_SHA1_KERNEL_SHANI /* two buffers side by side, with the x86 SHA extensions */
+};
+
+/**
+ * @brief Generate the SHA1 hashes of `n` buffers that are each `length` bytes long.
+ *
+ * This is meant for hashing torrent pieces in bulk. Depending on the CPU,
+ * it hashes several of the buffers at once.
+ */
+void tr_sha1_many(uint8_t const* const* data, size_t n, size_t length, tr_sha1_digest_t* setme);
+
+/**
+ * @brief Check whether this CPU can run the given kernel.
+ */
+bool tr_sha1_kernel_is_supported(tr_sha1_kernel kernel);
+
+/**
+ * @brief Get the kernel used by @ref tr_sha1_many. It defaults to the best kernel the CPU supports.
+ */
+tr_sha1_kernel tr_sha1_get_kernel(void);
+
+/**
+ * @brief Choose the kernel used by @ref tr_sha1_many (internal, for tests and benchmarks).
+ * @return false if this CPU can't run it.
+ */
+bool tr_sha1_set_kernel(tr_sha1_kernel kernel);
+
 /**
  * @brief Allocate and initialize new Diffie-Hellman (DH) key exchange context.
  */
@@ -197,3 +197,10 @@ std::optional<tr_sha1_digest_t> tr_sha1_final(tr_sha1_ctx_t handle)
     auto const success = tr_sha1_final(handle, reinterpret_cast<uint8_t*>(std::data(digest)));
     return success ? digest : std::optional<tr_sha1_digest_t>{};
 }
+
+std::optional<tr_sha256_digest_t> tr_sha256_final(tr_sha256_ctx_t handle)
+{
+    auto digest = tr_sha256_digest_t{};
+    auto const success = tr_sha256_final(handle, reinterpret_cast<uint8_t*>(std::data(digest)));
+    return success ? digest : std::optional<tr_sha256_digest_t>{};
+}
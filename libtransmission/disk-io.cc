@@ -0,0 +1,372 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+#include "disk-io.h"
+#include "log.h"
+#include "session.h"
+#include "tr-assert.h"
+#include "trevent.h"
+
+#define dbgmsg(...) tr_logAddDeepNamed("DiskIO", __VA_ARGS__)
+
+using disk_io_clock = std::chrono::steady_clock;
+
+struct disk_io_job
+{
+    int torrent_id;
+    uint64_t begin;
+    uint64_t end;
+    tr_disk_io_work_func work;
+    tr_disk_io_done_func done;
+    void* user_data;
+    disk_io_clock::time_point queued_at;
+    int err;
+};
+
+struct tr_disk_io
+{
+    tr_session* session = nullptr;
+
+    mutable std::mutex mutex;
+    std::condition_variable work_cv; // wakes workers when a torrent becomes ready
+    std::condition_variable idle_cv; // wakes tr_diskIoWaitTorrent() when a job is done
+
+    // each torrent's jobs, in the order they were queued
+    std::map<int, std::deque<disk_io_job*>> pending;
+
+    // torrents with pending jobs that aren't being worked on right now
+    std::deque<int> ready;
+
+    // torrents that a worker is working on right now, and the job it's doing
+    std::map<int, disk_io_job const*> busy;
+
+    // jobs whose done funcs are waiting to be called in the libevent thread
+    std::vector<disk_io_job*> finished;
+
+    std::vector<std::thread> workers;
+    int worker_count = 0;
+    bool die = false;
+
+    size_t queue_depth = 0;
+    uint64_t jobs_done = 0;
+    uint64_t total_latency_usec = 0;
+    uint64_t max_latency_usec = 0;
+};
+
+/***
+****
+***/
+
+static void callDoneFuncs(tr_disk_io* dio)
+{
+    auto jobs = std::vector<disk_io_job*>{};
+
+    {
+        auto const lock = std::lock_guard(dio->mutex);
+        std::swap(jobs, dio->finished);
+    }
+
+    for (auto* job : jobs)
+    {
+        if (job->done != nullptr)
+        {
+            (*job->done)(job->err, job->user_data);
+        }
+
+        auto const usec = uint64_t(
+            std::chrono::duration_cast<std::chrono::microseconds>(disk_io_clock::now() - job->queued_at).count());
+
+        {
+            auto const lock = std::lock_guard(dio->mutex);
+            ++dio->jobs_done;
+            dio->total_latency_usec += usec;
+            dio->max_latency_usec = std::max(dio->max_latency_usec, usec);
+        }
+
+        delete job;
+    }
+}
+
+static void onJobsFinished(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+
+    // the queue may have been freed since this was posted
+    if (session->diskIo != nullptr)
+    {
+        callDoneFuncs(session->diskIo);
+    }
+}
+
+/* must be called with dio->mutex held */
+static void finishJob(tr_disk_io* dio, disk_io_job* job, std::unique_lock<std::mutex>& lock)
+{
+    --dio->queue_depth;
+    dio->finished.push_back(job);
+    dio->idle_cv.notify_all();
+
+    // only the first finished job needs to wake up the libevent thread;
+    // the rest will be picked up by the same callDoneFuncs() pass
+    if (std::size(dio->finished) == 1)
+    {
+        lock.unlock();
+        tr_runInEventThread(dio->session, onJobsFinished, dio->session);
+        lock.lock();
+    }
+}
+
+/* must be called with dio->mutex held */
+static disk_io_job* popReadyJob(tr_disk_io* dio)
+{
+    int const torrent_id = dio->ready.front();
+    dio->ready.pop_front();
+
+    auto& queue = dio->pending[torrent_id];
+    auto* const job = queue.front();
+    queue.pop_front();
+    dio->busy.emplace(torrent_id, job);
+    return job;
+}
+
+/* must be called with dio->mutex held */
+static void releaseTorrent(tr_disk_io* dio, int torrent_id)
+{
+    dio->busy.erase(torrent_id);
+
+    if (auto it = dio->pending.find(torrent_id); it != std::end(dio->pending))
+    {
+        if (std::empty(it->second))
+        {
+            dio->pending.erase(it);
+        }
+        else
+        {
+            dio->ready.push_back(torrent_id);
+            dio->work_cv.notify_one();
+        }
+    }
+}
+
+static void workerFunc(tr_disk_io* dio)
+{
+    auto lock = std::unique_lock(dio->mutex);
+
+    for (;;)
+    {
+        dio->work_cv.wait(lock, [dio]() { return dio->die || !std::empty(dio->ready); });
+
+        if (dio->die)
+        {
+            break;
+        }
+
+        auto* const job = popReadyJob(dio);
+
+        lock.unlock();
+        job->err = (*job->work)(job->user_data);
+        lock.lock();
+
+        releaseTorrent(dio, job->torrent_id);
+        finishJob(dio, job, lock);
+    }
+}
+
+static void stopWorkers(tr_disk_io* dio)
+{
+    {
+        auto const lock = std::lock_guard(dio->mutex);
+        dio->die = true;
+    }
+
+    dio->work_cv.notify_all();
+
+    for (auto& worker : dio->workers)
+    {
+        worker.join();
+    }
+
+    dio->workers.clear();
+    dio->die = false;
+}
+
+/* perform any queued jobs in the caller's thread */
+static void runPendingJobs(tr_disk_io* dio)
+{
+    auto lock = std::unique_lock(dio->mutex);
+
+    while (!std::empty(dio->ready))
+    {
+        auto* const job = popReadyJob(dio);
+        job->err = (*job->work)(job->user_data);
+        releaseTorrent(dio, job->torrent_id);
+        finishJob(dio, job, lock);
+    }
+}
+
+/***
+****
+***/
+
+tr_disk_io* tr_diskIoNew(tr_session* session, int worker_count)
+{
+    auto* const dio = new tr_disk_io{};
+    dio->session = session;
+    tr_diskIoSetWorkerCount(dio, worker_count);
+    return dio;
+}
+
+void tr_diskIoFree(tr_disk_io* dio)
+{
+    {
+        auto lock = std::unique_lock(dio->mutex);
+        dio->idle_cv.wait(lock, [dio]() { return std::empty(dio->pending) && std::empty(dio->busy); });
+    }
+
+    stopWorkers(dio);
+    callDoneFuncs(dio);
+    delete dio;
+}
+
+void tr_diskIoSetWorkerCount(tr_disk_io* dio, int worker_count)
+{
+    worker_count = std::max(worker_count, 0);
+
+    if (worker_count == dio->worker_count && std::size(dio->workers) == size_t(worker_count))
+    {
+        return;
+    }
+
+    dbgmsg("changing from %d to %d disk I/O workers", dio->worker_count, worker_count);
+
+    stopWorkers(dio);
+    dio->worker_count = worker_count;
+
+    if (worker_count == 0)
+    {
+        runPendingJobs(dio);
+        return;
+    }
+
+    for (int i = 0; i < worker_count; ++i)
+    {
+        dio->workers.emplace_back(workerFunc, dio);
+    }
+}
+
+int tr_diskIoGetWorkerCount(tr_disk_io const* dio)
+{
+    return dio->worker_count;
+}
+
+void tr_diskIoRun(
+    tr_disk_io* dio,
+    int torrent_id,
+    uint64_t begin,
+    uint64_t end,
+    tr_disk_io_work_func work,
+    tr_disk_io_done_func done,
+    void* user_data)
+{
+    TR_ASSERT(work != nullptr);
+
+    auto* const job = new disk_io_job{ torrent_id, begin, end, work, done, user_data, disk_io_clock::now(), 0 };
+
+    if (dio->worker_count == 0)
+    {
+        {
+            auto const lock = std::lock_guard(dio->mutex);
+            ++dio->queue_depth;
+        }
+
+        job->err = (*work)(user_data);
+
+        {
+            auto lock = std::unique_lock(dio->mutex);
+            --dio->queue_depth;
+            dio->finished.push_back(job);
+        }
+
+        callDoneFuncs(dio);
+        return;
+    }
+
+    auto const lock = std::lock_guard(dio->mutex);
+    ++dio->queue_depth;
+
+    auto& queue = dio->pending[torrent_id];
+    queue.push_back(job);
+
+    if (std::size(queue) == 1 && dio->busy.count(torrent_id) == 0)
+    {
+        dio->ready.push_back(torrent_id);
+        dio->work_cv.notify_one();
+    }
+}
+
+void tr_diskIoWaitTorrent(tr_disk_io* dio, int torrent_id)
+{
+    auto lock = std::unique_lock(dio->mutex);
+
+    dio->idle_cv.wait(
+        lock,
+        [dio, torrent_id]() { return dio->pending.count(torrent_id) == 0 && dio->busy.count(torrent_id) == 0; });
+}
+
+/* true if none of the torrent's queued jobs touch [begin, end). dio->mutex must be held */
+static bool rangeIsIdle(tr_disk_io const* dio, int torrent_id, uint64_t begin, uint64_t end)
+{
+    auto const overlaps = [begin, end](disk_io_job const* job)
+    {
+        return job->begin < end && begin < job->end;
+    };
+
+    if (auto const it = dio->busy.find(torrent_id); it != std::end(dio->busy) && overlaps(it->second))
+    {
+        return false;
+    }
+
+    auto const it = dio->pending.find(torrent_id);
+    return it == std::end(dio->pending) || std::none_of(std::begin(it->second), std::end(it->second), overlaps);
+}
+
+void tr_diskIoWaitRange(tr_disk_io* dio, int torrent_id, uint64_t begin, uint64_t end)
+{
+    auto lock = std::unique_lock(dio->mutex);
+
+    dio->idle_cv.wait(lock, [dio, torrent_id, begin, end]() { return rangeIsIdle(dio, torrent_id, begin, end); });
+}
+
+bool tr_diskIoIsRangeIdle(tr_disk_io const* dio, int torrent_id, uint64_t begin, uint64_t end)
+{
+    auto const lock = std::lock_guard(dio->mutex);
+
+    return rangeIsIdle(dio, torrent_id, begin, end);
+}
+
+tr_disk_io_stats tr_diskIoGetStats(tr_disk_io const* dio)
+{
+    auto const lock = std::lock_guard(dio->mutex);
+
+    auto stats = tr_disk_io_stats{};
+    stats.worker_count = dio->worker_count;
+    stats.queue_depth = dio->queue_depth;
+    stats.jobs_done = dio->jobs_done;
+    stats.average_latency_usec = dio->jobs_done == 0 ? 0 : dio->total_latency_usec / dio->jobs_done;
+    stats.max_latency_usec = dio->max_latency_usec;
+    return stats;
+}
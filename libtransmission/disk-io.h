@@ -0,0 +1,88 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+struct tr_disk_io;
+struct tr_session;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/**
+ * Performed in one of the disk I/O worker threads.
+ * It must not touch session state that is owned by the libevent thread.
+ * @return 0 on success, or an errno value on failure.
+ */
+using tr_disk_io_work_func = int (*)(void* user_data);
+
+/** Called in the libevent thread once the work has been performed. */
+using tr_disk_io_done_func = void (*)(int err, void* user_data);
+
+struct tr_disk_io_stats
+{
+    int worker_count;
+
+    /* jobs that are queued or being worked on right now */
+    size_t queue_depth;
+
+    uint64_t jobs_done;
+
+    /* time from a job being queued to its done func being called */
+    uint64_t average_latency_usec;
+    uint64_t max_latency_usec;
+};
+
+tr_disk_io* tr_diskIoNew(tr_session* session, int worker_count);
+
+/** Performs any outstanding jobs, then stops the workers. */
+void tr_diskIoFree(tr_disk_io* dio);
+
+/** With zero workers, jobs are performed synchronously in the caller's thread. */
+void tr_diskIoSetWorkerCount(tr_disk_io* dio, int worker_count);
+
+int tr_diskIoGetWorkerCount(tr_disk_io const* dio);
+
+/**
+ * Queues `work` to run in a worker thread, then `done` in the libevent thread.
+ * Jobs for the same torrent are performed one at a time in the order they were queued.
+ * [begin, end) are the torrent's bytes that the job reads or writes.
+ */
+void tr_diskIoRun(
+    tr_disk_io* dio,
+    int torrent_id,
+    uint64_t begin,
+    uint64_t end,
+    tr_disk_io_work_func work,
+    tr_disk_io_done_func done,
+    void* user_data);
+
+/**
+ * Blocks until all of a torrent's queued jobs have been performed.
+ * Their done funcs might not have been called yet.
+ */
+void tr_diskIoWaitTorrent(tr_disk_io* dio, int torrent_id);
+
+/** Blocks until none of a torrent's queued jobs touch its bytes in [begin, end). */
+void tr_diskIoWaitRange(tr_disk_io* dio, int torrent_id, uint64_t begin, uint64_t end);
+
+/** True if none of a torrent's queued jobs touch its bytes in [begin, end). Doesn't block. */
+bool tr_diskIoIsRangeIdle(tr_disk_io const* dio, int torrent_id, uint64_t begin, uint64_t end);
+
+tr_disk_io_stats tr_diskIoGetStats(tr_disk_io const* dio);
+
+/* @} */
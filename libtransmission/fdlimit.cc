@@ -7,13 +7,25 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstring>
+#include <functional> /* std::hash */
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h> /* getrlimit(), setrlimit() */
+#endif
 
 #include "transmission.h"
 #include "error.h"
 #include "error-types.h"
+#include "disk-io.h"
 #include "fdlimit.h"
 #include "file.h"
 #include "log.h"
@@ -121,7 +133,15 @@ struct tr_cached_file
     tr_sys_file_t fd;
     int torrent_id;
     tr_file_index_t file_index;
-    time_t used_at;
+
+    /* how many times the fd has been handed out and not yet returned.
+     * checked-out files are never closed to make room for others. */
+    int checkout_count;
+
+    /* open files that aren't checked out are kept in an LRU list,
+     * so the one to close to make room can be found right away */
+    struct tr_cached_file* lru_prev;
+    struct tr_cached_file* lru_next;
 };
 
 static constexpr bool cached_file_is_open(struct tr_cached_file const* o)
@@ -265,55 +285,104 @@ FAIL:
 ****
 ***/
 
+using fileset_key = std::pair<int /*torrent_id*/, tr_file_index_t>;
+
+struct fileset_key_hash
+{
+    size_t operator()(fileset_key const& key) const noexcept
+    {
+        return std::hash<uint64_t>{}(uint64_t{ uint32_t(key.first) } << 32 | key.second);
+    }
+};
+
 struct tr_fileset
 {
-    struct tr_cached_file* begin;
-    struct tr_cached_file const* end;
+    size_t max_files;
+
+    /* unordered_map never moves its elements, so the LRU links stay valid */
+    std::unordered_map<fileset_key, tr_cached_file, fileset_key_hash> files;
+
+    /* least recently used first */
+    struct tr_cached_file* lru_head;
+    struct tr_cached_file* lru_tail;
 };
 
 static void fileset_construct(struct tr_fileset* set, int n)
 {
-    set->begin = tr_new(struct tr_cached_file, n);
-    set->end = set->begin + n;
+    set->max_files = n;
+    set->files.reserve(n);
+    set->lru_head = set->lru_tail = nullptr;
+}
+
+static void fileset_lru_append(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->lru_prev = set->lru_tail;
+    o->lru_next = nullptr;
+    (set->lru_tail != nullptr ? set->lru_tail->lru_next : set->lru_head) = o;
+    set->lru_tail = o;
+}
+
+static void fileset_lru_remove(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    (o->lru_prev != nullptr ? o->lru_prev->lru_next : set->lru_head) = o->lru_next;
+    (o->lru_next != nullptr ? o->lru_next->lru_prev : set->lru_tail) = o->lru_prev;
+    o->lru_prev = o->lru_next = nullptr;
+}
 
-    for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+/* closes the file if it's open and forgets about it */
+static void fileset_erase(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    TR_ASSERT(o->checkout_count == 0);
+
+    if (cached_file_is_open(o))
     {
-        *o = { false, TR_BAD_SYS_FILE, 0, 0, 0 };
+        fileset_lru_remove(set, o);
+        cached_file_close(o);
     }
+
+    set->files.erase(fileset_key{ o->torrent_id, o->file_index });
 }
 
 static void fileset_close_all(struct tr_fileset* set)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        for (auto& [key, o] : set->files)
         {
-            if (cached_file_is_open(o))
+            if (cached_file_is_open(&o))
             {
-                cached_file_close(o);
+                cached_file_close(&o);
             }
         }
+
+        set->files.clear();
+        set->lru_head = set->lru_tail = nullptr;
     }
 }
 
 static void fileset_destruct(struct tr_fileset* set)
 {
     fileset_close_all(set);
-    tr_free(set->begin);
-    set->end = set->begin = nullptr;
 }
 
 static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        auto doomed = std::vector<struct tr_cached_file*>{};
+
+        for (auto& [key, o] : set->files)
         {
-            if (o->torrent_id == torrent_id && cached_file_is_open(o))
+            if (key.first == torrent_id)
             {
-                cached_file_close(o);
+                doomed.push_back(&o);
             }
         }
+
+        for (auto* o : doomed)
+        {
+            fileset_erase(set, o);
+        }
     }
 }
 
@@ -321,46 +390,69 @@ static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        auto const it = set->files.find(fileset_key{ torrent_id, i });
+
+        if (it != std::end(set->files) && cached_file_is_open(&it->second))
         {
-            if (torrent_id == o->torrent_id && i == o->file_index && cached_file_is_open(o))
-            {
-                return o;
-            }
+            return &it->second;
         }
     }
 
     return nullptr;
 }
 
-static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
+/* close the least recently used files that aren't checked out
+ * until there are fewer than `n` left, if that's possible */
+static void fileset_make_room(struct tr_fileset* set, size_t n)
 {
-    struct tr_cached_file* cull = nullptr;
+    while (std::size(set->files) >= n && set->lru_head != nullptr)
+    {
+        fileset_erase(set, set->lru_head);
+    }
+}
 
-    if (set != nullptr && set->begin != nullptr)
+/* returns a closed slot for the file, making room for it if needed */
+static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set, int torrent_id, tr_file_index_t i)
+{
+    if (set == nullptr || set->max_files == 0)
     {
-        /* try to find an unused slot */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (!cached_file_is_open(o))
-            {
-                return o;
-            }
-        }
+        return nullptr;
+    }
 
-        /* all slots are full... recycle the least recently used */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (cull == nullptr || o->used_at < cull->used_at)
-            {
-                cull = o;
-            }
-        }
+    auto const key = fileset_key{ torrent_id, i };
 
-        cached_file_close(cull);
+    if (auto const it = set->files.find(key); it != std::end(set->files))
+    {
+        TR_ASSERT(!cached_file_is_open(&it->second));
+        return &it->second;
     }
 
-    return cull;
+    fileset_make_room(set, set->max_files);
+
+    if (std::size(set->files) >= set->max_files)
+    {
+        return nullptr;
+    }
+
+    auto& o = set->files[key];
+    o = { false, TR_BAD_SYS_FILE, torrent_id, i, 0, nullptr, nullptr };
+    return &o;
+}
+
+static void fileset_checkout(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (o->checkout_count++ == 0)
+    {
+        fileset_lru_remove(set, o);
+    }
+}
+
+static void fileset_return(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (--o->checkout_count == 0)
+    {
+        fileset_lru_append(set, o);
+    }
 }
 
 /***
@@ -369,10 +461,20 @@ static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 ****
 ***/
 
+/* fds for things other than the file cache and peers' sockets:
+ * listening sockets, DHT, RPC, log files, and so on */
+static auto constexpr OtherFds = int{ 64 };
+
 struct tr_fdInfo
 {
     int peerCount;
     struct tr_fileset fileset;
+
+    /* the fileset is shared with the disk I/O workers */
+    std::mutex lock;
+
+    /* signalled when a file's last checkout is returned */
+    std::condition_variable returned_cv;
 };
 
 static void ensureSessionFdInfoExists(tr_session* session)
@@ -381,26 +483,90 @@ static void ensureSessionFdInfoExists(tr_session* session)
 
     if (session->fdInfo == nullptr)
     {
-        int const FILE_CACHE_SIZE = 32;
-
         /* Create the local file cache */
-        auto* const i = tr_new0(struct tr_fdInfo, 1);
-        fileset_construct(&i->fileset, FILE_CACHE_SIZE);
+        auto* const i = new tr_fdInfo{};
+        fileset_construct(&i->fileset, TR_DEFAULT_OPEN_FILE_LIMIT);
         session->fdInfo = i;
     }
 }
 
+void tr_fdInit(tr_session* session)
+{
+    ensureSessionFdInfoExists(session);
+}
+
 void tr_fdClose(tr_session* session)
 {
     if (session != nullptr && session->fdInfo != nullptr)
     {
         struct tr_fdInfo* i = session->fdInfo;
         fileset_destruct(&i->fileset);
-        tr_free(i);
+        delete i;
         session->fdInfo = nullptr;
     }
 }
 
+/* raise the process's soft limit on open files so that `limit` files can
+ * be cached, and as many dups of them open, alongside the peers' sockets.
+ * returns the limit that fits */
+static int raiseOpenFilesLimit([[maybe_unused]] tr_session const* session, int limit)
+{
+#ifndef _WIN32
+    struct rlimit rlim = {};
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) != 0)
+    {
+        return limit;
+    }
+
+    auto const others = rlim_t(session->peerLimit) + OtherFds;
+    auto const wanted = rlim_t(limit) * 2 + others;
+
+    if (rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur < wanted)
+    {
+        auto const old_cur = rlim.rlim_cur;
+        rlim.rlim_cur = rlim.rlim_max == RLIM_INFINITY ? wanted : std::min(wanted, rlim.rlim_max);
+
+        if (setrlimit(RLIMIT_NOFILE, &rlim) != 0)
+        {
+            rlim.rlim_cur = old_cur;
+        }
+
+        dbgmsg("open files limit is %" PRIu64 ", wanted %" PRIu64, uint64_t(rlim.rlim_cur), uint64_t(wanted));
+    }
+
+    if (rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur < wanted)
+    {
+        int const fits = rlim.rlim_cur > others + 1 ? int((rlim.rlim_cur - others) / 2) : 1;
+        tr_logAddError(
+            _("Can only keep %1$d files open, not %2$d, because of the system's open files limit"),
+            fits,
+            limit);
+        return fits;
+    }
+#endif
+
+    return limit;
+}
+
+void tr_fdSetFileLimit(tr_session* session, int limit)
+{
+    ensureSessionFdInfoExists(session);
+    struct tr_fdInfo* const i = session->fdInfo;
+
+    limit = raiseOpenFilesLimit(session, std::max(limit, 1));
+
+    auto const lock = std::lock_guard(i->lock);
+    i->fileset.max_files = size_t(std::max(limit, 1));
+    fileset_make_room(&i->fileset, i->fileset.max_files + 1);
+}
+
+int tr_fdGetFileLimit(tr_session* session)
+{
+    ensureSessionFdInfoExists(session);
+    return int(session->fdInfo->fileset.max_files);
+}
+
 /***
 ****
 ***/
@@ -416,11 +582,50 @@ static struct tr_fileset* get_fileset(tr_session* session)
     return &session->fdInfo->fileset;
 }
 
+static void fileset_lock(tr_session* session)
+{
+    ensureSessionFdInfoExists(session);
+    session->fdInfo->lock.lock();
+}
+
+static void fileset_unlock(tr_session* session)
+{
+    session->fdInfo->lock.unlock();
+}
+
+/* wait for the disk I/O workers to hand the file back.
+ * must be called with the fileset locked */
+static struct tr_cached_file* fileset_wait_for_return(tr_session* session, int torrent_id, tr_file_index_t i)
+{
+    auto* const set = get_fileset(session);
+    auto lock = std::unique_lock(session->fdInfo->lock, std::adopt_lock);
+
+    session->fdInfo->returned_cv.wait(
+        lock,
+        [set, torrent_id, i]()
+        {
+            auto const* const o = fileset_lookup(set, torrent_id, i);
+            return o == nullptr || o->checkout_count == 0;
+        });
+
+    lock.release();
+    return fileset_lookup(set, torrent_id, i);
+}
+
 void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
 {
+    if (s->diskIo != nullptr)
+    {
+        tr_diskIoWaitTorrent(s->diskIo, tr_torrentId(tor));
+    }
+
+    fileset_lock(s);
+
     tr_cached_file* const o = fileset_lookup(get_fileset(s), tr_torrentId(tor), i);
     if (o != nullptr)
     {
+        TR_ASSERT(o->checkout_count == 0);
+
         /* flush writable files so that their mtimes will be
          * up-to-date when this function returns to the caller... */
         if (o->is_writable)
@@ -428,28 +633,98 @@ void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
             tr_sys_file_flush(o->fd, nullptr);
         }
 
-        cached_file_close(o);
+        fileset_erase(get_fileset(s), o);
     }
+
+    fileset_unlock(s);
 }
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* s, int torrent_id, tr_file_index_t i, bool writable)
 {
-    struct tr_cached_file* o = fileset_lookup(get_fileset(s), torrent_id, i);
+    fileset_lock(s);
+
+    struct tr_fileset* set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
+    tr_sys_file_t fd = TR_BAD_SYS_FILE;
 
-    if (o == nullptr || (writable && !o->is_writable))
+    if (o != nullptr && (!writable || o->is_writable))
     {
-        return TR_BAD_SYS_FILE;
+        fileset_checkout(set, o);
+        fd = o->fd;
+    }
+
+    fileset_unlock(s);
+    return fd;
+}
+
+void tr_fdFileReturn(tr_session* s, int torrent_id, tr_file_index_t i)
+{
+    fileset_lock(s);
+
+    struct tr_fileset* set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
+    TR_ASSERT(o != nullptr);
+    TR_ASSERT(o->checkout_count > 0);
+
+    if (o != nullptr && o->checkout_count > 0)
+    {
+        fileset_return(set, o);
+
+        if (o->checkout_count == 0)
+        {
+            s->fdInfo->returned_cv.notify_all();
+        }
     }
 
-    o->used_at = tr_time();
-    return o->fd;
+    fileset_unlock(s);
+}
+
+/* dups are counted process-wide, like the open files limit that they count
+ * against. They can also outlive the session that made them, since they're
+ * closed whenever the buffer they were added to gets freed */
+static std::atomic<int> n_file_dups{ 0 };
+
+tr_sys_file_t tr_fdFileDup(tr_session* session, tr_sys_file_t fd)
+{
+    int const limit = tr_fdGetFileLimit(session);
+
+    auto n = n_file_dups.load();
+    do
+    {
+        if (n >= limit)
+        {
+            return TR_BAD_SYS_FILE;
+        }
+    } while (!n_file_dups.compare_exchange_weak(n, n + 1));
+
+    tr_sys_file_t const ret = tr_sys_file_dup(fd, nullptr);
+
+    if (ret == TR_BAD_SYS_FILE)
+    {
+        --n_file_dups;
+    }
+
+    return ret;
+}
+
+void tr_fdFileDupClose(tr_sys_file_t fd)
+{
+    tr_sys_file_close(fd, nullptr);
+    --n_file_dups;
 }
 
 void tr_fdTorrentClose(tr_session* session, int torrent_id)
 {
     TR_ASSERT(tr_sessionIsLocked(session));
 
+    if (session->diskIo != nullptr)
+    {
+        tr_diskIoWaitTorrent(session->diskIo, torrent_id);
+    }
+
+    fileset_lock(session);
     fileset_close_torrent(get_fileset(session), torrent_id);
+    fileset_unlock(session);
 }
 
 /* returns an fd on success, or a TR_BAD_SYS_FILE on failure and sets errno */
@@ -462,16 +737,33 @@ tr_sys_file_t tr_fdFileCheckout(
     tr_preallocation_mode allocation,
     uint64_t file_size)
 {
+    fileset_lock(session);
+
     struct tr_fileset* set = get_fileset(session);
     struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
 
     if (o != nullptr && writable && !o->is_writable)
     {
-        cached_file_close(o); /* close it so we can reopen in rw mode */
+        o = fileset_wait_for_return(session, torrent_id, i);
+
+        if (o != nullptr)
+        {
+            /* close it so we can reopen in rw mode */
+            fileset_lru_remove(set, o);
+            cached_file_close(o);
+        }
+    }
+
+    if (o == nullptr || !cached_file_is_open(o))
+    {
+        o = fileset_get_empty_slot(set, torrent_id, i);
     }
-    else if (o == nullptr)
+
+    if (o == nullptr)
     {
-        o = fileset_get_empty_slot(set);
+        fileset_unlock(session);
+        errno = EMFILE;
+        return TR_BAD_SYS_FILE;
     }
 
     if (!cached_file_is_open(o))
@@ -480,19 +772,24 @@ tr_sys_file_t tr_fdFileCheckout(
 
         if (err != 0)
         {
+            fileset_erase(set, o);
+            fileset_unlock(session);
             errno = err;
             return TR_BAD_SYS_FILE;
         }
 
         dbgmsg("opened '%s' writable %c", filename, writable ? 'y' : 'n');
         o->is_writable = writable;
+        o->checkout_count = 0;
+        fileset_lru_append(set, o);
     }
 
     dbgmsg("checking out '%s'", filename);
-    o->torrent_id = torrent_id;
-    o->file_index = i;
-    o->used_at = tr_time();
-    return o->fd;
+    fileset_checkout(set, o);
+
+    tr_sys_file_t const fd = o->fd;
+    fileset_unlock(session);
+    return fd;
 }
 
 /***
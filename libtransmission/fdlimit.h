@@ -38,6 +38,9 @@
  * on success, a file descriptor >= 0 is returned.
  * on failure, a TR_BAD_SYS_FILE is returned and errno is set.
  *
+ * The file stays checked out until it's handed back with tr_fdFileReturn().
+ * This is safe to call from the disk I/O worker threads.
+ *
  * @see tr_fdFileClose
  */
 tr_sys_file_t tr_fdFileCheckout(
@@ -49,13 +52,28 @@ tr_sys_file_t tr_fdFileCheckout(
     tr_preallocation_mode preallocation_mode,
     uint64_t preallocation_file_size);
 
+/** Like tr_fdFileCheckout(), but only succeeds if the file is already open. */
 tr_sys_file_t tr_fdFileGetCached(tr_session* session, int torrent_id, tr_file_index_t file_num, bool doWrite);
 
+/** Hands back a file from tr_fdFileCheckout() or tr_fdFileGetCached(). */
+void tr_fdFileReturn(tr_session* session, int torrent_id, tr_file_index_t file_num);
+
+/**
+ * Dups a checked-out file's fd, so that it can be read after the file is
+ * returned, e.g. by a sendfile() segment. Dups count against the file limit:
+ * returns TR_BAD_SYS_FILE if tr_fdGetFileLimit() of them are already open.
+ * Close it with tr_fdFileDupClose().
+ */
+tr_sys_file_t tr_fdFileDup(tr_session* session, tr_sys_file_t fd);
+
+/** Closes a dup from tr_fdFileDup(). Safe to call after the session is closed. */
+void tr_fdFileDupClose(tr_sys_file_t fd);
+
 /**
  * Closes a file that's being held by our file repository.
  *
- * If the file isn't checked out, it's fsync()ed and close()d immediately.
- * If the file is currently checked out, it will be closed upon its return.
+ * Waits for the torrent's queued disk I/O to finish,
+ * then fsync()s and close()s the file.
  *
  * @see tr_fdFileCheckout
  */
@@ -63,9 +81,24 @@ void tr_fdFileClose(tr_session* session, tr_torrent const* tor, tr_file_index_t
 
 /**
  * Closes all the files associated with a given torrent id
+ * once the torrent's queued disk I/O has finished.
  */
 void tr_fdTorrentClose(tr_session* session, int torrentId);
 
+/** How many files can be kept open at once, unless tr_fdSetFileLimit() says otherwise. */
+auto inline constexpr TR_DEFAULT_OPEN_FILE_LIMIT = int{ 32 };
+
+/**
+ * Sets how many files can be kept open at once.
+ * Lowering it closes the least recently used files that aren't checked out.
+ * The process's open files limit is raised to make room for them and their
+ * dups from tr_fdFileDup() if needed,
+ * and if it can't be, fewer files are kept open.
+ */
+void tr_fdSetFileLimit(tr_session* session, int limit);
+
+int tr_fdGetFileLimit(tr_session* session);
+
 /***********************************************************************
  * Sockets
  **********************************************************************/
@@ -75,6 +108,14 @@ tr_socket_t tr_fdSocketAccept(tr_session* session, tr_socket_t listening_sockfd,
 
 void tr_fdSocketClose(tr_session* session, tr_socket_t s);
 
+/***********************************************************************
+ * tr_fdInit
+ ***********************************************************************
+ * Sets up the file repository. Must be called before any worker
+ * threads can check out files.
+ **********************************************************************/
+void tr_fdInit(tr_session* session);
+
 /***********************************************************************
  * tr_fdClose
  ***********************************************************************
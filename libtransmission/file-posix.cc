@@ -11,8 +11,9 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cerrno>
-#include <climits> /* PATH_MAX */
+#include <climits> /* IOV_MAX, PATH_MAX */
 #include <cstdint> /* SIZE_MAX */
 #include <cstdio>
 #include <cstdlib>
@@ -20,10 +21,13 @@
 #include <dirent.h>
 #include <fcntl.h> /* O_LARGEFILE, posix_fadvise(), [posix_]fallocate(), fcntl() */
 #include <libgen.h> /* basename(), dirname() */
+#include <memory>
+#include <numeric>
 #include <sys/file.h> /* flock() */
 #include <sys/mman.h> /* mmap(), munmap() */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h> /* preadv(), pwritev() */
 #include <unistd.h> /* lseek(), write(), ftruncate(), pread(), pwrite(), pathconf(), etc */
 #include <vector>
 
@@ -52,6 +56,15 @@
 #define USE_COPY_FILE_RANGE
 #endif /* __linux__ */
 
+/* io_uring, for tr_sys_file_batch(). Talks to the kernel directly so that liburing isn't needed. */
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USE_IO_URING
+#endif
+#endif
+
 #include "transmission.h"
 #include "error.h"
 #include "file.h"
@@ -77,6 +90,10 @@
 #define PATH_MAX 4096
 #endif
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 /* don't use pread/pwrite on old versions of uClibc because they're buggy.
  * https://trac.transmissionbt.com/ticket/3826 */
 #if defined(__UCLIBC__) && !TR_UCLIBC_CHECK_VERSION(0, 9, 28)
@@ -679,6 +696,24 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+#ifdef F_DUPFD_CLOEXEC
+    tr_sys_file_t const ret = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+#else
+    tr_sys_file_t const ret = dup(handle);
+#endif
+
+    if (ret == TR_BAD_SYS_FILE)
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -872,6 +907,458 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+/* appends the segments of the operation that are still to be done */
+static void append_remaining_iovecs(tr_sys_file_io const* io, std::vector<iovec>* setme)
+{
+    if (io->iov == nullptr)
+    {
+        setme->push_back(iovec{ static_cast<uint8_t*>(io->buffer) + io->bytes_done, size_t(io->size - io->bytes_done) });
+        return;
+    }
+
+    uint64_t skip = io->bytes_done;
+
+    for (size_t i = 0, n = 0; i < io->iov_count && n < IOV_MAX; ++i)
+    {
+        tr_sys_file_iovec const& seg = io->iov[i];
+
+        if (skip >= seg.len)
+        {
+            skip -= seg.len;
+            continue;
+        }
+
+        setme->push_back(iovec{ static_cast<uint8_t*>(seg.base) + skip, size_t(seg.len - skip) });
+        skip = 0;
+        ++n;
+    }
+}
+
+static ssize_t transfer_at(tr_sys_file_io const* io, void* buf, size_t len, uint64_t offset)
+{
+#ifdef HAVE_PREAD
+    return io->is_write ? pwrite(io->handle, buf, len, offset) : pread(io->handle, buf, len, offset);
+#else
+    return lseek(io->handle, offset, SEEK_SET) == -1 ? -1 :
+                                                       (io->is_write ? write(io->handle, buf, len) :
+                                                                       read(io->handle, buf, len));
+#endif
+}
+
+/* performs the whole of one batched operation with pread()/pwrite()
+ * (or preadv()/pwritev()), picking up from wherever a previous attempt left off */
+static void file_io_sequential(tr_sys_file_io* io)
+{
+    auto iovs = std::vector<iovec>{};
+
+    while (io->err == 0 && io->bytes_done < io->size)
+    {
+        uint64_t const offset = io->offset + io->bytes_done;
+        ssize_t n = 0;
+
+        if (io->iov == nullptr)
+        {
+            n = transfer_at(io, static_cast<uint8_t*>(io->buffer) + io->bytes_done, io->size - io->bytes_done, offset);
+        }
+        else
+        {
+            iovs.clear();
+            append_remaining_iovecs(io, &iovs);
+
+#if defined(HAVE_PREADV) && defined(HAVE_PWRITEV)
+            n = io->is_write ? pwritev(io->handle, std::data(iovs), std::size(iovs), offset) :
+                               preadv(io->handle, std::data(iovs), std::size(iovs), offset);
+#else
+            n = transfer_at(io, iovs.front().iov_base, iovs.front().iov_len, offset);
+#endif
+        }
+
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n == -1)
+        {
+            io->err = errno;
+        }
+        else if (n == 0)
+        {
+            break; /* end of file */
+        }
+        else
+        {
+            io->bytes_done += n;
+        }
+    }
+}
+
+#ifdef USE_IO_URING
+
+/* one ring per thread, so that disk I/O workers don't need to share */
+struct file_io_ring
+{
+    int fd = -1;
+
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cq_mask = 0;
+
+    bool init()
+    {
+        auto params = io_uring_params{};
+        fd = syscall(__NR_io_uring_setup, RingEntries, &params);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool const single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+        {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+        {
+            return false;
+        }
+
+        if (!single_mmap)
+        {
+            cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED)
+            {
+                return false;
+            }
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+        {
+            return false;
+        }
+
+        auto* const sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+
+        auto* const cq = static_cast<char*>(single_mmap ? sq_ptr : cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+
+        return true;
+    }
+
+    ~file_io_ring()
+    {
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqes_size);
+        }
+
+        if (cq_ptr != MAP_FAILED)
+        {
+            munmap(cq_ptr, cq_size);
+        }
+
+        if (sq_ptr != MAP_FAILED)
+        {
+            munmap(sq_ptr, sq_size);
+        }
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    static auto constexpr RingEntries = unsigned{ 64 };
+};
+
+static thread_local auto thread_ring = std::unique_ptr<file_io_ring>{};
+
+/* returns nullptr if this kernel doesn't support io_uring (or has it disabled) */
+static file_io_ring* get_thread_ring()
+{
+    thread_local bool tried = false;
+
+    if (!tried)
+    {
+        tried = true;
+
+        auto candidate = std::make_unique<file_io_ring>();
+        if (candidate->init())
+        {
+            thread_ring = std::move(candidate);
+        }
+        else
+        {
+            tr_logAddDebug("io_uring unavailable: %s", tr_strerror(errno));
+        }
+    }
+
+    return thread_ring.get();
+}
+
+/* closes this thread's ring, which cancels whatever the kernel still has,
+ * and keeps the thread on pread()/pwrite() from then on */
+static void drop_thread_ring()
+{
+    thread_ring.reset();
+}
+
+/* submits the batch's operations, a ring's worth at a time, and waits for
+ * them to complete. returns false if the ring couldn't be used at all. */
+static bool file_io_uring(tr_sys_file_io* ios, size_t n_ios)
+{
+    file_io_ring* const ring = get_thread_ring();
+    if (ring == nullptr)
+    {
+        return false;
+    }
+
+    /* the segments of every operation, laid out one after the other.
+     * this is reserved up front so that pointers into it stay valid. */
+    auto iovs = std::vector<iovec>{};
+    auto first_iov = std::vector<size_t>(n_ios + 1);
+    iovs.reserve(std::accumulate(
+        ios,
+        ios + n_ios,
+        size_t{},
+        [](size_t sum, auto const& io) { return sum + (io.iov == nullptr ? 1 : std::min(io.iov_count, size_t{ IOV_MAX })); }));
+
+    for (size_t i = 0; i < n_ios; ++i)
+    {
+        append_remaining_iovecs(&ios[i], &iovs);
+        first_iov[i + 1] = std::size(iovs);
+    }
+
+    auto reaped = std::vector<bool>(n_ios);
+    size_t n_queued = 0;
+    size_t n_in_flight = 0;
+    size_t n_completed = 0;
+    bool can_queue = true;
+
+    auto const reap = [ring, ios, &reaped, &n_in_flight, &n_completed]()
+    {
+        unsigned cq_head = *ring->cq_head;
+        unsigned const cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; cq_head != cq_tail; ++cq_head)
+        {
+            io_uring_cqe const* const cqe = &ring->cqes[cq_head & ring->cq_mask];
+            tr_sys_file_io& io = ios[cqe->user_data];
+            reaped[cqe->user_data] = true;
+
+            if (cqe->res < 0)
+            {
+                io.err = -cqe->res;
+            }
+            else
+            {
+                io.bytes_done = cqe->res;
+            }
+
+            --n_in_flight;
+            ++n_completed;
+        }
+
+        __atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+    };
+
+    while (n_completed < n_queued || (can_queue && n_queued < n_ios))
+    {
+        /* fill any free submission slots */
+        unsigned tail = *ring->sq_tail;
+        unsigned const head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        while (can_queue && n_queued < n_ios && n_in_flight < ring->sq_entries && tail - head < ring->sq_entries)
+        {
+            tr_sys_file_io const& io = ios[n_queued];
+
+            unsigned const index = tail & ring->sq_mask;
+            io_uring_sqe* const sqe = &ring->sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = io.is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = io.handle;
+            sqe->off = io.offset;
+            sqe->addr = reinterpret_cast<uintptr_t>(&iovs[first_iov[n_queued]]);
+            sqe->len = first_iov[n_queued + 1] - first_iov[n_queued];
+            sqe->user_data = n_queued;
+            ring->sq_array[index] = index;
+
+            ++tail;
+            ++n_queued;
+            ++n_in_flight;
+        }
+
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned const to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1U, IORING_ENTER_GETEVENTS, nullptr, 0) == -1)
+        {
+            int const err = errno;
+
+            if (err == EINTR || ((err == EAGAIN || err == EBUSY) && n_in_flight != 0))
+            {
+                /* reap whatever's finished, then try again */
+            }
+            else if (to_submit != 0)
+            {
+                /* the kernel didn't take them; finish up with pread()/pwrite() */
+                tr_logAddDebug("io_uring_enter failed: %s", tr_strerror(err));
+                __atomic_store_n(ring->sq_tail, tail - to_submit, __ATOMIC_RELEASE);
+                n_queued -= to_submit;
+                n_in_flight -= to_submit;
+                can_queue = false;
+            }
+            else
+            {
+                tr_logAddDebug("io_uring_enter failed: %s", tr_strerror(err));
+                break;
+            }
+        }
+
+        reap();
+    }
+
+    /* if io_uring_enter() gave up while the kernel still had some of the
+     * operations, they have to finish before they're redone below. otherwise
+     * they'd still be touching the buffers, and their completions would turn
+     * up in the next batch and be taken for that batch's operations */
+    while (n_in_flight != 0)
+    {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0U, 1U, IORING_ENTER_GETEVENTS, nullptr, 0) == -1)
+        {
+            int const err = errno;
+
+            if (err != EINTR && err != EAGAIN && err != EBUSY)
+            {
+                tr_logAddDebug("io_uring_enter failed with operations in flight: %s", tr_strerror(err));
+                drop_thread_ring();
+                break;
+            }
+        }
+
+        reap();
+    }
+
+    /* anything not submitted, or only partly done, is finished the old-fashioned way */
+    for (size_t i = 0; i < n_ios; ++i)
+    {
+        tr_sys_file_io& io = ios[i];
+
+        if (!reaped[i] || io.err == EINTR || io.err == EAGAIN)
+        {
+            io.err = 0;
+            file_io_sequential(&io);
+        }
+        else if (io.err == 0 && io.bytes_done != 0 && io.bytes_done < io.size)
+        {
+            file_io_sequential(&io);
+        }
+    }
+
+    return true;
+}
+
+#endif /* USE_IO_URING */
+
+static auto file_batch_backend = std::atomic<int>{ TR_SYS_FILE_BATCH_SEQUENTIAL };
+
+bool tr_sys_file_batch_set_backend(tr_sys_file_batch_backend_t backend)
+{
+    if (backend == TR_SYS_FILE_BATCH_IO_URING)
+    {
+#ifdef USE_IO_URING
+        if (get_thread_ring() == nullptr)
+        {
+            return false;
+        }
+#else
+        return false;
+#endif
+    }
+
+    file_batch_backend = backend;
+    return true;
+}
+
+tr_sys_file_batch_backend_t tr_sys_file_batch_get_backend(void)
+{
+    return tr_sys_file_batch_backend_t(file_batch_backend.load());
+}
+
+bool tr_sys_file_batch(tr_sys_file_io* ios, size_t n_ios, tr_error** error)
+{
+    TR_ASSERT(ios != nullptr || n_ios == 0);
+
+    for (size_t i = 0; i < n_ios; ++i)
+    {
+        TR_ASSERT(ios[i].handle != TR_BAD_SYS_FILE);
+        TR_ASSERT(ios[i].buffer != nullptr || ios[i].iov != nullptr || ios[i].size == 0);
+        TR_ASSERT(ios[i].offset < UINT64_MAX / 2);
+
+        ios[i].bytes_done = 0;
+        ios[i].err = 0;
+    }
+
+    bool done = false;
+
+#ifdef USE_IO_URING
+
+    /* a single operation gains nothing from the ring */
+    if (n_ios > 1 && tr_sys_file_batch_get_backend() == TR_SYS_FILE_BATCH_IO_URING)
+    {
+        done = file_io_uring(ios, n_ios);
+    }
+
+#endif
+
+    if (!done)
+    {
+        for (size_t i = 0; i < n_ios; ++i)
+        {
+            file_io_sequential(&ios[i]);
+        }
+    }
+
+    auto const* const failed = std::find_if(ios, ios + n_ios, [](auto const& io) { return io.err != 0; });
+
+    if (failed != ios + n_ios)
+    {
+        set_system_error(error, failed->err);
+        return false;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
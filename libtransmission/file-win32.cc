@@ -7,6 +7,7 @@
  */
 
 #include <ctype.h> /* isalpha() */
+#include <utility> /* std::pair */
 
 #include <shlobj.h> /* SHCreateDirectoryEx() */
 #include <winioctl.h> /* FSCTL_SET_SPARSE */
@@ -980,6 +981,22 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+    HANDLE const process = GetCurrentProcess();
+    tr_sys_file_t ret = TR_BAD_SYS_FILE;
+
+    if (!DuplicateHandle(process, handle, process, &ret, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        set_system_error(error, GetLastError());
+        ret = TR_BAD_SYS_FILE;
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -1185,6 +1202,86 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+/* there's no batched positional I/O here, so each operation is done in turn */
+bool tr_sys_file_batch_set_backend(tr_sys_file_batch_backend_t backend)
+{
+    return backend == TR_SYS_FILE_BATCH_SEQUENTIAL;
+}
+
+tr_sys_file_batch_backend_t tr_sys_file_batch_get_backend(void)
+{
+    return TR_SYS_FILE_BATCH_SEQUENTIAL;
+}
+
+/* the segment of the operation that's next to be done, and its length */
+static std::pair<uint8_t*, uint64_t> get_next_segment(tr_sys_file_io const* io)
+{
+    if (io->iov == nullptr)
+    {
+        return { static_cast<uint8_t*>(io->buffer) + io->bytes_done, io->size - io->bytes_done };
+    }
+
+    uint64_t skip = io->bytes_done;
+
+    for (size_t i = 0; i < io->iov_count; ++i)
+    {
+        if (skip < io->iov[i].len)
+        {
+            return { static_cast<uint8_t*>(io->iov[i].base) + skip, io->iov[i].len - skip };
+        }
+
+        skip -= io->iov[i].len;
+    }
+
+    return { nullptr, 0 };
+}
+
+bool tr_sys_file_batch(tr_sys_file_io* ios, size_t n_ios, tr_error** error)
+{
+    TR_ASSERT(ios != nullptr || n_ios == 0);
+
+    bool ret = true;
+
+    for (size_t i = 0; i < n_ios; ++i)
+    {
+        tr_sys_file_io* const io = &ios[i];
+        io->bytes_done = 0;
+        io->err = 0;
+
+        while (io->bytes_done < io->size)
+        {
+            auto const [buf, len] = get_next_segment(io);
+            uint64_t const offset = io->offset + io->bytes_done;
+            uint64_t n = 0;
+            tr_error* my_error = nullptr;
+
+            if (!(io->is_write ? tr_sys_file_write_at(io->handle, buf, len, offset, &n, &my_error) :
+                                 tr_sys_file_read_at(io->handle, buf, len, offset, &n, &my_error)))
+            {
+                io->err = my_error->code;
+
+                if (ret)
+                {
+                    tr_error_propagate(error, &my_error);
+                    ret = false;
+                }
+
+                tr_error_clear(&my_error);
+                break;
+            }
+
+            if (n == 0)
+            {
+                break; /* end of file */
+            }
+
+            io->bytes_done += n;
+        }
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -120,6 +120,40 @@ struct tr_sys_path_info
     time_t last_modified_at = 0;
 };
 
+enum tr_sys_file_batch_backend_t
+{
+    /* one pread()/pwrite() (or preadv()/pwritev()) per operation */
+    TR_SYS_FILE_BATCH_SEQUENTIAL,
+    /* all of the operations in one io_uring submission (Linux only) */
+    TR_SYS_FILE_BATCH_IO_URING
+};
+
+/** @brief One segment of a scattered read or gathered write. */
+struct tr_sys_file_iovec
+{
+    void* base;
+    size_t len;
+};
+
+/** @brief One positional read or write in a @ref tr_sys_file_batch call. */
+struct tr_sys_file_io
+{
+    tr_sys_file_t handle;
+    void* buffer;
+    uint64_t size;
+    uint64_t offset;
+    bool is_write;
+
+    /* set by tr_sys_file_batch() */
+    uint64_t bytes_done;
+    int err; /* platform error code, or 0 on success */
+
+    /* if set, the bytes are scattered over (or gathered from) these segments
+     * instead of `buffer`. `size` must still be their total length. */
+    tr_sys_file_iovec const* iov = nullptr;
+    size_t iov_count = 0;
+};
+
 /**
  * @name Platform-specific wrapper functions
  *
@@ -334,6 +368,21 @@ tr_sys_file_t tr_sys_file_open_temp(char* path_template, struct tr_error** error
  */
 bool tr_sys_file_close(tr_sys_file_t handle, struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `dup()`.
+ *
+ * The new descriptor refers to the same open file, but has to be closed
+ * separately with @ref tr_sys_file_close.
+ *
+ * @param[in]  handle Valid file descriptor.
+ * @param[out] error  Pointer to error object. Optional, pass `nullptr` if you
+ *                    are not interested in error details.
+ *
+ * @return New file descriptor on success, `TR_BAD_SYS_FILE` otherwise (with
+ *         `error` set accordingly).
+ */
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fstat()`.
  *
@@ -447,6 +496,32 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error);
 
+/**
+ * @brief Perform several positional reads and writes at once, in no
+ *        particular order. Safe to call from several threads at once as
+ *        long as the operations don't overlap.
+ *
+ * @param[in,out] ios    Operations to perform. Each one's `bytes_done` and
+ *                       `err` fields are set on return.
+ * @param[in]     n_ios  Number of operations.
+ * @param[out]    error  Pointer to error object. Optional, pass `nullptr` if
+ *                       you are not interested in error details.
+ *
+ * @return `True` if every operation succeeded, `false` otherwise (with `error`
+ *         set from the first one that failed).
+ */
+bool tr_sys_file_batch(struct tr_sys_file_io* ios, size_t n_ios, struct tr_error** error);
+
+/**
+ * @brief Choose how @ref tr_sys_file_batch submits its operations.
+ *
+ * @return `True` on success, `false` if the backend isn't supported by this
+ *         platform or kernel (in which case the current backend is kept).
+ */
+bool tr_sys_file_batch_set_backend(tr_sys_file_batch_backend_t backend);
+
+tr_sys_file_batch_backend_t tr_sys_file_batch_get_backend(void);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
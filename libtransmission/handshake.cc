@@ -11,7 +11,6 @@
 #include <cstring> /* strcmp(), strlen(), strncmp() */
 
 #include <event2/buffer.h>
-#include <event2/event.h>
 
 #include "transmission.h"
 #include "clients.h"
@@ -21,6 +20,7 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "session.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-dht.h"
@@ -79,6 +79,10 @@ static auto constexpr HANDSHAKE_TIMEOUT_SEC = int{ 30 };
 #define HANDSHAKE_SET_DHT(bits) ((void)0)
 #endif
 
+// https://www.bittorrent.org/beps/bep_0052.html
+#define HANDSHAKE_HAS_V2(bits) (((bits)[7] & 0x10) != 0)
+#define HANDSHAKE_SET_V2(bits) ((bits)[7] |= 0x10)
+
 /**
 ***
 **/
@@ -118,7 +122,7 @@ struct tr_handshake
     uint32_t crypto_select;
     uint32_t crypto_provide;
     uint8_t myReq1[SHA_DIGEST_LENGTH];
-    struct event* timeout_timer;
+    tr_timer* timeout_timer;
 
     std::optional<tr_peer_id_t> peer_id;
 
@@ -194,6 +198,11 @@ static bool buildHandshakeMessage(tr_handshake* handshake, uint8_t* buf)
         {
             HANDSHAKE_SET_DHT(walk);
         }
+        /* we can only use the v2 hash messages for hybrid torrents' pieces */
+        if (tor->hasMerkle())
+        {
+            HANDSHAKE_SET_V2(walk);
+        }
         walk += HANDSHAKE_FLAGS_LEN;
 
         walk = std::copy_n(torrent_hash, SHA_DIGEST_LENGTH, walk);
@@ -274,6 +283,7 @@ static handshake_parse_err_t parseHandshake(tr_handshake* handshake, struct evbu
     tr_peerIoEnableDHT(handshake->io, HANDSHAKE_HAS_DHT(reserved));
     tr_peerIoEnableLTEP(handshake->io, HANDSHAKE_HAS_LTEP(reserved));
     tr_peerIoEnableFEXT(handshake->io, HANDSHAKE_HAS_FASTEXT(reserved));
+    tr_peerIoEnableV2(handshake->io, HANDSHAKE_HAS_V2(reserved));
 
     return HANDSHAKE_OK;
 }
@@ -638,6 +648,7 @@ static ReadState readHandshake(tr_handshake* handshake, struct evbuffer* inbuf)
     tr_peerIoEnableDHT(handshake->io, HANDSHAKE_HAS_DHT(reserved));
     tr_peerIoEnableLTEP(handshake->io, HANDSHAKE_HAS_LTEP(reserved));
     tr_peerIoEnableFEXT(handshake->io, HANDSHAKE_HAS_FASTEXT(reserved));
+    tr_peerIoEnableV2(handshake->io, HANDSHAKE_HAS_V2(reserved));
 
     /* torrent hash */
     uint8_t hash[SHA_DIGEST_LENGTH];
@@ -1089,7 +1100,7 @@ static void tr_handshakeFree(tr_handshake* handshake)
         tr_peerIoUnref(handshake->io); /* balanced by the ref in tr_handshakeNew */
     }
 
-    event_free(handshake->timeout_timer);
+    delete handshake->timeout_timer;
     tr_free(handshake);
 }
 
@@ -1165,7 +1176,7 @@ static void gotError(tr_peerIo* io, short what, void* vhandshake)
 ***
 **/
 
-static void handshakeTimeout(evutil_socket_t /*s*/, short /*type*/, void* handshake)
+static void handshakeTimeout(void* handshake)
 {
     tr_handshakeAbort(static_cast<tr_handshake*>(handshake));
 }
@@ -1185,8 +1196,8 @@ tr_handshake* tr_handshakeNew(
     handshake->done_func = done_func;
     handshake->done_func_user_data = done_func_user_data;
     handshake->session = session;
-    handshake->timeout_timer = evtimer_new(session->event_base, handshakeTimeout, handshake);
-    tr_timerAdd(handshake->timeout_timer, HANDSHAKE_TIMEOUT_SEC, 0);
+    handshake->timeout_timer = new tr_timer{ handshakeTimeout, handshake };
+    tr_sessionAddTimer(session, handshake->timeout_timer, HANDSHAKE_TIMEOUT_SEC * 1000);
 
     tr_peerIoRef(io); /* balanced by the unref in tr_handshakeFree */
     tr_peerIoSetIOFuncs(handshake->io, canRead, nullptr, gotError, handshake);
@@ -10,21 +10,29 @@
 #include <cerrno>
 #include <cstdlib> /* bsearch() */
 #include <cstring> /* memcmp() */
+#include <deque>
+#include <limits>
 #include <optional>
+#include <tuple>
 #include <vector>
 
+#include <event2/buffer.h>
+
 #include "transmission.h"
 #include "cache.h" /* tr_cacheReadBlock() */
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
+#include "session.h"
 #include "stats.h" /* tr_statsFileCreated() */
 #include "torrent.h"
 #include "tr-assert.h"
+#include "trevent.h"
 #include "utils.h"
 
 /****
@@ -39,15 +47,15 @@ enum
     TR_IO_WRITE
 };
 
-/* returns 0 on success, or an errno on failure */
-static int readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    int ioMode,
-    tr_file_index_t fileIndex,
-    uint64_t fileOffset,
-    void* buf,
-    size_t buflen)
+static void onFileCreated(void* vsession)
+{
+    tr_statsFileCreated(static_cast<tr_session*>(vsession));
+}
+
+/* checks out the file's fd, opening (and maybe creating) the file if needed.
+ * returns 0 on success, or an errno on failure.
+ * this may be called from a disk I/O worker thread. */
+static int checkoutFile(tr_session* session, tr_torrent* tor, int ioMode, tr_file_index_t fileIndex, tr_sys_file_t* setme_fd)
 {
     int err = 0;
     bool const doWrite = ioMode >= TR_IO_WRITE;
@@ -55,17 +63,6 @@ static int readOrWriteBytes(
     tr_file const* const file = &info->files[fileIndex];
 
     TR_ASSERT(fileIndex < info->fileCount);
-    TR_ASSERT(file->length == 0 || fileOffset < file->length);
-    TR_ASSERT(fileOffset + buflen <= file->length);
-
-    if (file->length == 0)
-    {
-        return 0;
-    }
-
-    /***
-    ****  Find the fd
-    ***/
 
     tr_sys_file_t fd = tr_fdFileGetCached(session, tr_torrentId(tor), fileIndex, doWrite);
 
@@ -104,50 +101,160 @@ static int readOrWriteBytes(
             else if (doWrite)
             {
                 /* make a note that we just created a file */
-                tr_statsFileCreated(tor->session);
+                tr_runInEventThread(session, onFileCreated, session);
             }
         }
 
         tr_free(subpath);
     }
 
-    /***
-    ****  Use the fd
-    ***/
+    *setme_fd = fd;
+    return err;
+}
+
+/* a run of bytes within one piece, and the memory they're read into
+ * or written from: either `buf`, or the `iov` segments */
+struct io_span
+{
+    tr_piece_index_t piece;
+    uint32_t offset;
+    uint32_t len;
+    uint8_t* buf;
+    tr_sys_file_iovec const* iov;
+    size_t iov_count;
+};
+
+/* reads and writes that are waiting to be handed to tr_sys_file_batch() */
+struct io_batch
+{
+    size_t max_files; /* how many different files it may check out at once */
 
-    if (err == 0)
+    std::vector<tr_sys_file_io> ios;
+    std::vector<tr_file_index_t> files; /* the checked-out file for each of `ios` */
+    size_t n_files = 0; /* how many different files are checked out */
+
+    /* the parts of spans' segments that fall within one file */
+    std::deque<std::vector<tr_sys_file_iovec>> iov_slices;
+};
+
+/* the fds of a batch are all checked out until it's submitted,
+ * so keep it well below the fd cache's size */
+static auto constexpr MaxBatchFiles = size_t{ 8 };
+
+/* each disk I/O worker and the libevent thread can have a batch going at
+ * once, and all of their checked-out files have to fit in the fd cache */
+static size_t getBatchFileLimit(tr_session* session)
+{
+    auto const n_batches = size_t(tr_sessionGetDiskIoThreads(session)) + 1;
+    auto const limit = size_t(tr_fdGetFileLimit(session)) / n_batches;
+    return std::clamp(limit, size_t{ 1 }, MaxBatchFiles);
+}
+
+/* performs the batch's operations, then hands back its files.
+ * returns 0 on success, or an errno on failure. */
+static int submitBatch(tr_torrent* tor, io_batch* batch, tr_file_index_t* setme_failed_file)
+{
+    int err = 0;
+
+    if (!std::empty(batch->ios))
     {
         tr_error* error = nullptr;
 
-        if (ioMode == TR_IO_READ)
-        {
-            if (!tr_sys_file_read_at(fd, buf, buflen, fileOffset, nullptr, &error))
-            {
-                err = error->code;
-                tr_logAddTorErr(tor, "read failed for \"%s\": %s", file->name, error->message);
-                tr_error_free(error);
-            }
-        }
-        else if (ioMode == TR_IO_WRITE)
+        if (!tr_sys_file_batch(std::data(batch->ios), std::size(batch->ios), &error))
         {
-            if (!tr_sys_file_write_at(fd, buf, buflen, fileOffset, nullptr, &error))
+            auto const it = std::find_if(
+                std::begin(batch->ios),
+                std::end(batch->ios),
+                [](auto const& io) { return io.err != 0; });
+            tr_file_index_t const fileIndex = batch->files[it - std::begin(batch->ios)];
+
+            err = error->code;
+            tr_logAddTorErr(
+                tor,
+                "%s failed for \"%s\": %s",
+                it->is_write ? "write" : "read",
+                tor->info.files[fileIndex].name,
+                error->message);
+            tr_error_free(error);
+
+            if (setme_failed_file != nullptr)
             {
-                err = error->code;
-                tr_logAddTorErr(tor, "write failed for \"%s\": %s", file->name, error->message);
-                tr_error_free(error);
+                *setme_failed_file = fileIndex;
             }
         }
-        else if (ioMode == TR_IO_PREFETCH)
+    }
+
+    for (auto const fileIndex : batch->files)
+    {
+        tr_fdFileReturn(tor->session, tr_torrentId(tor), fileIndex);
+    }
+
+    batch->ios.clear();
+    batch->files.clear();
+    batch->n_files = 0;
+    return err;
+}
+
+/* queues `io`, a read or write within one file, after filling in its fd.
+ * returns 0 on success, or an errno on failure. */
+static int addToBatch(
+    tr_torrent* tor,
+    io_batch* batch,
+    int ioMode,
+    tr_file_index_t fileIndex,
+    tr_sys_file_io io,
+    tr_file_index_t* setme_failed_file)
+{
+    tr_file const* const file = &tor->info.files[fileIndex];
+
+    TR_ASSERT(file->length == 0 || io.offset < file->length);
+    TR_ASSERT(io.offset + io.size <= file->length);
+
+    if (file->length == 0)
+    {
+        return 0;
+    }
+
+    bool const is_new_file = std::find(std::begin(batch->files), std::end(batch->files), fileIndex) ==
+        std::end(batch->files);
+
+    if (is_new_file && batch->n_files >= batch->max_files)
+    {
+        if (int const err = submitBatch(tor, batch, setme_failed_file); err != 0)
         {
-            tr_sys_file_advise(fd, fileOffset, buflen, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+            return err;
         }
-        else
+    }
+
+    int const err = checkoutFile(tor->session, tor, ioMode, fileIndex, &io.handle);
+
+    if (err != 0)
+    {
+        if (setme_failed_file != nullptr)
         {
-            abort();
+            *setme_failed_file = fileIndex;
         }
+
+        return err;
     }
 
-    return err;
+    if (ioMode == TR_IO_PREFETCH)
+    {
+        tr_sys_file_advise(io.handle, io.offset, io.size, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+        tr_fdFileReturn(tor->session, tr_torrentId(tor), fileIndex);
+        return 0;
+    }
+
+    io.is_write = ioMode == TR_IO_WRITE;
+    batch->ios.push_back(io);
+    batch->files.push_back(fileIndex);
+
+    if (is_new_file)
+    {
+        ++batch->n_files;
+    }
+
+    return 0;
 }
 
 static int compareOffsetToFile(void const* a, void const* b)
@@ -194,61 +301,367 @@ void tr_ioFindFileLocation(
     }
 }
 
-/* returns 0 on success, or an errno on failure */
+/* the `len` bytes of the segments that start `skip` bytes in */
+static std::vector<tr_sys_file_iovec> sliceIovecs(tr_sys_file_iovec const* iov, size_t iov_count, uint64_t skip, uint64_t len)
+{
+    auto slice = std::vector<tr_sys_file_iovec>{};
+
+    for (size_t i = 0; i < iov_count && len != 0; ++i)
+    {
+        if (skip >= iov[i].len)
+        {
+            skip -= iov[i].len;
+            continue;
+        }
+
+        size_t const n = std::min(uint64_t{ iov[i].len - skip }, len);
+        slice.push_back(tr_sys_file_iovec{ static_cast<uint8_t*>(iov[i].base) + skip, n });
+        skip = 0;
+        len -= n;
+    }
+
+    return slice;
+}
+
+/* reads or writes each of the spans, submitting as many of them at once as possible.
+ * returns 0 on success, or an errno on failure.
+ * this may be called from a disk I/O worker thread. */
+static int readOrWriteSpans(
+    tr_torrent* tor,
+    int ioMode,
+    io_span const* spans,
+    size_t n_spans,
+    tr_file_index_t* setme_failed_file = nullptr)
+{
+    int err = 0;
+    tr_info const* info = &tor->info;
+    auto batch = io_batch{};
+    batch.max_files = getBatchFileLimit(tor->session);
+
+    for (size_t i = 0; err == 0 && i < n_spans; ++i)
+    {
+        io_span const& span = spans[i];
+
+        if (span.piece >= tor->info.pieceCount)
+        {
+            err = EINVAL;
+            break;
+        }
+
+        auto fileIndex = tr_file_index_t{};
+        auto fileOffset = uint64_t{};
+        tr_ioFindFileLocation(tor, span.piece, span.offset, &fileIndex, &fileOffset);
+
+        for (uint32_t pos = 0; pos < span.len && err == 0;)
+        {
+            tr_file const* file = &info->files[fileIndex];
+            uint64_t const bytesThisPass = std::min(uint64_t{ span.len - pos }, uint64_t{ file->length - fileOffset });
+
+            auto io = tr_sys_file_io{};
+            io.size = bytesThisPass;
+            io.offset = fileOffset;
+
+            if (span.iov == nullptr)
+            {
+                io.buffer = span.buf != nullptr ? span.buf + pos : nullptr;
+            }
+            else if (bytesThisPass == span.len)
+            {
+                io.iov = span.iov;
+                io.iov_count = span.iov_count;
+            }
+            else /* the span crosses into another file */
+            {
+                auto const& slice = batch.iov_slices.emplace_back(sliceIovecs(span.iov, span.iov_count, pos, bytesThisPass));
+                io.iov = std::data(slice);
+                io.iov_count = std::size(slice);
+            }
+
+            err = addToBatch(tor, &batch, ioMode, fileIndex, io, setme_failed_file);
+
+            pos += bytesThisPass;
+            fileIndex++;
+            fileOffset = 0;
+        }
+    }
+
+    /* even if a file couldn't be opened, finish what was already queued */
+    int const batch_err = submitBatch(tor, &batch, err == 0 ? setme_failed_file : nullptr);
+    return err != 0 ? err : batch_err;
+}
+
 static int readOrWritePiece(
     tr_torrent* tor,
     int ioMode,
     tr_piece_index_t pieceIndex,
     uint32_t pieceOffset,
     uint8_t* buf,
-    size_t buflen)
+    size_t buflen,
+    tr_file_index_t* setme_failed_file = nullptr)
 {
-    int err = 0;
-    tr_info const* info = &tor->info;
+    auto const span = io_span{ pieceIndex, pieceOffset, uint32_t(buflen), buf, nullptr, 0 };
+    return readOrWriteSpans(tor, ioMode, &span, 1, setme_failed_file);
+}
 
-    if (pieceIndex >= tor->info.pieceCount)
+static void setLocalWriteError(tr_torrent* tor, tr_file_index_t fileIndex, int err)
+{
+    if (tor->error != TR_STAT_LOCAL_ERROR)
     {
-        return EINVAL;
+        auto const path = tr_strvPath(tor->downloadDir, tor->info.files[fileIndex].name);
+        tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(err), path.c_str());
     }
+}
 
-    auto fileIndex = tr_file_index_t{};
-    auto fileOffset = uint64_t{};
-    tr_ioFindFileLocation(tor, pieceIndex, pieceOffset, &fileIndex, &fileOffset);
+/* jobs already queued for these bytes must land before they're touched in the libevent thread */
+static void waitForQueuedIo(tr_torrent const* tor, tr_piece_index_t piece, uint32_t begin, uint32_t len)
+{
+    tr_session* const session = tor->session;
+
+    if (session->diskIo != nullptr && tr_amInEventThread(session))
+    {
+        uint64_t const offset = tr_pieceOffset(tor, piece, begin, 0);
+        tr_diskIoWaitRange(session->diskIo, tr_torrentId(tor), offset, offset + len);
+    }
+}
 
-    while (buflen != 0 && err == 0)
+int tr_ioRead(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t* buf)
+{
+    waitForQueuedIo(tor, pieceIndex, begin, len);
+    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, buf, len);
+}
+
+int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len)
+{
+    return readOrWritePiece(tor, TR_IO_PREFETCH, pieceIndex, begin, nullptr, len);
+}
+
+tr_sys_file_t tr_ioOpenBlock(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint64_t* fileOffset)
+{
+    if (pieceIndex >= tor->info.pieceCount || len == 0)
     {
-        tr_file const* file = &info->files[fileIndex];
-        uint64_t const bytesThisPass = std::min(uint64_t{ buflen }, uint64_t{ file->length - fileOffset });
+        return TR_BAD_SYS_FILE;
+    }
 
-        err = readOrWriteBytes(tor->session, tor, ioMode, fileIndex, fileOffset, buf, bytesThisPass);
-        buf += bytesThisPass;
-        buflen -= bytesThisPass;
-        fileIndex++;
-        fileOffset = 0;
+    auto fileIndex = tr_file_index_t{};
+    tr_ioFindFileLocation(tor, pieceIndex, begin, &fileIndex, fileOffset);
+
+    /* blocks that cross into the next file are read the usual way */
+    if (*fileOffset + len > tor->info.files[fileIndex].length)
+    {
+        return TR_BAD_SYS_FILE;
+    }
 
-        if (err != 0 && ioMode == TR_IO_WRITE && tor->error != TR_STAT_LOCAL_ERROR)
+    /* if queued jobs are still writing these bytes, don't wait for them:
+     * the caller can read the block the usual way, through the cache */
+    tr_session* const session = tor->session;
+    if (session->diskIo != nullptr)
+    {
+        uint64_t const offset = tr_pieceOffset(tor, pieceIndex, begin, 0);
+        if (!tr_diskIoIsRangeIdle(session->diskIo, tr_torrentId(tor), offset, offset + len))
         {
-            auto const path = tr_strvPath(tor->downloadDir, file->name);
-            tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(err), path.c_str());
+            return TR_BAD_SYS_FILE;
         }
     }
 
+    auto fd = tr_sys_file_t{};
+    if (checkoutFile(session, tor, TR_IO_READ, fileIndex, &fd) != 0)
+    {
+        return TR_BAD_SYS_FILE;
+    }
+
+    tr_sys_file_t const ret = tr_fdFileDup(session, fd);
+    tr_fdFileReturn(session, tr_torrentId(tor), fileIndex);
+    return ret;
+}
+
+int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t const* buf)
+{
+    waitForQueuedIo(tor, pieceIndex, begin, len);
+
+    auto failed_file = tr_file_index_t{};
+    int const err = readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len, &failed_file);
+
+    if (err != 0)
+    {
+        setLocalWriteError(tor, failed_file, err);
+    }
+
     return err;
 }
 
-int tr_ioRead(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t* buf)
+/****
+*****  Asynchronous IO
+****/
+
+/* [begin, end) are the torrent's bytes that the job touches */
+static void runDiskIoJob(
+    tr_torrent* tor,
+    uint64_t begin,
+    uint64_t end,
+    tr_disk_io_work_func work,
+    tr_disk_io_done_func done,
+    void* user_data)
 {
-    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, buf, len);
+    tr_disk_io* const dio = tor->session->diskIo;
+
+    if (dio != nullptr)
+    {
+        tr_diskIoRun(dio, tr_torrentId(tor), begin, end, work, done, user_data);
+    }
+    else
+    {
+        (*done)((*work)(user_data), user_data);
+    }
 }
 
-int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len)
+struct io_job
 {
-    return readOrWritePiece(tor, TR_IO_PREFETCH, pieceIndex, begin, nullptr, len);
+    tr_session* session;
+    tr_torrent* tor; /* only valid in the worker; the torrent waits for its jobs before being freed */
+    int tor_id;
+    tr_piece_index_t piece;
+    uint32_t offset;
+    uint32_t len;
+    uint8_t* buf;
+    tr_io_done_func done;
+    void* user_data;
+};
+
+static io_job* ioJobNew(tr_torrent* tor, tr_piece_index_t piece, uint32_t offset, uint32_t len, uint8_t* buf)
+{
+    auto* const job = new io_job{};
+    job->session = tor->session;
+    job->tor = tor;
+    job->tor_id = tr_torrentId(tor);
+    job->piece = piece;
+    job->offset = offset;
+    job->len = len;
+    job->buf = buf;
+    return job;
 }
 
-int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t const* buf)
+struct write_job
+{
+    tr_session* session;
+    tr_torrent* tor; /* only valid in the worker */
+    int tor_id;
+    std::vector<tr_io_block_run> runs;
+
+    /* the blocks' evbuffer segments, which are written in place */
+    std::vector<tr_sys_file_iovec> iov;
+    std::vector<io_span> spans;
+
+    tr_file_index_t failed_file;
+};
+
+static int writeJobWork(void* vjob)
 {
-    return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
+    auto* const job = static_cast<write_job*>(vjob);
+    return readOrWriteSpans(job->tor, TR_IO_WRITE, std::data(job->spans), std::size(job->spans), &job->failed_file);
+}
+
+static void writeJobDone(int err, void* vjob)
+{
+    auto* const job = static_cast<write_job*>(vjob);
+
+    if (err != 0)
+    {
+        tr_torrent* const tor = tr_torrentFindFromId(job->session, job->tor_id);
+
+        if (tor != nullptr)
+        {
+            setLocalWriteError(tor, job->failed_file, err);
+        }
+    }
+
+    for (auto const& run : job->runs)
+    {
+        for (auto* const block : run.blocks)
+        {
+            evbuffer_free(block);
+        }
+    }
+
+    delete job;
+}
+
+void tr_ioWriteAsync(tr_torrent* tor, std::vector<tr_io_block_run> runs)
+{
+    auto* const job = new write_job{};
+    job->session = tor->session;
+    job->tor = tor;
+    job->tor_id = tr_torrentId(tor);
+    job->runs = std::move(runs);
+
+    /* gather every block's segments. the spans point into `iov`,
+     * so they're made once it's done growing */
+    auto segments = std::vector<evbuffer_iovec>{};
+    auto run_iov = std::vector<std::tuple<size_t /*first*/, size_t /*count*/, uint32_t /*len*/>>{};
+
+    for (auto const& run : job->runs)
+    {
+        size_t const first = std::size(job->iov);
+        uint32_t len = 0;
+
+        for (auto* const block : run.blocks)
+        {
+            segments.resize(evbuffer_peek(block, -1, nullptr, nullptr, 0));
+            evbuffer_peek(block, -1, nullptr, std::data(segments), std::size(segments));
+
+            for (auto const& segment : segments)
+            {
+                job->iov.push_back(tr_sys_file_iovec{ segment.iov_base, segment.iov_len });
+            }
+
+            len += evbuffer_get_length(block);
+        }
+
+        run_iov.emplace_back(first, std::size(job->iov) - first, len);
+    }
+
+    auto begin = std::numeric_limits<uint64_t>::max();
+    auto end = uint64_t{};
+
+    for (size_t i = 0; i < std::size(job->runs); ++i)
+    {
+        auto const [first, count, len] = run_iov[i];
+        job->spans.push_back(io_span{ job->runs[i].piece, job->runs[i].offset, len, nullptr, std::data(job->iov) + first, count });
+
+        uint64_t const offset = tr_pieceOffset(tor, job->runs[i].piece, job->runs[i].offset, 0);
+        begin = std::min(begin, offset);
+        end = std::max(end, offset + len);
+    }
+
+    runDiskIoJob(tor, begin, end, writeJobWork, writeJobDone, job);
+}
+
+static int ioReadJobWork(void* vjob)
+{
+    auto* const job = static_cast<io_job*>(vjob);
+    return readOrWritePiece(job->tor, TR_IO_READ, job->piece, job->offset, job->buf, job->len);
+}
+
+static void ioJobDone(int err, void* vjob)
+{
+    auto* const job = static_cast<io_job*>(vjob);
+    (*job->done)(err, job->user_data);
+    delete job;
+}
+
+void tr_ioReadAsync(
+    tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func done,
+    void* user_data)
+{
+    auto* const job = ioJobNew(tor, pieceIndex, begin, len, setme);
+    job->done = done;
+    job->user_data = user_data;
+    uint64_t const offset = tr_pieceOffset(tor, pieceIndex, begin, 0);
+    runDiskIoJob(tor, offset, offset + len, ioReadJobWork, ioJobDone, job);
 }
 
 /****
@@ -289,3 +702,147 @@ bool tr_ioTestPiece(tr_torrent* tor, tr_piece_index_t piece)
     auto const hash = recalculateHash(tor, piece);
     return hash && *hash == tor->pieceHash(piece);
 }
+
+struct test_piece_job
+{
+    tr_session* session;
+    tr_torrent* tor; /* only valid in the worker */
+    int tor_id;
+    tr_piece_index_t piece;
+
+    /* the piece's SHA1, already hashed through its first `offset` bytes
+     * as they arrived, or nullptr to hash the whole piece */
+    tr_sha1_ctx_t sha;
+    uint32_t offset;
+
+    /* the rest of the piece's contents, with the blocks that
+     * were still in the write cache already filled in */
+    std::vector<uint8_t> buf;
+    std::vector<bool> have_block;
+
+    bool pass;
+    tr_io_test_piece_func done;
+};
+
+static int testPieceJobWork(void* vjob)
+{
+    auto* const job = static_cast<test_piece_job*>(vjob);
+    tr_torrent* const tor = job->tor;
+    uint32_t const block_size = tor->blockSize;
+
+    /* read whatever wasn't in the cache, coalescing neighbouring blocks */
+    auto spans = std::vector<io_span>{};
+
+    for (size_t i = 0, n = std::size(job->have_block); i < n;)
+    {
+        if (job->have_block[i])
+        {
+            ++i;
+            continue;
+        }
+
+        size_t end = i + 1;
+        while (end < n && !job->have_block[end])
+        {
+            ++end;
+        }
+
+        uint32_t const offset = i * block_size;
+        uint32_t const len = std::min(size_t{ (end - i) * block_size }, std::size(job->buf) - offset);
+        spans.push_back(io_span{ job->piece, job->offset + offset, len, std::data(job->buf) + offset, nullptr, 0 });
+
+        i = end;
+    }
+
+    int const err = readOrWriteSpans(tor, TR_IO_READ, std::data(spans), std::size(spans));
+    auto hash = std::optional<tr_sha1_digest_t>{};
+
+    if (job->sha != nullptr)
+    {
+        if (err == 0)
+        {
+            tr_sha1_update(job->sha, std::data(job->buf), std::size(job->buf));
+            hash = tr_sha1_final(job->sha);
+        }
+        else
+        {
+            tr_sha1_final(job->sha, nullptr);
+        }
+
+        job->sha = nullptr;
+    }
+    else if (err == 0)
+    {
+        auto const sha = tr_sha1_init();
+        tr_sha1_update(sha, std::data(job->buf), std::size(job->buf));
+        hash = tr_sha1_final(sha);
+    }
+
+    job->pass = hash && *hash == tor->pieceHash(job->piece);
+    return err;
+}
+
+static void testPieceJobDone(int /*err*/, void* vjob)
+{
+    auto* const job = static_cast<test_piece_job*>(vjob);
+    tr_torrent* const tor = tr_torrentFindFromId(job->session, job->tor_id);
+
+    if (tor != nullptr)
+    {
+        (*job->done)(tor, job->piece, job->pass);
+    }
+
+    delete job;
+}
+
+void tr_ioTestPieceAsync(tr_torrent* tor, tr_piece_index_t piece, tr_io_test_piece_func done)
+{
+    TR_ASSERT(tr_amInEventThread(tor->session));
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    uint32_t const piece_size = tr_torPieceCountBytes(tor, piece);
+
+    /* if the piece's blocks arrived in order, it's been hashed already */
+    uint32_t hashed = 0;
+    auto const sha = tr_cacheTakePieceHash(tor->session->cache, tor, piece, &hashed);
+
+    if (sha != nullptr && hashed == piece_size)
+    {
+        auto const hash = tr_sha1_final(sha);
+        (*done)(tor, piece, hash && *hash == tor->pieceHash(piece));
+        return;
+    }
+
+    TR_ASSERT(hashed % tor->blockSize == 0);
+
+    auto* const job = new test_piece_job{};
+    job->session = tor->session;
+    job->tor = tor;
+    job->tor_id = tr_torrentId(tor);
+    job->piece = piece;
+    job->sha = sha;
+    job->offset = hashed;
+    job->done = done;
+    job->buf.resize(piece_size - hashed);
+
+    /* snapshot the unhashed blocks that are still in the write cache.
+     * the rest are on disk, or will be by the time the job runs. */
+    auto const [piece_first, last] = tr_torGetPieceBlockRange(tor, piece);
+    tr_block_index_t const first = piece_first + hashed / tor->blockSize;
+    job->have_block.resize(last + 1 - first);
+
+    for (tr_block_index_t block = first; block <= last; ++block)
+    {
+        uint32_t const offset = (block - first) * tor->blockSize;
+        uint32_t const len = tr_torBlockCountBytes(tor, block);
+
+        if (tr_cacheHasBlock(tor->session->cache, tor, block) &&
+            tr_cacheReadBlock(tor->session->cache, tor, piece, hashed + offset, len, std::data(job->buf) + offset) == 0)
+        {
+            job->have_block[block - first] = true;
+        }
+    }
+
+    uint64_t const offset = tr_pieceOffset(tor, piece, hashed, 0);
+    runDiskIoJob(tor, offset, offset + std::size(job->buf), testPieceJobWork, testPieceJobDone, job);
+}
@@ -12,6 +12,11 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <vector>
+
+#include "file.h" /* tr_sys_file_t */
+
+struct evbuffer;
 struct tr_torrent;
 
 /**
@@ -27,6 +32,17 @@ int tr_ioRead(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offs
 
 int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len);
 
+/**
+ * Opens a new descriptor for the file that holds the block specified by the
+ * piece index, offset, and length, and sets `fileOffset` to where the block
+ * starts in that file. The descriptor is a dup from tr_fdFileDup(), and the
+ * caller closes it with tr_fdFileDupClose().
+ * @return the descriptor, or TR_BAD_SYS_FILE if the block spans more than
+ *         one file, queued disk I/O is still touching it, too many dups are
+ *         open, or its file can't be opened.
+ */
+tr_sys_file_t tr_ioOpenBlock(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint64_t* fileOffset);
+
 /**
  * Writes the block specified by the piece index, offset, and length.
  * @return 0 on success, or an errno value on failure.
@@ -38,6 +54,50 @@ int tr_ioWrite(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t off
  */
 bool tr_ioTestPiece(tr_torrent* tor, tr_piece_index_t piece);
 
+/***
+****  Asynchronous IO
+****
+****  These are performed by the session's disk I/O workers, one job at a time
+****  per torrent in the order they were queued. Their callbacks are invoked in
+****  the libevent thread and aren't invoked if the torrent has been removed.
+***/
+
+using tr_io_done_func = void (*)(int err, void* user_data);
+
+using tr_io_test_piece_func = void (*)(tr_torrent* tor, tr_piece_index_t piece, bool pass);
+
+/**
+ * Like tr_ioRead(), but `done` is called once `setme` has been filled.
+ * `done` is called even if the torrent has been removed.
+ */
+void tr_ioReadAsync(
+    tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func done,
+    void* user_data);
+
+/** Consecutive blocks to be written, starting at `piece` and `offset`. */
+struct tr_io_block_run
+{
+    tr_piece_index_t piece;
+    uint32_t offset;
+    std::vector<struct evbuffer*> blocks;
+};
+
+/**
+ * Like tr_ioWrite(), but writes all of the runs in one go, straight from
+ * their blocks' evbuffers. Takes ownership of the evbuffers, which must
+ * not be touched until they're freed once the write is done.
+ * A failed write sets the torrent's local error.
+ */
+void tr_ioWriteAsync(tr_torrent* tor, std::vector<tr_io_block_run> runs);
+
+/** Like tr_ioTestPiece(), but the reading and hashing are done in a worker. */
+void tr_ioTestPieceAsync(tr_torrent* tor, tr_piece_index_t piece, tr_io_test_piece_func done);
+
 /**
  * Converts a piece index + offset into a file index + offset.
  */
@@ -7,15 +7,21 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdlib> /* qsort */
 #include <cstring> /* strcmp, strlen */
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
 #include "transmission.h"
 
-#include "crypto-utils.h" /* tr_sha1 */
+#include "crypto-utils.h" /* tr_sha1_many() */
 #include "error.h"
 #include "file.h"
 #include "log.h"
@@ -187,6 +193,7 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFileArg)
     qsort(ret->files, ret->fileCount, sizeof(tr_metainfo_builder_file), builderFileCompare);
 
     tr_metaInfoBuilderSetPieceSize(ret, bestPieceSize(ret->totalSize));
+    tr_metaInfoBuilderSetThreadCount(ret, int(std::thread::hardware_concurrency()));
 
     return ret;
 }
@@ -221,6 +228,11 @@ bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* b, uint32_t bytes)
     return true;
 }
 
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* b, int threadCount)
+{
+    b->threadCount = std::max(threadCount, 1);
+}
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 {
     if (builder != nullptr)
@@ -250,100 +262,279 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
+/* pieces are read a few at a time, so that tr_sha1_many() can hash them together */
+static auto constexpr MaxHashBatch = uint32_t{ 8 };
+static auto constexpr HashBatchBytes = uint32_t{ 1024 * 1024 * 8 };
+
+/* the most memory that pieces waiting to be hashed can take up */
+static auto constexpr MaxHashMemory = uint64_t{ 1024 * 1024 * 256 };
+
+/* hashes the `n` pieces in `buf`. they're full-sized, except maybe the last one */
+static void hashPieces(uint8_t const* buf, uint32_t n, uint32_t piece_size, uint32_t last_piece_size, uint8_t* setme)
+{
+    auto data = std::array<uint8_t const*, MaxHashBatch>{};
+    auto hashes = std::array<tr_sha1_digest_t, MaxHashBatch>{};
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        data[i] = buf + uint64_t{ i } * piece_size;
+    }
+
+    uint32_t const n_full = last_piece_size == piece_size ? n : n - 1;
+    tr_sha1_many(std::data(data), n_full, piece_size, std::data(hashes));
+
+    if (n_full < n)
+    {
+        tr_sha1_many(&data[n_full], 1, last_piece_size, &hashes[n_full]);
+    }
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        memcpy(setme + i * SHA_DIGEST_LENGTH, std::data(hashes[i]), SHA_DIGEST_LENGTH);
+    }
+}
+
+/* some consecutive pieces, read in order and then hashed by one of the hashing threads */
+struct hash_batch
+{
+    std::vector<uint8_t> buf;
+    uint32_t first_piece;
+    uint32_t n_pieces;
+    uint32_t last_piece_size;
+};
+
+/* The builder's thread reads the pieces in order, so that the files are read
+ * sequentially, and hands them off in batches to a pool of hashing threads.
+ * The number of batches bounds how much memory is used. */
+struct hash_pool
+{
+    tr_metainfo_builder* builder = nullptr;
+    uint8_t* hashes = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<hash_batch> batches;
+    std::vector<hash_batch*> empty;
+    std::deque<hash_batch*> full;
+    uint32_t pieces_hashed = 0;
+    bool done_reading = false;
+
+    std::vector<std::thread> threads;
+};
+
+static void hashBatch(hash_pool* pool, hash_batch const* batch)
+{
+    uint8_t* const setme = pool->hashes + size_t{ batch->first_piece } * SHA_DIGEST_LENGTH;
+    hashPieces(std::data(batch->buf), batch->n_pieces, pool->builder->pieceSize, batch->last_piece_size, setme);
+}
+
+/* must be called with pool->mutex held */
+static void finishBatch(hash_pool* pool, hash_batch* batch)
+{
+    pool->pieces_hashed += batch->n_pieces;
+    pool->builder->pieceIndex = pool->pieces_hashed;
+    pool->empty.push_back(batch);
+    pool->cv.notify_all();
+}
+
+static void hashThreadFunc(hash_pool* pool)
+{
+    auto lock = std::unique_lock(pool->mutex);
+
+    for (;;)
+    {
+        pool->cv.wait(lock, [pool]() { return pool->done_reading || !std::empty(pool->full); });
+
+        if (std::empty(pool->full))
+        {
+            break;
+        }
+
+        auto* const batch = pool->full.front();
+        pool->full.pop_front();
+
+        lock.unlock();
+        hashBatch(pool, batch);
+        lock.lock();
+
+        finishBatch(pool, batch);
+    }
+}
+
+static hash_batch* takeEmptyBatch(hash_pool* pool)
+{
+    auto lock = std::unique_lock(pool->mutex);
+    pool->cv.wait(lock, [pool]() { return !std::empty(pool->empty); });
+
+    auto* const batch = pool->empty.back();
+    pool->empty.pop_back();
+    return batch;
+}
+
+/* hands a batch to the hashing threads, or hashes it right away if there aren't any */
+static void submitBatch(hash_pool* pool, hash_batch* batch)
+{
+    if (std::empty(pool->threads))
+    {
+        hashBatch(pool, batch);
+
+        auto const lock = std::lock_guard(pool->mutex);
+        finishBatch(pool, batch);
+        return;
+    }
+
+    auto const lock = std::lock_guard(pool->mutex);
+    pool->full.push_back(batch);
+    pool->cv.notify_all();
+}
+
+/* where the builder's thread is in the files as it reads the pieces */
+struct hash_reader
+{
+    uint32_t fileIndex;
+    uint64_t off;
+    tr_sys_file_t fd;
+};
+
+/* returns false, and sets the builder's result, if a file can't be opened */
+static bool readPiece(tr_metainfo_builder* b, hash_reader* reader, uint8_t* bufptr, uint32_t pieceSize)
+{
+    uint64_t leftInPiece = pieceSize;
+
+    while (leftInPiece != 0)
+    {
+        tr_metainfo_builder_file const* const file = &b->files[reader->fileIndex];
+
+        if (reader->fd == TR_BAD_SYS_FILE)
+        {
+            tr_error* error = nullptr;
+            reader->fd = tr_sys_file_open(file->filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
+
+            if (reader->fd == TR_BAD_SYS_FILE)
+            {
+                b->my_errno = error->code;
+                tr_strlcpy(b->errfile, file->filename, sizeof(b->errfile));
+                b->result = TR_MAKEMETA_IO_READ;
+                tr_error_free(error);
+                return false;
+            }
+        }
+
+        uint64_t const n_this_pass = std::min(file->size - reader->off, leftInPiece);
+        uint64_t n_read = 0;
+        (void)tr_sys_file_read(reader->fd, bufptr, n_this_pass, &n_read, nullptr);
+        bufptr += n_read;
+        reader->off += n_read;
+        leftInPiece -= n_read;
+
+        if (reader->off == file->size)
+        {
+            reader->off = 0;
+            tr_sys_file_close(reader->fd, nullptr);
+            reader->fd = TR_BAD_SYS_FILE;
+            ++reader->fileIndex;
+        }
+    }
+
+    return true;
+}
+
 static uint8_t* getHashInfo(tr_metainfo_builder* b)
 {
-    uint32_t fileIndex = 0;
     uint8_t* ret = tr_new0(uint8_t, SHA_DIGEST_LENGTH * b->pieceCount);
-    uint8_t* walk = ret;
-    uint64_t off = 0;
-    tr_error* error = nullptr;
 
     if (b->totalSize == 0)
     {
         return ret;
     }
 
-    auto* const buf = static_cast<uint8_t*>(tr_malloc(b->pieceSize));
-    b->pieceIndex = 0;
-    uint64_t totalRemain = b->totalSize;
+    uint32_t const batchPieces = std::clamp(HashBatchBytes / b->pieceSize, uint32_t{ 1 }, MaxHashBatch);
+    size_t const batchBytes = size_t{ b->pieceSize } * batchPieces;
+    int const threadCount = std::max(b->threadCount, 1);
 
-    tr_sys_file_t fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-    if (fd == TR_BAD_SYS_FILE)
+    /* with one thread, the pieces are hashed as they're read */
+    size_t batchCount = 1;
+    if (threadCount > 1)
     {
-        b->my_errno = error->code;
-        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-        b->result = TR_MAKEMETA_IO_READ;
-        tr_free(buf);
-        tr_free(ret);
-        tr_error_free(error);
-        return nullptr;
+        size_t const maxBatches = std::max(size_t(MaxHashMemory / batchBytes), size_t{ 2 });
+        batchCount = std::min(size_t(threadCount) * 2, maxBatches);
     }
 
-    while (totalRemain != 0)
+    auto pool = hash_pool{};
+    pool.builder = b;
+    pool.hashes = ret;
+    pool.batches.resize(batchCount);
+
+    for (auto& batch : pool.batches)
     {
-        TR_ASSERT(b->pieceIndex < b->pieceCount);
+        batch.buf.resize(batchBytes);
+        pool.empty.push_back(&batch);
+    }
 
-        uint8_t* bufptr = buf;
-        uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
-        uint64_t leftInPiece = thisPieceSize;
+    for (int i = 0; threadCount > 1 && i < threadCount; ++i)
+    {
+        pool.threads.emplace_back(hashThreadFunc, &pool);
+    }
 
-        while (leftInPiece != 0)
-        {
-            uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
-            uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
-            bufptr += n_read;
-            off += n_read;
-            leftInPiece -= n_read;
-
-            if (off == b->files[fileIndex].size)
-            {
-                off = 0;
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+    b->pieceIndex = 0;
+    auto reader = hash_reader{ 0, 0, TR_BAD_SYS_FILE };
+    uint64_t totalRemain = b->totalSize;
+    uint32_t nextPiece = 0;
+    bool ok = true;
 
-                if (++fileIndex < b->fileCount)
-                {
-                    fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-
-                    if (fd == TR_BAD_SYS_FILE)
-                    {
-                        b->my_errno = error->code;
-                        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_free(buf);
-                        tr_free(ret);
-                        tr_error_free(error);
-                        return nullptr;
-                    }
-                }
-            }
-        }
+    while (ok && totalRemain != 0 && !b->abortFlag)
+    {
+        auto* const batch = takeEmptyBatch(&pool);
+        batch->first_piece = nextPiece;
+        batch->n_pieces = 0;
 
-        TR_ASSERT(bufptr - buf == (int)thisPieceSize);
-        TR_ASSERT(leftInPiece == 0);
-        tr_sha1(walk, buf, (int)thisPieceSize, nullptr);
-        walk += SHA_DIGEST_LENGTH;
+        while (ok && batch->n_pieces < batchPieces && totalRemain != 0)
+        {
+            TR_ASSERT(nextPiece < b->pieceCount);
+
+            uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
+            ok = readPiece(b, &reader, std::data(batch->buf) + size_t{ b->pieceSize } * batch->n_pieces, thisPieceSize);
+            batch->last_piece_size = thisPieceSize;
+            ++batch->n_pieces;
+            ++nextPiece;
+            totalRemain -= thisPieceSize;
+        }
 
-        if (b->abortFlag)
+        if (ok)
         {
-            b->result = TR_MAKEMETA_CANCELLED;
-            break;
+            submitBatch(&pool, batch);
         }
+    }
 
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
+    {
+        auto const lock = std::lock_guard(pool.mutex);
+        pool.done_reading = true;
+        pool.cv.notify_all();
     }
 
-    TR_ASSERT(b->abortFlag || walk - ret == (int)(SHA_DIGEST_LENGTH * b->pieceCount));
-    TR_ASSERT(b->abortFlag || !totalRemain);
+    for (auto& thread : pool.threads)
+    {
+        thread.join();
+    }
 
-    if (fd != TR_BAD_SYS_FILE)
+    if (reader.fd != TR_BAD_SYS_FILE)
     {
-        tr_sys_file_close(fd, nullptr);
+        tr_sys_file_close(reader.fd, nullptr);
     }
 
-    tr_free(buf);
+    if (!ok)
+    {
+        tr_free(ret);
+        return nullptr;
+    }
+
+    if (totalRemain != 0)
+    {
+        b->result = TR_MAKEMETA_CANCELLED;
+    }
+
+    TR_ASSERT(b->abortFlag || b->pieceIndex == b->pieceCount);
+
     return ret;
 }
 
@@ -39,6 +39,7 @@ struct tr_metainfo_builder
     uint32_t fileCount;
     uint32_t pieceSize;
     uint32_t pieceCount;
+    int threadCount;
     bool isFolder;
 
     /**
@@ -61,7 +62,7 @@ struct tr_metainfo_builder
     ***  tell tr_makeMetaInfo() to abort and clean up after itself.
     **/
 
-    uint32_t pieceIndex;
+    uint32_t pieceIndex; /* how many pieces have been hashed so far */
     bool abortFlag;
     bool isDone;
     tr_metainfo_builder_err result;
@@ -91,6 +92,13 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFile);
  */
 bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* builder, uint32_t bytes);
 
+/**
+ * Call this before tr_makeMetaInfo() to change how many threads
+ * hash the pieces. tr_metainfoBuilderCreate() sets it to the
+ * number of CPU cores.
+ */
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* builder, int threadCount);
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder*);
 
 /**
@@ -0,0 +1,75 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <vector>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "merkle.h"
+#include "tr-assert.h"
+
+static tr_sha256_digest_t hashPair(tr_sha256_digest_t const& left, tr_sha256_digest_t const& right)
+{
+    auto* const sha = tr_sha256_init();
+    tr_sha256_update(sha, std::data(left), std::size(left));
+    tr_sha256_update(sha, std::data(right), std::size(right));
+    return tr_sha256_final(sha).value_or(tr_sha256_digest_t{});
+}
+
+tr_sha256_digest_t tr_merkleHashBlock(void const* data, size_t length)
+{
+    TR_ASSERT(length <= TR_MERKLE_BLOCK_SIZE);
+
+    auto* const sha = tr_sha256_init();
+    tr_sha256_update(sha, data, length);
+    return tr_sha256_final(sha).value_or(tr_sha256_digest_t{});
+}
+
+uint32_t tr_merkleLeafCount(uint64_t length)
+{
+    auto const n_blocks = (length + TR_MERKLE_BLOCK_SIZE - 1) / TR_MERKLE_BLOCK_SIZE;
+
+    auto n_leaves = uint32_t{ 1 };
+    while (n_leaves < n_blocks)
+    {
+        n_leaves *= 2;
+    }
+
+    return n_leaves;
+}
+
+tr_sha256_digest_t tr_merkleRoot(tr_sha256_digest_t const* leaves, size_t n, size_t n_leaves)
+{
+    TR_ASSERT(n > 0);
+    TR_ASSERT(n <= n_leaves);
+    TR_ASSERT((n_leaves & (n_leaves - 1)) == 0);
+
+    auto layer = std::vector<tr_sha256_digest_t>(leaves, leaves + n);
+
+    // every node past the end of the data is the root of an all-zeroes
+    // subtree, so only one padding hash is needed for each layer
+    auto pad = tr_sha256_digest_t{};
+
+    for (auto width = n_leaves; width > 1; width /= 2)
+    {
+        if (std::size(layer) % 2 != 0)
+        {
+            layer.push_back(pad);
+        }
+
+        for (size_t i = 0; i < std::size(layer) / 2; ++i)
+        {
+            layer[i] = hashPair(layer[i * 2], layer[i * 2 + 1]);
+        }
+
+        layer.resize(std::size(layer) / 2);
+        pad = hashPair(pad, pad);
+    }
+
+    return layer.front();
+}
@@ -0,0 +1,62 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#include "transmission.h"
+
+/**
+ * BitTorrent v2 (BEP 52) hashes each file as a merkle tree of SHA-256 hashes.
+ * The leaves are the hashes of the file's 16 KiB blocks, so a block can be
+ * checked as soon as it arrives instead of waiting for its whole piece.
+ *
+ * @see https://www.bittorrent.org/beps/bep_0052.html
+ */
+
+auto inline constexpr TR_MERKLE_BLOCK_SIZE = uint32_t{ 1024 * 16 };
+
+/** @brief Where one v1 piece of a hybrid torrent sits in its file's merkle tree */
+struct tr_merkle_piece
+{
+    /* the "pieces root" of the file that this piece belongs to */
+    tr_sha256_digest_t file_root = {};
+
+    /* the root of the piece's own subtree: its entry in "piece layers",
+     * or the file's root if the whole file fits in one piece */
+    tr_sha256_digest_t root = {};
+
+    /* where the piece's leaves begin in the file's leaf layer */
+    uint32_t first_leaf = 0;
+
+    /* how many leaves the piece's subtree has. This is always a power of two. */
+    uint32_t n_leaves = 0;
+
+    /* how many bytes at the start of the piece are file data rather than padding */
+    uint32_t data_length = 0;
+};
+
+/** @brief Get the leaf hash of one block, which may be shorter than TR_MERKLE_BLOCK_SIZE at the end of a file */
+tr_sha256_digest_t tr_merkleHashBlock(void const* data, size_t length);
+
+/** @brief Get the number of leaves in a tree covering `length` bytes: the block count, rounded up to a power of two */
+uint32_t tr_merkleLeafCount(uint64_t length);
+
+/**
+ * @brief Get the root of a merkle tree.
+ *
+ * @param leaves the tree's first `n` leaves.
+ * @param n_leaves the tree's width, a power of two. Leaves past `n` are all zeroes.
+ */
+tr_sha256_digest_t tr_merkleRoot(tr_sha256_digest_t const* leaves, size_t n, size_t n_leaves);
@@ -20,6 +20,7 @@
 #include "error-types.h"
 #include "file.h"
 #include "log.h"
+#include "merkle.h"
 #include "metainfo.h"
 #include "platform.h" /* tr_getTorrentDir() */
 #include "session.h"
@@ -284,6 +285,166 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
     return errstr;
 }
 
+/* BEP 52: find a file's entry in the v2 "file tree" */
+static tr_variant* findFileTreeEntry(tr_variant* tree, std::vector<std::string_view> const& path)
+{
+    for (auto const& component : path)
+    {
+        auto const key = tr_quark_lookup(component);
+        if (!key || !tr_variantDictFindDict(tree, *key, &tree))
+        {
+            return nullptr;
+        }
+    }
+
+    return tr_variantDictFindDict(tree, TR_KEY_NONE, &tree) ? tree : nullptr;
+}
+
+/**
+ * Hybrid torrents carry both v1 and v2 (BEP 52) hashes. Map each v1 piece to
+ * the v2 merkle hashes that cover it so that its blocks can be checked one
+ * at a time. That only works if every file starts on a piece boundary, which
+ * hybrid torrents ensure with padding files.
+ *
+ * Returns false if the v2 data is missing or doesn't line up with the v1 pieces.
+ */
+static bool parseMerkle(tr_info const* inf, tr_variant* info_dict, tr_variant* meta, std::vector<tr_merkle_piece>* setme)
+{
+    auto i = int64_t{};
+    tr_variant* file_tree = nullptr;
+    tr_variant* piece_layers = nullptr;
+    if (!tr_variantDictFindInt(info_dict, TR_KEY_meta_version, &i) || i != 2 ||
+        !tr_variantDictFindDict(info_dict, TR_KEY_file_tree, &file_tree) ||
+        !tr_variantDictFindDict(meta, TR_KEY_piece_layers, &piece_layers))
+    {
+        return false;
+    }
+
+    uint64_t const piece_size = inf->pieceSize;
+    if (piece_size < TR_MERKLE_BLOCK_SIZE || (piece_size & (piece_size - 1)) != 0)
+    {
+        return false;
+    }
+
+    // walk the raw v1 file list, since tr_info doesn't say which files are padding
+    struct v1_file
+    {
+        std::vector<std::string_view> path;
+        uint64_t length = 0;
+        bool is_padding = false;
+    };
+
+    auto v1_files = std::vector<v1_file>{};
+    auto sv = std::string_view{};
+    tr_variant* files = nullptr;
+
+    if (tr_variantDictFindList(info_dict, TR_KEY_files, &files))
+    {
+        for (size_t fi = 0, n = tr_variantListSize(files); fi < n; ++fi)
+        {
+            auto* const file = tr_variantListChild(files, fi);
+            auto& v1 = v1_files.emplace_back();
+            tr_variant* path = nullptr;
+
+            if (!tr_variantDictFindInt(file, TR_KEY_length, &i) || i < 0 || !tr_variantDictFindList(file, TR_KEY_path, &path))
+            {
+                return false;
+            }
+
+            v1.length = i;
+            v1.is_padding = tr_variantDictFindStrView(file, TR_KEY_attr, &sv) && sv.find('p') != std::string_view::npos;
+
+            for (size_t pi = 0, n_components = tr_variantListSize(path); pi < n_components; ++pi)
+            {
+                if (!tr_variantGetStrView(tr_variantListChild(path, pi), &sv))
+                {
+                    return false;
+                }
+
+                v1.path.push_back(sv);
+            }
+        }
+    }
+    else if (tr_variantDictFindStrView(info_dict, TR_KEY_name, &sv) && tr_variantDictFindInt(info_dict, TR_KEY_length, &i))
+    {
+        auto& v1 = v1_files.emplace_back();
+        v1.path.push_back(sv);
+        v1.length = i;
+    }
+
+    auto merkle_pieces = std::vector<tr_merkle_piece>(inf->pieceCount);
+    auto const leaves_per_piece = uint32_t(piece_size / TR_MERKLE_BLOCK_SIZE);
+    auto offset = uint64_t{};
+
+    for (auto const& v1 : v1_files)
+    {
+        auto const file_offset = offset;
+        offset += v1.length;
+
+        if (v1.is_padding || v1.length == 0)
+        {
+            continue;
+        }
+
+        if (file_offset % piece_size != 0)
+        {
+            return false;
+        }
+
+        auto* const entry = findFileTreeEntry(file_tree, v1.path);
+        if (entry == nullptr || !tr_variantDictFindStrView(entry, TR_KEY_pieces_root, &sv) ||
+            std::size(sv) != TR_SHA256_DIGEST_LEN)
+        {
+            return false;
+        }
+
+        auto file_root = tr_sha256_digest_t{};
+        std::copy_n(reinterpret_cast<std::byte const*>(std::data(sv)), std::size(file_root), std::data(file_root));
+
+        auto const first_piece = tr_piece_index_t(file_offset / piece_size);
+        auto const n_pieces = tr_piece_index_t((v1.length + piece_size - 1) / piece_size);
+        if (first_piece + n_pieces > inf->pieceCount)
+        {
+            return false;
+        }
+
+        // a file that fits in one piece has no piece layer; its root covers the piece
+        if (n_pieces == 1)
+        {
+            auto& piece = merkle_pieces[first_piece];
+            piece.file_root = file_root;
+            piece.root = file_root;
+            piece.n_leaves = tr_merkleLeafCount(v1.length);
+            piece.data_length = uint32_t(v1.length);
+            continue;
+        }
+
+        auto const key = tr_quark_lookup(sv);
+        auto layer = std::string_view{};
+        if (!key || !tr_variantDictFindStrView(piece_layers, *key, &layer) ||
+            std::size(layer) != n_pieces * TR_SHA256_DIGEST_LEN)
+        {
+            return false;
+        }
+
+        for (tr_piece_index_t pi = 0; pi < n_pieces; ++pi)
+        {
+            auto& piece = merkle_pieces[first_piece + pi];
+            piece.file_root = file_root;
+            std::copy_n(
+                reinterpret_cast<std::byte const*>(std::data(layer)) + pi * TR_SHA256_DIGEST_LEN,
+                std::size(piece.root),
+                std::data(piece.root));
+            piece.first_leaf = pi * leaves_per_piece;
+            piece.n_leaves = leaves_per_piece;
+            piece.data_length = uint32_t(std::min(piece_size, v1.length - pi * piece_size));
+        }
+    }
+
+    *setme = std::move(merkle_pieces);
+    return true;
+}
+
 static char* tr_convertAnnounceToScrape(std::string_view url)
 {
     char* scrape = nullptr;
@@ -471,6 +632,7 @@ static char const* tr_metainfoParseImpl(
     tr_session const* session,
     tr_info* inf,
     std::vector<tr_sha1_digest_t>* pieces,
+    std::vector<tr_merkle_piece>* merkle_pieces,
     uint64_t* infoDictLength,
     tr_variant const* meta_in)
 {
@@ -654,6 +816,12 @@ static char const* tr_metainfoParseImpl(
         {
             return "files";
         }
+
+        /* hybrid torrents' v2 hashes; without them, pieces are only checked whole */
+        if (!parseMerkle(inf, infoDict, meta, merkle_pieces))
+        {
+            merkle_pieces->clear();
+        }
     }
 
     /* get announce or announce-list */
@@ -677,7 +845,13 @@ std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr
 {
     auto out = tr_metainfo_parsed{};
 
-    char const* bad_tag = tr_metainfoParseImpl(session, &out.info, &out.pieces, &out.info_dict_length, meta_in);
+    char const* bad_tag = tr_metainfoParseImpl(
+        session,
+        &out.info,
+        &out.pieces,
+        &out.merkle_pieces,
+        &out.info_dict_length,
+        meta_in);
     if (bad_tag != nullptr)
     {
         tr_error_set(error, TR_ERROR_EINVAL, _("Error parsing metainfo: %s"), bad_tag);
@@ -19,6 +19,7 @@
 #include <vector>
 
 #include "transmission.h"
+#include "merkle.h"
 
 struct tr_error;
 struct tr_variant;
@@ -35,12 +36,17 @@ struct tr_metainfo_parsed
     uint64_t info_dict_length = 0;
     std::vector<tr_sha1_digest_t> pieces;
 
+    // for hybrid v1 + v2 torrents, each piece's place in the v2 merkle trees.
+    // This is empty if the torrent is v1-only or lacks the v2 piece layers.
+    std::vector<tr_merkle_piece> merkle_pieces;
+
     tr_metainfo_parsed() = default;
 
     tr_metainfo_parsed(tr_metainfo_parsed&& that)
     {
         std::swap(this->info, that.info);
         std::swap(this->pieces, that.pieces);
+        std::swap(this->merkle_pieces, that.merkle_pieces);
         std::swap(this->info_dict_length, that.info_dict_length);
     }
 
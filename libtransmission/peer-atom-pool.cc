@@ -0,0 +1,182 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <functional> /* std::hash */
+#include <string_view>
+#include <utility>
+
+#include "transmission.h"
+#include "peer-atom-pool.h"
+#include "tr-assert.h"
+
+static auto constexpr NotFound = ~size_t{ 0 };
+
+size_t peer_atom_pool::slotIndex(tr_address const& addr) const
+{
+    auto const* const bytes = reinterpret_cast<char const*>(&addr.addr);
+    auto const n_bytes = addr.type == TR_AF_INET ? sizeof(addr.addr.addr4) : sizeof(addr.addr.addr6);
+    return std::hash<std::string_view>{}(std::string_view{ bytes, n_bytes }) & (std::size(slots_) - 1);
+}
+
+size_t peer_atom_pool::findSlot(tr_address const& addr) const
+{
+    if (std::empty(slots_))
+    {
+        return NotFound;
+    }
+
+    size_t const mask = std::size(slots_) - 1;
+
+    for (size_t pos = slotIndex(addr);; pos = (pos + 1) & mask)
+    {
+        if (slots_[pos] == None)
+        {
+            return NotFound;
+        }
+
+        if (tr_address_compare(&at(slots_[pos]).addr, &addr) == 0)
+        {
+            return pos;
+        }
+    }
+}
+
+void peer_atom_pool::rehash(size_t n_slots)
+{
+    TR_ASSERT((n_slots & (n_slots - 1)) == 0);
+
+    auto old = std::move(slots_);
+    slots_.assign(n_slots, None);
+    size_t const mask = n_slots - 1;
+
+    for (auto const idx : old)
+    {
+        if (idx != None)
+        {
+            auto pos = slotIndex(at(idx).addr);
+
+            while (slots_[pos] != None)
+            {
+                pos = (pos + 1) & mask;
+            }
+
+            slots_[pos] = idx;
+        }
+    }
+}
+
+/* remove a slot without leaving a tombstone: move later slots in the same
+ * run back into the gap if they would still be reachable from home */
+void peer_atom_pool::eraseSlot(size_t pos)
+{
+    size_t const mask = std::size(slots_) - 1;
+
+    for (auto next = (pos + 1) & mask; slots_[next] != None; next = (next + 1) & mask)
+    {
+        auto const home = slotIndex(at(slots_[next]).addr);
+        bool const reachable = pos <= next ? (pos < home && home <= next) : (pos < home || home <= next);
+
+        if (!reachable)
+        {
+            slots_[pos] = slots_[next];
+            pos = next;
+        }
+    }
+
+    slots_[pos] = None;
+}
+
+/* new atoms' shelf dates are usually among the newest,
+ * so look for the atom's place starting from the newest end */
+void peer_atom_pool::link(uint32_t idx)
+{
+    auto const shelf_date = at(idx).shelf_date;
+
+    auto prev = newest_;
+    while (prev != None && at(prev).shelf_date > shelf_date)
+    {
+        prev = links_[prev].prev;
+    }
+
+    auto const next = prev != None ? links_[prev].next : oldest_;
+    links_[idx] = links{ prev, next };
+    (prev != None ? links_[prev].next : oldest_) = idx;
+    (next != None ? links_[next].prev : newest_) = idx;
+}
+
+void peer_atom_pool::unlink(uint32_t idx)
+{
+    auto const [prev, next] = links_[idx];
+    (prev != None ? links_[prev].next : oldest_) = next;
+    (next != None ? links_[next].prev : newest_) = prev;
+}
+
+peer_atom* peer_atom_pool::find(tr_address const& addr) const
+{
+    auto const pos = findSlot(addr);
+    return pos != NotFound ? &at(slots_[pos]) : nullptr;
+}
+
+peer_atom* peer_atom_pool::add(tr_address const& addr, time_t shelf_date)
+{
+    TR_ASSERT(find(addr) == nullptr);
+
+    if (free_ == None)
+    {
+        auto const first = uint32_t(std::size(links_));
+        chunks_.push_back(std::make_unique<peer_atom[]>(ChunkSize));
+        links_.resize(std::size(links_) + ChunkSize);
+
+        for (size_t i = 0; i < ChunkSize; ++i)
+        {
+            links_[first + i].next = i + 1 < ChunkSize ? uint32_t(first + i + 1) : None;
+        }
+
+        free_ = first;
+    }
+
+    if ((size_ + 1) * 2 > std::size(slots_))
+    {
+        rehash(std::max(size_t{ 64 }, std::size(slots_) * 2));
+    }
+
+    auto const idx = free_;
+    free_ = links_[idx].next;
+
+    auto& atom = at(idx);
+    atom = {};
+    atom.addr = addr;
+    atom.shelf_date = shelf_date;
+
+    size_t const mask = std::size(slots_) - 1;
+    auto pos = slotIndex(addr);
+    while (slots_[pos] != None)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    slots_[pos] = idx;
+    link(idx);
+    ++size_;
+    return &atom;
+}
+
+void peer_atom_pool::erase(peer_atom* atom)
+{
+    auto const pos = findSlot(atom->addr);
+    TR_ASSERT(pos != NotFound);
+    TR_ASSERT(&at(slots_[pos]) == atom);
+
+    auto const idx = slots_[pos];
+    eraseSlot(pos);
+    unlink(idx);
+    links_[idx] = links{ None, free_ };
+    free_ = idx;
+    --size_;
+}
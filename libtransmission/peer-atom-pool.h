@@ -0,0 +1,204 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <iterator> /* std::forward_iterator_tag */
+#include <memory> /* std::unique_ptr */
+#include <vector>
+
+#include "transmission.h"
+#include "net.h"
+
+class tr_peer;
+
+/**
+ * Peer information that should be kept even before we've connected and
+ * after we've disconnected. These are kept in a pool of peer_atoms to decide
+ * which ones would make good candidates for connecting to, and to watch out
+ * for banned peers.
+ *
+ * @see tr_peer
+ * @see tr_peerMsgs
+ */
+struct peer_atom
+{
+    uint8_t fromFirst; /* where the peer was first found */
+    uint8_t fromBest; /* the "best" value of where the peer has been found */
+    uint8_t flags; /* these match the added_f flags */
+    uint8_t flags2; /* flags that aren't defined in added_f */
+    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
+    bool utp_failed; /* We recently failed to connect over uTP */
+
+    tr_port port;
+    uint16_t numFails;
+    bool is_candidate; /* true if it's in tr_swarm::candidates */
+    tr_address addr;
+
+    time_t time; /* when the peer's connection status last changed */
+    time_t piece_data_time;
+
+    time_t lastConnectionAttemptAt;
+    time_t lastConnectionAt;
+
+    /* similar to a TTL field, but less rigid --
+     * if the swarm is small, the atom will be kept past this date.
+     * This never changes, since peer_atom_pool sorts by it. */
+    time_t shelf_date;
+    tr_peer* peer; /* will be nullptr if not connected */
+
+    uint64_t candidate_key; /* its place in tr_swarm::candidates. See getAtomCandidateKey() */
+};
+
+/**
+ * @brief All the peer_atoms that a swarm knows about.
+ *
+ * The atoms are allocated in fixed-size chunks and recycled through a free
+ * list, so an atom stays at the same address until it's erased. Each atom
+ * has a uint32 index into the chunks. An open-addressing hash table of those
+ * indices finds atoms by address, and a list threaded through the indices
+ * keeps them sorted by shelf date so that the stalest ones can be pruned
+ * without sorting the whole pool.
+ */
+class peer_atom_pool
+{
+private:
+    static auto constexpr None = uint32_t{ 0xFFFFFFFF };
+
+public:
+    /* walks the atoms from the oldest shelf date to the newest */
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = peer_atom*;
+        using difference_type = std::ptrdiff_t;
+        using pointer = peer_atom* const*;
+        using reference = peer_atom*;
+
+        peer_atom* operator*() const
+        {
+            return &pool_->at(idx_);
+        }
+
+        const_iterator& operator++()
+        {
+            idx_ = pool_->links_[idx_].next;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto const old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const_iterator const& that) const
+        {
+            return idx_ == that.idx_;
+        }
+
+        bool operator!=(const_iterator const& that) const
+        {
+            return idx_ != that.idx_;
+        }
+
+    private:
+        friend class peer_atom_pool;
+
+        const_iterator(peer_atom_pool const* pool, uint32_t idx)
+            : pool_{ pool }
+            , idx_{ idx }
+        {
+        }
+
+        peer_atom_pool const* pool_;
+        uint32_t idx_;
+    };
+
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] const_iterator begin() const
+    {
+        return const_iterator{ this, oldest_ };
+    }
+
+    [[nodiscard]] const_iterator end() const
+    {
+        return const_iterator{ this, None };
+    }
+
+    [[nodiscard]] peer_atom* find(tr_address const& addr) const;
+
+    /* add a zeroed atom */
+    peer_atom* add(tr_address const& addr, time_t shelf_date);
+
+    void erase(peer_atom* atom);
+
+    /* erase the atoms that `can_prune` accepts, stalest first, until at most
+     * `max_count` are left. `on_erase` is called just before each one goes */
+    template<typename CanPrune, typename OnErase>
+    void prune(size_t max_count, CanPrune can_prune, OnErase on_erase)
+    {
+        for (auto it = begin(); it != end() && size() > max_count;)
+        {
+            auto* const atom = *it++;
+
+            if (can_prune(atom))
+            {
+                on_erase(atom);
+                erase(atom);
+            }
+        }
+    }
+
+private:
+    static auto constexpr ChunkSize = size_t{ 64 };
+
+    // an atom's neighbours in shelf-date order. Free atoms are chained through `next`
+    struct links
+    {
+        uint32_t prev = None;
+        uint32_t next = None;
+    };
+
+    [[nodiscard]] peer_atom& at(uint32_t idx) const
+    {
+        return chunks_[idx / ChunkSize][idx % ChunkSize];
+    }
+
+    [[nodiscard]] size_t slotIndex(tr_address const& addr) const;
+    [[nodiscard]] size_t findSlot(tr_address const& addr) const;
+    void eraseSlot(size_t pos);
+    void rehash(size_t n_slots);
+
+    void link(uint32_t idx);
+    void unlink(uint32_t idx);
+
+    std::vector<std::unique_ptr<peer_atom[]>> chunks_;
+    std::vector<links> links_; // one for each atom in chunks_
+    uint32_t free_ = None;
+
+    // slots_.size() is a power of two that's at least twice the number of atoms
+    std::vector<uint32_t> slots_;
+
+    uint32_t oldest_ = None;
+    uint32_t newest_ = None;
+    size_t size_ = 0;
+};
@@ -38,6 +38,7 @@ auto inline constexpr MAX_BLOCK_SIZE = 1024 * 16;
 enum PeerEventType
 {
     TR_PEER_CLIENT_GOT_BLOCK,
+    TR_PEER_CLIENT_GOT_BAD_BLOCK,
     TR_PEER_CLIENT_GOT_CHOKE,
     TR_PEER_CLIENT_GOT_PIECE_DATA,
     TR_PEER_CLIENT_GOT_ALLOWED_FAST,
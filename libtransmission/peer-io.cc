@@ -20,6 +20,7 @@
 #include "transmission.h"
 #include "session.h"
 #include "bandwidth.h"
+#include "fdlimit.h" /* tr_fdFileDupClose() */
 #include "log.h"
 #include "net.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
@@ -1116,6 +1117,60 @@ void tr_peerIoWriteBuf(tr_peerIo* io, struct evbuffer* buf, bool isPieceData)
     addDatatype(io, byteCount, isPieceData);
 }
 
+/* evbuffer_set_flags() is new in libevent 2.1.1,
+ * and evbuffer_add_file() can't take a Windows file handle */
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100 && !defined(_WIN32)
+#define HAVE_EVBUFFER_SENDFILE
+#endif
+
+bool tr_peerIoSupportsSendfile([[maybe_unused]] tr_peerIo const* io)
+{
+#ifdef HAVE_EVBUFFER_SENDFILE
+    return io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->encryption_type == PEER_ENCRYPTION_NONE;
+#else
+    return false;
+#endif
+}
+
+#ifdef HAVE_EVBUFFER_SENDFILE
+
+static void onFileSegmentFreed(evbuffer_file_segment const* /*seg*/, int /*flags*/, void* vfd)
+{
+    tr_fdFileDupClose(tr_sys_file_t(reinterpret_cast<intptr_t>(vfd)));
+}
+
+#endif
+
+bool tr_peerIoAddFile(
+    [[maybe_unused]] tr_peerIo* io,
+    [[maybe_unused]] struct evbuffer* buf,
+    tr_sys_file_t fd,
+    [[maybe_unused]] uint64_t offset,
+    [[maybe_unused]] size_t length)
+{
+    TR_ASSERT(tr_peerIoSupportsSendfile(io));
+    TR_ASSERT(fd != TR_BAD_SYS_FILE);
+
+#ifdef HAVE_EVBUFFER_SENDFILE
+    /* libevent only sends a file with sendfile() if the buffers it's in
+     * are never read from, but just written to the socket or drained */
+    evbuffer_set_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
+    evbuffer_set_flags(io->outbuf, EVBUFFER_FLAG_DRAINS_TO_FD);
+
+    if (auto* const seg = evbuffer_file_segment_new(fd, offset, length, 0); seg != nullptr)
+    {
+        /* the dup is closed, and uncounted, once the segment is sent or dropped */
+        evbuffer_file_segment_add_cleanup_cb(seg, onFileSegmentFreed, reinterpret_cast<void*>(intptr_t(fd)));
+        bool const added = evbuffer_add_file_segment(buf, seg, 0, length) == 0;
+        evbuffer_file_segment_free(seg);
+        return added;
+    }
+#endif
+
+    tr_fdFileDupClose(fd);
+    return false;
+}
+
 void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, bool isPieceData)
 {
     struct evbuffer_iovec iovec;
@@ -21,6 +21,7 @@
 #include "transmission.h"
 #include "bandwidth.h"
 #include "crypto.h"
+#include "file.h" /* tr_sys_file_t */
 #include "net.h" /* tr_address */
 #include "peer-socket.h"
 #include "utils.h" // tr_time()
@@ -125,6 +126,7 @@ public:
     bool extendedProtocolSupported = false;
     bool fastExtensionSupported = false;
     bool utpSupported = false;
+    bool v2Supported = false;
 };
 
 /**
@@ -194,6 +196,16 @@ constexpr bool tr_peerIoSupportsDHT(tr_peerIo const* io)
     return io->dhtSupported;
 }
 
+constexpr void tr_peerIoEnableV2(tr_peerIo* io, bool flag)
+{
+    io->v2Supported = flag;
+}
+
+constexpr bool tr_peerIoSupportsV2(tr_peerIo const* io)
+{
+    return io->v2Supported;
+}
+
 constexpr bool tr_peerIoSupportsUTP(tr_peerIo const* io)
 {
     return io->utpSupported;
@@ -250,6 +262,17 @@ void tr_peerIoWriteBytes(tr_peerIo* io, void const* writeme, size_t writemeLen,
 
 void tr_peerIoWriteBuf(tr_peerIo* io, struct evbuffer* buf, bool isPieceData);
 
+/* true if tr_peerIoAddFile() can be used for this peer.
+ * it needs a plaintext TCP connection */
+bool tr_peerIoSupportsSendfile(tr_peerIo const* io);
+
+/* appends `length` bytes of the file `fd`, starting at `offset`, to `buf`,
+ * which is then to be written to `io` with tr_peerIoWriteBuf(). The bytes are
+ * never copied into `buf`; the kernel sends them from the file to the socket.
+ * `fd` is a dup from tr_fdFileDup(), and this takes ownership of it, even on
+ * failure. returns false on failure */
+bool tr_peerIoAddFile(tr_peerIo* io, struct evbuffer* buf, tr_sys_file_t fd, uint64_t offset, size_t length);
+
 /**
 ***
 **/
@@ -11,7 +11,9 @@
 #include <climits> /* INT_MAX */
 #include <cstdlib> /* qsort */
 #include <cstring> /* memcpy, memcmp, strstr */
+#include <functional> /* std::less */
 #include <iterator>
+#include <set>
 #include <vector>
 
 #include <event2/event.h>
@@ -22,6 +24,7 @@
 #include "transmission.h"
 #include "announcer.h"
 #include "bandwidth.h"
+#include "block-requests.h"
 #include "blocklist.h"
 #include "cache.h"
 #include "clients.h"
@@ -30,12 +33,16 @@
 #include "handshake.h"
 #include "log.h"
 #include "net.h"
+#include "peer-atom-pool.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "piece-picker.h"
 #include "ptrarray.h"
+#include "rechoke.h"
 #include "session.h"
 #include "stats.h" /* tr_statsAddUploaded, tr_statsAddDownloaded */
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-utp.h"
@@ -48,6 +55,13 @@ static auto constexpr AtomPeriodMsec = int{ 60 * 1000 };
 // how frequently to change which peers are choked
 static auto constexpr RechokePeriodMsec = int{ 10 * 1000 };
 
+// the swarms that are due for a rechoke are checked on this shorter tick,
+// so that a session with thousands of torrents doesn't rechoke them all at once
+static auto constexpr RechokeTickMsec = int{ 500 };
+
+// the most swarms to rechoke in one tick
+static auto constexpr MaxSwarmsPerRechokeTick = size_t{ 32 };
+
 // an optimistically unchoked peer is immune from rechoking
 // for this many calls to rechokeUploads().
 static auto constexpr OptimisticUnchokeMultiplier = int{ 4 };
@@ -94,39 +108,6 @@ static auto constexpr CancelHistorySec = int{ 60 };
 ***
 **/
 
-/**
- * Peer information that should be kept even before we've connected and
- * after we've disconnected. These are kept in a pool of peer_atoms to decide
- * which ones would make good candidates for connecting to, and to watch out
- * for banned peers.
- *
- * @see tr_peer
- * @see tr_peerMsgs
- */
-struct peer_atom
-{
-    uint8_t fromFirst; /* where the peer was first found */
-    uint8_t fromBest; /* the "best" value of where the peer has been found */
-    uint8_t flags; /* these match the added_f flags */
-    uint8_t flags2; /* flags that aren't defined in added_f */
-    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
-
-    tr_port port;
-    bool utp_failed; /* We recently failed to connect over uTP */
-    uint16_t numFails;
-    time_t time; /* when the peer's connection status last changed */
-    time_t piece_data_time;
-
-    time_t lastConnectionAttemptAt;
-    time_t lastConnectionAt;
-
-    /* similar to a TTL field, but less rigid --
-     * if the swarm is small, the atom will be kept past this date. */
-    time_t shelf_date;
-    tr_peer* peer; /* will be nullptr if not connected */
-    tr_address addr;
-};
-
 #ifndef TR_ENABLE_ASSERTS
 
 #define tr_isAtom(a) (true)
@@ -147,25 +128,12 @@ static char const* tr_atomAddrStr(struct peer_atom const* atom)
     return atom != nullptr ? tr_address_and_port_to_string(addrstr, sizeof(addrstr), &atom->addr, atom->port) : "[no atom]";
 }
 
-struct block_request
+struct CompareAtomsByCandidateKey
 {
-    tr_block_index_t block;
-    tr_peer* peer;
-    time_t sentAt;
-};
-
-struct weighted_piece
-{
-    tr_piece_index_t index;
-    int16_t salt;
-    int16_t requestCount;
-};
-
-enum piece_sort_state
-{
-    PIECES_UNSORTED,
-    PIECES_SORTED_BY_INDEX,
-    PIECES_SORTED_BY_WEIGHT
+    bool operator()(peer_atom const* a, peer_atom const* b) const
+    {
+        return a->candidate_key != b->candidate_key ? a->candidate_key < b->candidate_key : std::less<>{}(a, b);
+    }
 };
 
 /** @brief Opaque, per-torrent data structure for peer connection information */
@@ -182,7 +150,7 @@ public:
     tr_swarm_stats stats = {};
 
     tr_ptrArray outgoingHandshakes = {}; /* tr_handshake */
-    tr_ptrArray pool = {}; /* struct peer_atom */
+    peer_atom_pool pool;
     tr_ptrArray peers = {}; /* tr_peerMsgs */
     tr_ptrArray webseeds = {}; /* tr_webseed */
 
@@ -194,19 +162,30 @@ public:
 
     bool poolIsAllSeeds = false;
     bool poolIsAllSeedsDirty = true; /* true if poolIsAllSeeds needs to be recomputed */
+
+    /* the atoms that we might want to connect to, best first */
+    std::set<peer_atom*, CompareAtomsByCandidateKey> candidates;
+    bool candidatesAreDirty = true; /* true if `candidates` needs to be rebuilt */
+    bool candidatesAreForSeed = false; /* whether we were seeding when `candidates` was built */
     bool isRunning = false;
     bool needsCompletenessCheck = true;
 
-    struct block_request* requests = nullptr;
-    int requestCount = 0;
-    int requestAlloc = 0;
+    tr_block_requests requests;
 
-    struct weighted_piece* pieces = nullptr;
-    int pieceCount = 0;
-    enum piece_sort_state pieceSortState = PIECES_UNSORTED;
+    /* also counts how many peers have each piece. See pickerIsBuilt() */
+    tr_piece_picker picker;
+    std::vector<uint16_t> requestsPerPiece; /* how many of each piece's blocks are in `requests` */
+    int seedCount = 0; /* how many peers have every piece */
 
     int interestedCount = 0;
     int maxPeers = 0;
+
+    /* how fast our peers were trading with us the last time we rechoked uploads.
+     * If isRechokeActive, this is counted in the manager's contribution total. */
+    uint64_t uploadContribution = 0;
+    bool isRechokeActive = false;
+    uint64_t lastRechokeMsec = 0; /* when rechokeUploads() last ran, or 0 if never */
+
     time_t lastCancel = 0;
 
     /* Before the endgame this should be 0. In endgame, is contains the average
@@ -220,10 +199,15 @@ struct tr_peerMgr
 {
     tr_session* session;
     tr_ptrArray incomingHandshakes; /* tr_handshake */
-    struct event* bandwidthTimer;
-    struct event* rechokeTimer;
-    struct event* refillUpkeepTimer;
-    struct event* atomTimer;
+    tr_timer* bandwidthTimer;
+    tr_timer* rechokeTimer;
+    tr_timer* refillUpkeepTimer;
+    tr_timer* atomTimer;
+
+    int rechokeCursor; /* the id of the torrent that was looked at last */
+    size_t rechokeActiveSwarms; /* how many swarms have isRechokeActive set */
+    uint64_t rechokeContributionTotal; /* the sum of those swarms' uploadContribution */
+    tr_rechoke_stats rechokeStats;
 };
 
 #define tordbg(t, ...) tr_logAddDeepNamed(tr_torrentName((t)->tor), __VA_ARGS__)
@@ -250,7 +234,8 @@ tr_peer::tr_peer(tr_torrent const* tor, peer_atom* atom_in)
 {
 }
 
-static void peerDeclinedAllRequests(tr_swarm*, tr_peer const*);
+static void peerDeclinedAllRequests(tr_swarm*, tr_peer*);
+static void candidatesUpdate(tr_swarm*, peer_atom*);
 
 tr_peer::~tr_peer()
 {
@@ -262,6 +247,11 @@ tr_peer::~tr_peer()
     if (atom != nullptr)
     {
         atom->peer = nullptr;
+
+        if (swarm != nullptr)
+        {
+            candidatesUpdate(swarm, atom);
+        }
     }
 }
 
@@ -326,23 +316,6 @@ static inline tr_handshake* getExistingHandshake(tr_ptrArray* handshakes, tr_add
     return static_cast<tr_handshake*>(tr_ptrArrayFindSorted(handshakes, addr, handshakeCompareToAddr));
 }
 
-static int comparePeerAtomToAddress(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct peer_atom const*>(va);
-    auto const* const b = static_cast<tr_address const*>(vb);
-
-    return tr_address_compare(&a->addr, b);
-}
-
-static int compareAtomsByAddress(void const* va, void const* vb)
-{
-    auto const* const b = static_cast<struct peer_atom const*>(vb);
-
-    TR_ASSERT(tr_isAtom(b));
-
-    return comparePeerAtomToAddress(va, &b->addr);
-}
-
 /**
 ***
 **/
@@ -366,10 +339,9 @@ static int peerCompare(void const* va, void const* vb)
     return tr_address_compare(tr_peerAddress(a), tr_peerAddress(b));
 }
 
-static struct peer_atom* getExistingAtom(tr_swarm const* cswarm, tr_address const* addr)
+static struct peer_atom* getExistingAtom(tr_swarm const* swarm, tr_address const* addr)
 {
-    auto* swarm = const_cast<tr_swarm*>(cswarm);
-    return static_cast<struct peer_atom*>(tr_ptrArrayFindSorted(&swarm->pool, addr, comparePeerAtomToAddress));
+    return swarm->pool.find(*addr);
 }
 
 static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
@@ -382,6 +354,26 @@ static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
         getExistingHandshake(&s->manager->incomingHandshakes, &atom->addr) != nullptr;
 }
 
+static void swarmSetUploadContribution(tr_swarm* s, bool is_active, uint64_t contribution)
+{
+    tr_peerMgr* const mgr = s->manager;
+
+    if (s->isRechokeActive)
+    {
+        --mgr->rechokeActiveSwarms;
+        mgr->rechokeContributionTotal -= s->uploadContribution;
+    }
+
+    s->isRechokeActive = is_active;
+    s->uploadContribution = is_active ? contribution : 0;
+
+    if (s->isRechokeActive)
+    {
+        ++mgr->rechokeActiveSwarms;
+        mgr->rechokeContributionTotal += s->uploadContribution;
+    }
+}
+
 static void swarmFree(void* vs)
 {
     auto* s = static_cast<tr_swarm*>(vs);
@@ -393,13 +385,10 @@ static void swarmFree(void* vs)
     TR_ASSERT(tr_ptrArrayEmpty(&s->peers));
 
     tr_ptrArrayDestruct(&s->webseeds, [](void* peer) { delete static_cast<tr_peer*>(peer); });
-    tr_ptrArrayDestruct(&s->pool, (PtrArrayForeachFunc)tr_free);
     tr_ptrArrayDestruct(&s->outgoingHandshakes, nullptr);
     tr_ptrArrayDestruct(&s->peers, nullptr);
     s->stats = {};
-
-    tr_free(s->requests);
-    tr_free(s->pieces);
+    swarmSetUploadContribution(s, false, 0);
 
     delete s;
 }
@@ -443,13 +432,10 @@ tr_peerMgr* tr_peerMgrNew(tr_session* session)
     return m;
 }
 
-static void deleteTimer(struct event** t)
+static void deleteTimer(tr_timer** t)
 {
-    if (*t != nullptr)
-    {
-        event_free(*t);
-        *t = nullptr;
-    }
+    delete *t;
+    *t = nullptr;
 }
 
 static void deleteTimers(struct tr_peerMgr* m)
@@ -489,13 +475,12 @@ void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
        since the blocklist has changed, erase that cached value */
     for (auto* tor : mgr->session->torrents)
     {
-        tr_swarm* s = tor->swarm;
-
-        for (int i = 0, n = tr_ptrArraySize(&s->pool); i < n; ++i)
+        for (auto* const atom : tor->swarm->pool)
         {
-            auto* const atom = static_cast<struct peer_atom*>(tr_ptrArrayNth(&s->pool, i));
             atom->blocklisted = -1;
         }
+
+        tor->swarm->candidatesAreDirty = true;
     }
 }
 
@@ -523,6 +508,7 @@ static void atomSetSeed(tr_swarm* s, struct peer_atom* atom)
     tordbg(s, "marking peer %s as a seed", tr_atomAddrStr(atom));
     atom->flags |= ADDED_F_SEED_FLAG;
     s->poolIsAllSeedsDirty = true;
+    candidatesUpdate(s, atom);
 }
 
 bool tr_peerMgrPeerIsSeed(tr_torrent const* tor, tr_address const* addr)
@@ -564,143 +550,51 @@ void tr_peerMgrSetUtpFailed(tr_torrent* tor, tr_address const* addr, bool failed
 ***
 *** There are two data structures associated with managing block requests:
 ***
-*** 1. tr_swarm::requests, an array of "struct block_request" which keeps
-***    track of which blocks have been requested, and when, and by which peers.
+*** 1. tr_swarm::requests, a tr_block_requests which keeps track of
+***    which blocks have been requested, and when, and by which peers.
 ***    This is list is used for (a) cancelling requests that have been pending
 ***    for too long and (b) avoiding duplicate requests before endgame.
 ***
-*** 2. tr_swarm::pieces, an array of "struct weighted_piece" which lists the
-***    pieces that we want to request. It's used to decide which blocks to
+*** 2. tr_swarm::picker, which keeps the pieces that we want to request in
+***    the order that we want them. It's used to decide which blocks to
 ***    return next when tr_peerMgrGetBlockRequests() is called.
 **/
 
 /**
-*** struct block_request
+*** tr_swarm::requests
 **/
 
-static constexpr int compareReqByBlock(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct block_request const*>(va);
-    auto const* const b = static_cast<struct block_request const*>(vb);
-
-    /* primary key: block */
-    if (a->block < b->block)
-    {
-        return -1;
-    }
-
-    if (a->block > b->block)
-    {
-        return 1;
-    }
-
-    /* secondary key: peer */
-    if (a->peer < b->peer)
-    {
-        return -1;
-    }
-
-    if (a->peer > b->peer)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
 static void requestListAdd(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
 {
-    struct block_request key;
-
-    /* ensure enough room is available... */
-    if (s->requestCount + 1 >= s->requestAlloc)
-    {
-        int const CHUNK_SIZE = 128;
-        s->requestAlloc += CHUNK_SIZE;
-        s->requests = tr_renew(struct block_request, s->requests, s->requestAlloc);
-    }
+    s->requests.add(block, peer, tr_time());
 
-    /* populate the record we're inserting */
-    key.block = block;
-    key.peer = peer;
-    key.sentAt = tr_time();
-
-    /* insert the request to our array... */
-    {
-        auto exact = bool{};
-        int const
-            pos = tr_lowerBound(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock, &exact);
-        TR_ASSERT(!exact);
-        memmove(s->requests + pos + 1, s->requests + pos, sizeof(struct block_request) * (s->requestCount++ - pos));
-        s->requests[pos] = key;
-    }
-
-    if (peer != nullptr)
-    {
-        ++peer->pendingReqsToPeer;
-        TR_ASSERT(peer->pendingReqsToPeer >= 0);
-    }
-}
-
-static struct block_request* requestListLookup(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
-{
-    struct block_request key;
-    key.block = block;
-    key.peer = (tr_peer*)peer;
-
-    return static_cast<struct block_request*>(
-        bsearch(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock));
+    ++peer->pendingReqsToPeer;
+    TR_ASSERT(peer->pendingReqsToPeer >= 0);
 }
 
 /**
  * Find the peers are we currently requesting the block
- * with index @a block from and append them to @a peerArr.
+ * with index @a block from.
  */
-static auto getBlockRequestPeers(tr_swarm* s, tr_block_index_t block)
+static auto getBlockRequestPeers(tr_swarm const* s, tr_block_index_t block)
 {
-    auto peers = std::vector<tr_peer*>{};
-
-    auto const key = block_request{ block, nullptr, 0 };
-    auto exact = bool{};
-    int const pos = tr_lowerBound(&key, s->requests, s->requestCount, sizeof(struct block_request), compareReqByBlock, &exact);
-
-    TR_ASSERT(!exact); /* shouldn't have a request with .peer == nullptr */
-
-    for (int i = pos; i < s->requestCount; ++i)
-    {
-        if (s->requests[i].block != block)
-        {
-            break;
-        }
-
-        peers.push_back(s->requests[i].peer);
-    }
-
-    return peers;
+    return s->requests.peers(block);
 }
 
-static void decrementPendingReqCount(struct block_request const* b)
+/* returns true if the request was found and removed */
+static bool requestListRemove(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
 {
-    if ((b->peer != nullptr) && (b->peer->pendingReqsToPeer > 0))
+    if (!s->requests.remove(block, peer))
     {
-        --b->peer->pendingReqsToPeer;
+        return false;
     }
-}
 
-static void requestListRemove(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
-{
-    struct block_request const* b = requestListLookup(s, block, peer);
-
-    if (b != nullptr)
+    if (peer->pendingReqsToPeer > 0)
     {
-        int const pos = b - s->requests;
-        TR_ASSERT(pos < s->requestCount);
-
-        decrementPendingReqCount(b);
-
-        tr_removeElementFromArray(s->requests, pos, sizeof(struct block_request), s->requestCount);
-        --s->requestCount;
+        --peer->pendingReqsToPeer;
     }
+
+    return true;
 }
 
 static int countActiveWebseeds(tr_swarm* s)
@@ -727,13 +621,11 @@ static bool testForEndgame(tr_swarm const* s)
 {
     /* we consider ourselves to be in endgame if the number of bytes
        we've got requested is >= the number of bytes left to download */
-    return (uint64_t)s->requestCount * s->tor->blockSize >= tr_torrentGetLeftUntilDone(s->tor);
+    return (uint64_t)std::size(s->requests) * s->tor->blockSize >= tr_torrentGetLeftUntilDone(s->tor);
 }
 
 static void updateEndgame(tr_swarm* s)
 {
-    TR_ASSERT(s->requestCount >= 0);
-
     if (!testForEndgame(s))
     {
         /* not in endgame */
@@ -758,7 +650,7 @@ static void updateEndgame(tr_swarm* s)
         numDownloading += countActiveWebseeds(s);
 
         /* average number of pending requests per downloading peer */
-        s->endgame = s->requestCount / std::max(numDownloading, 1);
+        s->endgame = int(std::size(s->requests)) / std::max(numDownloading, 1);
     }
 }
 
@@ -768,271 +660,106 @@ static void updateEndgame(tr_swarm* s)
 *****
 ****/
 
-static constexpr void invalidatePieceSorting(tr_swarm* s)
+static tr_piece_picker::Progress getPieceProgress(tr_swarm const* s, tr_piece_index_t piece)
 {
-    s->pieceSortState = PIECES_UNSORTED;
-}
+    auto const missing = tr_torrentMissingBlocksInPiece(s->tor, piece);
+    auto const requested = size_t{ s->requestsPerPiece[piece] };
 
-static tr_torrent const* weightTorrent;
-
-static void setComparePieceByWeightTorrent(tr_swarm* s)
-{
-    weightTorrent = s->tor;
-}
-
-/* we try to create a "weight" s.t. high-priority pieces come before others,
- * and that partially-complete pieces come before empty ones. */
-static int comparePieceByWeight(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct weighted_piece const*>(va);
-    auto const* const b = static_cast<struct weighted_piece const*>(vb);
-    tr_torrent const* const tor = weightTorrent;
-
-    /* primary key: weight */
-    int missing = tr_torrentMissingBlocksInPiece(tor, a->index);
-    int pending = a->requestCount;
-    int ia = missing > pending ? missing - pending : tor->blockCountInPiece + pending;
-    missing = tr_torrentMissingBlocksInPiece(tor, b->index);
-    pending = b->requestCount;
-    int ib = missing > pending ? missing - pending : tor->blockCountInPiece + pending;
-    if (ia != ib)
+    if (missing <= requested)
     {
-        return ia < ib ? -1 : 1;
+        return tr_piece_picker::PROGRESS_REQUESTED;
     }
 
-    /* secondary key: higher priorities go first */
-    ia = tor->piecePriority(a->index);
-    ib = tor->piecePriority(b->index);
-    if (ia != ib)
+    auto const [first, last] = tr_torGetPieceBlockRange(s->tor, piece);
+
+    if (requested > 0 || missing < last + 1 - first)
     {
-        return ia > ib ? -1 : 1;
+        return tr_piece_picker::PROGRESS_PARTIAL;
     }
 
-    /* tertiary key: random */
-    return a->salt - b->salt;
+    return tr_piece_picker::PROGRESS_NONE;
 }
 
-static int comparePieceByIndex(void const* va, void const* vb)
+/* call this when one of the picker's pieces has gained or lost blocks or requests */
+static void pickerUpdatePiece(tr_swarm* s, tr_piece_index_t piece)
 {
-    auto const* const a = static_cast<struct weighted_piece const*>(va);
-    auto const* const b = static_cast<struct weighted_piece const*>(vb);
-
-    if (a->index < b->index)
+    if (s->picker.isWanted(piece))
     {
-        return -1;
+        s->picker.setWanted(piece, s->tor->piecePriority(piece), getPieceProgress(s, piece));
     }
-
-    if (a->index > b->index)
-    {
-        return 1;
-    }
-
-    return 0;
 }
 
-static void pieceListSort(tr_swarm* s, enum piece_sort_state state)
+/* the piece counts are built the first time they're needed,
+ * and then kept up to date as peers come and go and send have messages */
+static bool pickerIsBuilt(tr_swarm const* s)
 {
-    TR_ASSERT(state == PIECES_SORTED_BY_INDEX || state == PIECES_SORTED_BY_WEIGHT);
-
-    if ((s->pieceCount > 0) && (s->pieces != nullptr))
-    {
-        if (state == PIECES_SORTED_BY_WEIGHT)
-        {
-            setComparePieceByWeightTorrent(s);
-            qsort(s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByWeight);
-        }
-        else
-        {
-            qsort(s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByIndex);
-        }
-    }
-
-    s->pieceSortState = state;
+    return s->picker.size() == s->tor->info.pieceCount;
 }
 
-/**
- * These functions are useful for testing, but too expensive for nightly builds.
- * let's leave it disabled but add an easy hook to compile it back in
- */
-#if 1
-
-#define assertWeightedPiecesAreSorted(t)
-
-#else
-
-static void assertWeightedPiecesAreSorted(Torrent* t)
+static void pickerAddPeerPieces(tr_swarm* s, tr_bitfield const& have)
 {
-    if (t->endgame == 0)
+    if (pickerIsBuilt(s))
     {
-        setComparePieceByWeightTorrent(t);
-
-        for (int i = 0; i < t->pieceCount - 1; ++i)
-        {
-            TR_ASSERT(comparePieceByWeight(&t->pieces[i], &t->pieces[i + 1]) <= 0);
-        }
+        s->picker.addBitfield(have);
+        s->seedCount += have.hasAll() ? 1 : 0;
     }
 }
 
-#endif
-
-static constexpr weighted_piece* pieceListLookup(tr_swarm* s, tr_piece_index_t index)
+static void pickerRemovePeerPieces(tr_swarm* s, tr_bitfield const& have)
 {
-    for (int i = 0; i < s->pieceCount; ++i)
+    if (pickerIsBuilt(s))
     {
-        if (s->pieces[i].index == index)
-        {
-            return &s->pieces[i];
-        }
+        s->picker.removeBitfield(have);
+        s->seedCount -= have.hasAll() ? 1 : 0;
     }
-
-    return nullptr;
 }
 
-static void pieceListRebuild(tr_swarm* s)
+/* choose the pieces that we want. The first time, also count which pieces the peers have */
+static void pickerRebuild(tr_swarm* s)
 {
-    if (!tr_torrentIsSeed(s->tor))
+    tr_torrent const* const tor = s->tor;
+    tr_piece_index_t const n = tor->info.pieceCount;
+
+    if (!pickerIsBuilt(s))
     {
-        tr_torrent const* const tor = s->tor;
-        tr_info const* const inf = tr_torrentInfo(tor);
+        s->picker.reset(n);
+        s->requestsPerPiece.assign(n, 0);
+        s->seedCount = 0;
 
-        /* build the new list */
-        auto poolCount = tr_piece_index_t{};
-        auto* const pool = tr_new(tr_piece_index_t, inf->pieceCount);
-        for (tr_piece_index_t i = 0; i < inf->pieceCount; ++i)
+        for (int i = 0, n_peers = tr_ptrArraySize(&s->peers); i < n_peers; ++i)
         {
-            if (!tor->pieceIsDnd(i) && !tr_torrentPieceIsComplete(tor, i))
-            {
-                pool[poolCount++] = i;
-            }
+            pickerAddPeerPieces(s, static_cast<tr_peer const*>(tr_ptrArrayNth(&s->peers, i))->have);
         }
+    }
 
-        int const pieceCount = poolCount;
-        auto* const pieces = tr_new0(weighted_piece, pieceCount);
+    bool const is_seed = tr_torrentIsSeed(tor);
 
-        for (tr_piece_index_t i = 0; i < poolCount; ++i)
+    for (tr_piece_index_t i = 0; i < n; ++i)
+    {
+        if (!is_seed && !tor->pieceIsDnd(i) && !tr_torrentPieceIsComplete(tor, i))
         {
-            struct weighted_piece* piece = pieces + i;
-            piece->index = pool[i];
-            piece->requestCount = 0;
-            piece->salt = tr_rand_int_weak(4096);
+            s->picker.setWanted(i, tor->piecePriority(i), getPieceProgress(s, i));
         }
-
-        /* if we already had a list of pieces, merge it into
-         * the new list so we don't lose its requestCounts */
-        if (s->pieces != nullptr)
-        {
-            struct weighted_piece const* o = s->pieces;
-            struct weighted_piece const* const oend = o + s->pieceCount;
-            struct weighted_piece* n = pieces;
-            struct weighted_piece const* const nend = n + pieceCount;
-
-            pieceListSort(s, PIECES_SORTED_BY_INDEX);
-
-            while (o != oend && n != nend)
-            {
-                if (o->index < n->index)
-                {
-                    ++o;
-                }
-                else if (o->index > n->index)
-                {
-                    ++n;
-                }
-                else
-                {
-                    *n++ = *o++;
-                }
-            }
-
-            tr_free(s->pieces);
-        }
-
-        s->pieces = pieces;
-        s->pieceCount = pieceCount;
-
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
-
-        /* cleanup */
-        tr_free(pool);
-    }
-}
-
-static void pieceListRemovePiece(tr_swarm* s, tr_piece_index_t piece)
-{
-    weighted_piece const* const p = pieceListLookup(s, piece);
-    if (p != nullptr)
-    {
-        int const pos = p - s->pieces;
-
-        tr_removeElementFromArray(s->pieces, pos, sizeof(struct weighted_piece), s->pieceCount);
-        --s->pieceCount;
-
-        if (s->pieceCount == 0)
+        else
         {
-            tr_free(s->pieces);
-            s->pieces = nullptr;
+            s->picker.setUnwanted(i);
         }
     }
 }
 
-static void pieceListResortPiece(tr_swarm* s, struct weighted_piece* p)
+static void pickerRemoveRequest(tr_swarm* s, tr_block_index_t block)
 {
-    if (p == nullptr)
+    if (!pickerIsBuilt(s))
     {
         return;
     }
 
-    /* is the torrent already sorted? */
-    int pos = p - s->pieces;
-    setComparePieceByWeightTorrent(s);
-
-    bool isSorted = true;
-
-    if (isSorted && pos > 0 && comparePieceByWeight(p - 1, p) > 0)
-    {
-        isSorted = false;
-    }
-
-    if (isSorted && pos < s->pieceCount - 1 && comparePieceByWeight(p, p + 1) > 0)
-    {
-        isSorted = false;
-    }
-
-    if (s->pieceSortState != PIECES_SORTED_BY_WEIGHT)
-    {
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
-        isSorted = true;
-    }
-
-    /* if it's not sorted, move it around */
-    if (!isSorted)
-    {
-        struct weighted_piece const tmp = *p;
-
-        tr_removeElementFromArray(s->pieces, pos, sizeof(struct weighted_piece), s->pieceCount);
-        --s->pieceCount;
-
-        auto exact = bool{};
-        pos = tr_lowerBound(&tmp, s->pieces, s->pieceCount, sizeof(struct weighted_piece), comparePieceByWeight, &exact);
-
-        memmove(&s->pieces[pos + 1], &s->pieces[pos], sizeof(struct weighted_piece) * (s->pieceCount - pos));
-        ++s->pieceCount;
-
-        s->pieces[pos] = tmp;
-    }
-
-    assertWeightedPiecesAreSorted(s);
-}
-
-static void pieceListRemoveRequest(tr_swarm* s, tr_block_index_t block)
-{
-    tr_piece_index_t const index = tr_torBlockPiece(s->tor, block);
+    tr_piece_index_t const piece = tr_torBlockPiece(s->tor, block);
 
-    weighted_piece* const p = pieceListLookup(s, index);
-    if (p != nullptr && p->requestCount > 0)
+    if (s->requestsPerPiece[piece] > 0)
     {
-        --p->requestCount;
-        pieceListResortPiece(s, p);
+        --s->requestsPerPiece[piece];
+        pickerUpdatePiece(s, piece);
     }
 }
 
@@ -1044,7 +771,7 @@ void tr_peerMgrRebuildRequests(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
-    pieceListRebuild(tor->swarm);
+    pickerRebuild(tor->swarm);
 }
 
 void tr_peerMgrGetNextRequests(
@@ -1065,41 +792,26 @@ void tr_peerMgrGetNextRequests(
     tr_swarm* const s = tor->swarm;
 
     /* prep the pieces list */
-    if (s->pieces == nullptr)
+    if (!pickerIsBuilt(s))
     {
-        pieceListRebuild(s);
+        pickerRebuild(s);
     }
 
-    if (s->pieceSortState != PIECES_SORTED_BY_WEIGHT)
-    {
-        pieceListSort(s, PIECES_SORTED_BY_WEIGHT);
-    }
-
-    assertWeightedPiecesAreSorted(s);
-
     updateEndgame(s);
 
-    // TODO(ckerr) this safeguard is here to silence a false nullptr dereference
-    // warning. The better fix is to refactor the `pieces` array to be a std
-    // container but that's out-of-scope for a "fix all the warnings" PR
-    if (s->pieces == nullptr)
-    {
-        *numgot = 0;
-        return;
-    }
-
-    struct weighted_piece* pieces = s->pieces;
     int got = 0;
-    int checkedPieceCount = 0;
-
-    for (int i = 0; i < s->pieceCount && got < numwant; ++i, ++checkedPieceCount)
-    {
-        struct weighted_piece* p = pieces + i;
+    auto touched = std::vector<tr_piece_index_t>{};
 
-        /* if the peer has this piece that we want... */
-        if (have->test(p->index))
+    s->picker.forEachWanted(
+        [&](tr_piece_index_t piece)
         {
-            auto const [first, last] = tr_torGetPieceBlockRange(tor, p->index);
+            /* if the peer has this piece that we want... */
+            if (!have->test(piece))
+            {
+                return true;
+            }
+
+            auto const [first, last] = tr_torGetPieceBlockRange(tor, piece);
 
             for (tr_block_index_t b = first; b <= last && (got < numwant || (get_intervals && setme[2 * got - 1] == b - 1));
                  ++b)
@@ -1164,57 +876,35 @@ void tr_peerMgrGetNextRequests(
 
                 /* update our own tables */
                 requestListAdd(s, b, peer);
-                ++p->requestCount;
-            }
-        }
-    }
-
-    /* In most cases we've just changed the weights of a small number of pieces.
-     * So rather than qsort()ing the entire array, it's faster to apply an
-     * adaptive insertion sort algorithm. */
-    if (got > 0)
-    {
-        /* not enough requests || last piece modified */
-        if (checkedPieceCount == s->pieceCount)
-        {
-            --checkedPieceCount;
-        }
+                ++s->requestsPerPiece[piece];
 
-        setComparePieceByWeightTorrent(s);
-
-        for (int i = checkedPieceCount - 1; i >= 0; --i)
-        {
-            auto exact = bool{};
+                if (std::empty(touched) || touched.back() != piece)
+                {
+                    touched.push_back(piece);
+                }
+            }
 
-            /* relative position! */
-            int const newpos = tr_lowerBound(
-                &s->pieces[i],
-                &s->pieces[i + 1],
-                s->pieceCount - (i + 1),
-                sizeof(struct weighted_piece),
-                comparePieceByWeight,
-                &exact);
+            return got < numwant;
+        });
 
-            if (newpos > 0)
-            {
-                struct weighted_piece const piece = s->pieces[i];
-                memmove(&s->pieces[i], &s->pieces[i + 1], sizeof(struct weighted_piece) * newpos);
-                s->pieces[i + newpos] = piece;
-            }
-        }
+    /* the pieces we just requested from have moved closer to the back of the line */
+    for (auto const piece : touched)
+    {
+        pickerUpdatePiece(s, piece);
     }
 
-    assertWeightedPiecesAreSorted(t);
     *numgot = got;
 }
 
 bool tr_peerMgrDidPeerRequest(tr_torrent const* tor, tr_peer const* peer, tr_block_index_t block)
 {
-    return requestListLookup(tor->swarm, block, peer) != nullptr;
+    return tor->swarm->requests.has(block, peer);
 }
 
+static void removeRequestFromTables(tr_swarm*, tr_block_index_t, tr_peer*);
+
 /* cancel requests that are too old */
-static void refillUpkeep(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+static void refillUpkeep(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     managerLock(mgr);
@@ -1222,63 +912,39 @@ static void refillUpkeep(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     /* prune requests that are too old */
     time_t const now = tr_time();
     time_t const too_old = now - RequestTtlSecs;
-    auto cancel = std::vector<block_request>{};
+    auto cancel = std::vector<tr_block_requests::request>{};
     for (auto* tor : mgr->session->torrents)
     {
         tr_swarm* s = tor->swarm;
-        int const n = s->requestCount;
-        if (n <= 0) // no requests to cull
+        if (std::empty(s->requests)) // no requests to cull
         {
             continue;
         }
 
-        int keepCount = 0;
         cancel.clear();
-        cancel.reserve(n);
-
-        for (int i = 0; i < n; ++i)
-        {
-            struct block_request const* const request = &s->requests[i];
-            auto const* const msgs = dynamic_cast<tr_peerMsgs const*>(request->peer);
 
-            if (msgs != nullptr && request->sentAt <= too_old && !msgs->is_reading_block(request->block))
+        s->requests.forEach(
+            [&cancel, too_old](tr_block_requests::request const& request)
             {
-                cancel.push_back(*request);
-            }
-            else
-            {
-                if (i != keepCount)
+                auto const* const msgs = dynamic_cast<tr_peerMsgs const*>(request.peer);
+
+                if (msgs != nullptr && request.sent_at <= too_old && !msgs->is_reading_block(request.block))
                 {
-                    s->requests[keepCount] = *request;
+                    cancel.push_back(request);
                 }
+            });
 
-                ++keepCount;
-            }
-        }
-
-        /* prune out the ones we aren't keeping */
-        s->requestCount = keepCount;
-
-        /* send cancel messages for all the "cancel" ones */
+        /* prune them and send cancel messages */
         for (auto& request : cancel)
         {
-            auto* msgs = dynamic_cast<tr_peerMsgs*>(request.peer);
-            if (msgs != nullptr)
-            {
-                request.peer->cancelsSentToPeer.add(now, 1);
-                msgs->cancel_block_request(request.block);
-                decrementPendingReqCount(&request);
-            }
-        }
+            removeRequestFromTables(s, request.block, request.peer);
 
-        /* decrement the pending request counts for the timed-out blocks */
-        for (auto& request : cancel)
-        {
-            pieceListRemoveRequest(s, request.block);
+            request.peer->cancelsSentToPeer.add(now, 1);
+            dynamic_cast<tr_peerMsgs*>(request.peer)->cancel_block_request(request.block);
         }
     }
 
-    tr_timerAddMsec(mgr->refillUpkeepTimer, RefillUpkeepPeriodMsec);
+    tr_sessionAddTimer(mgr->session, mgr->refillUpkeepTimer, RefillUpkeepPeriodMsec);
     managerUnlock(mgr);
 }
 
@@ -1290,6 +956,7 @@ static void addStrike(tr_swarm* s, tr_peer* peer)
     {
         struct peer_atom* atom = peer->atom;
         atom->flags2 |= MyflagBanned;
+        candidatesUpdate(s, atom);
         peer->doPurge = true;
         tordbg(s, "banning peer %s", tr_atomAddrStr(atom));
     }
@@ -1346,33 +1013,22 @@ static void peerSuggestedPiece(tr_swarm* /*s*/, tr_peer* /*peer*/, tr_piece_inde
 #endif
 }
 
-static void removeRequestFromTables(tr_swarm* s, tr_block_index_t block, tr_peer const* peer)
+static void removeRequestFromTables(tr_swarm* s, tr_block_index_t block, tr_peer* peer)
 {
-    requestListRemove(s, block, peer);
-    pieceListRemoveRequest(s, block);
+    if (requestListRemove(s, block, peer))
+    {
+        pickerRemoveRequest(s, block);
+    }
 }
 
 /* peer choked us, or maybe it disconnected.
    either way we need to remove all its requests */
-static void peerDeclinedAllRequests(tr_swarm* s, tr_peer const* peer)
+static void peerDeclinedAllRequests(tr_swarm* s, tr_peer* peer)
 {
-    int n = 0;
-    tr_block_index_t* blocks = tr_new(tr_block_index_t, s->requestCount);
-
-    for (int i = 0; i < s->requestCount; ++i)
-    {
-        if (peer == s->requests[i].peer)
-        {
-            blocks[n++] = s->requests[i].block;
-        }
-    }
-
-    for (int i = 0; i < n; ++i)
+    for (auto const block : s->requests.blocks(peer))
     {
-        removeRequestFromTables(s, blocks[i], peer);
+        removeRequestFromTables(s, block, peer);
     }
-
-    tr_free(blocks);
 }
 
 static void cancelAllRequestsForBlock(tr_swarm* s, tr_block_index_t block, tr_peer* no_notify)
@@ -1417,7 +1073,11 @@ void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t p)
     }
 
     /* bookkeeping */
-    pieceListRemovePiece(s, p);
+    if (pickerIsBuilt(s))
+    {
+        s->picker.setUnwanted(p);
+    }
+
     s->needsCompletenessCheck = true;
 }
 
@@ -1470,10 +1130,33 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
         }
 
     case TR_PEER_CLIENT_GOT_HAVE:
+        if (pickerIsBuilt(s))
+        {
+            s->picker.incrementAvailability(e->pieceIndex);
+
+            /* this is sent after peer->have changes, so this was the peer's last missing piece */
+            s->seedCount += peer->have.hasAll() ? 1 : 0;
+        }
+
+        break;
+
     case TR_PEER_CLIENT_GOT_HAVE_ALL:
     case TR_PEER_CLIENT_GOT_HAVE_NONE:
     case TR_PEER_CLIENT_GOT_BITFIELD:
-        /* noop */
+        /* these are sent before peer->have changes, so swap the old pieces for the new ones */
+        pickerRemovePeerPieces(s, peer->have);
+
+        if (e->eventType == TR_PEER_CLIENT_GOT_BITFIELD)
+        {
+            pickerAddPeerPieces(s, *e->bitfield);
+        }
+        else if (e->eventType == TR_PEER_CLIENT_GOT_HAVE_ALL)
+        {
+            auto all = tr_bitfield{ 0 };
+            all.setHasAll();
+            pickerAddPeerPieces(s, all);
+        }
+
         break;
 
     case TR_PEER_CLIENT_GOT_REJ:
@@ -1519,8 +1202,22 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             tr_block_index_t const block = _tr_block(tor, p, e->offset);
             cancelAllRequestsForBlock(s, block, peer);
             peer->blocksSentToClient.add(tr_time(), 1);
-            pieceListResortPiece(s, pieceListLookup(s, p));
             tr_torrentGotBlock(tor, block);
+
+            if (pickerIsBuilt(s))
+            {
+                pickerUpdatePiece(s, p);
+            }
+
+            break;
+        }
+
+    case TR_PEER_CLIENT_GOT_BAD_BLOCK:
+        {
+            // the block failed its v2 hash check, so ask someone else for it
+            tr_block_index_t const block = _tr_block(s->tor, e->pieceIndex, e->offset);
+            removeRequestFromTables(s, block, peer);
+            addStrike(s, peer);
             break;
         }
 
@@ -1595,15 +1292,13 @@ static struct peer_atom* ensureAtomExists(
     if (a == nullptr)
     {
         int const jitter = tr_rand_int_weak(60 * 10);
-        a = tr_new0(struct peer_atom, 1);
-        a->addr = *addr;
+        a = s->pool.add(*addr, tr_time() + getDefaultShelfLife(from) + jitter);
         a->port = port;
         a->flags = flags;
         a->fromFirst = from;
         a->fromBest = from;
-        a->shelf_date = tr_time() + getDefaultShelfLife(from) + jitter;
         a->blocklisted = -1;
-        tr_ptrArrayInsertSorted(&s->pool, a, compareAtomsByAddress);
+        candidatesUpdate(s, a);
 
         tordbg(s, "got a new atom: %s", tr_atomAddrStr(a));
     }
@@ -1615,6 +1310,7 @@ static struct peer_atom* ensureAtomExists(
         }
 
         a->flags |= flags;
+        candidatesUpdate(s, a);
     }
 
     s->poolIsAllSeedsDirty = true;
@@ -1643,6 +1339,7 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     auto* peer = tr_peerMsgsNew(tor, atom, io, peerCallbackFunc, swarm);
     peer->client = client;
     atom->peer = peer;
+    candidatesUpdate(swarm, atom);
 
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
     ++swarm->stats.peerCount;
@@ -1716,6 +1413,8 @@ static bool on_handshake_done(tr_handshake_result const& result)
             atom->flags2 &= ~MyflagUnreachable;
         }
 
+        candidatesUpdate(s, atom);
+
         /* In principle, this flag specifies whether the peer groks uTP,
            not whether it's currently connected over uTP. */
         if (result.io->socket.type == TR_PEER_SOCKET_TYPE_UTP)
@@ -1826,11 +1525,9 @@ void tr_peerMgrSetSwarmIsAllSeeds(tr_torrent* tor)
     tr_torrentLock(tor);
 
     tr_swarm* const swarm = tor->swarm;
-    auto atomCount = int{};
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &atomCount);
-    for (int i = 0; i < atomCount; ++i)
+    for (auto* const atom : swarm->pool)
     {
-        atomSetSeed(swarm, atoms[i]);
+        atomSetSeed(swarm, atom);
     }
 
     swarm->poolIsAllSeeds = true;
@@ -2051,15 +1748,13 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     }
     else /* TR_PEERS_INTERESTING */
     {
-        struct peer_atom** atomBase = (struct peer_atom**)tr_ptrArrayBase(&s->pool);
-        int const n = tr_ptrArraySize(&s->pool);
-        atoms = tr_new(struct peer_atom*, n);
+        atoms = tr_new(struct peer_atom*, std::size(s->pool));
 
-        for (int i = 0; i < n; ++i)
+        for (auto* const atom : s->pool)
         {
-            if (isAtomInteresting(tor, atomBase[i]))
+            if (isAtomInteresting(tor, atom))
             {
-                atoms[atomCount++] = atomBase[i];
+                atoms[atomCount++] = atom;
             }
         }
     }
@@ -2102,15 +1797,15 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     return count;
 }
 
-static void atomPulse(evutil_socket_t, short, void*);
-static void bandwidthPulse(evutil_socket_t, short, void*);
-static void rechokePulse(evutil_socket_t, short, void*);
+static void atomPulse(void*);
+static void bandwidthPulse(void*);
+static void rechokePulse(void*);
 static void reconnectPulse(evutil_socket_t, short, void*);
 
-static struct event* createTimer(tr_session* session, int msec, event_callback_fn callback, void* cbdata)
+static tr_timer* createTimer(tr_session* session, int msec, tr_timer::callback_t callback, void* cbdata)
 {
-    struct event* timer = evtimer_new(session->event_base, callback, cbdata);
-    tr_timerAddMsec(timer, msec);
+    auto* const timer = new tr_timer{ callback, cbdata };
+    tr_sessionAddTimer(session, timer, msec);
     return timer;
 }
 
@@ -2128,7 +1823,7 @@ static void ensureMgrTimersExist(struct tr_peerMgr* m)
 
     if (m->rechokeTimer == nullptr)
     {
-        m->rechokeTimer = createTimer(m->session, RechokePeriodMsec, rechokePulse, m);
+        m->rechokeTimer = createTimer(m->session, RechokeTickMsec, rechokePulse, m);
     }
 
     if (m->refillUpkeepTimer == nullptr)
@@ -2148,10 +1843,16 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
 
     s->isRunning = true;
     s->maxPeers = tor->maxConnectedPeers;
-    s->pieceSortState = PIECES_UNSORTED;
+
+    /* the torrent may have been verified while it was stopped */
+    if (pickerIsBuilt(s))
+    {
+        pickerRebuild(s);
+    }
 
     // rechoke soon
-    tr_timerAddMsec(s->manager->rechokeTimer, 100);
+    s->lastRechokeMsec = 0;
+    tr_sessionAddTimer(s->manager->session, s->manager->rechokeTimer, 100);
 }
 
 static void removeAllPeers(tr_swarm*);
@@ -2160,9 +1861,8 @@ static void stopSwarm(tr_swarm* swarm)
 {
     swarm->isRunning = false;
 
-    invalidatePieceSorting(swarm);
-
     removeAllPeers(swarm);
+    swarmSetUploadContribution(swarm, false, 0);
 
     /* disconnect the handshakes. handshakeAbort calls handshakeDoneCB(),
      * which removes the handshake from t->outgoingHandshakes... */
@@ -2266,11 +1966,15 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
 
     if (tr_torrentHasMetadata(tor))
     {
-        int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
-        tr_peer const** peers = (tr_peer const**)tr_ptrArrayBase(&tor->swarm->peers);
+        tr_swarm* const s = tor->swarm;
         float const interval = tor->info.pieceCount / (float)tabCount;
         bool const isSeed = tr_torrentGetCompleteness(tor) == TR_SEED;
 
+        if (!pickerIsBuilt(s))
+        {
+            pickerRebuild(s);
+        }
+
         for (tr_piece_index_t i = 0; i < tabCount; ++i)
         {
             int const piece = i * interval;
@@ -2279,15 +1983,9 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
             {
                 tab[i] = -1;
             }
-            else if (peerCount != 0)
+            else
             {
-                for (int j = 0; j < peerCount; ++j)
-                {
-                    if (peers[j]->have.test(piece))
-                    {
-                        ++tab[i];
-                    }
-                }
+                tab[i] = std::min(s->picker.availability(piece), uint16_t{ INT8_MAX });
             }
         }
     }
@@ -2337,48 +2035,35 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
         return 0;
     }
 
-    tr_swarm const* const s = tor->swarm;
+    tr_swarm* const s = tor->swarm;
     if (s == nullptr || !s->isRunning)
     {
         return 0;
     }
 
-    size_t const n_peers = tr_ptrArraySize(&s->peers);
-    if (n_peers == 0)
+    if (tr_ptrArrayEmpty(&s->peers))
     {
         return 0;
     }
 
-    tr_peer const** const peers = (tr_peer const**)tr_ptrArrayBase(&s->peers);
-    for (size_t i = 0; i < n_peers; ++i)
+    if (!pickerIsBuilt(s))
     {
-        if (peers[i]->atom != nullptr && atomIsSeed(peers[i]->atom))
-        {
-            return tr_torrentGetLeftUntilDone(tor);
-        }
+        pickerRebuild(s);
+    }
+
+    if (s->seedCount > 0)
+    {
+        return tr_torrentGetLeftUntilDone(tor);
     }
 
     // do it the hard way
 
     auto desired_available = uint64_t{};
     auto const n_pieces = tor->info.pieceCount;
-    auto have = std::vector<bool>(n_pieces);
-
-    for (size_t i = 0; i < n_peers; ++i)
-    {
-        auto* peer = peers[i];
-        for (size_t j = 0; j < n_pieces; ++j)
-        {
-            if (peer->have.test(j))
-            {
-                have[j] = true;
-            }
-        }
-    }
 
-    for (size_t i = 0; i < n_pieces; ++i)
+    for (tr_piece_index_t i = 0; i < n_pieces; ++i)
     {
-        if (!tor->pieceIsDnd(i) && have.at(i))
+        if (!tor->pieceIsDnd(i) && s->picker.availability(i) > 0)
         {
             desired_available += tr_torrentMissingBytesInPiece(tor, i);
         }
@@ -2859,6 +2544,16 @@ static inline bool isBandwidthMaxedOut(Bandwidth const* b, uint64_t const now_ms
     return got >= want;
 }
 
+static int getUploadSlots(tr_swarm const* s)
+{
+    tr_peerMgr const* const mgr = s->manager;
+    return tr_rechokeUploadSlots(
+        mgr->session->uploadSlotsPerTorrent,
+        mgr->rechokeActiveSwarms,
+        s->uploadContribution,
+        mgr->rechokeContributionTotal);
+}
+
 static void rechokeUploads(tr_swarm* s, uint64_t const now)
 {
     TR_ASSERT(swarmIsLocked(s));
@@ -2866,7 +2561,6 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     int const peerCount = tr_ptrArraySize(&s->peers);
     tr_peerMsgs** peers = (tr_peerMsgs**)tr_ptrArrayBase(&s->peers);
     struct ChokeData* choke = tr_new0(struct ChokeData, peerCount);
-    tr_session const* session = s->manager->session;
     bool const chokeAll = !tr_torrentIsPieceTransferAllowed(s->tor, TR_CLIENT_TO_PEER);
     bool const isMaxedOut = isBandwidthMaxedOut(s->tor->bandwidth, now, TR_UP);
 
@@ -2882,6 +2576,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     }
 
     int size = 0;
+    uint64_t contribution = 0;
 
     /* sort the peers by preference and rate */
     for (int i = 0; i < peerCount; ++i)
@@ -2908,9 +2603,13 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
             n->rate = getRate(s->tor, atom, now);
             n->salt = tr_rand_int_weak(INT_MAX);
             n->isChoked = true;
+            contribution += n->rate;
         }
     }
 
+    swarmSetUploadContribution(s, true, contribution);
+    int const uploadSlots = getUploadSlots(s);
+
     qsort(choke, size, sizeof(struct ChokeData), compareChoke);
 
     /**
@@ -2931,7 +2630,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     int checkedChokeCount = 0;
     int unchokedInterested = 0;
 
-    for (int i = 0; i < size && unchokedInterested < session->uploadSlotsPerTorrent; ++i)
+    for (int i = 0; i < size && unchokedInterested < uploadSlots; ++i)
     {
         choke[i].isChoked = isMaxedOut ? choke[i].wasChoked : false;
 
@@ -2981,31 +2680,60 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     tr_free(choke);
 }
 
-static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+static void rechokePulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     uint64_t const now = tr_time_msec();
 
     managerLock(mgr);
 
-    for (auto* tor : mgr->session->torrents)
-    {
-        if (tor->isRunning)
+    uint64_t const cpu_begin = tr_thread_cpu_usec();
+
+    /* walk the torrents round-robin, rechoking the swarms whose last rechoke
+     * was at least RechokePeriodMsec ago, up to a limit per tick */
+    size_t const n_rechoked = tr_rechokeRoundRobin(
+        mgr->session->torrentsById,
+        mgr->rechokeCursor,
+        MaxSwarmsPerRechokeTick,
+        [now](tr_torrent* tor)
         {
-            tr_swarm* s = tor->swarm;
+            tr_swarm* const s = tor->swarm;
 
-            if (s->stats.peerCount > 0)
+            if (!tor->isRunning || s->stats.peerCount == 0)
             {
-                rechokeUploads(s, now);
-                rechokeDownloads(s);
+                swarmSetUploadContribution(s, false, 0);
+                return false;
+            }
+
+            if (s->lastRechokeMsec != 0 && now - s->lastRechokeMsec < RechokePeriodMsec)
+            {
+                return false;
             }
-        }
-    }
 
-    tr_timerAddMsec(mgr->rechokeTimer, RechokePeriodMsec);
+            rechokeUploads(s, now);
+            rechokeDownloads(s);
+            s->lastRechokeMsec = now;
+            return true;
+        });
+
+    auto& stats = mgr->rechokeStats;
+    ++stats.pulses;
+    stats.last_pulse_swarms = n_rechoked;
+    stats.last_pulse_cpu_usec = tr_thread_cpu_usec() - cpu_begin;
+    stats.max_pulse_cpu_usec = std::max(stats.max_pulse_cpu_usec, stats.last_pulse_cpu_usec);
+
+    tr_sessionAddTimer(mgr->session, mgr->rechokeTimer, RechokeTickMsec);
     managerUnlock(mgr);
 }
 
+tr_rechoke_stats tr_peerMgrGetRechokeStats(tr_peerMgr const* mgr)
+{
+    managerLock(mgr);
+    auto const stats = mgr->rechokeStats;
+    managerUnlock(mgr);
+    return stats;
+}
+
 /***
 ****
 ****  Life and Death
@@ -3157,6 +2885,8 @@ static void removePeer(tr_peer* peer)
     TR_ASSERT(s->stats.peerCount == tr_ptrArraySize(&s->peers));
     TR_ASSERT(s->stats.peerFromCount[atom->fromFirst] >= 0);
 
+    pickerRemovePeerPieces(s, peer->have);
+
     delete peer;
 }
 
@@ -3367,7 +3097,7 @@ static void queuePulse(tr_session* session, tr_direction dir)
     }
 }
 
-static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+static void bandwidthPulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     tr_session* session = mgr->session;
@@ -3409,7 +3139,7 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 
     reconnectPulse(0, 0, mgr);
 
-    tr_timerAddMsec(mgr->bandwidthTimer, BandwidthPeriodMsec);
+    tr_sessionAddTimer(mgr->session, mgr->bandwidthTimer, BandwidthPeriodMsec);
     managerUnlock(mgr);
 }
 
@@ -3417,64 +3147,12 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 ****
 ***/
 
-static int compareAtomPtrsByAddress(void const* va, void const* vb)
-{
-    struct peer_atom const* a = *(struct peer_atom const* const*)va;
-    struct peer_atom const* b = *(struct peer_atom const* const*)vb;
-
-    TR_ASSERT(tr_isAtom(a));
-    TR_ASSERT(tr_isAtom(b));
-
-    return tr_address_compare(&a->addr, &b->addr);
-}
-
-/* best come first, worst go last */
-static int compareAtomPtrsByShelfDate(void const* va, void const* vb)
-{
-    struct peer_atom const* a = *(struct peer_atom const* const*)va;
-    struct peer_atom const* b = *(struct peer_atom const* const*)vb;
-
-    TR_ASSERT(tr_isAtom(a));
-    TR_ASSERT(tr_isAtom(b));
-
-    int const data_time_cutoff_secs = 60 * 60;
-    time_t const tr_now = tr_time();
-
-    /* primary key: the last piece data time *if* it was within the last hour */
-    time_t atime = a->piece_data_time;
-
-    if (atime + data_time_cutoff_secs < tr_now)
-    {
-        atime = 0;
-    }
-
-    time_t btime = b->piece_data_time;
-
-    if (btime + data_time_cutoff_secs < tr_now)
-    {
-        btime = 0;
-    }
-
-    if (atime != btime)
-    {
-        return atime > btime ? -1 : 1;
-    }
-
-    /* secondary key: shelf date. */
-    if (a->shelf_date != b->shelf_date)
-    {
-        return a->shelf_date > b->shelf_date ? -1 : 1;
-    }
-
-    return 0;
-}
-
 static int getMaxAtomCount(tr_torrent const* tor)
 {
     return std::min(50, tor->maxConnectedPeers * 3);
 }
 
-static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+static void atomPulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     managerLock(mgr);
@@ -3482,70 +3160,36 @@ static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     for (auto* tor : mgr->session->torrents)
     {
         tr_swarm* s = tor->swarm;
-        int const maxAtomCount = getMaxAtomCount(tor);
-        auto atomCount = int{};
-        peer_atom** const atoms = (peer_atom**)tr_ptrArrayPeek(&s->pool, &atomCount);
+        auto const maxAtomCount = size_t(getMaxAtomCount(tor));
+        auto const atomCount = std::size(s->pool);
 
         if (atomCount > maxAtomCount) /* we've got too many atoms... time to prune */
         {
-            int keepCount = 0;
-            int testCount = 0;
-            struct peer_atom** keep = tr_new(struct peer_atom*, atomCount);
-            struct peer_atom** test = tr_new(struct peer_atom*, atomCount);
-
-            /* keep the ones that are in use */
-            for (int i = 0; i < atomCount; ++i)
-            {
-                struct peer_atom* atom = atoms[i];
-
-                if (peerIsInUse(s, atom))
-                {
-                    keep[keepCount++] = atom;
-                }
-                else
-                {
-                    test[testCount++] = atom;
-                }
-            }
-
-            /* if there's room, keep the best of what's left */
-            int i = 0;
+            /* keep the ones that are in use and the ones that have sent us data
+             * in the last hour. If that's still too many, prune the ones that
+             * have sent us data, too. Either way, the stalest go first. */
+            time_t const data_time_cutoff = tr_time() - 60 * 60;
 
-            if (keepCount < maxAtomCount)
+            for (bool const prune_recent : { false, true })
             {
-                qsort(test, testCount, sizeof(struct peer_atom*), compareAtomPtrsByShelfDate);
-
-                while (i < testCount && keepCount < maxAtomCount)
-                {
-                    keep[keepCount++] = test[i++];
-                }
-            }
-
-            /* free the culled atoms */
-            while (i < testCount)
-            {
-                tr_free(test[i++]);
-            }
-
-            /* rebuild Torrent.pool with what's left */
-            tr_ptrArrayDestruct(&s->pool, nullptr);
-            s->pool = {};
-            qsort(keep, keepCount, sizeof(struct peer_atom*), compareAtomPtrsByAddress);
-
-            for (i = 0; i < keepCount; ++i)
-            {
-                tr_ptrArrayAppend(&s->pool, keep[i]);
+                s->pool.prune(
+                    maxAtomCount,
+                    [s, prune_recent, data_time_cutoff](peer_atom const* atom)
+                    { return !peerIsInUse(s, atom) && (prune_recent || atom->piece_data_time < data_time_cutoff); },
+                    [s](peer_atom* atom)
+                    {
+                        if (atom->is_candidate)
+                        {
+                            s->candidates.erase(atom);
+                        }
+                    });
             }
 
-            tordbg(s, "max atom count is %d... pruned from %d to %d\n", maxAtomCount, atomCount, keepCount);
-
-            /* cleanup */
-            tr_free(test);
-            tr_free(keep);
+            tordbg(s, "max atom count is %zu... pruned from %zu to %zu\n", maxAtomCount, atomCount, std::size(s->pool));
         }
     }
 
-    tr_timerAddMsec(mgr->atomTimer, AtomPeriodMsec);
+    tr_sessionAddTimer(mgr->session, mgr->atomTimer, AtomPeriodMsec);
     managerUnlock(mgr);
 }
 
@@ -3669,20 +3313,73 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
     return score;
 }
 
-static bool calculateAllSeeds(tr_swarm* swarm)
+/**
+ * Smaller is better. This sorts a swarm's atoms in the same order as
+ * getPeerCandidateScore() would, but leaves out the parts that are the
+ * same for every atom in the swarm.
+ */
+static uint64_t getAtomCandidateKey(struct peer_atom const* atom, uint8_t salt)
+{
+    auto key = uint64_t{};
+    bool const failed = atom->lastConnectionAt < atom->lastConnectionAttemptAt;
+
+    key = addValToKey(key, 1, failed ? 1 : 0);
+    key = addValToKey(key, 32, atom->lastConnectionAttemptAt);
+    key = addValToKey(key, 1, (atom->flags & ADDED_F_CONNECTABLE) != 0 ? 0 : 1);
+    key = addValToKey(key, 1, (atom->flags & ADDED_F_SEED_FLAG) == 0 ? 0 : 1);
+    key = addValToKey(key, 4, atom->fromBest);
+    key = addValToKey(key, 8, salt);
+
+    return key;
+}
+
+/* The candidates leave out the atoms that isPeerCandidate() would reject
+ * for a long time, so that each reconnectPulse doesn't have to skip them
+ * again. The checks that only last a little while, like whether we tried
+ * the peer recently, are still left for isPeerCandidate(). */
+static bool atomCanBeCandidate(tr_swarm const* s, struct peer_atom* atom)
 {
-    int nAtoms = 0;
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &nAtoms);
+    return atom->peer == nullptr && (atom->flags2 & MyflagBanned) == 0 && !(s->candidatesAreForSeed && atomIsSeed(atom)) &&
+        !isAtomBlocklisted(s->tor->session, atom);
+}
 
-    for (int i = 0; i < nAtoms; ++i)
+/**
+ * Add an atom to its swarm's candidates, move it, or take it out.
+ * Call this whenever an atom changes in a way that getAtomCandidateKey()
+ * or atomCanBeCandidate() would notice.
+ */
+static void candidatesUpdate(tr_swarm* s, struct peer_atom* atom)
+{
+    if (atom->is_candidate)
     {
-        if (!atomIsSeed(atoms[i]))
-        {
-            return false;
-        }
+        s->candidates.erase(atom);
+        atom->is_candidate = false;
     }
 
-    return true;
+    if (!s->candidatesAreDirty && atomCanBeCandidate(s, atom))
+    {
+        atom->candidate_key = getAtomCandidateKey(atom, tr_rand_int_weak(256));
+        atom->is_candidate = true;
+        s->candidates.insert(atom);
+    }
+}
+
+static void candidatesRebuild(tr_swarm* s)
+{
+    s->candidates.clear();
+    s->candidatesAreDirty = false;
+    s->candidatesAreForSeed = tr_torrentIsSeed(s->tor);
+
+    for (auto* const atom : s->pool)
+    {
+        atom->is_candidate = false;
+        candidatesUpdate(s, atom);
+    }
+}
+
+static bool calculateAllSeeds(tr_swarm* swarm)
+{
+    return std::all_of(std::begin(swarm->pool), std::end(swarm->pool), atomIsSeed);
 }
 
 static bool swarmIsAllSeeds(tr_swarm* swarm)
@@ -3696,7 +3393,7 @@ static bool swarmIsAllSeeds(tr_swarm* swarm)
     return swarm->poolIsAllSeeds;
 }
 
-/** @return an array of all the atoms we might want to connect to */
+/** @return an array of the best `max` atoms that we might want to connect to */
 static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t max)
 {
     time_t const now = tr_time();
@@ -3704,12 +3401,10 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
     /* leave 5% of connection slots for incoming connections -- ticket #2609 */
     int const maxCandidates = tr_sessionGetPeerLimit(session) * 0.95;
 
-    /* count how many peers and atoms we've got */
-    int atomCount = 0;
+    /* count how many peers we've got */
     int peerCount = 0;
     for (auto const* tor : session->torrents)
     {
-        atomCount += tr_ptrArraySize(&tor->swarm->pool);
         peerCount += tr_ptrArraySize(&tor->swarm->peers);
     }
 
@@ -3719,13 +3414,32 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
         return {};
     }
 
-    auto candidates = std::vector<peer_candidate>{};
-    candidates.reserve(atomCount);
+    /* each swarm's candidates are already sorted, so merge the swarms'
+     * best candidates through a heap of each swarm's next one */
+    struct swarm_head
+    {
+        uint64_t score;
+        tr_torrent* tor;
+        decltype(tr_swarm::candidates)::const_iterator it;
+    };
+
+    auto const worse = [](swarm_head const& a, swarm_head const& b)
+    {
+        return a.score > b.score;
+    };
+
+    auto const getHeadScore = [](tr_torrent const* tor, peer_atom const* atom)
+    {
+        return getPeerCandidateScore(tor, atom, uint8_t(atom->candidate_key));
+    };
+
+    auto heads = std::vector<swarm_head>{};
 
-    /* populate the candidate array */
     for (auto* tor : session->torrents)
     {
-        if (!tor->swarm->isRunning)
+        tr_swarm* const s = tor->swarm;
+
+        if (!s->isRunning)
         {
             continue;
         }
@@ -3733,13 +3447,13 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
         /* if everyone in the swarm is seeds and pex is disabled because
          * the torrent is private, then don't initiate connections */
         bool const seeding = tr_torrentIsSeed(tor);
-        if (seeding && swarmIsAllSeeds(tor->swarm) && tr_torrentIsPrivate(tor))
+        if (seeding && swarmIsAllSeeds(s) && tr_torrentIsPrivate(tor))
         {
             continue;
         }
 
         /* if we've already got enough peers in this torrent... */
-        if (tr_torrentGetPeerLimit(tor) <= tr_ptrArraySize(&tor->swarm->peers))
+        if (tr_torrentGetPeerLimit(tor) <= tr_ptrArraySize(&s->peers))
         {
             continue;
         }
@@ -3750,30 +3464,42 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
             continue;
         }
 
-        auto nAtoms = int{};
-        peer_atom** atoms = (peer_atom**)tr_ptrArrayPeek(&tor->swarm->pool, &nAtoms);
-
-        for (int i = 0; i < nAtoms; ++i)
+        if (s->candidatesAreDirty || s->candidatesAreForSeed != seeding)
         {
-            struct peer_atom* atom = atoms[i];
+            candidatesRebuild(s);
+        }
 
-            if (isPeerCandidate(tor, atom, now))
-            {
-                uint8_t const salt = tr_rand_int_weak(1024);
-                candidates.push_back({ getPeerCandidateScore(tor, atom, salt), tor, atom });
-            }
+        if (!std::empty(s->candidates))
+        {
+            auto const it = std::begin(s->candidates);
+            heads.push_back({ getHeadScore(tor, *it), tor, it });
         }
     }
 
-    // only keep the best `max` candidates
-    if (std::size(candidates) > max)
+    std::make_heap(std::begin(heads), std::end(heads), worse);
+
+    auto candidates = std::vector<peer_candidate>{};
+
+    while (!std::empty(heads) && std::size(candidates) < max)
     {
-        std::partial_sort(
-            std::begin(candidates),
-            std::begin(candidates) + max,
-            std::end(candidates),
-            [](auto const& a, auto const& b) { return a.score < b.score; });
-        candidates.resize(max);
+        std::pop_heap(std::begin(heads), std::end(heads), worse);
+        auto& head = heads.back();
+        auto* const atom = *head.it;
+
+        if (isPeerCandidate(head.tor, atom, now))
+        {
+            candidates.push_back({ head.score, head.tor, atom });
+        }
+
+        if (++head.it != std::end(head.tor->swarm->candidates))
+        {
+            head.score = getHeadScore(head.tor, *head.it);
+            std::push_heap(std::begin(heads), std::end(heads), worse);
+        }
+        else
+        {
+            heads.pop_back();
+        }
     }
 
     return candidates;
@@ -3822,6 +3548,7 @@ static void initiateConnection(tr_peerMgr* mgr, tr_swarm* s, struct peer_atom* a
 
     atom->lastConnectionAttemptAt = now;
     atom->time = now;
+    candidatesUpdate(s, atom);
 }
 
 static void initiateCandidateConnection(tr_peerMgr* mgr, peer_candidate& c)
@@ -152,4 +152,16 @@ void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
 void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
+struct tr_rechoke_stats
+{
+    uint64_t pulses; /* how many rechoke ticks have run */
+    size_t last_pulse_swarms; /* how many swarms the last tick rechoked */
+
+    /* the CPU time that the ticks took, not counting time spent waiting */
+    uint64_t last_pulse_cpu_usec;
+    uint64_t max_pulse_cpu_usec;
+};
+
+tr_rechoke_stats tr_peerMgrGetRechokeStats(tr_peerMgr const* manager);
+
 /* @} */
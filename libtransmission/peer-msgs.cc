@@ -12,22 +12,28 @@
 #include <cstdlib>
 #include <cstring>
 #include <memory> // std::unique_ptr
+#include <optional>
+#include <unordered_set>
+#include <utility> // std::move
+#include <vector>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
-#include <event2/event.h>
 
 #include "transmission.h"
 
 #include "cache.h"
 #include "completion.h"
 #include "file.h"
+#include "inout.h" /* tr_ioOpenBlock(), tr_ioPrefetch() */
 #include "log.h"
+#include "merkle.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
 #include "ptrarray.h"
 #include "session.h"
+#include "timer-wheel.h"
 #include "torrent-magnet.h"
 #include "torrent.h"
 #include "tr-assert.h"
@@ -68,7 +74,12 @@ enum BitTorrentMessages
 
     // http://bittorrent.org/beps/bep_0010.html
     // see also LtepMessageIds below
-    BtLtep = 20
+    BtLtep = 20,
+
+    // https://www.bittorrent.org/beps/bep_0052.html
+    BtHashRequest = 21,
+    BtHashes = 22,
+    BtHashReject = 23
 };
 
 enum LtepMessages
@@ -110,14 +121,17 @@ static auto constexpr MetadataReqQ = int{ 64 };
 
 static auto constexpr ReqQ = int{ 512 };
 
+// BEP 52 hash messages: a 32-byte pieces root, then base layer, index, length, and proof layers
+static auto constexpr HashHeaderLen = uint32_t{ TR_SHA256_DIGEST_LEN + 4 * sizeof(uint32_t) };
+
+// BEP 52 doesn't allow asking for more hashes than this at once
+static auto constexpr MaxHashesPerRequest = uint32_t{ 512 };
+
 // used in lowering the outMessages queue period
 static auto constexpr ImmediatePriorityIntervalSecs = int{ 0 };
 static auto constexpr HighPriorityIntervalSecs = int{ 2 };
 static auto constexpr LowPriorityIntervalSecs = int{ 10 };
 
-// how many blocks to keep prefetched per peer
-static auto constexpr PrefetchSize = int{ 18 };
-
 // when we're making requests from another peer,
 // batch them together to send enough requests to
 // meet our bandwidth goals for the next N seconds
@@ -184,7 +198,7 @@ static void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs);
 static void didWrite(tr_peerIo* io, size_t bytesWritten, bool wasPieceData, void* vmsgs);
 static void gotError(tr_peerIo* io, short what, void* vmsgs);
 static void peerPulse(void* vmsgs);
-static void pexPulse(evutil_socket_t fd, short what, void* vmsgs);
+static void pexPulse(void* vmsgs);
 static void protocolSendCancel(tr_peerMsgsImpl* msgs, struct peer_request const& req);
 static void protocolSendChoke(tr_peerMsgsImpl* msgs, bool choke);
 static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index);
@@ -195,16 +209,6 @@ static void tellPeerWhatWeHave(tr_peerMsgsImpl* msgs);
 static void updateDesiredRequestCount(tr_peerMsgsImpl* msgs);
 //zzz
 
-struct EventDeleter
-{
-    void operator()(struct event* ev) const
-    {
-        event_free(ev);
-    }
-};
-
-using UniqueTimer = std::unique_ptr<struct event, EventDeleter>;
-
 /**
  * Low-level communication state information about a connected peer.
  *
@@ -233,8 +237,8 @@ public:
     {
         if (tr_torrentAllowsPex(torrent))
         {
-            pex_timer.reset(evtimer_new(torrent->session->event_base, pexPulse, this));
-            tr_timerAdd(pex_timer.get(), PexIntervalSecs, 0);
+            pex_timer = std::make_unique<tr_timer>(pexPulse, this);
+            tr_sessionAddTimer(torrent->session, pex_timer.get(), PexIntervalSecs * 1000);
         }
 
         if (tr_peerIoSupportsUTP(io))
@@ -446,6 +450,16 @@ public:
         publish(e);
     }
 
+    void publishGotBadBlock(struct peer_request const* req)
+    {
+        auto e = tr_peer_event{};
+        e.eventType = TR_PEER_CLIENT_GOT_BAD_BLOCK;
+        e.pieceIndex = req->index;
+        e.offset = req->offset;
+        e.length = req->length;
+        publish(e);
+    }
+
     void publishGotChoke()
     {
         auto e = tr_peer_event{};
@@ -617,6 +631,9 @@ public:
     int peerAskedForMetadata[MetadataReqQ] = {};
     int peerAskedForMetadataCount = 0;
 
+    /* pieces whose v2 leaf hashes we've asked this peer for */
+    std::unordered_set<tr_piece_index_t> merkleLeavesRequested;
+
     tr_pex* pex = nullptr;
     tr_pex* pex6 = nullptr;
 
@@ -634,7 +651,7 @@ public:
        value is zero and should be ignored. */
     int64_t reqq = 0;
 
-    UniqueTimer pex_timer;
+    std::unique_ptr<tr_timer> pex_timer;
 
     tr_peerIo* io = nullptr;
 
@@ -761,6 +778,49 @@ static void protocolSendCancel(tr_peerMsgsImpl* msgs, peer_request const& req)
     pokeBatchPeriod(msgs, ImmediatePriorityIntervalSecs);
 }
 
+struct hash_request
+{
+    tr_sha256_digest_t pieces_root;
+    uint32_t base_layer;
+    uint32_t index;
+    uint32_t length;
+    uint32_t proof_layers;
+};
+
+static void protocolSendHashMessage(tr_peerMsgsImpl* msgs, uint8_t id, hash_request const& req)
+{
+    struct evbuffer* out = msgs->outMessages;
+
+    evbuffer_add_uint32(out, sizeof(uint8_t) + HashHeaderLen);
+    evbuffer_add_uint8(out, id);
+    evbuffer_add(out, std::data(req.pieces_root), std::size(req.pieces_root));
+    evbuffer_add_uint32(out, req.base_layer);
+    evbuffer_add_uint32(out, req.index);
+    evbuffer_add_uint32(out, req.length);
+    evbuffer_add_uint32(out, req.proof_layers);
+
+    dbgmsg(msgs, "sending hash message %d for %u hashes at %u", (int)id, req.length, req.index);
+    dbgOutMessageLen(msgs);
+    pokeBatchPeriod(msgs, ImmediatePriorityIntervalSecs);
+}
+
+/* ask a v2 peer for a piece's leaf hashes, so that we can check each of its blocks as they arrive */
+static void maybeRequestMerkleLeaves(tr_peerMsgsImpl* msgs, tr_piece_index_t piece_index)
+{
+    tr_torrent const* const tor = msgs->torrent;
+    auto const* const piece = tor->merklePiece(piece_index);
+
+    // a piece with only one leaf doesn't need them: its root is that leaf
+    if (!tr_peerIoSupportsV2(msgs->io) || piece == nullptr || piece->n_leaves < 2 || piece->n_leaves > MaxHashesPerRequest ||
+        tor->merkleLeaves(piece_index) != nullptr || msgs->merkleLeavesRequested.count(piece_index) != 0)
+    {
+        return;
+    }
+
+    msgs->merkleLeavesRequested.insert(piece_index);
+    protocolSendHashMessage(msgs, BtHashRequest, hash_request{ piece->file_root, 0, piece->first_leaf, piece->n_leaves, 0 });
+}
+
 static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port)
 {
     struct evbuffer* out = msgs->outMessages;
@@ -975,6 +1035,18 @@ static bool popNextRequest(tr_peerMsgsImpl* msgs, struct peer_request* setme)
     return true;
 }
 
+/* true if the next block the peer wants is still being read by a disk I/O worker */
+static bool nextRequestIsPending(tr_peerMsgsImpl const* msgs)
+{
+    if (msgs->pendingReqsToClient == 0)
+    {
+        return false;
+    }
+
+    struct peer_request const* const req = &msgs->peerAskedFor[0];
+    return tr_cacheBlockIsPending(msgs->session->cache, msgs->torrent, req->index, req->offset);
+}
+
 static void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs)
 {
     struct peer_request req;
@@ -1456,6 +1528,8 @@ static void updatePeerProgress(tr_peerMsgsImpl* msgs)
     msgs->update_interest();
 }
 
+static bool canSendBlockFromFile(tr_peerMsgsImpl const* msgs, struct peer_request const* req);
+
 static void prefetchPieces(tr_peerMsgsImpl* msgs)
 {
     if (!msgs->session->isPrefetchEnabled)
@@ -1463,13 +1537,23 @@ static void prefetchPieces(tr_peerMsgsImpl* msgs)
         return;
     }
 
-    for (int i = msgs->prefetchCount; i < msgs->pendingReqsToClient && i < PrefetchSize; ++i)
+    for (int i = msgs->prefetchCount; i < msgs->pendingReqsToClient && i < msgs->session->prefetchLookahead; ++i)
     {
         struct peer_request const* req = msgs->peerAskedFor + i;
 
         if (requestIsValid(msgs, req))
         {
-            tr_cachePrefetchBlock(msgs->session->cache, msgs->torrent, req->index, req->offset, req->length);
+            /* blocks sent from their files don't go through the read cache,
+             * so just ask the OS to start reading them */
+            if (canSendBlockFromFile(msgs, req))
+            {
+                tr_ioPrefetch(msgs->torrent, req->index, req->offset, req->length);
+            }
+            else
+            {
+                tr_cachePrefetchBlock(msgs->session->cache, msgs->torrent, req->index, req->offset, req->length);
+            }
+
             ++msgs->prefetchCount;
         }
     }
@@ -1562,6 +1646,14 @@ static bool messageLengthIsCorrect(tr_peerMsgsImpl const* msg, uint8_t id, uint3
     case BtLtep:
         return len >= 2;
 
+    case BtHashRequest:
+    case BtHashReject:
+        return len == 1 + HashHeaderLen;
+
+    case BtHashes:
+        return len >= 1 + HashHeaderLen && (len - 1 - HashHeaderLen) % TR_SHA256_DIGEST_LEN == 0 &&
+            (len - 1 - HashHeaderLen) / TR_SHA256_DIGEST_LEN <= MaxHashesPerRequest;
+
     default:
         return false;
     }
@@ -1630,6 +1722,59 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
     return err != 0 ? READ_ERR : READ_NOW;
 }
 
+static void readHashHeader(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, hash_request* setme)
+{
+    tr_peerIoReadBytes(msgs->io, inbuf, std::data(setme->pieces_root), std::size(setme->pieces_root));
+    tr_peerIoReadUint32(msgs->io, inbuf, &setme->base_layer);
+    tr_peerIoReadUint32(msgs->io, inbuf, &setme->index);
+    tr_peerIoReadUint32(msgs->io, inbuf, &setme->length);
+    tr_peerIoReadUint32(msgs->io, inbuf, &setme->proof_layers);
+}
+
+/* find which of our outstanding leaf requests a hashes or hash reject message answers */
+static std::optional<tr_piece_index_t> takeMerkleLeavesRequest(tr_peerMsgsImpl* msgs, hash_request const& req)
+{
+    for (auto const piece_index : msgs->merkleLeavesRequested)
+    {
+        auto const* const piece = msgs->torrent->merklePiece(piece_index);
+
+        if (piece != nullptr && req.base_layer == 0 && piece->file_root == req.pieces_root && piece->first_leaf == req.index &&
+            piece->n_leaves == req.length)
+        {
+            msgs->merkleLeavesRequested.erase(piece_index);
+            return piece_index;
+        }
+    }
+
+    return {};
+}
+
+static void readBtHashes(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, uint32_t msglen)
+{
+    auto req = hash_request{};
+    readHashHeader(msgs, inbuf, &req);
+
+    auto leaves = std::vector<tr_sha256_digest_t>((msglen - HashHeaderLen) / TR_SHA256_DIGEST_LEN);
+    tr_peerIoReadBytes(msgs->io, inbuf, std::data(leaves), std::size(leaves) * TR_SHA256_DIGEST_LEN);
+
+    // we never ask for proof hashes, so a valid answer is exactly the leaves we asked for
+    auto const piece_index = takeMerkleLeavesRequest(msgs, req);
+    if (!piece_index || req.proof_layers != 0)
+    {
+        dbgmsg(msgs, "got %zu hashes that we didn't ask for", std::size(leaves));
+        return;
+    }
+
+    if (tr_torrentPieceIsComplete(msgs->torrent, *piece_index))
+    {
+        dbgmsg(msgs, "got piece %u's leaf hashes after the piece was done", *piece_index);
+    }
+    else if (!msgs->torrent->setMerkleLeaves(*piece_index, std::move(leaves)))
+    {
+        dbgmsg(msgs, "piece %u's leaf hashes don't match its root", *piece_index);
+    }
+}
+
 static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size_t inlen)
 {
     uint8_t const id = msgs->incoming.id;
@@ -1717,8 +1862,12 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
             uint8_t* tmp = tr_new(uint8_t, msglen);
             dbgmsg(msgs, "got a bitfield");
             tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
-            msgs->have.setRaw(tmp, msglen);
-            msgs->publishClientGotBitfield(&msgs->have);
+
+            /* publish before replacing `have` so that the swarm can see both bitfields */
+            auto bitfield = tr_bitfield{ msgs->have.size() };
+            bitfield.setRaw(tmp, msglen);
+            msgs->publishClientGotBitfield(&bitfield);
+            msgs->have = std::move(bitfield);
             updatePeerProgress(msgs);
             tr_free(tmp);
             break;
@@ -1811,8 +1960,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasAll();
             msgs->publishClientGotHaveAll();
+            msgs->have.setHasAll();
             updatePeerProgress(msgs);
         }
         else
@@ -1828,8 +1977,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasNone();
             msgs->publishClientGotHaveNone();
+            msgs->have.setHasNone();
             updatePeerProgress(msgs);
         }
         else
@@ -1866,6 +2015,30 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
         parseLtep(msgs, msglen, inbuf);
         break;
 
+    case BtHashRequest:
+        {
+            // we only use the v2 hashes to check blocks, so we have none to serve
+            auto req = hash_request{};
+            dbgmsg(msgs, "Got a BtHashRequest");
+            readHashHeader(msgs, inbuf, &req);
+            protocolSendHashMessage(msgs, BtHashReject, req);
+            break;
+        }
+
+    case BtHashes:
+        dbgmsg(msgs, "Got a BtHashes");
+        readBtHashes(msgs, inbuf, msglen);
+        break;
+
+    case BtHashReject:
+        {
+            auto req = hash_request{};
+            dbgmsg(msgs, "Got a BtHashReject");
+            readHashHeader(msgs, inbuf, &req);
+            takeMerkleLeavesRequest(msgs, req);
+            break;
+        }
+
     default:
         dbgmsg(msgs, "peer sent us an UNKNOWN: %d", (int)id);
         tr_peerIoDrain(msgs->io, inbuf, msglen);
@@ -1879,6 +2052,36 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
     return READ_NOW;
 }
 
+/* check a block against its v2 leaf hash, if we know it */
+static bool blockMatchesMerkle(tr_torrent const* tor, struct peer_request const* req, struct evbuffer* data)
+{
+    auto const* const piece = tor->merklePiece(req->index);
+
+    // the end of the piece may be padding, which only the v1 hash covers
+    if (piece == nullptr || req->offset >= piece->data_length)
+    {
+        return true;
+    }
+
+    tr_sha256_digest_t const* leaf = nullptr;
+
+    if (piece->n_leaves == 1)
+    {
+        leaf = &piece->root;
+    }
+    else if (auto const* const leaves = tor->merkleLeaves(req->index); leaves != nullptr)
+    {
+        leaf = &(*leaves)[req->offset / TR_MERKLE_BLOCK_SIZE];
+    }
+    else
+    {
+        return true;
+    }
+
+    auto const length = std::min(req->length, piece->data_length - req->offset);
+    return tr_merkleHashBlock(evbuffer_pullup(data, length), length) == *leaf;
+}
+
 /* returns 0 on success, or an errno on failure */
 static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct peer_request const* req)
 {
@@ -1914,6 +2117,13 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
         return 0;
     }
 
+    if (!blockMatchesMerkle(tor, req, data))
+    {
+        dbgmsg(msgs, "block %u:%u->%u doesn't match its v2 hash", req->index, req->offset, req->length);
+        msgs->publishGotBadBlock(req);
+        return 0;
+    }
+
     /**
     ***  Save the block
     **/
@@ -2086,6 +2296,7 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
 
         for (int i = 0; i < n; ++i)
         {
+            maybeRequestMerkleLeaves(msgs, tr_torBlockPiece(msgs->torrent, blocks[i]));
             protocolSendRequest(msgs, blockToReq(msgs->torrent, blocks[i]));
         }
 
@@ -2093,6 +2304,47 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+/* true if the block can go straight from its file to the peer's socket:
+ * a plaintext TCP peer, and none of the block is waiting in the write cache */
+static bool canSendBlockFromFile(tr_peerMsgsImpl const* msgs, struct peer_request const* req)
+{
+    tr_torrent const* const tor = msgs->torrent;
+
+    if (!tr_peerIoSupportsSendfile(msgs->io) || req->length == 0)
+    {
+        return false;
+    }
+
+    auto const first = _tr_block(tor, req->index, req->offset);
+    auto const last = _tr_block(tor, req->index, req->offset + req->length - 1);
+
+    for (auto block = first; block <= last; ++block)
+    {
+        if (tr_cacheHasBlock(msgs->session->cache, tor, block))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* appends the block to `out` as a segment of its file, so that it's never
+ * copied into userspace. returns false, leaving `out` as it was, if the
+ * block has to be read into memory instead */
+static bool addBlockFromFile(tr_peerMsgsImpl* msgs, struct peer_request const* req, evbuffer* out)
+{
+    if (!canSendBlockFromFile(msgs, req))
+    {
+        return false;
+    }
+
+    auto fileOffset = uint64_t{};
+    tr_sys_file_t const fd = tr_ioOpenBlock(msgs->torrent, req->index, req->offset, req->length, &fileOffset);
+
+    return fd != TR_BAD_SYS_FILE && tr_peerIoAddFile(msgs->io, out, fd, fileOffset, req->length);
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     size_t bytesWritten = 0;
@@ -2189,33 +2441,40 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize && popNextRequest(msgs, &req))
+    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize && !nextRequestIsPending(msgs) &&
+        popNextRequest(msgs, &req))
     {
         --msgs->prefetchCount;
 
         if (requestIsValid(msgs, &req) && tr_torrentPieceIsComplete(msgs->torrent, req.index))
         {
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer_iovec iovec[1];
+            bool err = false;
 
             auto* const out = evbuffer_new();
-            evbuffer_expand(out, msglen);
 
             evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
             evbuffer_add_uint8(out, BtPiece);
             evbuffer_add_uint32(out, req.index);
             evbuffer_add_uint32(out, req.offset);
 
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            bool err = tr_cacheReadBlock(
-                           msgs->session->cache,
-                           msgs->torrent,
-                           req.index,
-                           req.offset,
-                           req.length,
-                           static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+            /* plaintext TCP peers get the block straight from the file with sendfile().
+             * everyone else gets a copy read through the cache */
+            if (!addBlockFromFile(msgs, &req, out))
+            {
+                struct evbuffer_iovec iovec[1];
+                evbuffer_expand(out, req.length);
+                evbuffer_reserve_space(out, req.length, iovec, 1);
+                err = tr_cacheReadBlockForUpload(
+                          msgs->session->cache,
+                          msgs->torrent,
+                          req.index,
+                          req.offset,
+                          req.length,
+                          static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
+                iovec[0].iov_len = req.length;
+                evbuffer_commit_space(out, iovec, 1);
+            }
 
             /* check the piece if it needs checking... */
             if (!err)
@@ -2673,12 +2932,12 @@ static void sendPex(tr_peerMsgsImpl* msgs)
     }
 }
 
-static void pexPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmsgs)
+static void pexPulse(void* vmsgs)
 {
     auto* msgs = static_cast<tr_peerMsgsImpl*>(vmsgs);
 
     sendPex(msgs);
 
     TR_ASSERT(msgs->pex_timer);
-    tr_timerAdd(msgs->pex_timer.get(), PexIntervalSecs, 0);
+    tr_sessionAddTimer(msgs->torrent->session, msgs->pex_timer.get(), PexIntervalSecs * 1000);
 }
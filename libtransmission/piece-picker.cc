@@ -0,0 +1,171 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <limits>
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "crypto-utils.h" /* tr_rand_int_weak() */
+#include "piece-picker.h"
+#include "tr-assert.h"
+
+void tr_piece_picker::reset(tr_piece_index_t n_pieces)
+{
+    pieces_.assign(n_pieces, piece_info{});
+
+    for (auto& group : buckets_)
+    {
+        group.clear();
+    }
+
+    wanted_count_ = 0;
+}
+
+void tr_piece_picker::insert(tr_piece_index_t piece)
+{
+    auto& info = pieces_[piece];
+    auto& group = buckets_[info.group];
+
+    if (std::size(group) <= info.availability)
+    {
+        group.resize(info.availability + 1);
+    }
+
+    // add it at a random spot to break ties between equally good pieces
+    auto& bucket = group[info.availability];
+    bucket.push_back(piece);
+    auto const pos = uint32_t(tr_rand_int_weak(int(std::size(bucket))));
+    std::swap(bucket[pos], bucket.back());
+    pieces_[bucket.back()].pos = uint32_t(std::size(bucket) - 1);
+    info.pos = pos;
+}
+
+void tr_piece_picker::erase(tr_piece_index_t piece)
+{
+    auto const& info = pieces_[piece];
+    auto& bucket = buckets_[info.group][info.availability];
+    TR_ASSERT(bucket[info.pos] == piece);
+
+    bucket[info.pos] = bucket.back();
+    pieces_[bucket.back()].pos = info.pos;
+    bucket.pop_back();
+}
+
+void tr_piece_picker::incrementAvailability(tr_piece_index_t piece)
+{
+    if (piece >= size() || pieces_[piece].availability == std::numeric_limits<uint16_t>::max())
+    {
+        return;
+    }
+
+    bool const wanted = isWanted(piece);
+
+    if (wanted)
+    {
+        erase(piece);
+    }
+
+    ++pieces_[piece].availability;
+
+    if (wanted)
+    {
+        insert(piece);
+    }
+}
+
+void tr_piece_picker::decrementAvailability(tr_piece_index_t piece)
+{
+    if (piece >= size() || pieces_[piece].availability == 0)
+    {
+        return;
+    }
+
+    bool const wanted = isWanted(piece);
+
+    if (wanted)
+    {
+        erase(piece);
+    }
+
+    --pieces_[piece].availability;
+
+    if (wanted)
+    {
+        insert(piece);
+    }
+}
+
+void tr_piece_picker::addBitfield(tr_bitfield const& have)
+{
+    if (have.hasNone())
+    {
+        return;
+    }
+
+    for (tr_piece_index_t piece = 0, n = size(); piece < n; ++piece)
+    {
+        if (have.test(piece))
+        {
+            incrementAvailability(piece);
+        }
+    }
+}
+
+void tr_piece_picker::removeBitfield(tr_bitfield const& have)
+{
+    if (have.hasNone())
+    {
+        return;
+    }
+
+    for (tr_piece_index_t piece = 0, n = size(); piece < n; ++piece)
+    {
+        if (have.test(piece))
+        {
+            decrementAvailability(piece);
+        }
+    }
+}
+
+void tr_piece_picker::setWanted(tr_piece_index_t piece, tr_priority_t priority, Progress progress)
+{
+    TR_ASSERT(piece < size());
+    TR_ASSERT(progress < N_PROGRESS);
+
+    auto const group = uint8_t(groupIndex(progress, priority));
+    auto& info = pieces_[piece];
+
+    if (info.group == group)
+    {
+        return;
+    }
+
+    if (info.group == NotWanted)
+    {
+        ++wanted_count_;
+    }
+    else
+    {
+        erase(piece);
+    }
+
+    info.group = group;
+    insert(piece);
+}
+
+void tr_piece_picker::setUnwanted(tr_piece_index_t piece)
+{
+    if (!isWanted(piece))
+    {
+        return;
+    }
+
+    erase(piece);
+    pieces_[piece].group = NotWanted;
+    --wanted_count_;
+}
@@ -0,0 +1,160 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transmission.h"
+
+class tr_bitfield;
+
+/**
+ * @brief Keeps the pieces we want in the order that we want to request them.
+ *
+ * Pieces are ordered by priority, then by availability (rarest first),
+ * then by progress (partly downloaded pieces first). Ties are broken randomly.
+ * Pieces whose missing blocks have all been requested already go last.
+ *
+ * Rather than keeping a sorted list, the pieces are kept in buckets with one
+ * bucket for each (progress, priority, availability). A have message or a new
+ * block request moves one piece from one bucket to another in O(1), and
+ * walking the buckets in order visits the pieces in sorted order.
+ */
+class tr_piece_picker
+{
+public:
+    /* how far along a wanted piece is */
+    enum Progress : uint8_t
+    {
+        PROGRESS_PARTIAL, /* some of its blocks are downloaded or requested */
+        PROGRESS_NONE, /* none of its blocks are downloaded or requested */
+        PROGRESS_REQUESTED, /* every block it's missing has been requested, so it goes after all the others */
+        N_PROGRESS
+    };
+
+    /* forget everything and track `n_pieces` unwanted pieces that no peer has */
+    void reset(tr_piece_index_t n_pieces);
+
+    [[nodiscard]] tr_piece_index_t size() const
+    {
+        return tr_piece_index_t(std::size(pieces_));
+    }
+
+    /// AVAILABILITY
+
+    [[nodiscard]] uint16_t availability(tr_piece_index_t piece) const
+    {
+        return piece < size() ? pieces_[piece].availability : 0;
+    }
+
+    void incrementAvailability(tr_piece_index_t piece);
+    void decrementAvailability(tr_piece_index_t piece);
+
+    /* count, or stop counting, every piece that a peer has */
+    void addBitfield(tr_bitfield const& have);
+    void removeBitfield(tr_bitfield const& have);
+
+    /// WANTED PIECES
+
+    [[nodiscard]] bool isWanted(tr_piece_index_t piece) const
+    {
+        return piece < size() && pieces_[piece].group != NotWanted;
+    }
+
+    [[nodiscard]] size_t wantedCount() const
+    {
+        return wanted_count_;
+    }
+
+    /* add a piece to the wanted pieces, or move it if it's already there */
+    void setWanted(tr_piece_index_t piece, tr_priority_t priority, Progress progress);
+    void setUnwanted(tr_piece_index_t piece);
+
+    /**
+     * Call `func(piece)` on each wanted piece, best first, until it returns false.
+     * `func` must not change the picker.
+     */
+    template<typename Func>
+    void forEachWanted(Func&& func) const
+    {
+        auto const visit = [&func](std::vector<tr_piece_index_t> const& bucket)
+        {
+            for (auto const piece : bucket)
+            {
+                if (!func(piece))
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        for (auto const priority : Priorities)
+        {
+            auto const& partial = buckets_[groupIndex(PROGRESS_PARTIAL, priority)];
+            auto const& none = buckets_[groupIndex(PROGRESS_NONE, priority)];
+
+            for (size_t i = 0, n = std::max(std::size(partial), std::size(none)); i < n; ++i)
+            {
+                if ((i < std::size(partial) && !visit(partial[i])) || (i < std::size(none) && !visit(none[i])))
+                {
+                    return;
+                }
+            }
+        }
+
+        for (auto const priority : Priorities)
+        {
+            for (auto const& bucket : buckets_[groupIndex(PROGRESS_REQUESTED, priority)])
+            {
+                if (!visit(bucket))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+private:
+    static auto constexpr NotWanted = uint8_t{ 0xFF };
+    static auto constexpr Priorities = std::array<tr_priority_t, 3>{ TR_PRI_HIGH, TR_PRI_NORMAL, TR_PRI_LOW };
+    static auto constexpr NGroups = size_t{ N_PROGRESS * std::size(Priorities) };
+
+    static constexpr size_t groupIndex(Progress progress, tr_priority_t priority)
+    {
+        size_t const priority_index = priority == TR_PRI_HIGH ? 0 : (priority == TR_PRI_NORMAL ? 1 : 2);
+        return progress * std::size(Priorities) + priority_index;
+    }
+
+    struct piece_info
+    {
+        uint16_t availability = 0;
+        uint8_t group = NotWanted; // groupIndex(), or NotWanted
+        uint32_t pos = 0; // where the piece is in its bucket
+    };
+
+    void insert(tr_piece_index_t piece);
+    void erase(tr_piece_index_t piece);
+
+    std::vector<piece_info> pieces_;
+
+    // buckets_[groupIndex(progress, priority)][availability] is a list of pieces
+    std::array<std::vector<std::vector<tr_piece_index_t>>, NGroups> buckets_;
+
+    size_t wanted_count_ = 0;
+};
@@ -23,7 +23,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 430>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -47,6 +47,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "anti-brute-force-enabled"sv,
                                                               "anti-brute-force-threshold"sv,
                                                               "arguments"sv,
+                                                              "attr"sv,
+                                                              "averageLatencyUsec"sv,
                                                               "bandwidth-priority"sv,
                                                               "bandwidthPriority"sv,
                                                               "bind-address-ipv4"sv,
@@ -59,7 +61,10 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "blocklist-url"sv,
                                                               "blocks"sv,
                                                               "bytesCompleted"sv,
+                                                              "bytesPerSecond"sv,
+                                                              "bytesVerified"sv,
                                                               "cache-size-mb"sv,
+                                                              "cache-stats"sv,
                                                               "clientIsChoked"sv,
                                                               "clientIsInterested"sv,
                                                               "clientName"sv,
@@ -85,6 +90,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "details-window-height"sv,
                                                               "details-window-width"sv,
                                                               "dht-enabled"sv,
+                                                              "disk-io-stats"sv,
+                                                              "disk-io-threads"sv,
                                                               "display-name"sv,
                                                               "dnd"sv,
                                                               "done-date"sv,
@@ -116,6 +123,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "etaIdle"sv,
                                                               "failure reason"sv,
                                                               "fields"sv,
+                                                              "file tree"sv,
                                                               "file-count"sv,
                                                               "fileStats"sv,
                                                               "filename"sv,
@@ -137,6 +145,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "fromLtep"sv,
                                                               "fromPex"sv,
                                                               "fromTracker"sv,
+                                                              "groReceives"sv,
+                                                              "gsoSends"sv,
                                                               "hasAnnounced"sv,
                                                               "hasScraped"sv,
                                                               "hashString"sv,
@@ -158,6 +168,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "info_hash"sv,
                                                               "inhibit-desktop-hibernation"sv,
                                                               "interval"sv,
+                                                              "io-uring-enabled"sv,
                                                               "ip"sv,
                                                               "ipv4"sv,
                                                               "ipv6"sv,
@@ -170,6 +181,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "isStalled"sv,
                                                               "isUTP"sv,
                                                               "isUploadingTo"sv,
+                                                              "jobsDone"sv,
                                                               "labels"sv,
                                                               "lastAnnouncePeerCount"sv,
                                                               "lastAnnounceResult"sv,
@@ -199,9 +211,13 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "manualAnnounceTime"sv,
                                                               "max-peers"sv,
                                                               "maxConnectedPeers"sv,
+                                                              "maxLatencyUsec"sv,
+                                                              "maxRecvBatch"sv,
+                                                              "maxSendBatch"sv,
                                                               "memory-bytes"sv,
                                                               "memory-units"sv,
                                                               "message-level"sv,
+                                                              "meta version"sv,
                                                               "metadataPercentComplete"sv,
                                                               "metadata_size"sv,
                                                               "metainfo"sv,
@@ -218,6 +234,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "nodes"sv,
                                                               "nodes6"sv,
                                                               "open-dialog-dir"sv,
+                                                              "open-file-limit"sv,
                                                               "p"sv,
                                                               "path"sv,
                                                               "path.utf-8"sv,
@@ -246,16 +263,20 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "percentDone"sv,
                                                               "pex-enabled"sv,
                                                               "piece"sv,
+                                                              "piece layers"sv,
                                                               "piece length"sv,
                                                               "pieceCount"sv,
                                                               "pieceSize"sv,
                                                               "pieces"sv,
+                                                              "pieces root"sv,
                                                               "play-download-complete-sound"sv,
                                                               "port"sv,
                                                               "port-forwarding-enabled"sv,
                                                               "port-is-open"sv,
                                                               "preallocation"sv,
+                                                              "prefetch-budget-mb"sv,
                                                               "prefetch-enabled"sv,
+                                                              "prefetch-lookahead"sv,
                                                               "primary-mime-type"sv,
                                                               "priorities"sv,
                                                               "priority"sv,
@@ -271,7 +292,9 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "queue-move-up"sv,
                                                               "queue-stalled-enabled"sv,
                                                               "queue-stalled-minutes"sv,
+                                                              "queueDepth"sv,
                                                               "queuePosition"sv,
+                                                              "queuedTorrentCount"sv,
                                                               "rateDownload"sv,
                                                               "rateToClient"sv,
                                                               "rateToPeer"sv,
@@ -279,11 +302,17 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ratio-limit"sv,
                                                               "ratio-limit-enabled"sv,
                                                               "ratio-mode"sv,
+                                                              "readBytes"sv,
+                                                              "readEvictions"sv,
+                                                              "readHits"sv,
+                                                              "readMisses"sv,
                                                               "recent-download-dir-1"sv,
                                                               "recent-download-dir-2"sv,
                                                               "recent-download-dir-3"sv,
                                                               "recent-download-dir-4"sv,
                                                               "recheckProgress"sv,
+                                                              "recvBatches"sv,
+                                                              "recvDatagrams"sv,
                                                               "remote-session-enabled"sv,
                                                               "remote-session-host"sv,
                                                               "remote-session-password"sv,
@@ -328,6 +357,9 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "seedRatioMode"sv,
                                                               "seederCount"sv,
                                                               "seeding-time-seconds"sv,
+                                                              "sendBatches"sv,
+                                                              "sendDatagrams"sv,
+                                                              "sendErrors"sv,
                                                               "session-count"sv,
                                                               "session-id"sv,
                                                               "sessionCount"sv,
@@ -385,6 +417,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "trackers"sv,
                                                               "trash-can-enabled"sv,
                                                               "trash-original-torrent-files"sv,
+                                                              "udp-stats"sv,
                                                               "umask"sv,
                                                               "units"sv,
                                                               "upload-slots-per-torrent"sv,
@@ -408,13 +441,18 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ut_recommend"sv,
                                                               "utp-enabled"sv,
                                                               "v"sv,
+                                                              "verify-speed-limit-mb"sv,
+                                                              "verify-stats"sv,
+                                                              "verify-threads"sv,
                                                               "version"sv,
                                                               "wanted"sv,
                                                               "warning message"sv,
                                                               "watch-dir"sv,
                                                               "watch-dir-enabled"sv,
                                                               "webseeds"sv,
-                                                              "webseedsSendingToUs"sv };
+                                                              "webseedsSendingToUs"sv,
+                                                              "workerCount"sv,
+                                                              "writeBytes"sv };
 
 size_t constexpr quarks_are_sorted = ( //
     []() constexpr
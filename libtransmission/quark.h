@@ -50,6 +50,8 @@ enum
     TR_KEY_anti_brute_force_enabled, /* rpc */
     TR_KEY_anti_brute_force_threshold, /* rpc */
     TR_KEY_arguments, /* rpc */
+    TR_KEY_attr,
+    TR_KEY_averageLatencyUsec,
     TR_KEY_bandwidth_priority,
     TR_KEY_bandwidthPriority,
     TR_KEY_bind_address_ipv4,
@@ -62,7 +64,10 @@ enum
     TR_KEY_blocklist_url,
     TR_KEY_blocks,
     TR_KEY_bytesCompleted,
+    TR_KEY_bytesPerSecond,
+    TR_KEY_bytesVerified,
     TR_KEY_cache_size_mb,
+    TR_KEY_cache_stats,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
     TR_KEY_clientName,
@@ -88,6 +93,8 @@ enum
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
     TR_KEY_dht_enabled,
+    TR_KEY_disk_io_stats,
+    TR_KEY_disk_io_threads,
     TR_KEY_display_name,
     TR_KEY_dnd,
     TR_KEY_done_date,
@@ -119,6 +126,7 @@ enum
     TR_KEY_etaIdle,
     TR_KEY_failure_reason,
     TR_KEY_fields,
+    TR_KEY_file_tree,
     TR_KEY_file_count,
     TR_KEY_fileStats,
     TR_KEY_filename,
@@ -140,6 +148,8 @@ enum
     TR_KEY_fromLtep,
     TR_KEY_fromPex,
     TR_KEY_fromTracker,
+    TR_KEY_groReceives,
+    TR_KEY_gsoSends,
     TR_KEY_hasAnnounced,
     TR_KEY_hasScraped,
     TR_KEY_hashString,
@@ -161,6 +171,7 @@ enum
     TR_KEY_info_hash,
     TR_KEY_inhibit_desktop_hibernation,
     TR_KEY_interval,
+    TR_KEY_io_uring_enabled,
     TR_KEY_ip,
     TR_KEY_ipv4,
     TR_KEY_ipv6,
@@ -173,6 +184,7 @@ enum
     TR_KEY_isStalled,
     TR_KEY_isUTP,
     TR_KEY_isUploadingTo,
+    TR_KEY_jobsDone,
     TR_KEY_labels,
     TR_KEY_lastAnnouncePeerCount,
     TR_KEY_lastAnnounceResult,
@@ -202,9 +214,13 @@ enum
     TR_KEY_manualAnnounceTime,
     TR_KEY_max_peers,
     TR_KEY_maxConnectedPeers,
+    TR_KEY_maxLatencyUsec,
+    TR_KEY_maxRecvBatch,
+    TR_KEY_maxSendBatch,
     TR_KEY_memory_bytes,
     TR_KEY_memory_units,
     TR_KEY_message_level,
+    TR_KEY_meta_version,
     TR_KEY_metadataPercentComplete,
     TR_KEY_metadata_size,
     TR_KEY_metainfo,
@@ -221,6 +237,7 @@ enum
     TR_KEY_nodes,
     TR_KEY_nodes6,
     TR_KEY_open_dialog_dir,
+    TR_KEY_open_file_limit,
     TR_KEY_p,
     TR_KEY_path,
     TR_KEY_path_utf_8,
@@ -249,16 +266,20 @@ enum
     TR_KEY_percentDone,
     TR_KEY_pex_enabled,
     TR_KEY_piece,
+    TR_KEY_piece_layers,
     TR_KEY_piece_length,
     TR_KEY_pieceCount,
     TR_KEY_pieceSize,
     TR_KEY_pieces,
+    TR_KEY_pieces_root,
     TR_KEY_play_download_complete_sound,
     TR_KEY_port,
     TR_KEY_port_forwarding_enabled,
     TR_KEY_port_is_open,
     TR_KEY_preallocation,
+    TR_KEY_prefetch_budget_mb,
     TR_KEY_prefetch_enabled,
+    TR_KEY_prefetch_lookahead,
     TR_KEY_primary_mime_type,
     TR_KEY_priorities,
     TR_KEY_priority,
@@ -274,7 +295,9 @@ enum
     TR_KEY_queue_move_up,
     TR_KEY_queue_stalled_enabled,
     TR_KEY_queue_stalled_minutes,
+    TR_KEY_queueDepth,
     TR_KEY_queuePosition,
+    TR_KEY_queuedTorrentCount,
     TR_KEY_rateDownload,
     TR_KEY_rateToClient,
     TR_KEY_rateToPeer,
@@ -282,11 +305,17 @@ enum
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
+    TR_KEY_readBytes,
+    TR_KEY_readEvictions,
+    TR_KEY_readHits,
+    TR_KEY_readMisses,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
     TR_KEY_recent_download_dir_4,
     TR_KEY_recheckProgress,
+    TR_KEY_recvBatches,
+    TR_KEY_recvDatagrams,
     TR_KEY_remote_session_enabled,
     TR_KEY_remote_session_host,
     TR_KEY_remote_session_password,
@@ -331,6 +360,9 @@ enum
     TR_KEY_seedRatioMode,
     TR_KEY_seederCount,
     TR_KEY_seeding_time_seconds,
+    TR_KEY_sendBatches,
+    TR_KEY_sendDatagrams,
+    TR_KEY_sendErrors,
     TR_KEY_session_count,
     TR_KEY_session_id,
     TR_KEY_sessionCount,
@@ -388,6 +420,7 @@ enum
     TR_KEY_trackers,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
+    TR_KEY_udp_stats,
     TR_KEY_umask,
     TR_KEY_units,
     TR_KEY_upload_slots_per_torrent,
@@ -411,6 +444,9 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_speed_limit_mb,
+    TR_KEY_verify_stats,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_warning_message,
@@ -418,6 +454,8 @@ enum
     TR_KEY_watch_dir_enabled,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
+    TR_KEY_workerCount,
+    TR_KEY_writeBytes,
     TR_N_KEYS
 };
 
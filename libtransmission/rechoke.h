@@ -0,0 +1,82 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+/* a swarm never gets more than this many times uploadSlotsPerTorrent */
+auto inline constexpr TR_MAX_UPLOAD_SLOTS_MULTIPLIER = int{ 4 };
+
+/**
+ * @brief How many interested peers a swarm may unchoke.
+ *
+ * Each swarm gets half of `per_torrent`. The rest of the session's slots,
+ * `per_torrent` for each of the `active_swarms`, are shared between the
+ * swarms by how fast their peers have been trading with us: a swarm's share
+ * is `contribution / contribution_total`.
+ */
+[[nodiscard]] constexpr int tr_rechokeUploadSlots(
+    int per_torrent,
+    size_t active_swarms,
+    uint64_t contribution,
+    uint64_t contribution_total)
+{
+    if (active_swarms == 0 || contribution_total == 0)
+    {
+        return per_torrent;
+    }
+
+    int const guaranteed = std::max(1, per_torrent / 2);
+    auto const shared = uint64_t(std::max(0, per_torrent - guaranteed)) * active_swarms;
+    auto const earned = shared * contribution / contribution_total;
+    auto const max_earned = uint64_t(std::max(0, per_torrent * TR_MAX_UPLOAD_SLOTS_MULTIPLIER - guaranteed));
+    return guaranteed + int(std::min(earned, max_earned));
+}
+
+/**
+ * @brief Walk a map of swarms round-robin, starting just after `cursor`.
+ *
+ * `visit` is called on each swarm in turn and returns true if it rechoked
+ * that swarm. The walk stops once `max_rechoked` swarms have been rechoked
+ * or every swarm has been visited, and `cursor` is left at the last swarm
+ * visited so that the next walk picks up where this one stopped.
+ *
+ * @return how many swarms were rechoked
+ */
+template<typename Map, typename Visit>
+size_t tr_rechokeRoundRobin(Map const& swarms, typename Map::key_type& cursor, size_t max_rechoked, Visit visit)
+{
+    auto const n_swarms = std::size(swarms);
+    auto n_rechoked = size_t{};
+    auto it = swarms.upper_bound(cursor);
+
+    for (size_t i = 0; i < n_swarms && n_rechoked < max_rechoked; ++i, ++it)
+    {
+        if (it == std::end(swarms))
+        {
+            it = std::begin(swarms);
+        }
+
+        cursor = it->first;
+
+        if (visit(it->second))
+        {
+            ++n_rechoked;
+        }
+    }
+
+    return n_rechoked;
+}
@@ -685,8 +685,8 @@ void tr_torrentSaveResume(tr_torrent* tor)
     }
 
     tr_variantInitDict(&top, 50); /* arbitrary "big enough" number */
-    tr_variantDictAddInt(&top, TR_KEY_seeding_time_seconds, tor->secondsSeeding);
-    tr_variantDictAddInt(&top, TR_KEY_downloading_time_seconds, tor->secondsDownloading);
+    tr_variantDictAddInt(&top, TR_KEY_seeding_time_seconds, tr_torrentGetSecondsSeeding(tor, tr_time()));
+    tr_variantDictAddInt(&top, TR_KEY_downloading_time_seconds, tr_torrentGetSecondsDownloading(tor, tr_time()));
     tr_variantDictAddInt(&top, TR_KEY_activity_date, tor->activityDate);
     tr_variantDictAddInt(&top, TR_KEY_added_date, tor->addedDate);
     tr_variantDictAddInt(&top, TR_KEY_corrupt, tor->corruptPrev + tor->corruptCur);
@@ -22,8 +22,10 @@
 #include <zlib.h>
 
 #include "transmission.h"
+#include "cache.h"
 #include "completion.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
@@ -36,8 +38,11 @@
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-macros.h"
+#include "tr-udp.h" /* tr_udpGetStats() */
+#include "udp-io.h" /* tr_udp_io_stats */
 #include "utils.h"
 #include "variant.h"
+#include "verify.h"
 #include "version.h"
 #include "web.h"
 #include "web-utils.h"
@@ -1875,6 +1880,21 @@ static char const* sessionSet(
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(args_in, TR_KEY_disk_io_threads, &i))
+    {
+        tr_sessionSetDiskIoThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(args_in, TR_KEY_verify_threads, &i))
+    {
+        tr_sessionSetVerifyThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(args_in, TR_KEY_verify_speed_limit_mb, &i))
+    {
+        tr_sessionSetVerifySpeedLimit_MBps(session, i);
+    }
+
     if (tr_variantDictFindInt(args_in, TR_KEY_alt_speed_up, &i))
     {
         tr_sessionSetAltSpeed_KBps(session, TR_UP, i);
@@ -2154,6 +2174,42 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto const disk_io_stats = tr_diskIoGetStats(session->diskIo);
+    d = tr_variantDictAddDict(args_out, TR_KEY_disk_io_stats, 5);
+    tr_variantDictAddInt(d, TR_KEY_averageLatencyUsec, disk_io_stats.average_latency_usec);
+    tr_variantDictAddInt(d, TR_KEY_jobsDone, disk_io_stats.jobs_done);
+    tr_variantDictAddInt(d, TR_KEY_maxLatencyUsec, disk_io_stats.max_latency_usec);
+    tr_variantDictAddInt(d, TR_KEY_queueDepth, disk_io_stats.queue_depth);
+    tr_variantDictAddInt(d, TR_KEY_workerCount, disk_io_stats.worker_count);
+
+    auto const cache_stats = tr_cacheGetStats(session->cache);
+    d = tr_variantDictAddDict(args_out, TR_KEY_cache_stats, 5);
+    tr_variantDictAddInt(d, TR_KEY_readBytes, cache_stats.read_bytes);
+    tr_variantDictAddInt(d, TR_KEY_readEvictions, cache_stats.read_evictions);
+    tr_variantDictAddInt(d, TR_KEY_readHits, cache_stats.read_hits);
+    tr_variantDictAddInt(d, TR_KEY_readMisses, cache_stats.read_misses);
+    tr_variantDictAddInt(d, TR_KEY_writeBytes, cache_stats.write_bytes);
+
+    auto const udp_stats = tr_udpGetStats(session);
+    d = tr_variantDictAddDict(args_out, TR_KEY_udp_stats, 9);
+    tr_variantDictAddInt(d, TR_KEY_groReceives, udp_stats.gro_receives);
+    tr_variantDictAddInt(d, TR_KEY_gsoSends, udp_stats.gso_sends);
+    tr_variantDictAddInt(d, TR_KEY_maxRecvBatch, udp_stats.max_recv_batch);
+    tr_variantDictAddInt(d, TR_KEY_maxSendBatch, udp_stats.max_send_batch);
+    tr_variantDictAddInt(d, TR_KEY_recvBatches, udp_stats.recv_batches);
+    tr_variantDictAddInt(d, TR_KEY_recvDatagrams, udp_stats.recv_datagrams);
+    tr_variantDictAddInt(d, TR_KEY_sendBatches, udp_stats.send_batches);
+    tr_variantDictAddInt(d, TR_KEY_sendDatagrams, udp_stats.send_datagrams);
+    tr_variantDictAddInt(d, TR_KEY_sendErrors, udp_stats.send_errors);
+
+    auto const verify_stats = tr_verifyGetStats();
+    d = tr_variantDictAddDict(args_out, TR_KEY_verify_stats, 5);
+    tr_variantDictAddInt(d, TR_KEY_activeTorrentCount, verify_stats.active_count);
+    tr_variantDictAddInt(d, TR_KEY_bytesPerSecond, verify_stats.bytes_per_second);
+    tr_variantDictAddInt(d, TR_KEY_bytesVerified, verify_stats.bytes_verified);
+    tr_variantDictAddInt(d, TR_KEY_queuedTorrentCount, verify_stats.queued_count);
+    tr_variantDictAddInt(d, TR_KEY_workerCount, verify_stats.thread_count);
+
     return nullptr;
 }
 
@@ -2216,6 +2272,18 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddInt(d, key, tr_sessionGetCacheLimit_MB(s));
         break;
 
+    case TR_KEY_disk_io_threads:
+        tr_variantDictAddInt(d, key, tr_sessionGetDiskIoThreads(s));
+        break;
+
+    case TR_KEY_verify_threads:
+        tr_variantDictAddInt(d, key, tr_sessionGetVerifyThreads(s));
+        break;
+
+    case TR_KEY_verify_speed_limit_mb:
+        tr_variantDictAddInt(d, key, tr_sessionGetVerifySpeedLimit_MBps(s));
+        break;
+
     case TR_KEY_blocklist_size:
         tr_variantDictAddInt(d, key, tr_blocklistGetRuleCount(s));
         break;
@@ -8,6 +8,7 @@
 
 #include <algorithm> // std::partial_sort(), std::min(), std::max()
 #include <cerrno> /* ENOENT */
+#include <chrono>
 #include <climits> /* INT_MAX */
 #include <csignal>
 #include <cstdint>
@@ -37,6 +38,7 @@
 #include "blocklist.h"
 #include "cache.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "error-types.h"
 #include "error.h"
 #include "fdlimit.h"
@@ -52,6 +54,7 @@
 #include "session-id.h"
 #include "session.h"
 #include "stats.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-dht.h" /* tr_dhtUpkeep() */
@@ -69,11 +72,18 @@ using namespace std::literals;
 
 #ifdef TR_LIGHTWEIGHT
 static auto constexpr DefaultCacheSizeMB = int{ 2 };
+static auto constexpr DefaultDiskIoThreads = int{ 0 };
 static auto constexpr DefaultPrefetchEnabled = bool{ false };
+static auto constexpr DefaultVerifyThreads = int{ 1 };
 #else
 static auto constexpr DefaultCacheSizeMB = int{ 4 };
+static auto constexpr DefaultDiskIoThreads = int{ 2 };
 static auto constexpr DefaultPrefetchEnabled = bool{ true };
+static auto constexpr DefaultVerifyThreads = int{ 2 };
 #endif
+/* read-aheads share the cache with uploads that are already being served */
+static auto constexpr DefaultPrefetchBudgetMB = DefaultCacheSizeMB / 2;
+static auto constexpr DefaultPrefetchLookahead = int{ 18 };
 static auto constexpr SaveIntervalSecs = int{ 360 };
 
 #define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
@@ -322,12 +332,16 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 69);
+    tr_variantDictReserve(d, 76);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist"sv);
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DefaultCacheSizeMB);
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, true);
+    tr_variantDictAddInt(d, TR_KEY_disk_io_threads, DefaultDiskIoThreads);
+    tr_variantDictAddBool(d, TR_KEY_io_uring_enabled, false);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, true);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit_mb, 0);
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, DefaultVerifyThreads);
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddInt(d, TR_KEY_speed_limit_down, 100);
@@ -338,6 +352,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_message_level, TR_LOG_INFO);
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, TR_DEFAULT_OPEN_FILE_LIMIT);
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, 5);
     tr_variantDictAddBool(d, TR_KEY_download_queue_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, atoi(TR_DEFAULT_PEER_LIMIT_GLOBAL_STR));
@@ -351,6 +366,8 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DefaultPrefetchEnabled);
+    tr_variantDictAddInt(d, TR_KEY_prefetch_budget_mb, DefaultPrefetchBudgetMB);
+    tr_variantDictAddInt(d, TR_KEY_prefetch_lookahead, DefaultPrefetchLookahead);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
@@ -398,12 +415,16 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 68);
+    tr_variantDictReserve(d, 75);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, s->useBlocklist());
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, s->blocklistUrl());
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, s->isDHTEnabled);
+    tr_variantDictAddInt(d, TR_KEY_disk_io_threads, tr_sessionGetDiskIoThreads(s));
+    tr_variantDictAddBool(d, TR_KEY_io_uring_enabled, tr_sys_file_batch_get_backend() == TR_SYS_FILE_BATCH_IO_URING);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, s->isUTPEnabled);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit_mb, tr_sessionGetVerifySpeedLimit_MBps(s));
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, tr_sessionGetVerifyThreads(s));
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, s->isLPDEnabled);
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_sessionGetDownloadDir(s));
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, tr_sessionGetQueueSize(s, TR_DOWN));
@@ -416,6 +437,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_sessionGetIncompleteDir(s));
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, tr_sessionIsIncompleteDirEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_message_level, tr_logGetLevel());
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, tr_fdGetFileLimit(s));
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, s->peerLimit);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_per_torrent, s->peerLimitPerTorrent);
     tr_variantDictAddInt(d, TR_KEY_peer_port, tr_sessionGetPeerPort(s));
@@ -428,6 +450,8 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
+    tr_variantDictAddInt(d, TR_KEY_prefetch_budget_mb, tr_sessionGetPrefetchBudget_MB(s));
+    tr_variantDictAddInt(d, TR_KEY_prefetch_lookahead, s->prefetchLookahead);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
@@ -547,6 +571,77 @@ void tr_sessionSaveSettings(tr_session* session, char const* configDir, tr_varia
     tr_variantFree(&settings);
 }
 
+/***
+****  Timers
+***/
+
+static tr_timer_wheel::tick_t timerWheelNow()
+{
+    auto const since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+    auto const msec = std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch).count();
+    return tr_timer_wheel::tick_t(msec) / tr_timer_wheel::TickMsec;
+}
+
+/* make sure that timerWheelEvent goes off by the time the wheel's next timer is due */
+static void timerWheelArm(tr_session* session)
+{
+    TR_ASSERT(tr_amInEventThread(session));
+
+    /* onTimerWheel() arms it once it's done running the timers */
+    if (session->timerWheelEvent == nullptr || session->timerWheelIsAdvancing)
+    {
+        return;
+    }
+
+    auto const next = session->timerWheel->nextTick();
+    if (!next || (session->timerWheelEventTick != 0 && session->timerWheelEventTick <= *next))
+    {
+        return;
+    }
+
+    auto const now = timerWheelNow();
+    auto constexpr MaxTicks = tr_timer_wheel::tick_t{ INT_MAX / tr_timer_wheel::TickMsec };
+    auto const ticks = *next > now ? std::min(*next - now, MaxTicks) : 0;
+
+    session->timerWheelEventTick = *next;
+    tr_timerAddMsec(session->timerWheelEvent, int(ticks) * tr_timer_wheel::TickMsec);
+}
+
+static void timerWheelArmInEventThread(void* vsession)
+{
+    timerWheelArm(static_cast<tr_session*>(vsession));
+}
+
+static void onTimerWheel(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
+{
+    auto* session = static_cast<tr_session*>(vsession);
+
+    session->timerWheelEventTick = 0;
+    session->timerWheelIsAdvancing = true;
+    session->timerWheel->advance(timerWheelNow());
+    session->timerWheelIsAdvancing = false;
+
+    timerWheelArm(session);
+}
+
+void tr_sessionAddTimer(tr_session* session, tr_timer* timer, int msec)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(msec >= 0);
+
+    auto const delay = tr_timer_wheel::tick_t((msec + tr_timer_wheel::TickMsec - 1) / tr_timer_wheel::TickMsec);
+    session->timerWheel->schedule(timer, timerWheelNow(), delay);
+
+    if (tr_amInEventThread(session))
+    {
+        timerWheelArm(session);
+    }
+    else
+    {
+        tr_runInEventThread(session, timerWheelArmInEventThread, session);
+    }
+}
+
 /***
 ****
 ***/
@@ -556,7 +651,7 @@ void tr_sessionSaveSettings(tr_session* session, char const* configDir, tr_varia
  * status has recently changed. This prevents loss of metadata
  * in the case of a crash, unclean shutdown, clumsy user, etc.
  */
-static void onSaveTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
+static void onSaveTimer(void* vsession)
 {
     auto* session = static_cast<tr_session*>(vsession);
 
@@ -572,7 +667,7 @@ static void onSaveTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
 
     tr_statsSaveDirty(session);
 
-    tr_timerAdd(session->saveTimer, SaveIntervalSecs, 0);
+    tr_sessionAddTimer(session, session->saveTimer, SaveIntervalSecs * 1000);
 }
 
 /***
@@ -603,6 +698,8 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
     session->lock = tr_lockNew();
     session->cache = tr_cacheNew(1024 * 1024 * 2);
     session->magicNumber = SESSION_MAGIC_NUMBER;
+    tr_fdInit(session);
+    session->diskIo = tr_diskIoNew(session, 0);
     session->session_id = tr_session_id_new();
     session->bandwidth = new Bandwidth(nullptr);
     session->removed_torrents.clear();
@@ -639,7 +736,7 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
 
 static void turtleCheckClock(tr_session* s, struct tr_turtle_info* t);
 
-static void onNowTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
+static void onNowTimer(void* vsession)
 {
     auto* session = static_cast<tr_session*>(vsession);
 
@@ -661,24 +758,6 @@ static void onNowTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
         turtleCheckClock(session, &session->turtle);
     }
 
-    // TODO: this seems a little silly. Why do we increment this
-    // every second instead of computing the value as needed by
-    // subtracting the current time from a start time?
-    for (auto* tor : session->torrents)
-    {
-        if (tor->isRunning)
-        {
-            if (tr_torrentIsSeed(tor))
-            {
-                ++tor->secondsSeeding;
-            }
-            else
-            {
-                ++tor->secondsDownloading;
-            }
-        }
-    }
-
     /**
     ***  Set the timer
     **/
@@ -686,11 +765,11 @@ static void onNowTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
     /* schedule the next timer for right after the next second begins */
     struct timeval tv;
     tr_gettimeofday(&tv);
-    int constexpr Min = 100;
-    int constexpr Max = 999999;
-    int const usec = std::clamp(int(1000000 - tv.tv_usec), Min, Max);
+    int constexpr Min = 1;
+    int constexpr Max = 999;
+    int const msec = std::clamp(int(1000000 - tv.tv_usec) / 1000, Min, Max);
 
-    tr_timerAdd(session->nowTimer, 0, usec);
+    tr_sessionAddTimer(session, session->nowTimer, msec);
 }
 
 static void loadBlocklists(tr_session* session);
@@ -713,8 +792,10 @@ static void tr_sessionInitImpl(void* vdata)
     tr_variantMergeDicts(&settings, clientSettings);
 
     TR_ASSERT(session->event_base != nullptr);
-    session->nowTimer = evtimer_new(session->event_base, onNowTimer, session);
-    onNowTimer(0, 0, session);
+    session->timerWheel = new tr_timer_wheel{ timerWheelNow() };
+    session->timerWheelEvent = evtimer_new(session->event_base, onTimerWheel, session);
+    session->nowTimer = new tr_timer{ onNowTimer, session };
+    onNowTimer(session);
 
 #ifndef _WIN32
     /* Don't exit when writing on a broken socket */
@@ -741,8 +822,8 @@ static void tr_sessionInitImpl(void* vdata)
 
     TR_ASSERT(tr_isSession(session));
 
-    session->saveTimer = evtimer_new(session->event_base, onSaveTimer, session);
-    tr_timerAdd(session->saveTimer, SaveIntervalSecs, 0);
+    session->saveTimer = new tr_timer{ onSaveTimer, session };
+    tr_sessionAddTimer(session, session->saveTimer, SaveIntervalSecs * 1000);
 
     tr_announcerInit(session);
 
@@ -808,6 +889,37 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    /* the disk I/O thread count is limited by this, so it goes first */
+    if (tr_variantDictFindInt(settings, TR_KEY_open_file_limit, &i))
+    {
+        tr_fdSetFileLimit(session, int(i));
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_disk_io_threads, &i))
+    {
+        tr_sessionSetDiskIoThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_threads, &i))
+    {
+        tr_sessionSetVerifyThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_speed_limit_mb, &i))
+    {
+        tr_sessionSetVerifySpeedLimit_MBps(session, i);
+    }
+
+    if (tr_variantDictFindBool(settings, TR_KEY_io_uring_enabled, &boolVal))
+    {
+        auto const backend = boolVal ? TR_SYS_FILE_BATCH_IO_URING : TR_SYS_FILE_BATCH_SEQUENTIAL;
+
+        if (!tr_sys_file_batch_set_backend(backend))
+        {
+            tr_logAddInfo(_("io_uring isn't available; using pread() and pwrite() instead"));
+        }
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_peer_limit_per_torrent, &i))
     {
         tr_sessionSetPeerLimitPerTorrent(session, i);
@@ -909,6 +1021,16 @@ static void sessionSetImpl(void* vdata)
         session->isPrefetchEnabled = boolVal;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_prefetch_budget_mb, &i))
+    {
+        tr_sessionSetPrefetchBudget_MB(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_prefetch_lookahead, &i))
+    {
+        session->prefetchLookahead = std::max(int(i), 0);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_preallocation, &i))
     {
         session->preallocationMode = tr_preallocation_mode(i);
@@ -1836,7 +1958,7 @@ std::vector<tr_torrent*> tr_sessionGetTorrents(tr_session* session)
 
 static void closeBlocklists(tr_session*);
 
-static void sessionCloseImplWaitForIdleUdp(evutil_socket_t fd, short what, void* vsession);
+static void sessionCloseImplWaitForIdleUdp(void* vsession);
 
 static void sessionCloseImplStart(tr_session* session)
 {
@@ -1852,10 +1974,10 @@ static void sessionCloseImplStart(tr_session* session)
     tr_utpClose(session);
     tr_dhtUninit(session);
 
-    event_free(session->saveTimer);
+    delete session->saveTimer;
     session->saveTimer = nullptr;
 
-    event_free(session->nowTimer);
+    delete session->nowTimer;
     session->nowTimer = nullptr;
 
     tr_verifyClose(session);
@@ -1892,18 +2014,22 @@ static void sessionCloseImplStart(tr_session* session)
        it won't be idle until the announce events are sent... */
     tr_webClose(session, TR_WEB_CLOSE_WHEN_IDLE);
 
+    /* the disk I/O workers' callbacks may still touch the cache */
+    tr_diskIoFree(session->diskIo);
+    session->diskIo = nullptr;
+
     tr_cacheFree(session->cache);
     session->cache = nullptr;
 
     /* saveTimer is not used at this point, reusing for UDP shutdown wait */
     TR_ASSERT(session->saveTimer == nullptr);
-    session->saveTimer = evtimer_new(session->event_base, sessionCloseImplWaitForIdleUdp, session);
-    tr_timerAdd(session->saveTimer, 0, 0);
+    session->saveTimer = new tr_timer{ sessionCloseImplWaitForIdleUdp, session };
+    tr_sessionAddTimer(session, session->saveTimer, 0);
 }
 
 static void sessionCloseImplFinish(tr_session* session);
 
-static void sessionCloseImplWaitForIdleUdp(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
+static void sessionCloseImplWaitForIdleUdp(void* vsession)
 {
     auto* session = static_cast<tr_session*>(vsession);
 
@@ -1914,7 +2040,7 @@ static void sessionCloseImplWaitForIdleUdp(evutil_socket_t /*fd*/, short /*what*
     if (!tr_tracker_udp_is_idle(session))
     {
         tr_tracker_udp_upkeep(session);
-        tr_timerAdd(session->saveTimer, 0, 100000);
+        tr_sessionAddTimer(session, session->saveTimer, 100);
         return;
     }
 
@@ -1923,7 +2049,8 @@ static void sessionCloseImplWaitForIdleUdp(evutil_socket_t /*fd*/, short /*what*
 
 static void sessionCloseImplFinish(tr_session* session)
 {
-    event_free(session->saveTimer);
+    /* this is called from saveTimer's callback, which is done with it now */
+    delete session->saveTimer;
     session->saveTimer = nullptr;
 
     /* we had to wait until UDP trackers were closed before closing these: */
@@ -1939,6 +2066,9 @@ static void sessionCloseImplFinish(tr_session* session)
 
     tr_fdClose(session);
 
+    event_free(session->timerWheelEvent);
+    session->timerWheelEvent = nullptr;
+
     session->isClosed = true;
 }
 
@@ -2022,6 +2152,7 @@ void tr_sessionClose(tr_session* session)
     }
 
     /* free the session memory */
+    delete session->timerWheel;
     delete session->bandwidth;
     delete session->turtle.minutes;
     tr_session_id_free(session->session_id);
@@ -2271,6 +2402,66 @@ int tr_sessionGetCacheLimit_MB(tr_session const* session)
     return toMemMB(tr_cacheGetLimit(session->cache));
 }
 
+void tr_sessionSetPrefetchBudget_MB(tr_session* session, int mb)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_cacheSetPrefetchLimit(session->cache, toMemBytes(mb));
+}
+
+int tr_sessionGetPrefetchBudget_MB(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return toMemMB(tr_cacheGetPrefetchLimit(session->cache));
+}
+
+void tr_sessionSetDiskIoThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    /* every worker needs at least one slot in the fd cache,
+     * and the libevent thread needs one too */
+    n = std::min(n, tr_fdGetFileLimit(session) - 1);
+
+    tr_diskIoSetWorkerCount(session->diskIo, n);
+}
+
+int tr_sessionGetDiskIoThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_diskIoGetWorkerCount(session->diskIo);
+}
+
+void tr_sessionSetVerifyThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetThreadCount(n);
+}
+
+int tr_sessionGetVerifyThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_verifyGetThreadCount();
+}
+
+void tr_sessionSetVerifySpeedLimit_MBps(tr_session* session, int mbps)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetSpeedLimit(uint64_t(std::max(mbps, 0)) * 1024 * 1024);
+}
+
+int tr_sessionGetVerifySpeedLimit_MBps(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return int(tr_verifyGetSpeedLimit() / (1024 * 1024));
+}
+
 /***
 ****
 ***/
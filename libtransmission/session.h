@@ -53,7 +53,11 @@ struct tr_announcer_udp;
 struct tr_bindsockets;
 struct tr_blocklistFile;
 struct tr_cache;
+struct tr_disk_io;
 struct tr_fdInfo;
+class tr_timer;
+class tr_timer_wheel;
+class tr_udp_io;
 
 struct tr_turtle_info
 {
@@ -304,6 +308,9 @@ public:
 
     int uploadSlotsPerTorrent;
 
+    /* how many of a peer's requests to read ahead of uploading them */
+    int prefetchLookahead;
+
     /* The UDP sockets used for the DHT and uTP. */
     tr_port udp_port;
     tr_socket_t udp_socket;
@@ -312,6 +319,11 @@ public:
     struct event* udp_event;
     struct event* udp6_event;
 
+    /* batched reads and writes of udp_socket and udp6_socket */
+    tr_udp_io* udp_io;
+    tr_udp_io* udp6_io;
+    struct event* udp_flush_event;
+
     struct event* utp_timer;
 
     /* The open port on the local machine for incoming peer requests */
@@ -343,6 +355,8 @@ public:
 
     struct tr_cache* cache;
 
+    struct tr_disk_io* diskIo;
+
     struct tr_lock* lock;
 
     struct tr_web* web;
@@ -357,8 +371,14 @@ public:
     struct tr_announcer* announcer;
     struct tr_announcer_udp* announcer_udp;
 
-    struct event* nowTimer;
-    struct event* saveTimer;
+    tr_timer* nowTimer;
+    tr_timer* saveTimer;
+
+    /* runs the timers set by tr_sessionAddTimer() */
+    tr_timer_wheel* timerWheel;
+    struct event* timerWheelEvent;
+    uint64_t timerWheelEventTick; /* when timerWheelEvent is due, or 0 if it isn't pending */
+    bool timerWheelIsAdvancing;
 
     /* monitors the "global pool" speeds */
     // Changed to non-owning pointer temporarily till tr_session becomes C++-constructible and destructible
@@ -478,3 +498,8 @@ int tr_sessionCountQueueFreeSlots(tr_session* session, tr_direction);
 
 void tr_sessionAddTorrent(tr_session* session, tr_torrent* tor);
 void tr_sessionRemoveTorrent(tr_session* session, tr_torrent* tor);
+
+/* runs `timer` in the libevent thread after `msec` milliseconds, or a little
+ * later for long delays, so that timers that are due at about the same time
+ * run together. If it's already scheduled, it's moved */
+void tr_sessionAddTimer(tr_session* session, tr_timer* timer, int msec);
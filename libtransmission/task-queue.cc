@@ -0,0 +1,80 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+
+#include "transmission.h"
+#include "task-queue.h"
+
+tr_task_queue::~tr_task_queue()
+{
+    clear();
+}
+
+bool tr_task_queue::push(task_func func, void* user_data)
+{
+    auto* const t = new task{ func, user_data, nullptr };
+    task* head = head_.load(std::memory_order_relaxed);
+
+    /* once `t` is pushed, the consumer can run and delete it at any time,
+     * so don't touch it after that */
+    do
+    {
+        t->next = head;
+    } while (!head_.compare_exchange_weak(head, t, std::memory_order_release, std::memory_order_relaxed));
+
+    return head == nullptr;
+}
+
+tr_task_queue::task* tr_task_queue::takeAll()
+{
+    task* newest_first = head_.exchange(nullptr, std::memory_order_acquire);
+    task* oldest_first = nullptr;
+
+    while (newest_first != nullptr)
+    {
+        task* const next = newest_first->next;
+        newest_first->next = oldest_first;
+        oldest_first = newest_first;
+        newest_first = next;
+    }
+
+    return oldest_first;
+}
+
+size_t tr_task_queue::run()
+{
+    size_t n = 0;
+
+    for (task* t = takeAll(); t != nullptr; ++n)
+    {
+        task* const next = t->next;
+        (*t->func)(t->user_data);
+        delete t;
+        t = next;
+    }
+
+    if (n != 0)
+    {
+        ++stats_.batches;
+        stats_.tasks += n;
+        stats_.max_batch = std::max(stats_.max_batch, n);
+    }
+
+    return n;
+}
+
+void tr_task_queue::clear()
+{
+    for (task* t = takeAll(); t != nullptr;)
+    {
+        task* const next = t->next;
+        delete t;
+        t = next;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief A lock-free queue of tasks for one consumer thread to run.
+ *
+ * Any number of threads can push tasks. Each push is one compare-and-swap
+ * onto a stack; the consumer takes the whole stack with one exchange and
+ * runs it in the order that it was pushed.
+ *
+ * push() says when it was the one that made the queue non-empty. Only that
+ * caller needs to wake the consumer, so a burst of tasks that arrives while
+ * the consumer is busy or asleep costs one wakeup, not one per task.
+ */
+class tr_task_queue
+{
+public:
+    using task_func = void (*)(void* user_data);
+
+    struct stats
+    {
+        uint64_t batches; /* calls to run() that found tasks */
+        uint64_t tasks;
+        size_t max_batch;
+    };
+
+    tr_task_queue() = default;
+    ~tr_task_queue();
+
+    tr_task_queue(tr_task_queue const&) = delete;
+    tr_task_queue& operator=(tr_task_queue const&) = delete;
+
+    /* safe to call from any thread. returns true if the queue was empty,
+     * in which case the caller should wake the consumer up */
+    bool push(task_func func, void* user_data);
+
+    /* consumer thread only. runs the tasks that are queued, oldest first,
+     * and returns how many there were. Tasks pushed meanwhile are left for
+     * the next call */
+    size_t run();
+
+    /* consumer thread only. drops the queued tasks without running them */
+    void clear();
+
+    [[nodiscard]] bool empty() const
+    {
+        return head_.load(std::memory_order_relaxed) == nullptr;
+    }
+
+    /* consumer thread only */
+    [[nodiscard]] stats const& getStats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct task
+    {
+        task_func func;
+        void* user_data;
+        task* next;
+    };
+
+    /* takes every queued task, oldest first */
+    task* takeAll();
+
+    /* newest first */
+    std::atomic<task*> head_ = nullptr;
+
+    stats stats_ = {};
+};
@@ -0,0 +1,292 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+
+#include "transmission.h"
+#include "timer-wheel.h"
+#include "tr-assert.h"
+
+namespace
+{
+
+auto constexpr SlotMask = uint64_t{ tr_timer_wheel::Slots - 1 };
+
+/* the longest delay that fits in the wheel */
+auto constexpr MaxDelta = uint64_t{ 1 } << (tr_timer_wheel::SlotBits * tr_timer_wheel::Levels);
+
+int countTrailingZeros(uint64_t bits)
+{
+    TR_ASSERT(bits != 0);
+
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/* the largest power of two that's no greater than `n` */
+uint64_t floorPow2(uint64_t n)
+{
+    TR_ASSERT(n != 0);
+
+    uint64_t pow2 = 1;
+    while (pow2 <= n / 2)
+    {
+        pow2 *= 2;
+    }
+
+    return pow2;
+}
+
+} // namespace
+
+void tr_timer::cancel()
+{
+    if (wheel_ != nullptr)
+    {
+        wheel_->cancel(this);
+    }
+}
+
+tr_timer_wheel::~tr_timer_wheel()
+{
+    for (auto& level : slots_)
+    {
+        for (auto*& head : level)
+        {
+            while (head != nullptr)
+            {
+                auto* const timer = head;
+                unlink(timer);
+                timer->wheel_ = nullptr;
+            }
+        }
+    }
+}
+
+/***
+****
+***/
+
+void tr_timer_wheel::link(tr_timer* timer)
+{
+    TR_ASSERT(timer->next_ == nullptr);
+    TR_ASSERT(timer->expires_ >= now_);
+
+    auto const delta = timer->expires_ - now_;
+
+    int level = 0;
+    while (level + 1 < Levels && delta >= (uint64_t{ 1 } << ((level + 1) * SlotBits)))
+    {
+        ++level;
+    }
+
+    /* a timer that's further away than the wheel reaches goes in its last
+     * slot. when that slot comes up, the timer gets put back in further on */
+    auto const slot_tick = delta < MaxDelta ? timer->expires_ : now_ + MaxDelta - 1;
+    auto const slot = size_t((slot_tick >> (level * SlotBits)) & SlotMask);
+
+    auto*& head = slots_[level][slot];
+    if (head == nullptr)
+    {
+        timer->prev_ = timer;
+        timer->next_ = timer;
+        head = timer;
+        occupied_[level] |= uint64_t{ 1 } << slot;
+    }
+    else
+    {
+        timer->next_ = head;
+        timer->prev_ = head->prev_;
+        head->prev_->next_ = timer;
+        head->prev_ = timer;
+    }
+
+    timer->level_ = uint8_t(level);
+    timer->slot_ = uint8_t(slot);
+}
+
+void tr_timer_wheel::unlink(tr_timer* timer)
+{
+    TR_ASSERT(timer->next_ != nullptr);
+
+    auto*& head = slots_[timer->level_][timer->slot_];
+
+    if (timer->next_ == timer)
+    {
+        head = nullptr;
+        occupied_[timer->level_] &= ~(uint64_t{ 1 } << timer->slot_);
+    }
+    else
+    {
+        timer->prev_->next_ = timer->next_;
+        timer->next_->prev_ = timer->prev_;
+
+        if (head == timer)
+        {
+            head = timer->next_;
+        }
+    }
+
+    timer->prev_ = nullptr;
+    timer->next_ = nullptr;
+}
+
+/* moves the timers in `level`'s current slot down to the levels below */
+void tr_timer_wheel::cascade(int level)
+{
+    auto const slot = size_t((now_ >> (level * SlotBits)) & SlotMask);
+    auto* timer = slots_[level][slot];
+
+    while (timer != nullptr)
+    {
+        unlink(timer);
+        link(timer);
+        timer = slots_[level][slot];
+    }
+}
+
+void tr_timer_wheel::schedule(tr_timer* timer, tick_t now, tick_t delay)
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    TR_ASSERT(timer->wheel_ == nullptr || timer->wheel_ == this);
+    timer->wheel_ = this;
+
+    if (timer->next_ != nullptr)
+    {
+        unlink(timer);
+        --size_;
+    }
+
+    /* an empty wheel has nothing to catch up on, so it can jump ahead */
+    if (size_ == 0 && !advancing_)
+    {
+        now_ = std::max(now_, now);
+    }
+
+    auto expires = std::max(now + std::max(delay, tick_t{ 1 }), now_ + 1);
+
+    if (auto const slack = delay / 16; slack >= 2)
+    {
+        auto const granularity = floorPow2(slack);
+        expires = (expires + granularity - 1) & ~(granularity - 1);
+    }
+
+    timer->expires_ = expires;
+    link(timer);
+    ++size_;
+}
+
+void tr_timer_wheel::cancel(tr_timer* timer)
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    if (timer->next_ != nullptr)
+    {
+        unlink(timer);
+        --size_;
+    }
+}
+
+size_t tr_timer_wheel::advance(tick_t now)
+{
+    auto lock = std::unique_lock(mutex_);
+    size_t n_ran = 0;
+
+    TR_ASSERT(!advancing_);
+    advancing_ = true;
+
+    while (now_ < now)
+    {
+        /* skip the ticks that have nothing to do */
+        auto const next = nextTickLocked();
+        if (!next || *next > now)
+        {
+            now_ = now;
+            break;
+        }
+
+        now_ = *next;
+
+        for (int level = 1; level < Levels && (now_ & ((uint64_t{ 1 } << (level * SlotBits)) - 1)) == 0; ++level)
+        {
+            cascade(level);
+        }
+
+        auto*& head = slots_[0][now_ & SlotMask];
+
+        while (head != nullptr)
+        {
+            auto* const timer = head;
+            unlink(timer);
+            --size_;
+
+            /* the callback may schedule, cancel, or delete any timer, this one included */
+            lock.unlock();
+            (*timer->callback_)(timer->user_data_);
+            lock.lock();
+
+            ++n_ran;
+        }
+    }
+
+    advancing_ = false;
+    return n_ran;
+}
+
+std::optional<tr_timer_wheel::tick_t> tr_timer_wheel::nextTickLocked() const
+{
+    auto next = std::optional<tick_t>{};
+
+    for (int level = 0; level < Levels; ++level)
+    {
+        auto const bits = occupied_[level];
+        if (bits == 0)
+        {
+            continue;
+        }
+
+        /* find the first occupied slot after the current one, wrapping around */
+        auto const shift = level * SlotBits;
+        auto const current = now_ >> shift;
+        auto const first = unsigned((current + 1) & SlotMask);
+        auto const rotated = first == 0 ? bits : (bits >> first) | (bits << (Slots - first));
+        auto const tick = (current + 1 + tick_t(countTrailingZeros(rotated))) << shift;
+
+        next = next ? std::min(*next, tick) : tick;
+    }
+
+    return next;
+}
+
+std::optional<tr_timer_wheel::tick_t> tr_timer_wheel::nextTick() const
+{
+    auto const lock = std::lock_guard(mutex_);
+    return nextTickLocked();
+}
+
+tr_timer_wheel::tick_t tr_timer_wheel::now() const
+{
+    auto const lock = std::lock_guard(mutex_);
+    return now_;
+}
+
+size_t tr_timer_wheel::size() const
+{
+    auto const lock = std::lock_guard(mutex_);
+    return size_;
+}
@@ -0,0 +1,137 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+class tr_timer_wheel;
+
+/**
+ * @brief A callback that a tr_timer_wheel runs once, when its time comes.
+ *
+ * Destroying a timer cancels it, so an object can own timers that
+ * call back into it without having to clean them up.
+ */
+class tr_timer
+{
+public:
+    using callback_t = void (*)(void* user_data);
+
+    tr_timer(callback_t callback, void* user_data)
+        : callback_{ callback }
+        , user_data_{ user_data }
+    {
+    }
+
+    ~tr_timer()
+    {
+        cancel();
+    }
+
+    tr_timer(tr_timer const&) = delete;
+    tr_timer& operator=(tr_timer const&) = delete;
+
+    void cancel();
+
+private:
+    friend class tr_timer_wheel;
+
+    callback_t const callback_;
+    void* const user_data_;
+
+    /* the wheel that it was last scheduled on */
+    tr_timer_wheel* wheel_ = nullptr;
+
+    uint64_t expires_ = 0;
+
+    /* its place in a slot's circular list. next_ is nullptr when it isn't scheduled */
+    tr_timer* prev_ = nullptr;
+    tr_timer* next_ = nullptr;
+    uint8_t level_ = 0;
+    uint8_t slot_ = 0;
+};
+
+/**
+ * @brief Runs timers in ticks, and knows when the next one is due.
+ *
+ * A hierarchical timing wheel: level 0 has a slot for each of the next 64
+ * ticks, level 1 a slot for each of the next 64 runs of 64 ticks, and so on.
+ * Scheduling or cancelling a timer is O(1). When a level's slot comes up,
+ * its timers move down to the level below, until they're in level 0 and run.
+ *
+ * Long delays are rounded up by as much as 1/16th of their length, to the
+ * nearest power of two ticks, so that timers scheduled at different times
+ * with similar delays come due in the same tick and share one wakeup.
+ *
+ * The wheel doesn't read the clock. The caller passes in the current tick
+ * and calls advance() when nextTick() comes. Any thread may schedule or
+ * cancel timers; callbacks run in the thread that calls advance(), without
+ * the wheel's lock held.
+ */
+class tr_timer_wheel
+{
+public:
+    using tick_t = uint64_t;
+
+    static auto constexpr TickMsec = int{ 10 };
+    static auto constexpr SlotBits = 6;
+    static auto constexpr Slots = size_t{ 1 } << SlotBits;
+    static auto constexpr Levels = 4;
+
+    explicit tr_timer_wheel(tick_t now)
+        : now_{ now }
+    {
+    }
+
+    ~tr_timer_wheel();
+
+    tr_timer_wheel(tr_timer_wheel const&) = delete;
+    tr_timer_wheel& operator=(tr_timer_wheel const&) = delete;
+
+    /* runs `timer` `delay` ticks after `now`, or at the next tick if `delay` is 0.
+     * if it was already scheduled, it's moved */
+    void schedule(tr_timer* timer, tick_t now, tick_t delay);
+
+    void cancel(tr_timer* timer);
+
+    /* runs the timers that are due by `now`, earliest first. returns how many ran */
+    size_t advance(tick_t now);
+
+    /* the next tick that advance() has work to do at, or std::nullopt if there are no timers */
+    [[nodiscard]] std::optional<tick_t> nextTick() const;
+
+    [[nodiscard]] tick_t now() const;
+
+    [[nodiscard]] size_t size() const;
+
+private:
+    void link(tr_timer* timer);
+    void unlink(tr_timer* timer);
+    void cascade(int level);
+    [[nodiscard]] std::optional<tick_t> nextTickLocked() const;
+
+    mutable std::mutex mutex_;
+
+    /* the last tick that advance() finished */
+    tick_t now_;
+    size_t size_ = 0;
+    bool advancing_ = false;
+
+    /* the first timer in each slot, and which slots have any */
+    std::array<std::array<tr_timer*, Slots>, Levels> slots_ = {};
+    std::array<uint64_t, Levels> occupied_ = {};
+};
@@ -36,10 +36,11 @@
 #include "cache.h"
 #include "completion.h"
 #include "crypto-utils.h" /* for tr_sha1 */
+#include "disk-io.h"
 #include "error.h"
 #include "fdlimit.h" /* tr_fdTorrentClose */
 #include "file.h"
-#include "inout.h" /* tr_ioTestPiece() */
+#include "inout.h" /* tr_ioTestPiece(), tr_ioTestPieceAsync() */
 #include "log.h"
 #include "magnet-metainfo.h"
 #include "metainfo.h"
@@ -1046,10 +1047,22 @@ tr_torrent* tr_torrentNew(tr_ctor const* ctor, int* setme_error, int* setme_dupl
 ***
 **/
 
+/* the disk I/O workers read the torrent's directories and file names,
+ * so let them finish before those change or go away */
+static void torrentWaitForDiskIo(tr_torrent const* tor)
+{
+    if (tor->session->diskIo != nullptr)
+    {
+        tr_diskIoWaitTorrent(tor->session->diskIo, tor->uniqueId);
+    }
+}
+
 void tr_torrentSetDownloadDir(tr_torrent* tor, char const* path)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
+    torrentWaitForDiskIo(tor);
+
     if (path == nullptr || tor->downloadDir == nullptr || strcmp(path, tor->downloadDir) != 0)
     {
         tr_free(tor->downloadDir);
@@ -1235,8 +1248,8 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->doneDate = tor->doneDate;
     s->editDate = tor->editDate;
     s->startDate = tor->startDate;
-    s->secondsSeeding = tor->secondsSeeding;
-    s->secondsDownloading = tor->secondsDownloading;
+    s->secondsSeeding = tr_torrentGetSecondsSeeding(tor, tr_time());
+    s->secondsDownloading = tr_torrentGetSecondsDownloading(tor, tr_time());
 
     s->corruptEver = tor->corruptCur + tor->corruptPrev;
     s->downloadedEver = tor->downloadedCur + tor->downloadedPrev;
@@ -1506,6 +1519,9 @@ static void freeTorrent(tr_torrent* tor)
 
     tr_sessionLock(session);
 
+    /* the disk I/O workers may still be using this torrent */
+    torrentWaitForDiskIo(tor);
+
     tr_peerMgrRemoveTorrent(tor);
 
     tr_announcerRemoveTorrent(session->announcer, tor);
@@ -1543,6 +1559,15 @@ static void freeTorrent(tr_torrent* tor)
 
 static void torrentSetQueued(tr_torrent* tor, bool queued);
 
+/* adds the time since the last count to secondsSeeding or secondsDownloading.
+ * call this before changing isRunning or completeness */
+static void countSeconds(tr_torrent* tor, time_t now)
+{
+    tor->secondsSeeding = tr_torrentGetSecondsSeeding(tor, now);
+    tor->secondsDownloading = tr_torrentGetSecondsDownloading(tor, now);
+    tor->secondsCountedAt = now;
+}
+
 static void torrentStartImpl(void* vtor)
 {
     auto* tor = static_cast<tr_torrent*>(vtor);
@@ -1556,6 +1581,7 @@ static void torrentStartImpl(void* vtor)
 
     time_t const now = tr_time();
 
+    countSeconds(tor, now);
     tor->isRunning = true;
     tor->completeness = tr_cpGetStatus(&tor->completion);
     tor->startDate = now;
@@ -1657,6 +1683,7 @@ static void torrentStart(tr_torrent* tor, bool bypass_queue)
      * change the peerid. It would help sometimes if a stopped event
      * was missed to ensure that we didn't think someone was cheating. */
     tr_torrentUnsetPeerId(tor);
+    countSeconds(tor, tr_time());
     tor->isRunning = true;
     tr_torrentSetDirty(tor);
     tr_runInEventThread(tor->session, torrentStartImpl, tor);
@@ -1834,6 +1861,7 @@ void tr_torrentStop(tr_torrent* tor)
     {
         tr_sessionLock(tor->session);
 
+        countSeconds(tor, tr_time());
         tor->isRunning = false;
         tor->isStopping = false;
         tor->prefetchMagnetMetadata = false;
@@ -1863,6 +1891,7 @@ static void closeTorrent(void* vtor)
         tr_torrentRemoveResume(tor);
     }
 
+    countSeconds(tor, tr_time());
     tor->isRunning = false;
     freeTorrent(tor);
 }
@@ -2104,6 +2133,7 @@ void tr_torrentRecheckCompleteness(tr_torrent* tor)
                 getCompletionString(completeness));
         }
 
+        countSeconds(tor, tr_time());
         tor->completeness = completeness;
         tr_fdTorrentClose(tor->session, tor->uniqueId);
 
@@ -2982,6 +3012,9 @@ static void setLocationImpl(void* vdata)
         /* bad idea to move files while they're being verified... */
         tr_verifyRemove(tor);
 
+        /* ...or written */
+        torrentWaitForDiskIo(tor);
+
         /* try to move the files.
          * FIXME: there are still all kinds of nasty cases, like what
          * if the target directory runs out of space halfway through... */
@@ -3184,6 +3217,30 @@ static void tr_torrentPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceInde
     }
 }
 
+static void onDownloadedPieceChecked(tr_torrent* tor, tr_piece_index_t p, bool pass)
+{
+    /* the piece may have been re-verified while it was being checked */
+    if (!tr_torrentPieceIsComplete(tor, p))
+    {
+        return;
+    }
+
+    tr_logAddTorDbg(tor, "tested downloaded piece %zu, pass==%d", size_t(p), int(pass));
+
+    if (pass)
+    {
+        tr_torrentPieceCompleted(tor, p);
+    }
+    else
+    {
+        uint32_t const n = tr_torPieceCountBytes(tor, p);
+        tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
+        tor->corruptCur += n;
+        tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
+        tr_peerMgrGotBadPiece(tor, p);
+    }
+}
+
 void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -3200,18 +3257,9 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 
         if (tr_torrentPieceIsComplete(tor, p))
         {
-            if (tor->checkPiece(p))
-            {
-                tr_torrentPieceCompleted(tor, p);
-            }
-            else
-            {
-                uint32_t const n = tr_torPieceCountBytes(tor, p);
-                tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
-                tor->corruptCur += n;
-                tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
-                tr_peerMgrGotBadPiece(tor, p);
-            }
+            tor->dropMerkleLeaves(p);
+            tr_cachePieceCompleted(tor->session->cache, tor, p);
+            tr_ioTestPieceAsync(tor, p, onDownloadedPieceChecked);
         }
     }
     else
@@ -3652,6 +3700,9 @@ static void torrentRenamePath(void* vdata)
         }
         else
         {
+            /* don't pull the files or their names out from under the workers */
+            torrentWaitForDiskIo(tor);
+
             error = renamePath(tor, oldpath, newname);
 
             if (error == 0)
@@ -3716,5 +3767,23 @@ void tr_torrent::takeMetainfo(tr_metainfo_parsed&& parsed)
 {
     std::swap(this->info, parsed.info);
     std::swap(this->piece_checksums_, parsed.pieces);
+    std::swap(this->merkle_pieces_, parsed.merkle_pieces);
     std::swap(this->infoDictLength, parsed.info_dict_length);
+    this->merkle_leaves_.clear();
+}
+
+bool tr_torrent::setMerkleLeaves(tr_piece_index_t i, std::vector<tr_sha256_digest_t>&& leaves)
+{
+    auto const* const piece = merklePiece(i);
+
+    // a reply that arrives after the piece is done has nothing left to check,
+    // and nothing would ever drop the leaves again
+    if (piece == nullptr || tr_torrentPieceIsComplete(this, i) || std::size(leaves) != piece->n_leaves ||
+        tr_merkleRoot(std::data(leaves), std::size(leaves), piece->n_leaves) != piece->root)
+    {
+        return false;
+    }
+
+    this->merkle_leaves_[i] = std::move(leaves);
+    return true;
 }
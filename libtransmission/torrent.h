@@ -23,6 +23,7 @@
 #include "bitfield.h"
 #include "completion.h"
 #include "file.h"
+#include "merkle.h"
 #include "quark.h"
 #include "session.h"
 #include "tr-assert.h"
@@ -149,6 +150,41 @@ public:
         return this->piece_checksums_[i];
     }
 
+    /// MERKLE
+
+    // hybrid v1 + v2 torrents can check each block as it arrives (BEP 52)
+
+    bool hasMerkle() const
+    {
+        return !std::empty(this->merkle_pieces_);
+    }
+
+    // where this piece sits in its file's merkle tree, or nullptr if it's not covered
+    tr_merkle_piece const* merklePiece(tr_piece_index_t i) const
+    {
+        if (i >= std::size(this->merkle_pieces_) || this->merkle_pieces_[i].n_leaves == 0)
+        {
+            return nullptr;
+        }
+
+        return &this->merkle_pieces_[i];
+    }
+
+    // a piece's leaf hashes, if a peer has sent them to us
+    std::vector<tr_sha256_digest_t> const* merkleLeaves(tr_piece_index_t i) const
+    {
+        auto const it = this->merkle_leaves_.find(i);
+        return it == std::end(this->merkle_leaves_) ? nullptr : &it->second;
+    }
+
+    // keep a piece's leaf hashes if we still need them and they add up to the piece's root
+    bool setMerkleLeaves(tr_piece_index_t i, std::vector<tr_sha256_digest_t>&& leaves);
+
+    void dropMerkleLeaves(tr_piece_index_t i)
+    {
+        this->merkle_leaves_.erase(i);
+    }
+
     // these functions should become private when possible,
     // but more refactoring is needed before that can happen
     // because much of tr_torrent's impl is in the non-member C bindings
@@ -357,8 +393,12 @@ public:
     time_t editDate;
     time_t startDate;
 
+    /* the time spent downloading and seeding up to secondsCountedAt.
+     * use tr_torrentGetSecondsDownloading() and tr_torrentGetSecondsSeeding()
+     * to include the time since then */
     int secondsDownloading;
     int secondsSeeding;
+    time_t secondsCountedAt;
 
     int queuePosition;
 
@@ -421,6 +461,9 @@ public:
 
 private:
     mutable std::vector<tr_sha1_digest_t> piece_checksums_;
+
+    std::vector<tr_merkle_piece> merkle_pieces_;
+    std::unordered_map<tr_piece_index_t, std::vector<tr_sha256_digest_t>> merkle_leaves_;
 };
 
 /* what piece index is this block in? */
@@ -472,6 +515,18 @@ constexpr bool tr_torrentIsSeed(tr_torrent const* tor)
     return tr_torrentGetCompleteness(tor) != TR_LEECH;
 }
 
+constexpr int tr_torrentGetSecondsDownloading(tr_torrent const* tor, time_t now)
+{
+    bool const counting = tor->isRunning && !tr_torrentIsSeed(tor) && tor->secondsCountedAt != 0;
+    return tor->secondsDownloading + (counting ? int(now - tor->secondsCountedAt) : 0);
+}
+
+constexpr int tr_torrentGetSecondsSeeding(tr_torrent const* tor, time_t now)
+{
+    bool const counting = tor->isRunning && tr_torrentIsSeed(tor) && tor->secondsCountedAt != 0;
+    return tor->secondsSeeding + (counting ? int(now - tor->secondsCountedAt) : 0);
+}
+
 constexpr bool tr_torrentIsPrivate(tr_torrent const* tor)
 {
     return tor != nullptr && tor->info.isPrivate;
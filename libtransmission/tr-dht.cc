@@ -58,6 +58,7 @@
 #include "torrent.h" /* tr_torrentFindFromHash() */
 #include "tr-assert.h"
 #include "tr-dht.h"
+#include "tr-udp.h" /* tr_udpSendTo() */
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "variant.h"
@@ -820,9 +821,15 @@ int dht_random_bytes(void* buf, size_t size)
     return size;
 }
 
-int dht_sendto(int sockfd, void const* buf, int len, int flags, struct sockaddr const* to, int tolen)
+int dht_sendto(int /*sockfd*/, void const* buf, int len, int /*flags*/, struct sockaddr const* to, int tolen)
 {
-    return sendto(sockfd, static_cast<char const*>(buf), len, flags, to, tolen);
+    if (session_ == nullptr || !tr_udpSendTo(session_, buf, len, to, tolen))
+    {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    return len;
 }
 
 #if defined(_WIN32) && !defined(__MINGW32__)
@@ -143,3 +143,8 @@ auto inline constexpr TR_SHA1_DIGEST_LEN = size_t{ 20 };
 using tr_sha1_digest_t = std::array<std::byte, TR_SHA1_DIGEST_LEN>;
 
 using tr_sha1_digest_string_t = std::array<char, TR_SHA1_DIGEST_LEN * 2 + 1>;
+
+// https://www.bittorrent.org/beps/bep_0052.html
+// v2 torrents hash their data with SHA-256 instead of SHA1.
+auto inline constexpr TR_SHA256_DIGEST_LEN = size_t{ 32 };
+using tr_sha256_digest_t = std::array<std::byte, TR_SHA256_DIGEST_LEN>;
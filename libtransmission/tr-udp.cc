@@ -21,8 +21,10 @@ THE SOFTWARE.
 
 */
 
+#include <algorithm>
 #include <cstring> /* memcmp(), memcpy(), memset() */
 #include <cstdlib> /* malloc(), free() */
+#include <initializer_list>
 
 #ifdef _WIN32
 #include <io.h> /* dup2() */
@@ -43,6 +45,8 @@ THE SOFTWARE.
 #include "tr-dht.h"
 #include "tr-utp.h"
 #include "tr-udp.h"
+#include "trevent.h" /* tr_amInEventThread() */
+#include "udp-io.h"
 
 /* Since we use a single UDP socket in order to implement multiple
    uTP sockets, try to set up huge buffers. */
@@ -51,6 +55,10 @@ THE SOFTWARE.
 #define SEND_BUFFER_SIZE (1 * 1024 * 1024)
 #define SMALL_BUFFER_SIZE (32 * 1024)
 
+/* the most datagrams to read each time a socket is readable,
+   so that a flood of uTP packets doesn't starve everything else */
+#define MAX_DATAGRAMS_PER_EVENT 256
+
 static void set_socket_buffers(tr_socket_t fd, bool large)
 {
     int rbuf = 0;
@@ -257,18 +265,10 @@ FAIL:
     }
 }
 
-static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+static void dispatch_datagram(unsigned char* buf, size_t buflen, struct sockaddr const* from, socklen_t fromlen, void* vsession)
 {
-    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
-    TR_ASSERT(type == EV_READ);
-
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
     auto* session = static_cast<tr_session*>(vsession);
 
-    socklen_t fromlen = sizeof(from);
-    int rc = recvfrom(s, reinterpret_cast<char*>(buf), 4096 - 1, 0, (struct sockaddr*)&from, &fromlen);
-
     /* Since most packets we receive here are ÂµTP, make quick inline
        checks for the other protocols.  The logic is as follows:
        - all DHT packets start with 'd'
@@ -276,38 +276,136 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
          is between 0 and 3
        - the above cannot be ÂµTP packets, since these start with a 4-bit
          version number (1). */
-    if (rc > 0)
+    if (buf[0] == 'd')
     {
-        if (buf[0] == 'd')
+        if (tr_sessionAllowsDHT(session))
         {
-            if (tr_sessionAllowsDHT(session))
-            {
-                buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, vsession);
-            }
+            /* the DHT code needs the '\0' that tr_udp_io puts after the datagram */
+            tr_dhtCallback(buf, buflen, const_cast<struct sockaddr*>(from), fromlen, vsession);
+        }
+    }
+    else if (buflen >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    {
+        if (!tau_handle_message(session, buf, buflen))
+        {
+            tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
         }
-        else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    }
+    else
+    {
+        if (tr_sessionIsUTPEnabled(session))
         {
-            rc = tau_handle_message(session, buf, rc);
-
-            if (rc == 0)
+            if (tr_utpPacket(buf, buflen, from, fromlen, session) == 0)
             {
-                tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
+                tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
             }
         }
-        else
+    }
+}
+
+static void flush_queued_datagrams(tr_session* session)
+{
+    for (auto* io : { session->udp_io, session->udp6_io })
+    {
+        if (io != nullptr && io->pending() != 0)
         {
-            if (tr_sessionIsUTPEnabled(session))
-            {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, session);
+            io->flush();
+        }
+    }
+}
 
-                if (rc == 0)
-                {
-                    tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
-                }
-            }
+static void flush_callback(evutil_socket_t /*s*/, short /*type*/, void* vsession)
+{
+    flush_queued_datagrams(static_cast<tr_session*>(vsession));
+}
+
+static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+{
+    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
+    TR_ASSERT(type == EV_READ);
+
+    auto* session = static_cast<tr_session*>(vsession);
+    tr_udp_io* io = s == session->udp_socket ? session->udp_io : session->udp6_io;
+
+    if (io != nullptr)
+    {
+        io->receive(dispatch_datagram, session, MAX_DATAGRAMS_PER_EVENT);
+
+        /* send the replies to the whole batch together */
+        flush_queued_datagrams(session);
+    }
+}
+
+bool tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    tr_udp_io* io = nullptr;
+
+    if (to->sa_family == AF_INET)
+    {
+        io = session->udp_io;
+    }
+    else if (to->sa_family == AF_INET6)
+    {
+        io = session->udp6_io;
+    }
+
+    if (io == nullptr)
+    {
+        return false;
+    }
+
+    /* the DHT bootstrap thread sends its pings outside of the libevent thread */
+    if (!tr_amInEventThread(session))
+    {
+        return sendto(io->socket(), static_cast<char const*>(buf), buflen, 0, to, tolen) >= 0;
+    }
+
+    io->send(buf, buflen, to, tolen);
+
+    if (io->pending() != 0 && session->udp_flush_event != nullptr)
+    {
+        event_active(session->udp_flush_event, 0, 0);
+    }
+
+    return true;
+}
+
+tr_udp_io_stats tr_udpGetStats(tr_session const* session)
+{
+    auto stats = tr_udp_io_stats{};
+
+    for (auto const* io : { session->udp_io, session->udp6_io })
+    {
+        if (io != nullptr)
+        {
+            auto const& s = io->stats();
+            stats.recv_batches += s.recv_batches;
+            stats.recv_datagrams += s.recv_datagrams;
+            stats.max_recv_batch = std::max(stats.max_recv_batch, s.max_recv_batch);
+            stats.send_batches += s.send_batches;
+            stats.send_datagrams += s.send_datagrams;
+            stats.max_send_batch = std::max(stats.max_send_batch, s.max_send_batch);
+            stats.send_errors += s.send_errors;
+            stats.gro_receives += s.gro_receives;
+            stats.gso_sends += s.gso_sends;
         }
     }
+
+    return stats;
+}
+
+static tr_udp_io* udp_io_new(tr_socket_t sock, char const* family)
+{
+    auto* const io = new tr_udp_io(sock);
+
+    tr_logAddNamedDbg(
+        "UDP",
+        "%s socket: GSO %s, GRO %s",
+        family,
+        io->gsoEnabled() ? "supported" : "unsupported",
+        io->groEnabled() ? "supported" : "unsupported");
+
+    return io;
 }
 
 void tr_udpInit(tr_session* ss)
@@ -351,6 +449,7 @@ void tr_udpInit(tr_session* ss)
         }
         else
         {
+            ss->udp_io = udp_io_new(ss->udp_socket, "IPv4");
             ss->udp_event = event_new(ss->event_base, ss->udp_socket, EV_READ | EV_PERSIST, event_callback, ss);
 
             if (ss->udp_event == nullptr)
@@ -369,6 +468,7 @@ void tr_udpInit(tr_session* ss)
 
     if (ss->udp6_socket != TR_BAD_SOCKET)
     {
+        ss->udp6_io = udp_io_new(ss->udp6_socket, "IPv6");
         ss->udp6_event = event_new(ss->event_base, ss->udp6_socket, EV_READ | EV_PERSIST, event_callback, ss);
 
         if (ss->udp6_event == nullptr)
@@ -377,6 +477,8 @@ void tr_udpInit(tr_session* ss)
         }
     }
 
+    ss->udp_flush_event = evtimer_new(ss->event_base, flush_callback, ss);
+
     tr_udpSetSocketBuffers(ss);
 
     tr_udpSetSocketTOS(ss);
@@ -401,6 +503,21 @@ void tr_udpUninit(tr_session* ss)
 {
     tr_dhtUninit(ss);
 
+    /* send whatever the DHT said on its way out */
+    flush_queued_datagrams(ss);
+
+    if (ss->udp_flush_event != nullptr)
+    {
+        event_free(ss->udp_flush_event);
+        ss->udp_flush_event = nullptr;
+    }
+
+    delete ss->udp_io;
+    ss->udp_io = nullptr;
+
+    delete ss->udp6_io;
+    ss->udp6_io = nullptr;
+
     if (ss->udp_socket != TR_BAD_SOCKET)
     {
         tr_netCloseSocket(ss->udp_socket);
@@ -32,4 +32,12 @@ void tr_udpUninit(tr_session*);
 void tr_udpSetSocketBuffers(tr_session*);
 void tr_udpSetSocketTOS(tr_session*);
 
+/* queues a datagram on the UDP socket for `to`'s address family.
+ * the queued datagrams are sent in batches once the current libevent
+ * callback returns. returns false if there's no socket for that family */
+bool tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
+/* the counts for the IPv4 and IPv6 sockets, added together */
+struct tr_udp_io_stats tr_udpGetStats(tr_session const* session);
+
 bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen);
@@ -458,6 +458,22 @@ void tr_sessionSetLPDEnabled(tr_session* session, bool enabled);
 void tr_sessionSetCacheLimit_MB(tr_session* session, int mb);
 int tr_sessionGetCacheLimit_MB(tr_session const* session);
 
+/** @brief Set how much memory can hold pieces that have been read ahead of uploads but not sent yet. */
+void tr_sessionSetPrefetchBudget_MB(tr_session* session, int mb);
+int tr_sessionGetPrefetchBudget_MB(tr_session const* session);
+
+/** @brief Set how many threads read and write torrent data. 0 does it all in the libevent thread. */
+void tr_sessionSetDiskIoThreads(tr_session* session, int n);
+int tr_sessionGetDiskIoThreads(tr_session const* session);
+
+/** @brief Set how many threads hash pieces when verifying local data. */
+void tr_sessionSetVerifyThreads(tr_session* session, int n);
+int tr_sessionGetVerifyThreads(tr_session const* session);
+
+/** @brief Limit how fast local data is read when verifying it, in MB/s. 0 means no limit. */
+void tr_sessionSetVerifySpeedLimit_MBps(tr_session* session, int mbps);
+int tr_sessionGetVerifySpeedLimit_MBps(tr_session const* session);
+
 tr_encryption_mode tr_sessionGetEncryption(tr_session* session);
 void tr_sessionSetEncryption(tr_session* session, tr_encryption_mode mode);
 
@@ -6,6 +6,7 @@
  *
  */
 
+#include <atomic>
 #include <cerrno>
 #include <cstring>
 
@@ -17,6 +18,10 @@
 #include <unistd.h> /* read(), write(), pipe() */
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
 
@@ -26,7 +31,8 @@
 #include "session.h"
 
 #include "transmission.h"
-#include "platform.h" /* tr_lockLock() */
+#include "platform.h" /* tr_threadNew() */
+#include "task-queue.h"
 #include "tr-assert.h"
 #include "trevent.h"
 #include "utils.h"
@@ -150,72 +156,104 @@ using tr_pipe_end_t = int;
 
 struct tr_event_handle
 {
-    bool die;
+    std::atomic<bool> die;
+    /* the wakeup's read and write ends. they're the same fd if it's an eventfd */
     tr_pipe_end_t fds[2];
-    tr_lock* lock;
+    tr_task_queue tasks;
     tr_session* session;
     tr_thread* thread;
     struct event_base* base;
     struct event* pipeEvent;
 };
 
-struct tr_run_data
+#define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
+
+static bool wakeupNew(tr_event_handle* eh)
 {
-    void (*func)(void*);
-    void* user_data;
-};
+#ifdef HAVE_SYS_EVENTFD_H
+    int const fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 
-#define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
+    if (fd != -1)
+    {
+        eh->fds[0] = eh->fds[1] = fd;
+        return true;
+    }
+#endif
+
+    if (pipe(eh->fds) == -1)
+    {
+        return false;
+    }
 
-static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
+    evutil_make_socket_nonblocking(eh->fds[0]);
+    return true;
+}
+
+static void wakeupFree(tr_event_handle* eh)
 {
-    auto* eh = static_cast<tr_event_handle*>(veh);
+    if (eh->fds[1] != eh->fds[0])
+    {
+        tr_netCloseSocket(eh->fds[1]);
+    }
 
-    dbgmsg("readFromPipe: eventType is %hd", eventType);
+    tr_netCloseSocket(eh->fds[0]);
+}
 
-    /* read the command type */
-    char ch = '\0';
+static bool wakeupSend(tr_event_handle* eh)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    if (eh->fds[1] == eh->fds[0])
+    {
+        uint64_t const one = 1;
+        return write(eh->fds[1], &one, sizeof(one)) != -1;
+    }
+#endif
+
+    char const ch = 'r';
+    return pipewrite(eh->fds[1], &ch, 1) != -1;
+}
 
-    int ret = 0;
-    do
+static void wakeupDrain(tr_event_handle* eh)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    if (eh->fds[1] == eh->fds[0])
     {
-        ret = piperead(fd, &ch, 1);
-    } while (!eh->die && ret == -1 && errno == EAGAIN);
+        /* reading an eventfd resets its count */
+        uint64_t count = 0;
+        [[maybe_unused]] auto const n = read(eh->fds[0], &count, sizeof(count));
+        return;
+    }
+#endif
 
-    dbgmsg("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+    char buf[64];
 
-    switch (ch)
+    while (piperead(eh->fds[0], buf, sizeof(buf)) > 0)
     {
-    case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+    }
+}
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
-            {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
-            }
+static void readFromPipe([[maybe_unused]] evutil_socket_t fd, short eventType, void* veh)
+{
+    auto* eh = static_cast<tr_event_handle*>(veh);
 
-            break;
-        }
+    dbgmsg("readFromPipe: eventType is %hd", eventType);
 
-    case '\0': /* eof */
-        {
-            dbgmsg("pipe eof reached... removing event listener");
-            event_free(eh->pipeEvent);
-            tr_netCloseSocket(eh->fds[0]);
-            event_base_loopexit(eh->base, nullptr);
-            break;
-        }
+    /* drain the wakeup before taking the tasks, so that a task that's
+     * queued while these run is sure to wake us up again */
+    wakeupDrain(eh);
 
-    default:
-        {
-            TR_ASSERT_MSG(false, "unhandled command type %d", (int)ch);
-            break;
-        }
+    if (eh->die)
+    {
+        dbgmsg("closing... removing event listener");
+        eh->tasks.clear();
+        event_free(eh->pipeEvent);
+        wakeupFree(eh);
+        event_base_loopexit(eh->base, nullptr);
+        return;
     }
+
+    [[maybe_unused]] auto const n = eh->tasks.run();
+    dbgmsg("invoked %zu functions in libevent thread", n);
 }
 
 static void logFunc(int severity, char const* message)
@@ -260,10 +298,9 @@ static void libeventThreadFunc(void* veh)
     }
 
     /* shut down the thread */
-    tr_lockFree(eh->lock);
     event_base_free(base);
     eh->session->events = nullptr;
-    tr_free(eh);
+    delete eh;
     tr_logAddDebug("Closing libevent thread");
 }
 
@@ -271,10 +308,9 @@ void tr_eventInit(tr_session* session)
 {
     session->events = nullptr;
 
-    auto* const eh = tr_new0(tr_event_handle, 1);
-    eh->lock = tr_lockNew();
+    auto* const eh = new tr_event_handle{};
 
-    if (pipe(eh->fds) == -1)
+    if (!wakeupNew(eh))
     {
         tr_logAddError("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
     }
@@ -304,7 +340,7 @@ void tr_eventClose(tr_session* session)
         tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent pipe");
     }
 
-    tr_netCloseSocket(session->events->fds[1]);
+    wakeupSend(session->events);
 }
 
 /**
@@ -335,21 +371,10 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     else
     {
         tr_event_handle* e = session->events;
-        struct tr_run_data data;
-
-        tr_lockLock(e->lock);
-
-        tr_pipe_end_t const fd = e->fds[1];
-        char ch = 'r';
-        ev_ssize_t const res_1 = pipewrite(fd, &ch, 1);
-
-        data.func = func;
-        data.user_data = user_data;
-        ev_ssize_t const res_2 = pipewrite(fd, &data, sizeof(data));
-
-        tr_lockUnlock(e->lock);
 
-        if (res_1 == -1 || res_2 == -1)
+        /* only the task that makes the queue non-empty needs to wake the
+         * libevent thread. the rest are run in the same batch */
+        if (e->tasks.push(func, user_data) && !wakeupSend(e))
         {
             tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
         }
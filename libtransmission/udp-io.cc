@@ -0,0 +1,413 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring> /* memcmp(), memcpy() */
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#include <sys/socket.h> /* recvmmsg(), sendmmsg() */
+#endif
+
+#ifdef __linux__
+#include <netinet/udp.h> /* UDP_SEGMENT, UDP_GRO */
+#endif
+
+#include "transmission.h"
+#include "log.h"
+#include "tr-assert.h"
+#include "udp-io.h"
+
+#if defined(HAVE_SENDMMSG) && defined(UDP_SEGMENT) && defined(SOL_UDP)
+#define TR_UDP_GSO
+#endif
+
+#if defined(HAVE_RECVMMSG) && defined(UDP_GRO) && defined(SOL_UDP)
+#define TR_UDP_GRO
+#endif
+
+/* GSO needs a 4.18 kernel. Older ones don't know the socket option */
+static bool probe_gso([[maybe_unused]] tr_socket_t sock)
+{
+#ifdef TR_UDP_GSO
+
+    int segment_size = 0;
+    socklen_t optlen = sizeof(segment_size);
+    return getsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment_size, &optlen) == 0;
+
+#else
+
+    return false;
+
+#endif
+}
+
+/* GRO needs a 5.0 kernel, and has to be asked for */
+static bool enable_gro([[maybe_unused]] tr_socket_t sock)
+{
+#ifdef TR_UDP_GRO
+
+    int const on = 1;
+    return setsockopt(sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+
+#else
+
+    return false;
+
+#endif
+}
+
+tr_udp_io::tr_udp_io(tr_socket_t sock)
+    : sock_{ sock }
+    , gso_{ probe_gso(sock) }
+    , gro_{ enable_gro(sock) }
+    , recv_batch_size_{ gro_ ? GroBatchSize : BatchSize }
+    , recv_buf_size_{ (gro_ ? MaxGroSize : MaxDatagramSize) + 1 }
+    , recv_data_(recv_batch_size_ * recv_buf_size_)
+    , recv_from_(recv_batch_size_)
+{
+    queue_.reserve(BatchSize);
+}
+
+/***
+****
+***/
+
+size_t tr_udp_io::receive(tr_udp_datagram_func func, void* user_data, size_t max_datagrams)
+{
+    size_t n_read = 0;
+
+    while (n_read < max_datagrams)
+    {
+        size_t const n_wanted = std::min(recv_batch_size_, max_datagrams - n_read);
+        size_t const n = receiveBatch(func, user_data, n_wanted);
+        n_read += n;
+
+        /* a short batch means that the socket's been drained */
+        if (n < n_wanted)
+        {
+            break;
+        }
+    }
+
+    return n_read;
+}
+
+size_t tr_udp_io::receiveBatch(tr_udp_datagram_func func, void* user_data, size_t max_datagrams)
+{
+    TR_ASSERT(max_datagrams <= recv_batch_size_);
+
+    auto lengths = std::array<size_t, BatchSize>{};
+    auto segment_sizes = std::array<size_t, BatchSize>{};
+    auto fromlens = std::array<socklen_t, BatchSize>{};
+    size_t n = 0;
+
+#ifdef HAVE_RECVMMSG
+
+    auto iovs = std::array<struct iovec, BatchSize>{};
+    auto msgs = std::array<struct mmsghdr, BatchSize>{};
+
+#ifdef TR_UDP_GRO
+    union gro_control
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    };
+
+    auto controls = std::array<gro_control, BatchSize>{};
+#endif
+
+    for (size_t i = 0; i < max_datagrams; ++i)
+    {
+        iovs[i].iov_base = &recv_data_[i * recv_buf_size_];
+        iovs[i].iov_len = recv_buf_size_ - 1;
+        msgs[i].msg_hdr.msg_name = &recv_from_[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(recv_from_[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+
+#ifdef TR_UDP_GRO
+        if (gro_)
+        {
+            msgs[i].msg_hdr.msg_control = controls[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+        }
+#endif
+    }
+
+    /* the socket is blocking, so don't wait for a batch to fill up */
+    int const rc = recvmmsg(sock_, std::data(msgs), max_datagrams, MSG_DONTWAIT, nullptr);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        lengths[i] = msgs[i].msg_len;
+        segment_sizes[i] = lengths[i];
+        fromlens[i] = msgs[i].msg_hdr.msg_namelen;
+
+#ifdef TR_UDP_GRO
+        /* a coalesced read says how long each of its datagrams is */
+        for (auto* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int segment_size = 0;
+                memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+
+                if (segment_size > 0)
+                {
+                    segment_sizes[i] = size_t(segment_size);
+                }
+            }
+        }
+#endif
+    }
+
+    n = rc > 0 ? size_t(rc) : 0;
+
+#else
+
+    /* the socket is blocking, so only the datagram that woke us up can be read */
+    fromlens[0] = sizeof(recv_from_[0]);
+    int const rc = recvfrom(
+        sock_,
+        reinterpret_cast<char*>(std::data(recv_data_)),
+        MaxDatagramSize,
+        0,
+        reinterpret_cast<struct sockaddr*>(&recv_from_[0]),
+        &fromlens[0]);
+
+    if (rc >= 0)
+    {
+        lengths[0] = size_t(rc);
+        segment_sizes[0] = lengths[0];
+        n = 1;
+    }
+
+#endif
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    size_t n_datagrams = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char* const buf = &recv_data_[i * recv_buf_size_];
+        auto const* const from = reinterpret_cast<struct sockaddr const*>(&recv_from_[i]);
+
+        if (lengths[i] > segment_sizes[i])
+        {
+            ++stats_.gro_receives;
+        }
+
+        for (size_t offset = 0; offset < lengths[i]; offset += segment_sizes[i])
+        {
+            unsigned char* const datagram = buf + offset;
+            size_t const datagram_len = std::min({ segment_sizes[i], lengths[i] - offset, MaxDatagramSize });
+            ++n_datagrams;
+
+            /* the '\0' overwrites the first byte of the next coalesced datagram,
+             * so put it back afterwards */
+            unsigned char const next = datagram[datagram_len];
+            datagram[datagram_len] = '\0';
+            func(datagram, datagram_len, from, fromlens[i], user_data);
+            datagram[datagram_len] = next;
+        }
+    }
+
+    ++stats_.recv_batches;
+    stats_.recv_datagrams += n_datagrams;
+    stats_.max_recv_batch = std::max(stats_.max_recv_batch, n_datagrams);
+
+    return n;
+}
+
+/***
+****
+***/
+
+void tr_udp_io::send(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    TR_ASSERT(tolen <= sizeof(struct sockaddr_storage));
+
+    auto& datagram = queue_.emplace_back();
+    datagram.offset = std::size(send_data_);
+    datagram.length = buflen;
+    memcpy(&datagram.to, to, tolen);
+    datagram.tolen = tolen;
+
+    auto const* const bytes = static_cast<unsigned char const*>(buf);
+    send_data_.insert(std::end(send_data_), bytes, bytes + buflen);
+
+    if (std::size(queue_) >= BatchSize)
+    {
+        flush();
+    }
+}
+
+void tr_udp_io::flush()
+{
+    for (size_t i = 0, n = std::size(queue_); i < n;)
+    {
+        i += sendBatch(&queue_[i], n - i);
+    }
+
+    queue_.clear();
+    send_data_.clear();
+}
+
+/* how many of `datagrams` can go in one GSO write: a run of datagrams
+ * to the same address that are all as long as the first, except
+ * for the last one, which can be shorter */
+size_t tr_udp_io::countGsoSegments(queued_datagram const* datagrams, size_t n) const
+{
+    auto const& first = datagrams[0];
+    size_t total = first.length;
+    size_t count = 1;
+
+    while (count < n && count < MaxGsoSegments && first.length != 0)
+    {
+        auto const& datagram = datagrams[count];
+
+        if (datagram.length > first.length || total + datagram.length > MaxGsoSize || datagram.tolen != first.tolen ||
+            memcmp(&datagram.to, &first.to, first.tolen) != 0)
+        {
+            break;
+        }
+
+        total += datagram.length;
+        ++count;
+
+        if (datagram.length < first.length)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+/* sends the first of `datagrams`, and as many after it as fit in a batch.
+ * returns how many were sent, or how many were dropped if the first write
+ * failed, or 0 if that write should be retried without GSO */
+size_t tr_udp_io::sendBatch(queued_datagram const* datagrams, size_t n)
+{
+    TR_ASSERT(n > 0);
+
+#ifdef HAVE_SENDMMSG
+
+    auto iovs = std::array<struct iovec, BatchSize>{};
+    auto msgs = std::array<struct mmsghdr, BatchSize>{};
+    auto counts = std::array<size_t, BatchSize>{}; /* how many datagrams each write holds */
+
+#ifdef TR_UDP_GSO
+    union gso_control
+    {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    };
+
+    auto controls = std::array<gso_control, BatchSize>{};
+#endif
+
+    size_t n_msgs = 0;
+
+    for (size_t i = 0; i < n && n_msgs < BatchSize; ++n_msgs)
+    {
+        auto const& first = datagrams[i];
+        auto const count = gso_ ? countGsoSegments(datagrams + i, n - i) : size_t{ 1 };
+
+        /* queued datagrams are stored back to back, so a run is one span of send_data_ */
+        size_t length = 0;
+        for (size_t j = 0; j < count; ++j)
+        {
+            length += datagrams[i + j].length;
+        }
+
+        auto& msg = msgs[n_msgs].msg_hdr;
+        iovs[n_msgs].iov_base = std::data(send_data_) + first.offset;
+        iovs[n_msgs].iov_len = length;
+        msg.msg_name = const_cast<struct sockaddr_storage*>(&first.to);
+        msg.msg_namelen = first.tolen;
+        msg.msg_iov = &iovs[n_msgs];
+        msg.msg_iovlen = 1;
+
+#ifdef TR_UDP_GSO
+        if (count > 1)
+        {
+            msg.msg_control = controls[n_msgs].buf;
+            msg.msg_controllen = sizeof(controls[n_msgs].buf);
+
+            auto* const cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+            auto const segment_size = uint16_t(first.length);
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+        }
+#endif
+
+        counts[n_msgs] = count;
+        i += count;
+    }
+
+    /* this stops at the first write that fails */
+    int const rc = sendmmsg(sock_, std::data(msgs), n_msgs, 0);
+
+#else
+
+    auto counts = std::array<size_t, 1>{ 1 };
+    auto const& datagram = datagrams[0];
+    auto const* const buf = reinterpret_cast<char const*>(std::data(send_data_) + datagram.offset);
+    auto const* const to = reinterpret_cast<struct sockaddr const*>(&datagram.to);
+    int const rc = sendto(sock_, buf, datagram.length, 0, to, datagram.tolen) < 0 ? -1 : 1;
+
+#endif
+
+    if (rc <= 0)
+    {
+        int const err = sockerrno;
+        char err_buf[512];
+
+#ifdef TR_UDP_GSO
+        /* EIO if the network device can't offload checksums,
+         * EINVAL if the segments are larger than the path's MTU */
+        if (counts[0] > 1 && (err == EIO || err == EINVAL))
+        {
+            tr_logAddNamedDbg("UDP", "Turning off GSO: %s", tr_net_strerror(err_buf, sizeof(err_buf), err));
+            gso_ = false;
+            return 0;
+        }
+#endif
+
+        tr_logAddNamedDbg("UDP", "Couldn't send datagram: %s", tr_net_strerror(err_buf, sizeof(err_buf), err));
+        stats_.send_errors += counts[0];
+        return counts[0];
+    }
+
+    size_t n_sent = 0;
+
+    for (int i = 0; i < rc; ++i)
+    {
+        n_sent += counts[i];
+
+        if (counts[i] > 1)
+        {
+            ++stats_.gso_sends;
+        }
+    }
+
+    ++stats_.send_batches;
+    stats_.send_datagrams += n_sent;
+    stats_.max_send_batch = std::max(stats_.max_send_batch, n_sent);
+    return n_sent;
+}
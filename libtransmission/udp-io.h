@@ -0,0 +1,144 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transmission.h"
+#include "net.h" /* tr_socket_t, sockaddr */
+
+struct tr_udp_io_stats
+{
+    /* reads from the socket that returned datagrams, and how many they returned */
+    uint64_t recv_batches;
+    uint64_t recv_datagrams;
+    size_t max_recv_batch;
+
+    /* writes to the socket, and how many datagrams they sent */
+    uint64_t send_batches;
+    uint64_t send_datagrams;
+    size_t max_send_batch;
+
+    /* datagrams that were dropped because they couldn't be sent */
+    uint64_t send_errors;
+
+    /* GRO reads that held several coalesced datagrams, and GSO writes
+     * that sent several datagrams as one */
+    uint64_t gro_receives;
+    uint64_t gso_sends;
+};
+
+/* called for each datagram that's read. `buf` has a '\0' after its last byte */
+using tr_udp_datagram_func = void (*)(
+    unsigned char* buf,
+    size_t buflen,
+    struct sockaddr const* from,
+    socklen_t fromlen,
+    void* user_data);
+
+/**
+ * @brief Reads and writes a UDP socket's datagrams in batches.
+ *
+ * Where recvmmsg() and sendmmsg() are available, a whole batch of datagrams
+ * is moved with one system call. Elsewhere it falls back to one recvfrom()
+ * or sendto() per datagram.
+ *
+ * On Linux, if the kernel supports UDP_SEGMENT and UDP_GRO, consecutive
+ * queued datagrams of the same size to the same address are sent as one
+ * GSO write, and GRO-coalesced reads are split back into datagrams.
+ */
+class tr_udp_io
+{
+public:
+    static auto constexpr BatchSize = size_t{ 32 };
+
+    /* the largest datagram that's read. Longer ones are truncated */
+    static auto constexpr MaxDatagramSize = size_t{ 4096 - 1 };
+
+    /* GRO reads can be up to 64 KiB each, so fewer of them are batched */
+    static auto constexpr GroBatchSize = size_t{ 8 };
+    static auto constexpr MaxGroSize = size_t{ 65535 };
+
+    /* the kernel's limits on a GSO write */
+    static auto constexpr MaxGsoSegments = size_t{ 64 };
+    static auto constexpr MaxGsoSize = size_t{ 65507 };
+
+    explicit tr_udp_io(tr_socket_t sock);
+
+    [[nodiscard]] tr_socket_t socket() const
+    {
+        return sock_;
+    }
+
+    /* reads up to `max_datagrams` of the datagrams waiting on the socket,
+     * calling `func` on each of them. returns how many were read, where
+     * a GRO read counts once however many datagrams it held */
+    size_t receive(tr_udp_datagram_func func, void* user_data, size_t max_datagrams);
+
+    /* queues a datagram. the queue is flushed when it holds a full batch */
+    void send(void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
+    /* sends the queued datagrams */
+    void flush();
+
+    [[nodiscard]] bool gsoEnabled() const
+    {
+        return gso_;
+    }
+
+    [[nodiscard]] bool groEnabled() const
+    {
+        return gro_;
+    }
+
+    [[nodiscard]] size_t pending() const
+    {
+        return std::size(queue_);
+    }
+
+    [[nodiscard]] tr_udp_io_stats const& stats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct queued_datagram
+    {
+        size_t offset; /* where its bytes start in send_data_ */
+        size_t length;
+        struct sockaddr_storage to;
+        socklen_t tolen;
+    };
+
+    size_t receiveBatch(tr_udp_datagram_func func, void* user_data, size_t max_datagrams);
+    size_t sendBatch(queued_datagram const* datagrams, size_t n);
+    size_t countGsoSegments(queued_datagram const* datagrams, size_t n) const;
+
+    tr_socket_t const sock_;
+
+    /* turned off if the kernel or the network device turns out not to support it */
+    bool gso_;
+    bool const gro_;
+
+    size_t const recv_batch_size_;
+    size_t const recv_buf_size_;
+    std::vector<unsigned char> recv_data_; /* recv_batch_size_ buffers of recv_buf_size_ bytes */
+    std::vector<struct sockaddr_storage> recv_from_;
+
+    std::vector<queued_datagram> queue_;
+    std::vector<unsigned char> send_data_;
+
+    tr_udp_io_stats stats_ = {};
+};
@@ -39,7 +39,7 @@
 
 #ifdef _WIN32
 #include <ws2tcpip.h> /* WSAStartup() */
-#include <windows.h> /* Sleep(), GetSystemTimeAsFileTime(), GetEnvironmentVariable() */
+#include <windows.h> /* Sleep(), GetSystemTimeAsFileTime(), GetEnvironmentVariable(), GetThreadTimes() */
 #include <shellapi.h> /* CommandLineToArgv() */
 #include <shlwapi.h> /* StrStrIA() */
 #else
@@ -594,6 +594,46 @@ uint64_t tr_time_msec(void)
     return (uint64_t)tv.tv_sec * 1000 + (tv.tv_usec / 1000);
 }
 
+uint64_t tr_thread_cpu_usec(void)
+{
+#ifdef _WIN32
+
+    FILETIME creation;
+    FILETIME exit;
+    FILETIME kernel;
+    FILETIME user;
+
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    {
+        return 0;
+    }
+
+    /* FILETIMEs count 100-nanosecond intervals */
+    auto const to_usec = [](FILETIME const& ft)
+    {
+        return ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10;
+    };
+
+    return to_usec(kernel) + to_usec(user);
+
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+    {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000 + (ts.tv_nsec / 1000);
+
+#else
+
+    return 0;
+
+#endif
+}
+
 void tr_wait_msec(long int msec)
 {
 #ifdef _WIN32
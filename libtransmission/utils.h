@@ -120,6 +120,9 @@ void tr_timerAddMsec(struct event* timer, int milliseconds) TR_GNUC_NONNULL(1);
 /** @brief return the current date in milliseconds */
 uint64_t tr_time_msec(void);
 
+/** @brief return how much CPU time the calling thread has used, in microseconds, or 0 if that's unknown */
+uint64_t tr_thread_cpu_usec(void);
+
 /** @brief sleep the specified number of milliseconds */
 void tr_wait_msec(long int delay_milliseconds);
 
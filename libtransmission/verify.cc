@@ -7,16 +7,25 @@
  */
 
 #include <algorithm>
-#include <cstdlib> /* free() */
-#include <cstring> /* memcmp() */
+#include <array>
+#include <chrono>
+#include <cinttypes> /* PRIu64 */
+#include <condition_variable>
+#include <list>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "transmission.h"
 #include "completion.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "file.h"
+#include "inout.h" /* tr_ioFindFileLocation() */
 #include "log.h"
 #include "platform.h" /* tr_lock() */
+#include "session.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "utils.h" /* tr_malloc(), tr_free() */
@@ -26,135 +35,358 @@
 ****
 ***/
 
-static auto constexpr MsecToSleepPerSecondDuringVerify = int{ 100 };
+/* while peers' disk I/O is queued, wait this long between chunks, up to the max */
+static auto constexpr YieldMsec = int{ 5 };
+static auto constexpr MaxYieldMsecPerChunk = int{ 50 };
 
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+/* pieces are handed out to the verify threads in runs of about this many bytes */
+static auto constexpr VerifyRunBytes = uint64_t{ 1024 * 1024 * 4 };
+
+/* a run is read in chunks of up to this size, a few chunks ahead of the hashing.
+ * small pieces are read several to a chunk, so that they can be hashed together */
+static auto constexpr ChunkSize = uint32_t{ 1024 * 1024 };
+static auto constexpr ChunkCount = size_t{ 3 };
+static auto constexpr MaxPiecesPerChunk = tr_piece_index_t{ 8 };
+
+/* the part of a run that's read into one chunk:
+ * either some whole pieces, or a slice of a piece that's bigger than a chunk */
+struct verify_span
 {
-    tr_sys_file_t fd = TR_BAD_SYS_FILE;
-    uint64_t filePos = 0;
-    bool changed = false;
-    bool hadPiece = false;
-    time_t lastSleptAt = 0;
-    uint32_t piecePos = 0;
-    tr_file_index_t fileIndex = 0;
-    tr_file_index_t prevFileIndex = !fileIndex;
-    tr_piece_index_t pieceIndex = 0;
-    time_t const begin = tr_time();
-    size_t const buflen = 1024 * 128; // 128 KiB buffer
-    auto* const buffer = static_cast<uint8_t*>(tr_malloc(buflen));
-
-    tr_sha1_ctx_t sha = tr_sha1_init();
+    tr_piece_index_t piece;
+    tr_piece_index_t n_pieces; /* 0 if this is a slice of `piece` */
+    uint32_t offset;
+    uint32_t len;
+};
 
-    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
-    tor->verify_progress = 0;
+/* the span that starts at `offset` bytes into `piece` */
+static verify_span getSpan(tr_torrent const* tor, tr_piece_index_t end_piece, tr_piece_index_t piece, uint32_t offset)
+{
+    auto span = verify_span{ piece, 0, offset, 0 };
+    uint32_t const piece_size = tr_torPieceCountBytes(tor, piece);
+
+    if (offset != 0 || piece_size > ChunkSize)
+    {
+        span.len = std::min(ChunkSize, piece_size - offset);
+        return span;
+    }
 
-    while (!*stopFlag && pieceIndex < tor->info.pieceCount)
+    while (span.n_pieces < MaxPiecesPerChunk && piece + span.n_pieces < end_piece)
     {
-        tr_file const* file = &tor->info.files[fileIndex];
+        uint32_t const len = tr_torPieceCountBytes(tor, piece + span.n_pieces);
 
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
+        if (span.len + len > ChunkSize)
         {
-            hadPiece = tr_torrentPieceIsComplete(tor, pieceIndex);
+            break;
         }
 
-        /* if we're starting a new file... */
-        if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
+        span.len += len;
+        ++span.n_pieces;
+    }
+
+    return span;
+}
+
+/* the position right after `span` */
+static void getSpanEnd(tr_torrent const* tor, verify_span const& span, tr_piece_index_t* piece, uint32_t* offset)
+{
+    *piece = span.piece + span.n_pieces;
+    *offset = 0;
+
+    if (span.n_pieces == 0)
+    {
+        if (span.offset + span.len < tr_torPieceCountBytes(tor, span.piece))
         {
-            char* filename = tr_torrentFindFile(tor, fileIndex);
-            fd = filename == nullptr ? TR_BAD_SYS_FILE :
-                                       tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
-            tr_free(filename);
-            prevFileIndex = fileIndex;
+            *offset = span.offset + span.len;
         }
+        else
+        {
+            ++*piece;
+        }
+    }
+}
+
+struct verify_chunk
+{
+    std::vector<uint8_t> buf = std::vector<uint8_t>(ChunkSize);
+    verify_span span = {};
+    bool ok = false;
+};
+
+struct verify_result
+{
+    tr_piece_index_t piece;
+    bool has_piece;
+};
+
+/* Reads a run of pieces ahead of the verify thread that's hashing them,
+ * so that the disk and the CPU can both be kept busy.
+ * The chunks are filled in the order the pieces will be hashed. */
+struct verify_reader
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::array<verify_chunk, ChunkCount> chunks;
+    size_t n_read = 0; /* chunks filled so far in this run */
+    size_t n_hashed = 0; /* chunks handed back so far in this run */
+
+    /* the run being read */
+    tr_torrent* tor = nullptr;
+    tr_piece_index_t first_piece = 0;
+    tr_piece_index_t end_piece = 0;
+    bool is_reading = false;
+    bool cancel = false;
+    bool die = false;
+
+    /* only touched by the reader's thread */
+    tr_file_index_t file_index = 0;
+    tr_sys_file_t fd = TR_BAD_SYS_FILE;
+
+    /* only touched by the hashing thread: a piece that's being hashed slice by slice */
+    tr_sha1_ctx_t sha = nullptr;
+    bool slices_ok = false;
+};
+
+static void readerCloseFile(verify_reader* reader)
+{
+    if (reader->fd != TR_BAD_SYS_FILE)
+    {
+        tr_sys_file_close(reader->fd, nullptr);
+        reader->fd = TR_BAD_SYS_FILE;
+    }
+}
+
+/* returns the file's fd, or TR_BAD_SYS_FILE if it can't be opened */
+static tr_sys_file_t readerOpenFile(verify_reader* reader, tr_file_index_t file_index)
+{
+    if (reader->fd != TR_BAD_SYS_FILE && reader->file_index == file_index)
+    {
+        return reader->fd;
+    }
 
-        /* figure out how much we can read this pass */
-        uint64_t leftInPiece = tr_torPieceCountBytes(tor, pieceIndex) - piecePos;
-        uint64_t leftInFile = file->length - filePos;
-        uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t{ buflen });
+    readerCloseFile(reader);
+    reader->file_index = file_index;
+
+    char* const filename = tr_torrentFindFile(reader->tor, file_index);
+    reader->fd = filename == nullptr ? TR_BAD_SYS_FILE :
+                                       tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
+    tr_free(filename);
+    return reader->fd;
+}
+
+/* returns true if all `len` bytes were read */
+static bool readerReadChunk(verify_reader* reader, tr_piece_index_t piece, uint32_t offset, uint32_t len, uint8_t* buf)
+{
+    tr_torrent const* const tor = reader->tor;
+    auto file_index = tr_file_index_t{};
+    auto file_pos = uint64_t{};
+    tr_ioFindFileLocation(tor, piece, offset, &file_index, &file_pos);
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+    while (len > 0 && file_index < tor->info.fileCount)
+    {
+        uint64_t const left_in_file = tor->info.files[file_index].length - file_pos;
+
+        if (left_in_file == 0)
         {
-            auto numRead = uint64_t{};
-            if (tr_sys_file_read_at(fd, buffer, bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
-            {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, buffer, bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
-            }
+            ++file_index;
+            file_pos = 0;
+            continue;
         }
 
-        /* move our offsets */
-        leftInPiece -= bytesThisPass;
-        leftInFile -= bytesThisPass;
-        piecePos += bytesThisPass;
-        filePos += bytesThisPass;
+        tr_sys_file_t const fd = readerOpenFile(reader, file_index);
+        uint64_t const bytes_this_pass = std::min(uint64_t{ len }, left_in_file);
+        auto num_read = uint64_t{};
 
-        /* if we're finishing a piece... */
-        if (leftInPiece == 0)
+        if (fd == TR_BAD_SYS_FILE || !tr_sys_file_read_at(fd, buf, bytes_this_pass, file_pos, &num_read, nullptr) ||
+            num_read == 0)
         {
-            auto hash = tr_sha1_final(sha);
-            auto const hasPiece = hash && *hash == tor->pieceHash(pieceIndex);
+            return false;
+        }
 
-            if (hasPiece || hadPiece)
-            {
-                tr_torrentSetHasPiece(tor, pieceIndex, hasPiece);
-                changed |= hasPiece != hadPiece;
-            }
+        tr_sys_file_advise(fd, file_pos, num_read, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+        buf += num_read;
+        len -= num_read;
+        file_pos += num_read;
+    }
 
-            time_t const now = tr_time();
-            tor->anyDate = now;
+    return len == 0;
+}
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (lastSleptAt != now)
-            {
-                lastSleptAt = now;
-                tr_wait_msec(MsecToSleepPerSecondDuringVerify);
-            }
+static void readerThreadFunc(verify_reader* reader)
+{
+    auto lock = std::unique_lock(reader->mutex);
 
-            sha = tr_sha1_init();
-            ++pieceIndex;
-            tor->verify_progress = pieceIndex / double(tor->info.pieceCount);
-            piecePos = 0;
+    for (;;)
+    {
+        reader->cv.wait(lock, [reader]() { return reader->die || reader->is_reading; });
+
+        if (reader->die)
+        {
+            break;
         }
 
-        /* if we're finishing a file... */
-        if (leftInFile == 0)
+        auto piece = reader->first_piece;
+        auto offset = uint32_t{};
+
+        while (piece < reader->end_piece)
         {
-            if (fd != TR_BAD_SYS_FILE)
+            reader->cv.wait(lock, [reader]() { return reader->cancel || reader->n_read - reader->n_hashed < ChunkCount; });
+
+            if (reader->cancel)
             {
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+                break;
             }
 
-            fileIndex++;
-            filePos = 0;
+            auto& chunk = reader->chunks[reader->n_read % ChunkCount];
+            chunk.span = getSpan(reader->tor, reader->end_piece, piece, offset);
+
+            lock.unlock();
+            chunk.ok = readerReadChunk(reader, piece, offset, chunk.span.len, std::data(chunk.buf));
+            lock.lock();
+
+            ++reader->n_read;
+            reader->cv.notify_all();
+            getSpanEnd(reader->tor, chunk.span, &piece, &offset);
         }
+
+        readerCloseFile(reader);
+        reader->is_reading = false;
+        reader->cv.notify_all();
     }
+}
 
-    /* cleanup */
-    if (fd != TR_BAD_SYS_FILE)
+static verify_reader* readerNew(void)
+{
+    auto* const reader = new verify_reader{};
+    reader->thread = std::thread(readerThreadFunc, reader);
+    return reader;
+}
+
+static void readerFree(verify_reader* reader)
+{
     {
-        tr_sys_file_close(fd, nullptr);
+        auto const lock = std::lock_guard(reader->mutex);
+        reader->die = true;
     }
 
-    tor->verify_progress.reset();
-    tr_sha1_final(sha);
-    free(buffer);
+    reader->cv.notify_all();
+    reader->thread.join();
+    delete reader;
+}
 
-    /* stopwatch */
-    time_t const end = tr_time();
-    tr_logAddTorDbg(
-        tor,
-        "Verification is done. It took %d seconds to verify %" PRIu64 " bytes (%" PRIu64 " bytes per second)",
-        (int)(end - begin),
-        tor->info.totalSize,
-        (uint64_t)(tor->info.totalSize / (1 + (end - begin))));
+static void readerStartRun(verify_reader* reader, tr_torrent* tor, tr_piece_index_t first_piece, tr_piece_index_t end_piece)
+{
+    auto const lock = std::lock_guard(reader->mutex);
+
+    TR_ASSERT(!reader->is_reading);
+
+    reader->tor = tor;
+    reader->first_piece = first_piece;
+    reader->end_piece = end_piece;
+    reader->n_read = 0;
+    reader->n_hashed = 0;
+    reader->cancel = false;
+    reader->is_reading = true;
+    reader->cv.notify_all();
+}
+
+/* stops reading ahead, if the run wasn't finished, and waits for the reader to be idle */
+static void readerEndRun(verify_reader* reader)
+{
+    if (reader->sha != nullptr)
+    {
+        tr_sha1_final(reader->sha, nullptr);
+        reader->sha = nullptr;
+    }
 
-    return changed;
+    auto lock = std::unique_lock(reader->mutex);
+
+    reader->cancel = true;
+    reader->cv.notify_all();
+    reader->cv.wait(lock, [reader]() { return !reader->is_reading; });
+}
+
+/* hashes the whole pieces in a chunk, several at a time */
+static void hashPieces(tr_torrent const* tor, verify_chunk const& chunk, std::vector<verify_result>& setme)
+{
+    auto const& span = chunk.span;
+    auto data = std::array<uint8_t const*, MaxPiecesPerChunk>{};
+    auto hashes = std::array<tr_sha1_digest_t, MaxPiecesPerChunk>{};
+    auto lens = std::array<uint32_t, MaxPiecesPerChunk>{};
+
+    uint8_t const* walk = std::data(chunk.buf);
+    for (tr_piece_index_t i = 0; i < span.n_pieces; ++i)
+    {
+        data[i] = walk;
+        lens[i] = tr_torPieceCountBytes(tor, span.piece + i);
+        walk += lens[i];
+    }
+
+    /* only the torrent's last piece can be a different size from the rest */
+    for (tr_piece_index_t i = 0; chunk.ok && i < span.n_pieces;)
+    {
+        auto end = i + 1;
+        while (end < span.n_pieces && lens[end] == lens[i])
+        {
+            ++end;
+        }
+
+        tr_sha1_many(&data[i], end - i, lens[i], &hashes[i]);
+        i = end;
+    }
+
+    for (tr_piece_index_t i = 0; i < span.n_pieces; ++i)
+    {
+        setme.push_back({ span.piece + i, chunk.ok && hashes[i] == tor->pieceHash(span.piece + i) });
+    }
+}
+
+/* hashes the next chunk in the run once it's been read, and adds the pieces that it
+ * finishes to `setme`, noting whether their data on disk matches their checksums.
+ * returns the chunk's size in bytes */
+static uint32_t readerHashChunk(verify_reader* reader, std::vector<verify_result>& setme)
+{
+    auto lock = std::unique_lock(reader->mutex);
+    reader->cv.wait(lock, [reader]() { return reader->n_read > reader->n_hashed; });
+    lock.unlock();
+
+    /* the reader won't touch this chunk until it's handed back */
+    tr_torrent const* const tor = reader->tor;
+    auto const& chunk = reader->chunks[reader->n_hashed % ChunkCount];
+    auto const& span = chunk.span;
+
+    if (span.n_pieces > 0)
+    {
+        hashPieces(tor, chunk, setme);
+    }
+    else
+    {
+        if (span.offset == 0)
+        {
+            reader->sha = tr_sha1_init();
+            reader->slices_ok = true;
+        }
+
+        reader->slices_ok = reader->slices_ok && chunk.ok;
+
+        if (reader->slices_ok)
+        {
+            tr_sha1_update(reader->sha, std::data(chunk.buf), span.len);
+        }
+
+        if (span.offset + span.len == tr_torPieceCountBytes(tor, span.piece))
+        {
+            auto const hash = tr_sha1_final(reader->sha);
+            reader->sha = nullptr;
+            setme.push_back({ span.piece, reader->slices_ok && hash && *hash == tor->pieceHash(span.piece) });
+        }
+    }
+
+    lock.lock();
+    ++reader->n_hashed;
+    reader->cv.notify_all();
+    return span.len;
 }
 
 /***
@@ -193,11 +425,49 @@ struct verify_node
     }
 };
 
-static struct verify_node currentNode;
+/* a torrent that's being verified right now */
+struct verify_task
+{
+    verify_node node;
+    time_t begin;
+
+    tr_piece_index_t next_piece; /* the first piece that hasn't been handed out yet */
+    tr_piece_index_t pieces_done;
+    int n_threads; /* threads hashing its pieces right now */
+
+    bool stop;
+    bool changed;
+    bool is_finishing;
+
+    bool isReadyToFinish() const
+    {
+        return !is_finishing && n_threads == 0 && (stop || next_piece >= node.torrent->info.pieceCount);
+    }
+
+    bool hasPiecesToHandOut() const
+    {
+        return !is_finishing && !stop && next_piece < node.torrent->info.pieceCount;
+    }
+};
+
+using verify_clock = std::chrono::steady_clock;
+
 // TODO: refactor s.t. this doesn't leak
 static auto& verifyList{ *new std::set<verify_node>{} };
-static tr_thread* verifyThread = nullptr;
-static bool stopCurrent = false;
+static auto& activeList{ *new std::list<verify_task>{} }; /* in the order they were started */
+static int maxThreads = 1;
+static int nThreads = 0;
+
+/* throughput across all the verify threads */
+static uint64_t bytesVerified = 0;
+static uint64_t busyBytes = 0; /* since the threads last went from idle to busy */
+static verify_clock::time_point busyBegin;
+static verify_clock::time_point busyEnd;
+
+/* a token bucket, shared by all the verify threads, that limits how fast they read */
+static uint64_t speedLimit = 0; /* bytes per second, or 0 for no limit */
+static double tokens = 0; /* bytes that can be read now. negative while in debt */
+static verify_clock::time_point tokensUpdatedAt;
 
 static tr_lock* getVerifyLock(void)
 {
@@ -211,45 +481,232 @@ static tr_lock* getVerifyLock(void)
     return lock;
 }
 
-static void verifyThreadFunc(void* /*user_data*/)
+/* must be called with the verify lock held.
+ * takes `n` bytes' worth of tokens and returns how long to wait before reading more */
+static std::chrono::milliseconds takeTokens(uint64_t n)
 {
-    for (;;)
+    if (speedLimit == 0)
     {
-        bool changed = false;
+        return std::chrono::milliseconds{ 0 };
+    }
 
-        tr_lockLock(getVerifyLock());
-        stopCurrent = false;
-        if (std::empty(verifyList))
+    auto const now = verify_clock::now();
+    double const elapsed = std::chrono::duration<double>(now - tokensUpdatedAt).count();
+    tokensUpdatedAt = now;
+
+    /* allow bursts of up to a second's worth */
+    tokens = std::min(tokens + elapsed * speedLimit, double(speedLimit)) - n;
+
+    return std::chrono::milliseconds{ tokens >= 0 ? 0 : int64_t(-tokens * 1000 / speedLimit) };
+}
+
+/* give way to peers' reads and writes while they're waiting on the disk */
+static void waitForPeerIo(tr_session* session)
+{
+    for (int waited = 0; waited < MaxYieldMsecPerChunk; waited += YieldMsec)
+    {
+        if (session->diskIo == nullptr || tr_diskIoGetStats(session->diskIo).queue_depth == 0)
+        {
+            break;
+        }
+
+        tr_wait_msec(YieldMsec);
+    }
+}
+
+/* must be called with the verify lock held.
+ * returns the first started torrent that has pieces to hand out or that's ready to finish,
+ * starting the next queued one if there's none */
+static verify_task* getNextTask(void)
+{
+    for (auto& task : activeList)
+    {
+        if (task.isReadyToFinish() || task.hasPiecesToHandOut())
         {
-            currentNode.torrent = nullptr;
-            break; // FIXME: unbalanced lock?
+            return &task;
         }
+    }
+
+    if (std::empty(verifyList))
+    {
+        return nullptr;
+    }
+
+    auto const it = std::begin(verifyList);
+    auto& task = activeList.emplace_back(verify_task{ *it, tr_time(), 0, 0, 0, false, false, false });
+    verifyList.erase(it);
+
+    tr_torrent* const tor = task.node.torrent;
+    tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
+    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
+    tr_torrentSetVerifyState(tor, TR_VERIFY_NOW);
+    tor->verify_progress = 0;
+    return &task;
+}
+
+/* must be called with the verify lock held. it's released while the callback runs */
+static void finishTask(verify_task* task)
+{
+    task->is_finishing = true;
+
+    tr_torrent* const tor = task->node.torrent;
+    auto const node = task->node;
+    bool const stopped = task->stop;
+    bool const changed = task->changed;
+    time_t const begin = task->begin;
+    tor->verify_progress.reset();
+
+    tr_lockUnlock(getVerifyLock());
+
+    tr_torrentSetVerifyState(tor, TR_VERIFY_NONE);
+    TR_ASSERT(tr_isTorrent(tor));
+
+    if (!stopped && changed)
+    {
+        tr_torrentSetDirty(tor);
+    }
+
+    /* stopwatch */
+    time_t const end = tr_time();
+    tr_logAddTorDbg(
+        tor,
+        "Verification is done. It took %d seconds to verify %" PRIu64 " bytes (%" PRIu64 " bytes per second)",
+        (int)(end - begin),
+        tor->info.totalSize,
+        (uint64_t)(tor->info.totalSize / (1 + (end - begin))));
+
+    if (node.callback_func != nullptr)
+    {
+        (*node.callback_func)(tor, stopped, node.callback_data);
+    }
+
+    tr_lockLock(getVerifyLock());
+    activeList.remove_if([task](auto const& that) { return &that == task; });
+}
+
+/* must be called with the verify lock held. it's released while the pieces are hashed */
+static void verifyRun(verify_reader* reader, verify_task* task)
+{
+    tr_torrent* const tor = task->node.torrent;
+    tr_piece_index_t const n_pieces = tor->info.pieceCount;
+    tr_piece_index_t const first = task->next_piece;
+    tr_piece_index_t const max_run = std::max(tr_piece_index_t(VerifyRunBytes / tor->info.pieceSize), tr_piece_index_t{ 1 });
+    tr_piece_index_t const n = std::min(max_run, n_pieces - first);
+    task->next_piece += n;
+    ++task->n_threads;
 
-        auto const it = std::begin(verifyList);
-        currentNode = *it;
-        verifyList.erase(it);
+    readerStartRun(reader, tor, first, first + n);
+
+    auto results = std::vector<verify_result>{};
+    results.reserve(MaxPiecesPerChunk);
+
+    for (tr_piece_index_t piece = first; piece < first + n && !task->stop;)
+    {
         tr_lockUnlock(getVerifyLock());
 
-        tr_torrent* tor = currentNode.torrent;
-        tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
-        tr_torrentSetVerifyState(tor, TR_VERIFY_NOW);
-        changed = verifyTorrent(tor, &stopCurrent);
-        tr_torrentSetVerifyState(tor, TR_VERIFY_NONE);
-        TR_ASSERT(tr_isTorrent(tor));
+        results.clear();
+        uint32_t const chunk_size = readerHashChunk(reader, results);
+
+        waitForPeerIo(tor->session);
 
-        if (!stopCurrent && changed)
+        tr_lockLock(getVerifyLock());
+        auto const wait = takeTokens(chunk_size);
+        tr_lockUnlock(getVerifyLock());
+
+        if (wait.count() > 0)
         {
-            tr_torrentSetDirty(tor);
+            tr_wait_msec(wait.count());
         }
 
-        if (currentNode.callback_func != nullptr)
+        tr_lockLock(getVerifyLock());
+
+        for (auto const& [result_piece, has_piece] : results)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            bool const had_piece = tr_torrentPieceIsComplete(tor, result_piece);
+
+            if (has_piece || had_piece)
+            {
+                tr_torrentSetHasPiece(tor, result_piece, has_piece);
+                task->changed |= has_piece != had_piece;
+            }
+
+            piece = result_piece + 1;
+            ++task->pieces_done;
         }
+
+        bytesVerified += chunk_size;
+        busyBytes += chunk_size;
+
+        tor->anyDate = tr_time();
+        tor->verify_progress = task->pieces_done / double(n_pieces);
     }
 
-    verifyThread = nullptr;
     tr_lockUnlock(getVerifyLock());
+    readerEndRun(reader);
+    tr_lockLock(getVerifyLock());
+
+    --task->n_threads;
+}
+
+static void verifyThreadFunc(void* /*user_data*/)
+{
+    auto* const reader = readerNew();
+
+    tr_lockLock(getVerifyLock());
+
+    while (nThreads <= maxThreads)
+    {
+        verify_task* const task = getNextTask();
+
+        if (task == nullptr)
+        {
+            break;
+        }
+
+        if (task->isReadyToFinish())
+        {
+            finishTask(task);
+        }
+        else
+        {
+            verifyRun(reader, task);
+
+            if (task->isReadyToFinish())
+            {
+                finishTask(task);
+            }
+        }
+    }
+
+    if (--nThreads == 0)
+    {
+        busyEnd = verify_clock::now();
+    }
+
+    tr_lockUnlock(getVerifyLock());
+
+    readerFree(reader);
+}
+
+/* must be called with the verify lock held */
+static void startThreads(void)
+{
+    if (std::empty(verifyList) && std::empty(activeList))
+    {
+        return;
+    }
+
+    if (nThreads == 0)
+    {
+        busyBegin = verify_clock::now();
+        busyBytes = 0;
+    }
+
+    while (nThreads < maxThreads)
+    {
+        ++nThreads;
+        tr_threadNew(verifyThreadFunc, nullptr);
+    }
 }
 
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_data)
@@ -266,12 +723,7 @@ void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* call
     tr_lockLock(getVerifyLock());
     tr_torrentSetVerifyState(tor, TR_VERIFY_WAIT);
     verifyList.insert(node);
-
-    if (verifyThread == nullptr)
-    {
-        verifyThread = tr_threadNew(verifyThreadFunc, nullptr);
-    }
-
+    startThreads();
     tr_lockUnlock(getVerifyLock());
 }
 
@@ -282,11 +734,25 @@ void tr_verifyRemove(tr_torrent* tor)
     tr_lock* lock = getVerifyLock();
     tr_lockLock(lock);
 
-    if (tor == currentNode.torrent)
+    auto const is_active = [tor]()
     {
-        stopCurrent = true;
+        return std::any_of(
+            std::begin(activeList),
+            std::end(activeList),
+            [tor](auto const& task) { return tor == task.node.torrent; });
+    };
 
-        while (stopCurrent)
+    if (is_active())
+    {
+        for (auto& task : activeList)
+        {
+            if (tor == task.node.torrent)
+            {
+                task.stop = true;
+            }
+        }
+
+        while (is_active())
         {
             tr_lockUnlock(lock);
             tr_wait_msec(100);
@@ -320,8 +786,67 @@ void tr_verifyClose(tr_session* /*session*/)
 {
     tr_lockLock(getVerifyLock());
 
-    stopCurrent = true;
+    for (auto& task : activeList)
+    {
+        task.stop = true;
+    }
+
     verifyList.clear();
 
     tr_lockUnlock(getVerifyLock());
 }
+
+void tr_verifySetThreadCount(int n)
+{
+    tr_lockLock(getVerifyLock());
+
+    maxThreads = std::max(n, 1);
+    startThreads();
+
+    tr_lockUnlock(getVerifyLock());
+}
+
+int tr_verifyGetThreadCount(void)
+{
+    tr_lockLock(getVerifyLock());
+    int const n = maxThreads;
+    tr_lockUnlock(getVerifyLock());
+    return n;
+}
+
+void tr_verifySetSpeedLimit(uint64_t bytes_per_second)
+{
+    tr_lockLock(getVerifyLock());
+
+    speedLimit = bytes_per_second;
+    tokens = double(bytes_per_second);
+    tokensUpdatedAt = verify_clock::now();
+
+    tr_lockUnlock(getVerifyLock());
+}
+
+uint64_t tr_verifyGetSpeedLimit(void)
+{
+    tr_lockLock(getVerifyLock());
+    uint64_t const limit = speedLimit;
+    tr_lockUnlock(getVerifyLock());
+    return limit;
+}
+
+tr_verify_stats tr_verifyGetStats(void)
+{
+    tr_lockLock(getVerifyLock());
+
+    auto stats = tr_verify_stats{};
+    stats.thread_count = maxThreads;
+    stats.queued_count = std::size(verifyList);
+    stats.active_count = std::size(activeList);
+    stats.bytes_verified = bytesVerified;
+
+    auto const end = nThreads > 0 ? verify_clock::now() : busyEnd;
+    auto const msec = std::chrono::duration_cast<std::chrono::milliseconds>(end - busyBegin).count();
+    stats.bytes_per_second = msec > 0 ? busyBytes * 1000 / uint64_t(msec) : 0;
+
+    tr_lockUnlock(getVerifyLock());
+    return stats;
+}
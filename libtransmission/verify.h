@@ -12,15 +12,44 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 /**
  * @addtogroup file_io File IO
  * @{
  */
 
+struct tr_verify_stats
+{
+    int thread_count;
+
+    /* torrents waiting to be verified, and ones being verified right now */
+    size_t queued_count;
+    size_t active_count;
+
+    uint64_t bytes_verified;
+
+    /* across all the threads, since they last went from idle to busy */
+    uint64_t bytes_per_second;
+};
+
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_user_data);
 
 void tr_verifyRemove(tr_torrent* tor);
 
 void tr_verifyClose(tr_session*);
 
+/** Sets how many threads hash pieces. Several threads can share one torrent. */
+void tr_verifySetThreadCount(int n);
+
+int tr_verifyGetThreadCount(void);
+
+/** Limits how fast the verify threads read, all together. 0 means no limit. */
+void tr_verifySetSpeedLimit(uint64_t bytes_per_second);
+
+uint64_t tr_verifyGetSpeedLimit(void);
+
+tr_verify_stats tr_verifyGetStats(void);
+
 /* @} */
@@ -0,0 +1,138 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "transmission.h"
+#include "block-requests.h"
+#include "crypto-utils.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+// the requests only compare peer pointers, so these never get dereferenced
+std::array<char, 8> peer_storage = {};
+
+tr_peer* fakePeer(size_t i)
+{
+    return reinterpret_cast<tr_peer*>(&peer_storage[i]);
+}
+
+} // namespace
+
+TEST(BlockRequests, addAndRemove)
+{
+    auto requests = tr_block_requests{};
+    EXPECT_TRUE(std::empty(requests));
+
+    requests.add(10, fakePeer(0), 100);
+    requests.add(11, fakePeer(0), 101);
+    requests.add(10, fakePeer(1), 102);
+    requests.add(12, fakePeer(0), 103);
+    EXPECT_EQ(4U, std::size(requests));
+
+    EXPECT_TRUE(requests.has(10, fakePeer(0)));
+    EXPECT_TRUE(requests.has(10, fakePeer(1)));
+    EXPECT_FALSE(requests.has(11, fakePeer(1)));
+    EXPECT_FALSE(requests.has(13, fakePeer(0)));
+
+    auto peers = requests.peers(10);
+    std::sort(std::begin(peers), std::end(peers));
+    EXPECT_EQ((std::vector<tr_peer*>{ fakePeer(0), fakePeer(1) }), peers);
+    EXPECT_TRUE(std::empty(requests.peers(13)));
+
+    // a peer's blocks are in the order they were requested
+    EXPECT_EQ((std::vector<tr_block_index_t>{ 10, 11, 12 }), requests.blocks(fakePeer(0)));
+    EXPECT_EQ((std::vector<tr_block_index_t>{ 10 }), requests.blocks(fakePeer(1)));
+    EXPECT_TRUE(std::empty(requests.blocks(fakePeer(2))));
+
+    EXPECT_TRUE(requests.remove(11, fakePeer(0)));
+    EXPECT_FALSE(requests.remove(11, fakePeer(0)));
+    EXPECT_FALSE(requests.remove(10, fakePeer(2)));
+    EXPECT_EQ((std::vector<tr_block_index_t>{ 10, 12 }), requests.blocks(fakePeer(0)));
+
+    auto sent_at = time_t{};
+    requests.forEach(
+        [&sent_at](tr_block_requests::request const& request)
+        {
+            if (request.block == 12)
+            {
+                sent_at = request.sent_at;
+            }
+        });
+    EXPECT_EQ(103, sent_at);
+
+    EXPECT_TRUE(requests.remove(10, fakePeer(0)));
+    EXPECT_TRUE(requests.remove(10, fakePeer(1)));
+    EXPECT_TRUE(requests.remove(12, fakePeer(0)));
+    EXPECT_TRUE(std::empty(requests));
+    EXPECT_TRUE(std::empty(requests.blocks(fakePeer(0))));
+}
+
+TEST(BlockRequests, matchesSet)
+{
+    auto constexpr Rounds = 20000;
+    auto constexpr BlockCount = 500;
+
+    // add and remove random requests, and check them against a std::set
+    auto requests = tr_block_requests{};
+    auto expected = std::set<std::pair<tr_block_index_t, tr_peer*>>{};
+
+    for (int i = 0; i < Rounds; ++i)
+    {
+        auto const block = tr_block_index_t(tr_rand_int_weak(BlockCount));
+        auto* const peer = fakePeer(tr_rand_int_weak(int(std::size(peer_storage))));
+        auto const key = std::make_pair(block, peer);
+
+        if (expected.count(key) != 0)
+        {
+            EXPECT_TRUE(requests.remove(block, peer));
+            expected.erase(key);
+        }
+        else
+        {
+            requests.add(block, peer, i);
+            expected.insert(key);
+        }
+    }
+
+    EXPECT_EQ(std::size(expected), std::size(requests));
+
+    auto found = std::set<std::pair<tr_block_index_t, tr_peer*>>{};
+    requests.forEach([&found](tr_block_requests::request const& request) { found.emplace(request.block, request.peer); });
+    EXPECT_EQ(expected, found);
+
+    for (tr_block_index_t block = 0; block < BlockCount; ++block)
+    {
+        for (auto* const peer : requests.peers(block))
+        {
+            EXPECT_EQ(1U, expected.count(std::make_pair(block, peer)));
+        }
+
+        for (size_t i = 0; i < std::size(peer_storage); ++i)
+        {
+            EXPECT_EQ(expected.count(std::make_pair(block, fakePeer(i))) != 0, requests.has(block, fakePeer(i)));
+        }
+    }
+
+    for (size_t i = 0; i < std::size(peer_storage); ++i)
+    {
+        for (auto const block : requests.blocks(fakePeer(i)))
+        {
+            EXPECT_TRUE(requests.remove(block, fakePeer(i)));
+        }
+    }
+
+    EXPECT_TRUE(std::empty(requests));
+}
@@ -16,6 +16,7 @@
 #define KEY_LEN KEY_LEN_
 
 #define tr_sha1_ctx_t tr_sha1_ctx_t_
+#define tr_sha256_ctx_t tr_sha256_ctx_t_
 #define tr_dh_ctx_t tr_dh_ctx_t_
 #define tr_dh_secret_t tr_dh_secret_t_
 #define tr_ssl_ctx_t tr_ssl_ctx_t_
@@ -38,6 +39,9 @@
 #define tr_sha1_init tr_sha1_init_
 #define tr_sha1_update tr_sha1_update_
 #define tr_sha1_final tr_sha1_final_
+#define tr_sha256_init tr_sha256_init_
+#define tr_sha256_update tr_sha256_update_
+#define tr_sha256_final tr_sha256_final_
 #define tr_dh_new tr_dh_new_
 #define tr_dh_free tr_dh_free_
 #define tr_dh_make_key tr_dh_make_key_
@@ -75,6 +79,7 @@
 #undef KEY_LEN_
 
 #undef tr_sha1_ctx_t
+#undef tr_sha256_ctx_t
 #undef tr_dh_ctx_t
 #undef tr_dh_secret_t
 #undef tr_ssl_ctx_t
@@ -97,6 +102,9 @@
 #undef tr_sha1_init
 #undef tr_sha1_update
 #undef tr_sha1_final
+#undef tr_sha256_init
+#undef tr_sha256_update
+#undef tr_sha256_final
 #undef tr_dh_new
 #undef tr_dh_free
 #undef tr_dh_make_key
@@ -127,6 +135,7 @@
 #define KEY_LEN_ KEY_LEN
 
 #define tr_sha1_ctx_t_ tr_sha1_ctx_t
+#define tr_sha256_ctx_t_ tr_sha256_ctx_t
 #define tr_dh_ctx_t_ tr_dh_ctx_t
 #define tr_dh_secret_t_ tr_dh_secret_t
 #define tr_ssl_ctx_t_ tr_ssl_ctx_t
@@ -149,6 +158,9 @@
 #define tr_sha1_init_ tr_sha1_init
 #define tr_sha1_update_ tr_sha1_update
 #define tr_sha1_final_ tr_sha1_final
+#define tr_sha256_init_ tr_sha256_init
+#define tr_sha256_update_ tr_sha256_update
+#define tr_sha256_final_ tr_sha256_final
 #define tr_dh_new_ tr_dh_new
 #define tr_dh_free_ tr_dh_free
 #define tr_dh_make_key_ tr_dh_make_key
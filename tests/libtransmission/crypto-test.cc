@@ -19,6 +19,7 @@
 #include <cstring>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 using namespace std::literals;
 
@@ -122,6 +123,109 @@ TEST(Crypto, sha1)
     EXPECT_EQ(0, memcmp(hash1.data(), hash2.data(), hash2.size()));
 }
 
+TEST(Crypto, sha256)
+{
+    auto hash1 = std::array<uint8_t, TR_SHA256_DIGEST_LEN>{};
+    auto hash2 = std::array<uint8_t, TR_SHA256_DIGEST_LEN>{};
+
+    auto* sha = tr_sha256_init();
+    EXPECT_TRUE(tr_sha256_update(sha, "test", 4));
+    EXPECT_TRUE(tr_sha256_final(sha, hash1.data()));
+    auto* sha_ = tr_sha256_init_();
+    EXPECT_TRUE(tr_sha256_update_(sha_, "test", 4));
+    EXPECT_TRUE(tr_sha256_final_(sha_, hash2.data()));
+    EXPECT_EQ(
+        0,
+        memcmp(
+            hash1.data(),
+            "\x9f\x86\xd0\x81\x88\x4c\x7d\x65\x9a\x2f\xea\xa0\xc5\x5a\xd0\x15"
+            "\xa3\xbf\x4f\x1b\x2b\x0b\x82\x2c\xd1\x5d\x6c\x15\xb0\xf0\x0a\x08",
+            hash1.size()));
+    EXPECT_EQ(0, memcmp(hash1.data(), hash2.data(), hash2.size()));
+
+    sha = tr_sha256_init();
+    EXPECT_TRUE(tr_sha256_update(sha, "1", 1));
+    EXPECT_TRUE(tr_sha256_update(sha, "23", 2));
+    EXPECT_TRUE(tr_sha256_update(sha, "", 0));
+    auto const digest = tr_sha256_final(sha);
+    ASSERT_TRUE(digest);
+    EXPECT_EQ(
+        0,
+        memcmp(
+            std::data(*digest),
+            "\xa6\x65\xa4\x59\x20\x42\x2f\x9d\x41\x7e\x48\x67\xef\xdc\x4f\xb8"
+            "\xa0\x4a\x1f\x3f\xff\x1f\xa0\x7e\x99\x8e\x86\xf7\xf7\xa2\x7a\xe3",
+            std::size(*digest)));
+}
+
+TEST(Crypto, sha1Many)
+{
+    auto constexpr MaxBuffers = size_t{ 11 };
+    auto constexpr Lengths = std::array<size_t, 14>{ 0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 1000, 16384, 16385 };
+
+    auto buf = std::vector<uint8_t>(MaxBuffers * Lengths.back());
+    for (auto& ch : buf)
+    {
+        ch = uint8_t(tr_rand_int_weak(256));
+    }
+
+    auto const default_kernel = tr_sha1_get_kernel();
+
+    for (auto const kernel : { TR_SHA1_KERNEL_GENERIC, TR_SHA1_KERNEL_AVX2, TR_SHA1_KERNEL_SHANI })
+    {
+        if (!tr_sha1_set_kernel(kernel))
+        {
+            EXPECT_FALSE(tr_sha1_kernel_is_supported(kernel));
+            continue;
+        }
+
+        EXPECT_EQ(kernel, tr_sha1_get_kernel());
+
+        for (auto const length : Lengths)
+        {
+            for (size_t n = 1; n <= MaxBuffers; ++n)
+            {
+                auto data = std::vector<uint8_t const*>{};
+                for (size_t i = 0; i < n; ++i)
+                {
+                    data.push_back(buf.data() + i * length);
+                }
+
+                auto hashes = std::vector<tr_sha1_digest_t>(n);
+                tr_sha1_many(data.data(), n, length, hashes.data());
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    auto expected = tr_sha1_digest_t{};
+                    EXPECT_TRUE(tr_sha1_(reinterpret_cast<uint8_t*>(expected.data()), data[i], int(length), nullptr));
+                    EXPECT_EQ(expected, hashes[i]) << "kernel " << kernel << ", length " << length << ", buffer " << i;
+                }
+            }
+        }
+    }
+
+    EXPECT_TRUE(tr_sha1_set_kernel(default_kernel));
+}
+
+TEST(Crypto, sha1DefaultKernel)
+{
+    auto const default_kernel = tr_sha1_get_kernel();
+    EXPECT_TRUE(tr_sha1_kernel_is_supported(default_kernel));
+
+    if (tr_sha1_kernel_is_supported(TR_SHA1_KERNEL_AVX2))
+    {
+        EXPECT_EQ(TR_SHA1_KERNEL_AVX2, default_kernel);
+    }
+    else if (tr_sha1_kernel_is_supported(TR_SHA1_KERNEL_SHANI))
+    {
+        EXPECT_EQ(TR_SHA1_KERNEL_SHANI, default_kernel);
+    }
+    else
+    {
+        EXPECT_EQ(TR_SHA1_KERNEL_GENERIC, default_kernel);
+    }
+}
+
 TEST(Crypto, ssha1)
 {
     struct LocalTest
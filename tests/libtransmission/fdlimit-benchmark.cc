@@ -0,0 +1,198 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> // getenv()
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "fdlimit.h"
+#include "file.h"
+#include "log.h"
+#include "utils.h"
+#include "variant.h"
+
+/* Times opening, looking up, and evicting files in the fd cache as it
+ * grows to 10,000 files, to show that none of them slow down with size. */
+
+namespace
+{
+
+auto constexpr CacheSizes = std::array<tr_file_index_t, 3>{ 100, 1000, 10000 };
+auto constexpr LookupPasses = 20;
+
+double elapsedSince(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+bool checkout(tr_session* session, int torrent_id, tr_file_index_t i, std::string const& dir)
+{
+    auto const path = tr_strvPath(dir, std::to_string(i));
+    if (tr_fdFileCheckout(session, torrent_id, i, path.c_str(), true, TR_PREALLOCATE_NONE, 0) == TR_BAD_SYS_FILE)
+    {
+        return false;
+    }
+
+    tr_fdFileReturn(session, torrent_id, i);
+    return true;
+}
+
+void rimraf(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+
+        auto const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        if (odir != TR_BAD_SYS_DIR)
+        {
+            char const* name = nullptr;
+            while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+            {
+                if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+                {
+                    children.push_back(tr_strvPath(path, name));
+                }
+            }
+
+            tr_sys_dir_close(odir, nullptr);
+        }
+
+        for (auto const& child : children)
+        {
+            rimraf(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+/* returns false if a file couldn't be opened */
+bool run(tr_session* session, std::string const& sandbox, tr_file_index_t n_files)
+{
+    auto const torrent_id = int(n_files);
+    auto const dir = tr_strvPath(sandbox, std::to_string(n_files));
+    tr_sys_dir_create(dir.c_str(), 0, 0700, nullptr);
+
+    // fill the cache
+    auto begin = std::chrono::steady_clock::now();
+    for (tr_file_index_t i = 0; i < n_files; ++i)
+    {
+        if (!checkout(session, torrent_id, i, dir))
+        {
+            return false;
+        }
+    }
+
+    auto const open_sec = elapsedSince(begin);
+
+    // look every file up, in a different order each pass
+    auto order = std::vector<tr_file_index_t>(n_files);
+    std::iota(std::begin(order), std::end(order), 0);
+    auto rng = std::mt19937{ n_files };
+    auto n_found = size_t{};
+    auto lookup_sec = double{};
+
+    for (int pass = 0; pass < LookupPasses; ++pass)
+    {
+        std::shuffle(std::begin(order), std::end(order), rng);
+
+        begin = std::chrono::steady_clock::now();
+        for (auto const i : order)
+        {
+            if (tr_fdFileGetCached(session, torrent_id, i, false) != TR_BAD_SYS_FILE)
+            {
+                tr_fdFileReturn(session, torrent_id, i);
+                ++n_found;
+            }
+        }
+
+        lookup_sec += elapsedSince(begin);
+    }
+
+    // each new file closes the least recently used one to make room
+    begin = std::chrono::steady_clock::now();
+    for (tr_file_index_t i = n_files; i < n_files * 2; ++i)
+    {
+        if (!checkout(session, torrent_id, i, dir))
+        {
+            return false;
+        }
+    }
+
+    auto const evict_sec = elapsedSince(begin);
+
+    tr_fdTorrentClose(session, torrent_id);
+
+    std::printf(
+        "%5u files: open %5.2f us, lookup %4.0f ns (%zu/%zu found), open + evict %5.2f us\n",
+        unsigned(n_files),
+        open_sec / n_files * 1e6,
+        lookup_sec / (n_files * LookupPasses) * 1e9,
+        n_found,
+        size_t(n_files) * LookupPasses,
+        evict_sec / n_files * 1e6);
+
+    return true;
+}
+
+} // namespace
+
+int main()
+{
+    char const* const tmpdir = getenv("TMPDIR");
+    auto sandbox = tr_strvPath(tmpdir != nullptr ? tmpdir : ".", "transmission-benchmark-XXXXXX");
+    if (!tr_sys_dir_create_temp(std::data(sandbox), nullptr))
+    {
+        std::fprintf(stderr, "couldn't create a directory for the session\n");
+        return 1;
+    }
+
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 4);
+    tr_variantDictAddStr(&settings, TR_KEY_download_dir, tr_strvPath(sandbox, "Downloads").c_str());
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    tr_session* const session = tr_sessionInit(sandbox.c_str(), true, &settings);
+    tr_variantFree(&settings);
+
+    auto ret = 0;
+
+    for (auto const n_files : CacheSizes)
+    {
+        // this raises the open-files rlimit if it can, and settles for less if it can't
+        tr_fdSetFileLimit(session, n_files);
+        if (tr_fdGetFileLimit(session) < int(n_files))
+        {
+            std::printf("%5u files: skipped, the open-files rlimit is too low\n", unsigned(n_files));
+            ret = 1;
+            continue;
+        }
+
+        if (!run(session, sandbox, n_files))
+        {
+            std::fprintf(stderr, "%u files: couldn't open a file\n", unsigned(n_files));
+            ret = 1;
+        }
+    }
+
+    tr_sessionClose(session);
+    rimraf(sandbox);
+
+    return ret;
+}
@@ -0,0 +1,142 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "fdlimit.h"
+#include "file.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+#include <string>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class FdLimitTest : public SessionTest
+{
+protected:
+    static auto constexpr TorrentId = int{ 1 };
+
+    std::string filename(tr_file_index_t i) const
+    {
+        return tr_strvPath(sandboxDir(), "file-" + std::to_string(i));
+    }
+
+    bool checkout(tr_file_index_t i)
+    {
+        auto const path = filename(i);
+        auto const fd = tr_fdFileCheckout(session_, TorrentId, i, path.c_str(), true, TR_PREALLOCATE_NONE, 0);
+
+        if (fd == TR_BAD_SYS_FILE)
+        {
+            return false;
+        }
+
+        tr_fdFileReturn(session_, TorrentId, i);
+        return true;
+    }
+
+    bool isCached(tr_file_index_t i)
+    {
+        if (tr_fdFileGetCached(session_, TorrentId, i, false) == TR_BAD_SYS_FILE)
+        {
+            return false;
+        }
+
+        tr_fdFileReturn(session_, TorrentId, i);
+        return true;
+    }
+};
+
+TEST_F(FdLimitTest, evictsLeastRecentlyUsed)
+{
+    tr_fdSetFileLimit(session_, 3);
+    EXPECT_EQ(3, tr_fdGetFileLimit(session_));
+
+    EXPECT_TRUE(checkout(0));
+    EXPECT_TRUE(checkout(1));
+    EXPECT_TRUE(checkout(2));
+
+    // use file 0 again, so file 1 is the least recently used
+    EXPECT_TRUE(isCached(0));
+
+    EXPECT_TRUE(checkout(3));
+    EXPECT_TRUE(isCached(0));
+    EXPECT_FALSE(isCached(1));
+    EXPECT_TRUE(isCached(2));
+    EXPECT_TRUE(isCached(3));
+
+    // checked-out files are never closed to make room
+    auto const path = filename(0);
+    auto const fd = tr_fdFileCheckout(session_, TorrentId, 0, path.c_str(), true, TR_PREALLOCATE_NONE, 0);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    tr_fdSetFileLimit(session_, 1);
+    EXPECT_TRUE(isCached(0));
+    EXPECT_FALSE(isCached(2));
+    EXPECT_FALSE(isCached(3));
+    tr_fdFileReturn(session_, TorrentId, 0);
+
+    // with a limit of one, file 0 has to make way now that it's been returned
+    EXPECT_TRUE(checkout(4));
+    EXPECT_FALSE(isCached(0));
+    EXPECT_TRUE(isCached(4));
+}
+
+TEST_F(FdLimitTest, evictsLeastRecentlyUsedAmongManyFiles)
+{
+    auto constexpr NumFiles = tr_file_index_t{ 10000 };
+
+    // this raises the open-files rlimit if it can, and settles for less if it can't
+    tr_fdSetFileLimit(session_, NumFiles);
+
+    if (tr_fdGetFileLimit(session_) < int(NumFiles))
+    {
+        GTEST_SKIP() << "the open-files rlimit is too low to cache " << NumFiles << " files";
+    }
+
+    for (tr_file_index_t i = 0; i < NumFiles; ++i)
+    {
+        ASSERT_TRUE(checkout(i)) << filename(i);
+    }
+
+    // use the even-numbered files again, oldest first,
+    // so the odd-numbered ones are the least recently used
+    for (tr_file_index_t i = 0; i < NumFiles; i += 2)
+    {
+        EXPECT_TRUE(isCached(i));
+    }
+
+    // each new file closes the least recently used one
+    for (tr_file_index_t i = 0; i < NumFiles / 2; ++i)
+    {
+        ASSERT_TRUE(checkout(NumFiles + i));
+    }
+
+    for (tr_file_index_t i = 0; i < NumFiles; ++i)
+    {
+        EXPECT_EQ(i % 2 == 0, isCached(i)) << i;
+    }
+
+    for (tr_file_index_t i = NumFiles; i < NumFiles + NumFiles / 2; ++i)
+    {
+        EXPECT_TRUE(isCached(i)) << i;
+    }
+
+    // and then the even-numbered ones go, in the order they were used
+    ASSERT_TRUE(checkout(NumFiles + NumFiles / 2));
+    EXPECT_FALSE(isCached(0));
+    EXPECT_TRUE(isCached(2));
+}
+
+} // namespace test
+
+} // namespace libtransmission
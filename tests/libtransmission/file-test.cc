@@ -13,9 +13,11 @@
 
 #include "test-fixtures.h"
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -220,6 +222,122 @@ protected:
         EXPECT_TRUE(tr_sys_dir_close(dd, &err));
         EXPECT_EQ(nullptr, err);
     }
+
+    void testFileBatch(std::string const& test_dir)
+    {
+        auto const path1 = tr_strvPath(test_dir, "a"sv);
+        auto const path2 = tr_strvPath(test_dir, "b"sv);
+        auto const fd1 = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+        auto const fd2 = tr_sys_file_open(path2.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+        /* writes to two files, out of order */
+        char hello[] = "hello";
+        char world[] = "world";
+        char other[] = "other file";
+        auto writes = std::array<tr_sys_file_io, 3>{ {
+            { fd1, world, 5, 6, true, 0, 0 },
+            { fd2, other, 10, 0, true, 0, 0 },
+            { fd1, hello, 5, 0, true, 0, 0 },
+        } };
+
+        tr_error* err = nullptr;
+        EXPECT_TRUE(tr_sys_file_batch(writes.data(), writes.size(), &err));
+        EXPECT_EQ(nullptr, err);
+
+        for (auto const& io : writes)
+        {
+            EXPECT_EQ(0, io.err);
+            EXPECT_EQ(io.size, io.bytes_done);
+        }
+
+        /* reads, including one that runs past the end of the file */
+        auto buf1 = std::array<char, 5>{};
+        auto buf2 = std::array<char, 5>{};
+        auto buf3 = std::array<char, 100>{};
+        auto reads = std::array<tr_sys_file_io, 3>{ {
+            { fd1, buf1.data(), buf1.size(), 6, false, 0, 0 },
+            { fd1, buf2.data(), buf2.size(), 0, false, 0, 0 },
+            { fd2, buf3.data(), buf3.size(), 6, false, 0, 0 },
+        } };
+
+        EXPECT_TRUE(tr_sys_file_batch(reads.data(), reads.size(), &err));
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(5, reads[0].bytes_done);
+        EXPECT_EQ(0, memcmp("world", buf1.data(), 5));
+        EXPECT_EQ(5, reads[1].bytes_done);
+        EXPECT_EQ(0, memcmp("hello", buf2.data(), 5));
+        EXPECT_EQ(4, reads[2].bytes_done);
+        EXPECT_EQ(0, memcmp("file", buf3.data(), 4));
+
+        /* gathered writes and scattered reads */
+        char part1[] = "gat";
+        char part2[] = "her";
+        char part3[] = "ed";
+        auto const gather = std::array<tr_sys_file_iovec, 3>{ { { part1, 3 }, { part2, 3 }, { part3, 2 } } };
+        auto vectored = std::array<tr_sys_file_io, 1>{};
+        vectored[0] = tr_sys_file_io{ fd1, nullptr, 8, 11, true, 0, 0, gather.data(), gather.size() };
+        EXPECT_TRUE(tr_sys_file_batch(vectored.data(), vectored.size(), &err));
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(8, vectored[0].bytes_done);
+
+        auto scatter1 = std::array<char, 4>{};
+        auto scatter2 = std::array<char, 10>{};
+        auto const scatter = std::array<tr_sys_file_iovec, 2>{ { { scatter1.data(), scatter1.size() },
+                                                                 { scatter2.data(), scatter2.size() } } };
+        vectored[0] = tr_sys_file_io{ fd1, nullptr, 14, 5, false, 0, 0, scatter.data(), scatter.size() };
+        EXPECT_TRUE(tr_sys_file_batch(vectored.data(), vectored.size(), &err));
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(14, vectored[0].bytes_done);
+        EXPECT_EQ(0, memcmp("\0wor", scatter1.data(), 4));
+        EXPECT_EQ(0, memcmp("ldgathered", scatter2.data(), 10));
+
+        /* more operations than fit in one submission */
+        auto many_bufs = std::vector<std::array<char, 4>>(200);
+        auto many = std::vector<tr_sys_file_io>{};
+        for (size_t i = 0; i < many_bufs.size(); ++i)
+        {
+            memcpy(many_bufs[i].data(), &i, std::min(sizeof(i), many_bufs[i].size()));
+            many.push_back({ fd2, many_bufs[i].data(), many_bufs[i].size(), i * many_bufs[i].size(), true, 0, 0 });
+        }
+
+        EXPECT_TRUE(tr_sys_file_batch(many.data(), many.size(), &err));
+        EXPECT_EQ(nullptr, err);
+
+        for (auto& io : many)
+        {
+            EXPECT_EQ(io.size, io.bytes_done);
+            io.is_write = false;
+        }
+
+        auto const expected = many_bufs;
+        std::fill(many_bufs.begin(), many_bufs.end(), std::array<char, 4>{});
+        EXPECT_TRUE(tr_sys_file_batch(many.data(), many.size(), &err));
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(expected, many_bufs);
+
+        tr_sys_file_close(fd2, nullptr);
+
+        /* a failed operation doesn't stop the others */
+        auto const fd3 = tr_sys_file_open(path2.c_str(), TR_SYS_FILE_READ, 0600, nullptr);
+        auto failing = std::array<tr_sys_file_io, 2>{ {
+            { fd3, hello, 5, 0, true, 0, 0 },
+            { fd1, buf2.data(), buf2.size(), 6, false, 0, 0 },
+        } };
+
+        EXPECT_FALSE(tr_sys_file_batch(failing.data(), failing.size(), &err));
+        EXPECT_NE(nullptr, err);
+        tr_error_clear(&err);
+        EXPECT_NE(0, failing[0].err);
+        EXPECT_EQ(0, failing[1].err);
+        EXPECT_EQ(5, failing[1].bytes_done);
+        EXPECT_EQ(0, memcmp("world", buf2.data(), 5));
+
+        tr_sys_file_close(fd3, nullptr);
+        tr_sys_file_close(fd1, nullptr);
+
+        tr_sys_path_remove(path2.c_str(), nullptr);
+        tr_sys_path_remove(path1.c_str(), nullptr);
+    }
 };
 
 TEST_F(FileTest, getInfo)
@@ -1134,11 +1252,47 @@ TEST_F(FileTest, fileReadWriteSeek)
 
     EXPECT_EQ(0, memcmp("st-ok", buf.data(), 5));
 
+    /* a duplicate reads the same file and outlives the original */
+    auto const fd2 = tr_sys_file_dup(fd, &err);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd2);
+    EXPECT_EQ(nullptr, err);
+
     tr_sys_file_close(fd, nullptr);
 
+    EXPECT_TRUE(tr_sys_file_read_at(fd2, buf.data(), 4, 0, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(4, n);
+
+    EXPECT_EQ(0, memcmp("tEst", buf.data(), 4));
+
+    tr_sys_file_close(fd2, nullptr);
+
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, fileBatch)
+{
+    EXPECT_TRUE(tr_sys_file_batch_set_backend(TR_SYS_FILE_BATCH_SEQUENTIAL));
+    EXPECT_EQ(TR_SYS_FILE_BATCH_SEQUENTIAL, tr_sys_file_batch_get_backend());
+
+    testFileBatch(createTestDir(currentTestName()));
+}
+
+TEST_F(FileTest, fileBatchIoUring)
+{
+    if (!tr_sys_file_batch_set_backend(TR_SYS_FILE_BATCH_IO_URING))
+    {
+        EXPECT_EQ(TR_SYS_FILE_BATCH_SEQUENTIAL, tr_sys_file_batch_get_backend());
+        GTEST_SKIP() << "io_uring isn't available";
+    }
+
+    EXPECT_EQ(TR_SYS_FILE_BATCH_IO_URING, tr_sys_file_batch_get_backend());
+
+    testFileBatch(createTestDir(currentTestName()));
+
+    EXPECT_TRUE(tr_sys_file_batch_set_backend(TR_SYS_FILE_BATCH_SEQUENTIAL));
+}
+
 TEST_F(FileTest, fileTruncate)
 {
     auto const test_dir = createTestDir(currentTestName());
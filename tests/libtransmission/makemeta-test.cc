@@ -14,10 +14,12 @@
 
 #include "test-fixtures.h"
 
+#include <algorithm>
 #include <array>
 #include <cstdlib> // mktemp()
 #include <cstring> // strlen()
 #include <string>
+#include <vector>
 
 using namespace std::literals;
 
@@ -281,6 +283,54 @@ TEST_F(MakemetaTest, singleFileDifferentSourceFlags)
     tr_metainfoFree(&inf_testme);
 }
 
+TEST_F(MakemetaTest, hashesPiecesOnManyThreads)
+{
+    auto constexpr PieceSize = uint32_t{ 1024 * 16 };
+    auto constexpr FileCount = size_t{ 5 };
+
+    // a payload that's many batches of pieces long, and that doesn't end on a piece boundary
+    auto const top = tr_strvPath(sandboxDir(), "folder");
+    ASSERT_TRUE(tr_sys_dir_create(top.c_str(), 0, 0700, nullptr));
+
+    for (size_t i = 0; i < FileCount; ++i)
+    {
+        auto payload = std::vector<char>(100000 + i * 33333);
+        tr_rand_buffer(std::data(payload), std::size(payload));
+        createFileWithContents(tr_strvPath(top, "file-" + std::to_string(i)), std::data(payload), std::size(payload));
+    }
+
+    auto info_hashes = std::vector<std::array<uint8_t, SHA_DIGEST_LENGTH>>{};
+
+    for (int const thread_count : { 1, 4 })
+    {
+        auto* builder = tr_metaInfoBuilderCreate(top.c_str());
+        EXPECT_TRUE(tr_metaInfoBuilderSetPieceSize(builder, PieceSize));
+        tr_metaInfoBuilderSetThreadCount(builder, thread_count);
+        EXPECT_EQ(thread_count, builder->threadCount);
+
+        auto const torrent_file = tr_strvPath(sandboxDir(), "threads-" + std::to_string(thread_count) + ".torrent");
+        tr_makeMetaInfo(builder, torrent_file.c_str(), nullptr, 0, nullptr, false, nullptr);
+        EXPECT_TRUE(waitFor([builder]() { return builder->isDone; }, 5000));
+        EXPECT_EQ(TR_MAKEMETA_OK, builder->result);
+        EXPECT_EQ(builder->pieceCount, builder->pieceIndex);
+
+        auto* ctor = tr_ctorNew(nullptr);
+        tr_ctorSetMetainfoFromFile(ctor, torrent_file.c_str());
+        auto inf = tr_info{};
+        EXPECT_EQ(TR_PARSE_OK, tr_torrentParse(ctor, &inf));
+
+        auto& info_hash = info_hashes.emplace_back();
+        std::copy_n(inf.hash, std::size(info_hash), std::begin(info_hash));
+
+        tr_ctorFree(ctor);
+        tr_metainfoFree(&inf);
+        tr_metaInfoBuilderFree(builder);
+    }
+
+    // the piece hashes are part of the info dict, so they're the same if the info hashes are
+    EXPECT_EQ(info_hashes[0], info_hashes[1]);
+}
+
 TEST_F(MakemetaTest, singleDirectoryRandomPayload)
 {
     auto constexpr DefaultMaxFileCount = size_t{ 16 };
@@ -8,15 +8,21 @@
 
 #include "transmission.h"
 
+#include "completion.h"
+#include "crypto-utils.h"
+#include "merkle.h"
 #include "metainfo.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 #include <array>
 #include <cerrno>
 #include <cstring>
 #include <string_view>
+#include <vector>
 
 using namespace std::literals;
 
@@ -177,3 +183,192 @@ TEST(Metainfo, AndroidTorrent)
 
     tr_ctorFree(ctor);
 }
+
+TEST(Metainfo, hybridMerkle)
+{
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto constexpr LengthA = uint32_t{ 40000 }; // two pieces, three blocks
+    auto constexpr LengthPad = uint32_t{ PieceSize * 2 - LengthA };
+    auto constexpr LengthB = uint32_t{ 10000 }; // one piece, one block
+
+    auto data_a = std::vector<uint8_t>(LengthA);
+    auto data_b = std::vector<uint8_t>(LengthB);
+    tr_rand_buffer(std::data(data_a), std::size(data_a));
+    tr_rand_buffer(std::data(data_b), std::size(data_b));
+
+    auto leaves_a = std::vector<tr_sha256_digest_t>{};
+    for (uint32_t offset = 0; offset < LengthA; offset += TR_MERKLE_BLOCK_SIZE)
+    {
+        leaves_a.push_back(tr_merkleHashBlock(&data_a[offset], std::min(TR_MERKLE_BLOCK_SIZE, LengthA - offset)));
+    }
+
+    auto const layer0 = tr_merkleRoot(&leaves_a[0], 2, 2);
+    auto const layer1 = tr_merkleRoot(&leaves_a[2], 1, 2);
+    auto const root_a = tr_merkleRoot(std::data(leaves_a), std::size(leaves_a), 4);
+    auto const root_b = tr_merkleHashBlock(std::data(data_b), std::size(data_b));
+    EXPECT_EQ(4U, tr_merkleLeafCount(LengthA));
+    EXPECT_EQ(1U, tr_merkleLeafCount(LengthB));
+    EXPECT_EQ(root_a, tr_merkleRoot(std::data(std::array<tr_sha256_digest_t, 2>{ layer0, layer1 }), 2, 2));
+    EXPECT_EQ(root_b, tr_merkleRoot(&root_b, 1, 1));
+
+    auto const as_sv = [](tr_sha256_digest_t const& digest)
+    {
+        return std::string_view{ reinterpret_cast<char const*>(std::data(digest)), std::size(digest) };
+    };
+
+    // build a hybrid torrent whose files are padded to piece boundaries
+    auto meta = tr_variant{};
+    tr_variantInitDict(&meta, 2);
+    auto* const info = tr_variantDictAddDict(&meta, TR_KEY_info, 6);
+    tr_variantDictAddStr(info, TR_KEY_name, "hybrid"sv);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    tr_variantDictAddStr(info, TR_KEY_pieces, std::string(3 * SHA_DIGEST_LENGTH, '\0'));
+    tr_variantDictAddInt(info, TR_KEY_meta_version, 2);
+
+    auto* const files = tr_variantDictAddList(info, TR_KEY_files, 3);
+    auto const add_file = [files](std::string_view name, int64_t length, bool is_padding)
+    {
+        auto* const file = tr_variantListAddDict(files, 3);
+        tr_variantDictAddInt(file, TR_KEY_length, length);
+        tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), name);
+        if (is_padding)
+        {
+            tr_variantDictAddStr(file, TR_KEY_attr, "p"sv);
+        }
+    };
+    add_file("a"sv, LengthA, false);
+    add_file(".pad"sv, LengthPad, true);
+    add_file("b"sv, LengthB, false);
+
+    auto* const file_tree = tr_variantDictAddDict(info, TR_KEY_file_tree, 2);
+    auto const add_tree_entry = [file_tree, &as_sv](std::string_view name, int64_t length, tr_sha256_digest_t const& root)
+    {
+        auto* const entry = tr_variantDictAddDict(tr_variantDictAddDict(file_tree, tr_quark_new(name), 1), TR_KEY_NONE, 2);
+        tr_variantDictAddInt(entry, TR_KEY_length, length);
+        tr_variantDictAddStr(entry, TR_KEY_pieces_root, as_sv(root));
+    };
+    add_tree_entry("a"sv, LengthA, root_a);
+    add_tree_entry("b"sv, LengthB, root_b);
+
+    auto* const piece_layers = tr_variantDictAddDict(&meta, TR_KEY_piece_layers, 1);
+    auto const layers_a = std::string{ as_sv(layer0) } + std::string{ as_sv(layer1) };
+    auto* const layer = tr_variantDictAddStr(piece_layers, tr_quark_new(as_sv(root_a)), layers_a);
+
+    auto parsed = tr_metainfoParse(nullptr, &meta, nullptr);
+    ASSERT_TRUE(parsed);
+    ASSERT_EQ(3U, std::size(parsed->merkle_pieces));
+
+    auto const& piece0 = parsed->merkle_pieces[0];
+    EXPECT_EQ(root_a, piece0.file_root);
+    EXPECT_EQ(layer0, piece0.root);
+    EXPECT_EQ(0U, piece0.first_leaf);
+    EXPECT_EQ(2U, piece0.n_leaves);
+    EXPECT_EQ(PieceSize, piece0.data_length);
+
+    auto const& piece1 = parsed->merkle_pieces[1];
+    EXPECT_EQ(root_a, piece1.file_root);
+    EXPECT_EQ(layer1, piece1.root);
+    EXPECT_EQ(2U, piece1.first_leaf);
+    EXPECT_EQ(2U, piece1.n_leaves);
+    EXPECT_EQ(LengthA - PieceSize, piece1.data_length);
+
+    auto const& piece2 = parsed->merkle_pieces[2];
+    EXPECT_EQ(root_b, piece2.file_root);
+    EXPECT_EQ(root_b, piece2.root);
+    EXPECT_EQ(0U, piece2.first_leaf);
+    EXPECT_EQ(1U, piece2.n_leaves);
+    EXPECT_EQ(LengthB, piece2.data_length);
+
+    // a piece layer that doesn't fit the file leaves the torrent with v1 checks only
+    tr_variantFree(layer);
+    tr_variantInitStr(layer, as_sv(layer0));
+    auto const v1_only = tr_metainfoParse(nullptr, &meta, nullptr);
+    ASSERT_TRUE(v1_only);
+    EXPECT_TRUE(std::empty(v1_only->merkle_pieces));
+
+    tr_variantFree(&meta);
+}
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using MerkleTest = SessionTest;
+
+TEST_F(MerkleTest, leavesForACompletePieceAreNotKept)
+{
+    auto constexpr PieceSize = uint32_t{ TR_MERKLE_BLOCK_SIZE * 2 };
+    auto constexpr Length = uint32_t{ PieceSize * 2 }; // two pieces, two leaves each
+
+    auto data = std::vector<uint8_t>(Length);
+    tr_rand_buffer(std::data(data), std::size(data));
+
+    auto leaves = std::vector<tr_sha256_digest_t>{};
+    for (uint32_t offset = 0; offset < Length; offset += TR_MERKLE_BLOCK_SIZE)
+    {
+        leaves.push_back(tr_merkleHashBlock(&data[offset], TR_MERKLE_BLOCK_SIZE));
+    }
+
+    auto const leaves0 = std::vector<tr_sha256_digest_t>{ leaves[0], leaves[1] };
+    auto const leaves1 = std::vector<tr_sha256_digest_t>{ leaves[2], leaves[3] };
+    auto const layer0 = tr_merkleRoot(std::data(leaves0), 2, 2);
+    auto const layer1 = tr_merkleRoot(std::data(leaves1), 2, 2);
+    auto const root = tr_merkleRoot(std::data(leaves), std::size(leaves), 4);
+
+    auto const as_sv = [](tr_sha256_digest_t const& digest)
+    {
+        return std::string_view{ reinterpret_cast<char const*>(std::data(digest)), std::size(digest) };
+    };
+
+    auto meta = tr_variant{};
+    tr_variantInitDict(&meta, 2);
+    auto* const info = tr_variantDictAddDict(&meta, TR_KEY_info, 6);
+    tr_variantDictAddStr(info, TR_KEY_name, "hybrid"sv);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    tr_variantDictAddStr(info, TR_KEY_pieces, std::string(2 * SHA_DIGEST_LENGTH, '\0'));
+    tr_variantDictAddInt(info, TR_KEY_meta_version, 2);
+
+    auto* const file = tr_variantListAddDict(tr_variantDictAddList(info, TR_KEY_files, 1), 2);
+    tr_variantDictAddInt(file, TR_KEY_length, Length);
+    tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), "a"sv);
+
+    auto* const file_tree = tr_variantDictAddDict(info, TR_KEY_file_tree, 1);
+    auto* const entry = tr_variantDictAddDict(tr_variantDictAddDict(file_tree, tr_quark_new("a"sv), 1), TR_KEY_NONE, 2);
+    tr_variantDictAddInt(entry, TR_KEY_length, Length);
+    tr_variantDictAddStr(entry, TR_KEY_pieces_root, as_sv(root));
+
+    auto* const piece_layers = tr_variantDictAddDict(&meta, TR_KEY_piece_layers, 1);
+    tr_variantDictAddStr(piece_layers, tr_quark_new(as_sv(root)), std::string{ as_sv(layer0) } + std::string{ as_sv(layer1) });
+
+    auto benc_len = size_t{};
+    auto* const benc = tr_variantToStr(&meta, TR_VARIANT_FMT_BENC, &benc_len);
+    tr_variantFree(&meta);
+
+    auto* const ctor = tr_ctorNew(session_);
+    tr_ctorSetMetainfo(ctor, reinterpret_cast<uint8_t const*>(benc), benc_len);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    tr_free(benc);
+    auto err = int{};
+    auto* const tor = tr_torrentNew(ctor, &err, nullptr);
+    tr_ctorFree(ctor);
+    ASSERT_NE(nullptr, tor);
+    ASSERT_TRUE(tor->hasMerkle());
+
+    // the hash reply for piece 0 only arrives after the piece is done
+    tr_cpPieceAdd(&tor->completion, 0);
+    EXPECT_FALSE(tor->setMerkleLeaves(0, std::vector<tr_sha256_digest_t>{ leaves0 }));
+    EXPECT_EQ(nullptr, tor->merkleLeaves(0));
+
+    // piece 1 still needs its leaves
+    EXPECT_TRUE(tor->setMerkleLeaves(1, std::vector<tr_sha256_digest_t>{ leaves1 }));
+    ASSERT_NE(nullptr, tor->merkleLeaves(1));
+    EXPECT_EQ(leaves1, *tor->merkleLeaves(1));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,215 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "transmission.h"
+#include "net.h"
+#include "peer-atom-pool.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+tr_address makeAddress(char const* str)
+{
+    auto addr = tr_address{};
+    EXPECT_TRUE(tr_address_from_string(&addr, str));
+    return addr;
+}
+
+tr_address makeAddress(int i)
+{
+    char str[32];
+    std::snprintf(str, sizeof(str), "10.0.%d.%d", i / 256, i % 256);
+    return makeAddress(str);
+}
+
+std::vector<time_t> shelfDates(peer_atom_pool const& pool)
+{
+    auto dates = std::vector<time_t>{};
+    for (auto const* const atom : pool)
+    {
+        dates.push_back(atom->shelf_date);
+    }
+
+    return dates;
+}
+
+} // namespace
+
+TEST(PeerAtomPool, addAndFind)
+{
+    auto pool = peer_atom_pool{};
+    EXPECT_EQ(0U, std::size(pool));
+
+    auto const v4 = makeAddress("192.0.2.1");
+    auto const v6 = makeAddress("2001:db8::1");
+
+    auto* const a = pool.add(v4, 100);
+    auto* const b = pool.add(v6, 200);
+    EXPECT_EQ(2U, std::size(pool));
+
+    // new atoms are zeroed, apart from their address and shelf date
+    EXPECT_EQ(0, tr_address_compare(&v4, &a->addr));
+    EXPECT_EQ(100, a->shelf_date);
+    EXPECT_EQ(0, a->numFails);
+    EXPECT_EQ(nullptr, a->peer);
+    EXPECT_FALSE(a->is_candidate);
+
+    EXPECT_EQ(a, pool.find(v4));
+    EXPECT_EQ(b, pool.find(v6));
+    EXPECT_EQ(nullptr, pool.find(makeAddress("192.0.2.2")));
+    EXPECT_EQ(nullptr, pool.find(makeAddress("2001:db8::2")));
+
+    pool.erase(a);
+    EXPECT_EQ(1U, std::size(pool));
+    EXPECT_EQ(nullptr, pool.find(v4));
+    EXPECT_EQ(b, pool.find(v6));
+}
+
+TEST(PeerAtomPool, atomsKeepTheirAddress)
+{
+    auto constexpr AtomCount = 500;
+
+    auto pool = peer_atom_pool{};
+    auto atoms = std::vector<peer_atom*>{};
+    for (int i = 0; i < AtomCount; ++i)
+    {
+        atoms.push_back(pool.add(makeAddress(i), i));
+        atoms.back()->port = tr_port(i);
+    }
+
+    // growing the pool didn't move the atoms that were already in it
+    for (int i = 0; i < AtomCount; ++i)
+    {
+        auto const addr = makeAddress(i);
+        EXPECT_EQ(atoms[i], pool.find(addr));
+        EXPECT_EQ(tr_port(i), atoms[i]->port);
+    }
+
+    // erased atoms are recycled
+    pool.erase(atoms[7]);
+    EXPECT_EQ(atoms[7], pool.add(makeAddress(AtomCount), AtomCount));
+}
+
+TEST(PeerAtomPool, sortedByShelfDate)
+{
+    auto pool = peer_atom_pool{};
+    pool.add(makeAddress(0), 300);
+    pool.add(makeAddress(1), 100);
+    pool.add(makeAddress(2), 200);
+    pool.add(makeAddress(3), 100);
+
+    EXPECT_EQ((std::vector<time_t>{ 100, 100, 200, 300 }), shelfDates(pool));
+
+    pool.erase(pool.find(makeAddress(2)));
+    EXPECT_EQ((std::vector<time_t>{ 100, 100, 300 }), shelfDates(pool));
+}
+
+TEST(PeerAtomPool, pruneStalestFirst)
+{
+    auto pool = peer_atom_pool{};
+    for (int i = 0; i < 6; ++i)
+    {
+        pool.add(makeAddress(i), 1000 - i * 100);
+    }
+
+    // the atom at 600 is in use and has to be kept
+    auto const keep = makeAddress(4);
+    auto erased = std::vector<time_t>{};
+    pool.prune(
+        3,
+        [&keep](peer_atom const* atom) { return tr_address_compare(&atom->addr, &keep) != 0; },
+        [&erased](peer_atom* atom) { erased.push_back(atom->shelf_date); });
+
+    EXPECT_EQ((std::vector<time_t>{ 500, 700, 800 }), erased);
+    EXPECT_EQ((std::vector<time_t>{ 600, 900, 1000 }), shelfDates(pool));
+    EXPECT_NE(nullptr, pool.find(keep));
+}
+
+TEST(PeerAtomPool, pruneStopsWhenNothingElseCanGo)
+{
+    auto pool = peer_atom_pool{};
+    for (int i = 0; i < 4; ++i)
+    {
+        pool.add(makeAddress(i), i);
+    }
+
+    auto n_erased = 0;
+    pool.prune(
+        1,
+        [](peer_atom const* atom) { return atom->shelf_date % 2 == 0; },
+        [&n_erased](peer_atom* /*atom*/) { ++n_erased; });
+
+    EXPECT_EQ(2, n_erased);
+    EXPECT_EQ((std::vector<time_t>{ 1, 3 }), shelfDates(pool));
+
+    // a pool that's already small enough is left alone
+    pool.prune(
+        2,
+        [](peer_atom const* /*atom*/) { return true; },
+        [&n_erased](peer_atom* /*atom*/) { ++n_erased; });
+    EXPECT_EQ(2, n_erased);
+}
+
+TEST(PeerAtomPool, manyAddsAndErases)
+{
+    auto constexpr AddressCount = 2000;
+
+    auto pool = peer_atom_pool{};
+    auto expected = std::map<int, time_t>{}; // address number -> shelf date
+    auto rng = std::mt19937{ 42 };
+
+    for (int round = 0; round < 20000; ++round)
+    {
+        auto const i = int(rng() % AddressCount);
+        auto const addr = makeAddress(i);
+
+        if (expected.count(i) != 0)
+        {
+            pool.erase(pool.find(addr));
+            expected.erase(i);
+        }
+        else
+        {
+            auto const shelf_date = time_t(rng() % 1000);
+            pool.add(addr, shelf_date);
+            expected.emplace(i, shelf_date);
+        }
+    }
+
+    // every atom that's left can still be found, and nothing else can
+    EXPECT_EQ(std::size(expected), std::size(pool));
+    for (int i = 0; i < AddressCount; ++i)
+    {
+        auto const* const atom = pool.find(makeAddress(i));
+        auto const it = expected.find(i);
+        ASSERT_EQ(it != std::end(expected), atom != nullptr) << i;
+
+        if (atom != nullptr)
+        {
+            EXPECT_EQ(it->second, atom->shelf_date);
+        }
+    }
+
+    // and they're still in shelf-date order
+    auto dates = std::vector<time_t>{};
+    for (auto const& [i, shelf_date] : expected)
+    {
+        dates.push_back(shelf_date);
+    }
+
+    std::sort(std::begin(dates), std::end(dates));
+    EXPECT_EQ(dates, shelfDates(pool));
+}
@@ -0,0 +1,119 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h> /* socketpair() */
+#include <unistd.h> /* close() */
+#endif
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "fdlimit.h"
+#include "file.h"
+#include "inout.h"
+#include "net.h"
+#include "peer-io.h"
+#include "peer-socket.h"
+#include "torrent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using PeerIoTest = SessionTest;
+
+#ifndef _WIN32
+
+TEST_F(PeerIoTest, addFileSendsBlockFromFile)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    // give the first block something to tell it apart from the rest
+    uint32_t const len = tor->blockSize;
+    auto expected = std::vector<uint8_t>(len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        expected[i] = uint8_t(i % 251);
+    }
+
+    auto* const path = tr_torrentFindFile(tor, 0);
+    ASSERT_NE(nullptr, path);
+    auto fd = tr_sys_file_open(path, TR_SYS_FILE_WRITE, 0, nullptr);
+    tr_free(path);
+    ASSERT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_write(fd, std::data(expected), len, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    // only one dup can be open at a time
+    tr_fdSetFileLimit(session_, 1);
+
+    int sockets[2] = {};
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+
+    auto addr = tr_address{};
+    EXPECT_TRUE(tr_address_from_string(&addr, "127.0.0.1"));
+    auto io = tr_peerIo{ session_, addr, 51413, true };
+    io.socket = tr_peer_socket_tcp_create(sockets[0]);
+
+    if (tr_peerIoSupportsSendfile(&io))
+    {
+        auto file_offset = uint64_t{};
+        fd = tr_ioOpenBlock(tor, 0, 0, len, &file_offset);
+        ASSERT_NE(TR_BAD_SYS_FILE, fd);
+        EXPECT_EQ(0U, file_offset);
+
+        auto* const buf = evbuffer_new();
+        EXPECT_TRUE(tr_peerIoAddFile(&io, buf, fd, file_offset, len));
+        EXPECT_EQ(len, evbuffer_get_length(buf));
+
+        // the segment's dup is still open, so there's no room for another
+        EXPECT_EQ(TR_BAD_SYS_FILE, tr_ioOpenBlock(tor, 1, 0, len, &file_offset));
+
+        // the bytes go from the file to the socket
+        while (evbuffer_get_length(buf) > 0)
+        {
+            ASSERT_LT(0, evbuffer_write(buf, sockets[0]));
+        }
+
+        auto received = std::vector<uint8_t>(len);
+        for (size_t n_received = 0; n_received < len;)
+        {
+            auto const n = recv(sockets[1], std::data(received) + n_received, len - n_received, 0);
+            ASSERT_LT(0, n);
+            n_received += size_t(n);
+        }
+
+        EXPECT_EQ(expected, received);
+
+        // sending the segment closed its dup, which made room for another
+        fd = tr_ioOpenBlock(tor, 1, 0, len, &file_offset);
+        ASSERT_NE(TR_BAD_SYS_FILE, fd);
+        tr_fdFileDupClose(fd);
+
+        evbuffer_free(buf);
+    }
+
+    close(sockets[0]);
+    close(sockets[1]);
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+#endif
+
+} // namespace test
+
+} // namespace libtransmission
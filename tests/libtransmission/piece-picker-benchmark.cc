@@ -0,0 +1,140 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <tuple>
+#include <vector>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "piece-picker.h"
+
+/* Compares tr_piece_picker with the sorted array that tr_swarm used
+ * to keep, on a stream of have messages each followed by a request. */
+
+namespace
+{
+
+auto constexpr PieceCount = tr_piece_index_t{ 20000 };
+auto constexpr BlocksPerPiece = 16;
+auto constexpr Rounds = 20000;
+
+struct weighted_piece
+{
+    tr_piece_index_t index;
+    int16_t salt;
+    uint16_t availability;
+    int16_t requestCount;
+};
+
+bool weightLess(weighted_piece const& a, weighted_piece const& b)
+{
+    auto const weight = [](weighted_piece const& p)
+    {
+        return std::make_tuple(p.requestCount >= BlocksPerPiece, p.availability, p.requestCount == 0, p.salt);
+    };
+
+    return weight(a) < weight(b);
+}
+
+// the way that tr_swarm used to do it: an array sorted by weight,
+// where a changed piece is looked up and moved to its new spot
+double runSortedArray(std::vector<tr_piece_index_t> const& haves)
+{
+    auto sorted = std::vector<weighted_piece>{};
+    for (tr_piece_index_t piece = 0; piece < PieceCount; ++piece)
+    {
+        sorted.push_back({ piece, int16_t(tr_rand_int_weak(4096)), 0, 0 });
+    }
+
+    std::sort(std::begin(sorted), std::end(sorted), weightLess);
+
+    auto const resort = [&sorted](std::vector<weighted_piece>::iterator it)
+    {
+        auto const tmp = *it;
+        sorted.erase(it);
+        sorted.insert(std::lower_bound(std::begin(sorted), std::end(sorted), tmp, weightLess), tmp);
+    };
+
+    auto const begin = std::chrono::steady_clock::now();
+
+    for (auto const piece : haves)
+    {
+        auto it = std::find_if(
+            std::begin(sorted),
+            std::end(sorted),
+            [piece](weighted_piece const& p) { return p.index == piece; });
+        ++it->availability;
+        resort(it);
+
+        ++sorted.front().requestCount;
+        resort(std::begin(sorted));
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+double runPicker(std::vector<tr_piece_index_t> const& haves)
+{
+    auto picker = tr_piece_picker{};
+    picker.reset(PieceCount);
+    auto requests = std::vector<int>(PieceCount);
+
+    for (tr_piece_index_t piece = 0; piece < PieceCount; ++piece)
+    {
+        picker.setWanted(piece, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    }
+
+    auto const begin = std::chrono::steady_clock::now();
+
+    for (auto const piece : haves)
+    {
+        picker.incrementAvailability(piece);
+
+        auto best = tr_piece_index_t{};
+        picker.forEachWanted(
+            [&best](tr_piece_index_t p)
+            {
+                best = p;
+                return false;
+            });
+
+        auto const n = ++requests[best];
+        picker.setWanted(
+            best,
+            TR_PRI_NORMAL,
+            n >= BlocksPerPiece ? tr_piece_picker::PROGRESS_REQUESTED : tr_piece_picker::PROGRESS_PARTIAL);
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+} // namespace
+
+int main()
+{
+    auto haves = std::vector<tr_piece_index_t>{};
+    for (int i = 0; i < Rounds; ++i)
+    {
+        haves.push_back(tr_piece_index_t(tr_rand_int_weak(PieceCount)));
+    }
+
+    auto const sorted_elapsed = runSortedArray(haves);
+    auto const picker_elapsed = runPicker(haves);
+
+    std::printf(
+        "%d have messages and requests in a %u-piece torrent: %.1f ms with a sorted array, %.1f ms with the picker\n",
+        Rounds,
+        unsigned(PieceCount),
+        sorted_elapsed * 1000,
+        picker_elapsed * 1000);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "piece-picker.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+std::vector<tr_piece_index_t> wantedPieces(tr_piece_picker const& picker)
+{
+    auto pieces = std::vector<tr_piece_index_t>{};
+    picker.forEachWanted(
+        [&pieces](tr_piece_index_t piece)
+        {
+            pieces.push_back(piece);
+            return true;
+        });
+    return pieces;
+}
+
+} // namespace
+
+TEST(PiecePicker, availability)
+{
+    auto picker = tr_piece_picker{};
+    picker.reset(10);
+
+    auto have = tr_bitfield{ 10 };
+    have.set(2);
+    have.set(3);
+    picker.addBitfield(have);
+    picker.incrementAvailability(3);
+
+    auto all = tr_bitfield{ 0 };
+    all.setHasAll();
+    picker.addBitfield(all);
+
+    EXPECT_EQ(1, picker.availability(0));
+    EXPECT_EQ(2, picker.availability(2));
+    EXPECT_EQ(3, picker.availability(3));
+
+    picker.removeBitfield(have);
+    picker.removeBitfield(all);
+    EXPECT_EQ(0, picker.availability(2));
+    EXPECT_EQ(1, picker.availability(3));
+
+    // never goes below zero
+    picker.decrementAvailability(0);
+    EXPECT_EQ(0, picker.availability(0));
+
+    // out-of-range pieces are ignored
+    picker.incrementAvailability(10);
+    EXPECT_EQ(0, picker.availability(10));
+}
+
+TEST(PiecePicker, order)
+{
+    auto picker = tr_piece_picker{};
+    picker.reset(8);
+
+    // pieces 0..7 are available from 8..1 peers
+    for (tr_piece_index_t piece = 0; piece < 8; ++piece)
+    {
+        for (tr_piece_index_t i = piece; i < 8; ++i)
+        {
+            picker.incrementAvailability(piece);
+        }
+    }
+
+    picker.setWanted(0, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(1, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_REQUESTED);
+    picker.setWanted(2, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(3, TR_PRI_HIGH, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(4, TR_PRI_LOW, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(5, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(6, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_PARTIAL);
+    EXPECT_EQ(7U, picker.wantedCount());
+
+    // high priority first, then the rarest, with fully-requested pieces last
+    auto expected = std::vector<tr_piece_index_t>{ 3, 6, 5, 2, 0, 4, 1 };
+    EXPECT_EQ(expected, wantedPieces(picker));
+
+    // a partial piece goes before an untouched one that's just as rare
+    picker.incrementAvailability(6);
+    picker.setWanted(6, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    picker.setWanted(5, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_PARTIAL);
+    expected = { 3, 5, 6, 2, 0, 4, 1 };
+    EXPECT_EQ(expected, wantedPieces(picker));
+
+    // more peers got piece 5
+    for (int i = 0; i < 4; ++i)
+    {
+        picker.incrementAvailability(5);
+    }
+
+    expected = { 3, 6, 2, 5, 0, 4, 1 };
+    EXPECT_EQ(expected, wantedPieces(picker));
+
+    picker.setUnwanted(3);
+    picker.setUnwanted(3);
+    picker.setUnwanted(7);
+    EXPECT_EQ(6U, picker.wantedCount());
+    EXPECT_FALSE(picker.isWanted(3));
+    EXPECT_TRUE(picker.isWanted(6));
+    expected = { 6, 2, 5, 0, 4, 1 };
+    EXPECT_EQ(expected, wantedPieces(picker));
+
+    // stop early when the callback says so
+    auto n_visited = int{};
+    picker.forEachWanted([&n_visited](tr_piece_index_t /*piece*/) { return ++n_visited < 2; });
+    EXPECT_EQ(2, n_visited);
+}
+
+TEST(PiecePicker, ties)
+{
+    auto constexpr PieceCount = tr_piece_index_t{ 1000 };
+
+    auto picker = tr_piece_picker{};
+    picker.reset(PieceCount);
+
+    for (tr_piece_index_t piece = 0; piece < PieceCount; ++piece)
+    {
+        picker.setWanted(piece, TR_PRI_NORMAL, tr_piece_picker::PROGRESS_NONE);
+    }
+
+    // equally good pieces are visited in random order, so that
+    // different peers don't all start on the same pieces
+    auto pieces = wantedPieces(picker);
+    EXPECT_EQ(PieceCount, std::size(pieces));
+    EXPECT_FALSE(std::is_sorted(std::begin(pieces), std::end(pieces)));
+    std::sort(std::begin(pieces), std::end(pieces));
+    EXPECT_EQ(std::end(pieces), std::adjacent_find(std::begin(pieces), std::end(pieces)));
+}
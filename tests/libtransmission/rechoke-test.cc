@@ -0,0 +1,171 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "transmission.h"
+#include "peer-mgr.h"
+#include "rechoke.h"
+#include "session.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+TEST(Rechoke, slotsWithoutContributions)
+{
+    // until some swarm has been trading, everyone gets the per-torrent number
+    EXPECT_EQ(8, tr_rechokeUploadSlots(8, 0, 0, 0));
+    EXPECT_EQ(8, tr_rechokeUploadSlots(8, 3, 0, 0));
+}
+
+TEST(Rechoke, slotsAreSplitByContribution)
+{
+    auto constexpr PerTorrent = 8;
+    auto constexpr Swarms = size_t{ 4 };
+
+    // half of each swarm's slots are guaranteed. The other half of each,
+    // 16 in all, go to the swarms by how much they contributed
+    EXPECT_EQ(4 + 0, tr_rechokeUploadSlots(PerTorrent, Swarms, 0, 1000));
+    EXPECT_EQ(4 + 4, tr_rechokeUploadSlots(PerTorrent, Swarms, 250, 1000));
+    EXPECT_EQ(4 + 8, tr_rechokeUploadSlots(PerTorrent, Swarms, 500, 1000));
+
+    // the session's slots add up to Swarms * PerTorrent
+    auto const contributions = std::vector<uint64_t>{ 125, 250, 250, 375 };
+    auto total = 0;
+    for (auto const contribution : contributions)
+    {
+        total += tr_rechokeUploadSlots(PerTorrent, Swarms, contribution, 1000);
+    }
+
+    EXPECT_EQ(int(Swarms) * PerTorrent, total);
+}
+
+TEST(Rechoke, slotsAreCapped)
+{
+    // one swarm doing all the trading doesn't get every slot in the session
+    EXPECT_EQ(8 * TR_MAX_UPLOAD_SLOTS_MULTIPLIER, tr_rechokeUploadSlots(8, 100, 1000, 1000));
+
+    // and a swarm with one slot per torrent still gets one
+    EXPECT_EQ(1, tr_rechokeUploadSlots(1, 10, 0, 1000));
+    EXPECT_EQ(1, tr_rechokeUploadSlots(0, 10, 0, 1000));
+}
+
+TEST(Rechoke, roundRobinResumesAfterCursor)
+{
+    auto const swarms = std::map<int, int>{ { 2, 20 }, { 5, 50 }, { 7, 70 }, { 9, 90 }, { 11, 110 } };
+    auto visited = std::vector<int>{};
+    auto const rechokeAll = [&visited](int value)
+    {
+        visited.push_back(value);
+        return true;
+    };
+
+    auto cursor = 0;
+    EXPECT_EQ(2U, tr_rechokeRoundRobin(swarms, cursor, 2, rechokeAll));
+    EXPECT_EQ((std::vector<int>{ 20, 50 }), visited);
+    EXPECT_EQ(5, cursor);
+
+    EXPECT_EQ(2U, tr_rechokeRoundRobin(swarms, cursor, 2, rechokeAll));
+    EXPECT_EQ((std::vector<int>{ 20, 50, 70, 90 }), visited);
+    EXPECT_EQ(9, cursor);
+
+    // the walk wraps around to the beginning
+    visited.clear();
+    EXPECT_EQ(2U, tr_rechokeRoundRobin(swarms, cursor, 2, rechokeAll));
+    EXPECT_EQ((std::vector<int>{ 110, 20 }), visited);
+    EXPECT_EQ(2, cursor);
+
+    // a cursor whose swarm has been removed still works
+    visited.clear();
+    cursor = 6;
+    EXPECT_EQ(1U, tr_rechokeRoundRobin(swarms, cursor, 1, rechokeAll));
+    EXPECT_EQ((std::vector<int>{ 70 }), visited);
+    EXPECT_EQ(7, cursor);
+}
+
+TEST(Rechoke, roundRobinOnlyCountsRechokedSwarms)
+{
+    auto const swarms = std::map<int, int>{ { 1, 1 }, { 2, 2 }, { 3, 3 }, { 4, 4 }, { 5, 5 }, { 6, 6 } };
+    auto visited = std::vector<int>{};
+    auto const rechokeEven = [&visited](int value)
+    {
+        visited.push_back(value);
+        return value % 2 == 0;
+    };
+
+    // swarms that aren't due are skipped without counting against the limit
+    auto cursor = 0;
+    EXPECT_EQ(2U, tr_rechokeRoundRobin(swarms, cursor, 2, rechokeEven));
+    EXPECT_EQ((std::vector<int>{ 1, 2, 3, 4 }), visited);
+    EXPECT_EQ(4, cursor);
+
+    // each swarm is visited at most once per walk, even if the limit isn't reached
+    visited.clear();
+    EXPECT_EQ(3U, tr_rechokeRoundRobin(swarms, cursor, 10, rechokeEven));
+    EXPECT_EQ((std::vector<int>{ 5, 6, 1, 2, 3, 4 }), visited);
+    EXPECT_EQ(4, cursor);
+
+    auto const empty = std::map<int, int>{};
+    EXPECT_EQ(0U, tr_rechokeRoundRobin(empty, cursor, 10, rechokeEven));
+    EXPECT_EQ(4, cursor);
+}
+
+TEST(Rechoke, threadCpuTimeDoesNotCountWaiting)
+{
+    auto const cpu_begin = tr_thread_cpu_usec();
+    if (cpu_begin == 0)
+    {
+        GTEST_SKIP() << "this platform can't measure a thread's CPU time";
+    }
+
+    // sleeping takes time on the clock but not on the CPU
+    tr_wait_msec(100);
+    auto const cpu_after_wait = tr_thread_cpu_usec();
+    EXPECT_LT(cpu_after_wait - cpu_begin, 50000U);
+
+    // spinning takes both
+    auto const spin_begin = std::chrono::steady_clock::now();
+    auto volatile sum = uint64_t{};
+    while (std::chrono::steady_clock::now() - spin_begin < std::chrono::milliseconds(100))
+    {
+        sum = sum + 1;
+    }
+
+    EXPECT_GE(tr_thread_cpu_usec() - cpu_after_wait, 50000U);
+}
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using RechokeTest = SessionTest;
+
+TEST_F(RechokeTest, statsCountEachTick)
+{
+    auto* const mgr = session_->peerMgr;
+
+    // the rechoke timer starts with the session
+    auto const test = [mgr]()
+    {
+        return tr_peerMgrGetRechokeStats(mgr).pulses >= 2;
+    };
+    EXPECT_TRUE(waitFor(test, 5000));
+
+    // with no torrents there's nothing to rechoke
+    auto const stats = tr_peerMgrGetRechokeStats(mgr);
+    EXPECT_EQ(0U, stats.last_pulse_swarms);
+    EXPECT_LE(stats.last_pulse_cpu_usec, stats.max_pulse_cpu_usec);
+}
+
+} // namespace test
+
+} // namespace libtransmission
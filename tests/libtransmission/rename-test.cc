@@ -9,11 +9,15 @@
 #include "transmission.h"
 #include "crypto-utils.h"
 #include "file.h"
+#include "inout.h" // tr_ioWriteAsync()
 #include "resume.h"
 #include "torrent.h" // tr_isTorrent()
 #include "tr-assert.h"
+#include "trevent.h" // tr_runInEventThread()
 #include "variant.h"
 
+#include <event2/buffer.h>
+
 #include "test-fixtures.h"
 
 #include <array>
@@ -21,6 +25,7 @@
 #include <cstdio> // fopen()
 #include <cstring> // strcmp()
 #include <string>
+#include <vector>
 
 namespace libtransmission
 {
@@ -530,6 +535,67 @@ TEST_F(RenameTest, partialFile)
     torrentRemoveAndWait(tor, 0);
 }
 
+/***
+****
+***/
+
+TEST_F(RenameTest, renameWhileWritesAreQueued)
+{
+    // write in the background, so that the rename has jobs to wait for
+    tr_sessionSetDiskIoThreads(session_, 2);
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_STREQ("files-filled-with-zeroes/1048576", tor->info.files[0].name);
+
+    // queue a write of every block in the first file, which ends on a piece boundary
+    auto const queue_writes = [](void* vtor)
+    {
+        auto* const t = static_cast<tr_torrent*>(vtor);
+        auto const zeroes = std::vector<char>(t->blockSize);
+
+        for (tr_piece_index_t piece = 0; piece <= t->info.files[0].lastPiece; ++piece)
+        {
+            auto blocks = std::vector<struct evbuffer*>{};
+            for (uint32_t offset = 0; offset < t->info.pieceSize; offset += t->blockSize)
+            {
+                blocks.push_back(evbuffer_new());
+                evbuffer_add(blocks.back(), std::data(zeroes), std::size(zeroes));
+            }
+
+            auto runs = std::vector<tr_io_block_run>{};
+            runs.push_back(tr_io_block_run{ piece, 0, std::move(blocks) });
+            tr_ioWriteAsync(t, std::move(runs));
+        }
+    };
+    tr_runInEventThread(session_, queue_writes, tor);
+
+    // rename the top folder while those writes are still queued or in flight.
+    // the rename waits for them, so they all land in the old folder before it moves
+    EXPECT_EQ(0, torrentRenameAndWait(tor, "files-filled-with-zeroes", "foo"));
+    EXPECT_STREQ("foo", tr_torrentName(tor));
+    EXPECT_STREQ("foo/1048576", tor->info.files[0].name);
+    EXPECT_STREQ("foo/4096", tor->info.files[1].name);
+    EXPECT_STREQ("foo/512", tor->info.files[2].name);
+
+    auto const old_dir = tr_strvPath(tor->currentDir, "files-filled-with-zeroes");
+    EXPECT_FALSE(tr_sys_path_exists(old_dir.c_str(), nullptr));
+
+    char* path = tr_torrentFindFile(tor, 0);
+    EXPECT_NE(nullptr, path);
+    if (path != nullptr)
+    {
+        auto const new_dir = tr_strvPath(tor->currentDir, "foo", "");
+        EXPECT_EQ(0, strncmp(new_dir.c_str(), path, std::size(new_dir)));
+
+        auto info = tr_sys_path_info{};
+        EXPECT_TRUE(tr_sys_path_get_info(path, 0, &info, nullptr));
+        EXPECT_EQ(tor->info.files[0].length, info.size);
+        tr_free(path);
+    }
+
+    torrentRemoveAndWait(tor, 0);
+}
+
 } // namespace test
 
 } // namespace libtransmission
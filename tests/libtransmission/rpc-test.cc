@@ -97,7 +97,7 @@ TEST_F(RpcTest, sessionGet)
     EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
 
     // what we expected
-    auto const expected_keys = std::array<tr_quark, 55>{
+    auto const expected_keys = std::array<tr_quark, 58>{
         TR_KEY_alt_speed_down,
         TR_KEY_alt_speed_enabled,
         TR_KEY_alt_speed_time_begin,
@@ -113,6 +113,7 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_cache_size_mb,
         TR_KEY_config_dir,
         TR_KEY_dht_enabled,
+        TR_KEY_disk_io_threads,
         TR_KEY_download_dir,
         TR_KEY_download_dir_free_space,
         TR_KEY_download_queue_enabled,
@@ -152,6 +153,8 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_trash_original_torrent_files,
         TR_KEY_units,
         TR_KEY_utp_enabled,
+        TR_KEY_verify_speed_limit_mb,
+        TR_KEY_verify_threads,
         TR_KEY_version,
     };
 
@@ -0,0 +1,67 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+
+/* Hashes a batch of pieces with each SHA1 kernel this CPU supports. */
+
+int main()
+{
+    auto constexpr PieceSize = size_t{ 1024 * 256 };
+    auto constexpr PieceCount = size_t{ 128 };
+    auto constexpr KernelNames = std::array<char const*, 3>{ "generic", "avx2", "sha-ni" };
+
+    auto buf = std::vector<uint8_t>(PieceSize * PieceCount, 0x5A);
+    auto data = std::vector<uint8_t const*>{};
+    for (size_t i = 0; i < PieceCount; ++i)
+    {
+        data.push_back(std::data(buf) + i * PieceSize);
+    }
+
+    auto const default_kernel = tr_sha1_get_kernel();
+    auto hashes = std::vector<tr_sha1_digest_t>(PieceCount);
+    auto expected = std::vector<tr_sha1_digest_t>{};
+    auto ret = 0;
+
+    for (auto const kernel : { TR_SHA1_KERNEL_GENERIC, TR_SHA1_KERNEL_AVX2, TR_SHA1_KERNEL_SHANI })
+    {
+        if (!tr_sha1_set_kernel(kernel))
+        {
+            continue;
+        }
+
+        auto const begin = std::chrono::steady_clock::now();
+        tr_sha1_many(std::data(data), PieceCount, PieceSize, std::data(hashes));
+        auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::printf(
+            "sha1 %-7s kernel: %.0f MiB/s%s\n",
+            KernelNames[kernel],
+            PieceSize * PieceCount / (1024.0 * 1024.0) / elapsed,
+            kernel == default_kernel ? " (default)" : "");
+
+        if (std::empty(expected))
+        {
+            expected = hashes;
+        }
+        else if (hashes != expected)
+        {
+            std::printf("sha1 %s kernel: hashes differ from the generic kernel's\n", KernelNames[kernel]);
+            ret = 1;
+        }
+    }
+
+    tr_sha1_set_kernel(default_kernel);
+    return ret;
+}
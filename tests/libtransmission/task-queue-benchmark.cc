@@ -0,0 +1,158 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> // getenv()
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+#include "file.h"
+#include "log.h"
+#include "trevent.h"
+#include "utils.h"
+#include "variant.h"
+
+/* Pushes tasks into the session's event thread from several threads at
+ * once, and reports the throughput and how long tasks waited to run. */
+
+namespace
+{
+
+auto constexpr ProducerCount = 4;
+auto constexpr TasksPerProducer = 20000;
+
+struct timed_task
+{
+    std::chrono::steady_clock::time_point pushed;
+    double latency;
+    std::atomic<size_t>* n_ran;
+};
+
+void runTimedTask(void* vtask)
+{
+    auto* const task = static_cast<timed_task*>(vtask);
+    task->latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - task->pushed).count();
+    ++*task->n_ran;
+}
+
+void rimraf(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+
+        auto const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        if (odir != TR_BAD_SYS_DIR)
+        {
+            char const* name = nullptr;
+            while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+            {
+                if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+                {
+                    children.push_back(tr_strvPath(path, name));
+                }
+            }
+
+            tr_sys_dir_close(odir, nullptr);
+        }
+
+        for (auto const& child : children)
+        {
+            rimraf(child);
+        }
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+} // namespace
+
+int main()
+{
+    char const* const tmpdir = getenv("TMPDIR");
+    auto sandbox = tr_strvPath(tmpdir != nullptr ? tmpdir : ".", "transmission-benchmark-XXXXXX");
+    if (!tr_sys_dir_create_temp(std::data(sandbox), nullptr))
+    {
+        std::fprintf(stderr, "couldn't create a directory for the session\n");
+        return 1;
+    }
+
+    auto settings = tr_variant{};
+    tr_variantInitDict(&settings, 4);
+    tr_variantDictAddStr(&settings, TR_KEY_download_dir, tr_strvPath(sandbox, "Downloads").c_str());
+    tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+    tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+    tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+    tr_session* const session = tr_sessionInit(sandbox.c_str(), true, &settings);
+    tr_variantFree(&settings);
+
+    auto n_ran = std::atomic<size_t>{};
+    auto tasks = std::vector<timed_task>(ProducerCount * TasksPerProducer);
+    for (auto& task : tasks)
+    {
+        task.n_ran = &n_ran;
+    }
+
+    auto const begin = std::chrono::steady_clock::now();
+
+    auto producers = std::vector<std::thread>{};
+    for (int producer = 0; producer < ProducerCount; ++producer)
+    {
+        producers.emplace_back(
+            [session, &tasks, producer]()
+            {
+                for (int i = 0; i < TasksPerProducer; ++i)
+                {
+                    auto& task = tasks[producer * TasksPerProducer + i];
+                    task.pushed = std::chrono::steady_clock::now();
+                    tr_runInEventThread(session, runTimedTask, &task);
+                }
+            });
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    while (n_ran != std::size(tasks))
+    {
+        tr_wait_msec(1);
+    }
+
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    tr_sessionClose(session);
+    rimraf(sandbox);
+
+    auto latencies = std::vector<double>{};
+    std::transform(
+        std::begin(tasks),
+        std::end(tasks),
+        std::back_inserter(latencies),
+        [](timed_task const& task) { return task.latency; });
+    std::sort(std::begin(latencies), std::end(latencies));
+
+    std::printf(
+        "%zu tasks from %d threads: %.0f tasks/s, latency %.1f us median, %.1f us p99\n",
+        std::size(tasks),
+        ProducerCount,
+        std::size(tasks) / elapsed,
+        latencies[std::size(latencies) / 2] * 1e6,
+        latencies[std::size(latencies) * 99 / 100] * 1e6);
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+#include "task-queue.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+struct pushed_task
+{
+    std::vector<int>* ran;
+    int id;
+};
+
+void recordTask(void* vtask)
+{
+    auto const* const task = static_cast<pushed_task const*>(vtask);
+    task->ran->push_back(task->id);
+}
+
+} // namespace
+
+TEST(TaskQueue, runsTasksInOrder)
+{
+    auto queue = tr_task_queue{};
+    auto ran = std::vector<int>{};
+    auto tasks = std::vector<pushed_task>{};
+    for (int i = 0; i < 5; ++i)
+    {
+        tasks.push_back({ &ran, i });
+    }
+
+    // only the first push finds the queue empty
+    EXPECT_TRUE(queue.empty());
+    EXPECT_TRUE(queue.push(recordTask, &tasks[0]));
+    EXPECT_FALSE(queue.push(recordTask, &tasks[1]));
+    EXPECT_FALSE(queue.push(recordTask, &tasks[2]));
+    EXPECT_FALSE(queue.empty());
+
+    EXPECT_EQ(3U, queue.run());
+    EXPECT_EQ((std::vector<int>{ 0, 1, 2 }), ran);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0U, queue.run());
+
+    // once the queue's been emptied, the next push needs to wake the consumer again
+    EXPECT_TRUE(queue.push(recordTask, &tasks[3]));
+    EXPECT_FALSE(queue.push(recordTask, &tasks[4]));
+    queue.clear();
+    EXPECT_EQ(0U, queue.run());
+    EXPECT_EQ((std::vector<int>{ 0, 1, 2 }), ran);
+
+    auto const& stats = queue.getStats();
+    EXPECT_EQ(1U, stats.batches);
+    EXPECT_EQ(3U, stats.tasks);
+    EXPECT_EQ(3U, stats.max_batch);
+}
+
+TEST(TaskQueue, manyProducers)
+{
+    auto constexpr ProducerCount = 4;
+    auto constexpr TasksPerProducer = 10000;
+
+    // each task is tagged with its producer and its place in that producer's sequence
+    auto ran = std::vector<int>{};
+    auto tasks = std::vector<pushed_task>{};
+    for (int producer = 0; producer < ProducerCount; ++producer)
+    {
+        for (int i = 0; i < TasksPerProducer; ++i)
+        {
+            tasks.push_back({ &ran, producer * TasksPerProducer + i });
+        }
+    }
+
+    auto queue = tr_task_queue{};
+    auto wakeups = std::atomic<int>{};
+    auto producers = std::vector<std::thread>{};
+    for (int producer = 0; producer < ProducerCount; ++producer)
+    {
+        producers.emplace_back(
+            [&, producer]()
+            {
+                for (int i = 0; i < TasksPerProducer; ++i)
+                {
+                    if (queue.push(recordTask, &tasks[producer * TasksPerProducer + i]))
+                    {
+                        ++wakeups;
+                    }
+                }
+            });
+    }
+
+    auto const total = size_t{ ProducerCount * TasksPerProducer };
+    while (std::size(ran) < total)
+    {
+        queue.run();
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    EXPECT_EQ(total, std::size(ran));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(total, queue.getStats().tasks);
+
+    // each producer's tasks ran in the order they were pushed
+    auto next = std::vector<int>(ProducerCount);
+    for (auto const id : ran)
+    {
+        auto const producer = id / TasksPerProducer;
+        EXPECT_EQ(next[producer], id % TasksPerProducer);
+        next[producer] = id % TasksPerProducer + 1;
+    }
+
+    // each batch needed one wakeup, however many tasks it held
+    EXPECT_EQ(uint64_t(wakeups), queue.getStats().batches);
+}
@@ -0,0 +1,171 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "timer-wheel.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+using tick_t = tr_timer_wheel::tick_t;
+
+/* a timer that records the ticks that it ran at */
+struct test_timer
+{
+    explicit test_timer(tr_timer_wheel& wheel_in)
+        : wheel{ wheel_in }
+    {
+    }
+
+    static void onTimer(void* vself)
+    {
+        auto* const self = static_cast<test_timer*>(vself);
+        self->ran_at.push_back(self->wheel.now());
+
+        if (self->repeat_every != 0)
+        {
+            self->wheel.schedule(&self->timer, self->wheel.now(), self->repeat_every);
+        }
+    }
+
+    tr_timer_wheel& wheel;
+    tr_timer timer{ onTimer, this };
+    std::vector<tick_t> ran_at;
+    tick_t repeat_every = 0;
+};
+
+/* the largest amount that the wheel may round up `delay` by */
+tick_t maxSlack(tick_t delay)
+{
+    return delay / 16;
+}
+
+} // namespace
+
+TEST(TimerWheel, runsTimersWhenTheyreDue)
+{
+    auto constexpr Start = tick_t{ 1000 };
+    auto wheel = tr_timer_wheel{ Start };
+
+    auto a = test_timer{ wheel };
+    auto b = test_timer{ wheel };
+    auto c = test_timer{ wheel };
+    wheel.schedule(&a.timer, Start, 5);
+    wheel.schedule(&b.timer, Start, 1);
+    wheel.schedule(&c.timer, Start, 0); // runs at the next tick
+    EXPECT_EQ(3U, wheel.size());
+    EXPECT_EQ(Start + 1, wheel.nextTick());
+
+    EXPECT_EQ(2U, wheel.advance(Start + 4));
+    EXPECT_EQ((std::vector<tick_t>{ Start + 1 }), b.ran_at);
+    EXPECT_EQ((std::vector<tick_t>{ Start + 1 }), c.ran_at);
+    EXPECT_TRUE(std::empty(a.ran_at));
+    EXPECT_EQ(Start + 5, wheel.nextTick());
+
+    EXPECT_EQ(1U, wheel.advance(Start + 100));
+    EXPECT_EQ((std::vector<tick_t>{ Start + 5 }), a.ran_at);
+    EXPECT_EQ(0U, wheel.size());
+    EXPECT_FALSE(wheel.nextTick());
+    EXPECT_EQ(Start + 100, wheel.now());
+}
+
+TEST(TimerWheel, cancelAndDestroy)
+{
+    auto wheel = tr_timer_wheel{ 0 };
+
+    auto a = test_timer{ wheel };
+    wheel.schedule(&a.timer, 0, 10);
+    a.timer.cancel();
+    a.timer.cancel();
+    EXPECT_EQ(0U, wheel.size());
+
+    auto b = std::make_unique<test_timer>(wheel);
+    wheel.schedule(&b->timer, 0, 10);
+    b.reset();
+    EXPECT_EQ(0U, wheel.size());
+
+    // rescheduling moves a timer instead of adding it again
+    wheel.schedule(&a.timer, 0, 10);
+    wheel.schedule(&a.timer, 0, 20);
+    EXPECT_EQ(1U, wheel.size());
+
+    EXPECT_EQ(1U, wheel.advance(100));
+    EXPECT_EQ((std::vector<tick_t>{ 20 }), a.ran_at);
+}
+
+TEST(TimerWheel, repeatingTimers)
+{
+    auto wheel = tr_timer_wheel{ 0 };
+
+    auto a = test_timer{ wheel };
+    a.repeat_every = 7;
+    wheel.schedule(&a.timer, 0, 7);
+
+    // one call to advance() runs each time that a timer comes due
+    EXPECT_EQ(3U, wheel.advance(21));
+    EXPECT_EQ((std::vector<tick_t>{ 7, 14, 21 }), a.ran_at);
+    EXPECT_EQ(1U, wheel.size());
+}
+
+TEST(TimerWheel, longDelays)
+{
+    auto constexpr TimerCount = 2000;
+    auto constexpr Start = tick_t{ 123456 };
+    auto wheel = tr_timer_wheel{ Start };
+
+    // delays from a tick to beyond what the wheel's levels reach
+    auto timers = std::vector<std::unique_ptr<test_timer>>{};
+    auto delays = std::vector<tick_t>{};
+    for (int i = 0; i < TimerCount; ++i)
+    {
+        auto const delay = tick_t{ 1 } << tr_rand_int_weak(26);
+        auto const jitter = tick_t(tr_rand_int_weak(int(delay)));
+        delays.push_back(delay + jitter);
+        timers.push_back(std::make_unique<test_timer>(wheel));
+        wheel.schedule(&timers.back()->timer, Start, delays.back());
+    }
+
+    // jump from one wakeup to the next, the way that the session does
+    auto wakeups = size_t{};
+    while (auto const next = wheel.nextTick())
+    {
+        EXPECT_GT(*next, wheel.now());
+        wheel.advance(*next);
+        ++wakeups;
+    }
+
+    for (int i = 0; i < TimerCount; ++i)
+    {
+        auto const& ran_at = timers[i]->ran_at;
+        ASSERT_EQ(1U, std::size(ran_at));
+        EXPECT_GE(ran_at.front(), Start + delays[i]);
+        EXPECT_LE(ran_at.front(), Start + delays[i] + maxSlack(delays[i]));
+    }
+
+    // the long timers share their ticks, and the empty ticks are skipped
+    EXPECT_LT(wakeups, size_t{ TimerCount });
+}
+
+TEST(TimerWheel, emptyWheelCatchesUp)
+{
+    auto wheel = tr_timer_wheel{ 0 };
+
+    // a wheel that's been idle doesn't have to walk the ticks it slept through
+    auto a = test_timer{ wheel };
+    wheel.schedule(&a.timer, 1000000, 3);
+    EXPECT_EQ(1000003U, wheel.nextTick());
+    EXPECT_EQ(1U, wheel.advance(1000003));
+    EXPECT_EQ((std::vector<tick_t>{ 1000003 }), a.ran_at);
+}
@@ -0,0 +1,178 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "net.h"
+#include "udp-io.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+/* a UDP socket bound to a free port on the loopback address */
+class LoopbackSocket
+{
+public:
+    LoopbackSocket()
+        : sock_{ socket(PF_INET, SOCK_DGRAM, 0) }
+    {
+        addr_.sin_family = AF_INET;
+        addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(sock_, reinterpret_cast<struct sockaddr const*>(&addr_), sizeof(addr_));
+
+        auto len = socklen_t{ sizeof(addr_) };
+        getsockname(sock_, reinterpret_cast<struct sockaddr*>(&addr_), &len);
+    }
+
+    ~LoopbackSocket()
+    {
+        tr_netCloseSocket(sock_);
+    }
+
+    LoopbackSocket(LoopbackSocket const&) = delete;
+    LoopbackSocket& operator=(LoopbackSocket const&) = delete;
+
+    [[nodiscard]] tr_socket_t get() const
+    {
+        return sock_;
+    }
+
+    [[nodiscard]] struct sockaddr const* addr() const
+    {
+        return reinterpret_cast<struct sockaddr const*>(&addr_);
+    }
+
+private:
+    tr_socket_t const sock_;
+    struct sockaddr_in addr_ = {};
+};
+
+void collect(unsigned char* buf, size_t buflen, struct sockaddr const* /*from*/, socklen_t /*fromlen*/, void* vdatagrams)
+{
+    EXPECT_EQ('\0', buf[buflen]);
+    static_cast<std::vector<std::string>*>(vdatagrams)->emplace_back(reinterpret_cast<char const*>(buf), buflen);
+}
+
+/* reads until `n` datagrams have come in */
+std::vector<std::string> receiveAll(tr_udp_io& io, size_t n)
+{
+    auto datagrams = std::vector<std::string>{};
+
+    while (std::size(datagrams) < n && io.receive(collect, &datagrams, n - std::size(datagrams)) > 0)
+    {
+    }
+
+    return datagrams;
+}
+
+} // namespace
+
+TEST(UdpIo, sendAndReceive)
+{
+    auto constexpr N = size_t{ 100 };
+
+    auto const a = LoopbackSocket{};
+    auto const b = LoopbackSocket{};
+    auto sender = tr_udp_io{ a.get() };
+    auto receiver = tr_udp_io{ b.get() };
+
+    auto expected = std::vector<std::string>{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto const datagram = std::string(i + 1, char('a' + i % 26));
+        sender.send(std::data(datagram), std::size(datagram), b.addr(), sizeof(struct sockaddr_in));
+        expected.push_back(datagram);
+    }
+
+    // full batches are sent as soon as they're queued
+    EXPECT_EQ(N % tr_udp_io::BatchSize, sender.pending());
+    sender.flush();
+    EXPECT_EQ(0U, sender.pending());
+
+    EXPECT_EQ(expected, receiveAll(receiver, N));
+
+    auto const& sent = sender.stats();
+    EXPECT_EQ(N, sent.send_datagrams);
+    EXPECT_EQ(0U, sent.send_errors);
+    EXPECT_LE(sent.max_send_batch, tr_udp_io::BatchSize);
+
+    auto const& received = receiver.stats();
+    EXPECT_EQ(N, received.recv_datagrams);
+    EXPECT_LE(received.max_recv_batch, tr_udp_io::BatchSize);
+    EXPECT_EQ(0U, received.gro_receives);
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+    EXPECT_EQ((N + tr_udp_io::BatchSize - 1) / tr_udp_io::BatchSize, sent.send_batches);
+    auto const recv_batch_size = receiver.groEnabled() ? tr_udp_io::GroBatchSize : tr_udp_io::BatchSize;
+    EXPECT_EQ((N + recv_batch_size - 1) / recv_batch_size, received.recv_batches);
+#endif
+}
+
+TEST(UdpIo, truncatesLongDatagrams)
+{
+    auto const a = LoopbackSocket{};
+    auto const b = LoopbackSocket{};
+    auto sender = tr_udp_io{ a.get() };
+    auto receiver = tr_udp_io{ b.get() };
+
+    auto const datagram = std::string(tr_udp_io::MaxDatagramSize + 100, 'x');
+    sender.send(std::data(datagram), std::size(datagram), b.addr(), sizeof(struct sockaddr_in));
+    sender.flush();
+
+    auto const received = receiveAll(receiver, 1);
+    ASSERT_EQ(1U, std::size(received));
+    EXPECT_EQ(datagram.substr(0, tr_udp_io::MaxDatagramSize), received.front());
+}
+
+TEST(UdpIo, coalescesRunsToTheSameAddress)
+{
+    auto constexpr SegmentSize = size_t{ 1200 };
+    auto constexpr N = size_t{ 10 };
+
+    auto const a = LoopbackSocket{};
+    auto const b = LoopbackSocket{};
+    auto const c = LoopbackSocket{};
+    auto sender = tr_udp_io{ a.get() };
+    auto receiver = tr_udp_io{ b.get() };
+
+    // a run of full-sized datagrams and a short one, then one for somewhere else
+    auto expected = std::vector<std::string>{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto const datagram = std::string(i + 1 < N ? SegmentSize : SegmentSize / 2, char('a' + i));
+        sender.send(std::data(datagram), std::size(datagram), b.addr(), sizeof(struct sockaddr_in));
+        expected.push_back(datagram);
+    }
+    auto const other = std::string(SegmentSize, 'z');
+    sender.send(std::data(other), std::size(other), c.addr(), sizeof(struct sockaddr_in));
+    sender.flush();
+
+    // however they were sent and read, the datagrams come out the same
+    EXPECT_EQ(expected, receiveAll(receiver, N));
+    EXPECT_EQ(N + 1, sender.stats().send_datagrams);
+    EXPECT_EQ(N, receiver.stats().recv_datagrams);
+    EXPECT_EQ(0U, sender.stats().send_errors);
+
+    if (sender.gsoEnabled())
+    {
+        EXPECT_EQ(1U, sender.stats().gso_sends);
+    }
+    else
+    {
+        EXPECT_EQ(0U, sender.stats().gso_sends);
+    }
+
+    if (!receiver.groEnabled())
+    {
+        EXPECT_EQ(0U, receiver.stats().gro_receives);
+    }
+}
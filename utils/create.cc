@@ -7,7 +7,7 @@
  */
 
 #include <stdio.h> /* fprintf() */
-#include <stdlib.h> /* strtoul(), EXIT_FAILURE */
+#include <stdlib.h> /* atoi(), strtoul(), EXIT_FAILURE */
 #include <inttypes.h> /* PRIu32 */
 
 #include <libtransmission/transmission.h>
@@ -32,6 +32,7 @@ static char const* comment = nullptr;
 static char const* outfile = nullptr;
 static char const* infile = nullptr;
 static uint32_t piecesize_kib = 0;
+static int thread_count = 0;
 static char const* source = NULL;
 
 static tr_option options[] = {
@@ -41,6 +42,7 @@ static tr_option options[] = {
     { 's', "piecesize", "Set how many KiB each piece should be, overriding the preferred default", "s", true, "<size in KiB>" },
     { 'c', "comment", "Add a comment", "c", true, "<comment>" },
     { 't', "tracker", "Add a tracker's announce URL", "t", true, "<url>" },
+    { 'T', "threads", "Set how many threads hash the pieces, overriding the number of CPU cores", "T", true, "<count>" },
     { 'V', "version", "Show version number and exit", "V", false, nullptr },
     { 0, nullptr, nullptr, nullptr, false, nullptr }
 };
@@ -103,6 +105,10 @@ static int parseCommandLine(int argc, char const* const* argv)
             source = optarg;
             break;
 
+        case 'T':
+            thread_count = atoi(optarg);
+            break;
+
         case TR_OPT_UNK:
             infile = optarg;
             break;
@@ -208,6 +214,11 @@ int tr_main(int argc, char* argv[])
         tr_metaInfoBuilderSetPieceSize(b, piecesize_kib * KiB);
     }
 
+    if (thread_count > 0)
+    {
+        tr_metaInfoBuilderSetThreadCount(b, thread_count);
+    }
+
     char buf[128];
     printf(
         b->fileCount > 1 ? " %" PRIu32 " files, %s\n" : " %" PRIu32 " file, %s\n",